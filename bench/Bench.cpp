@@ -0,0 +1,615 @@
+// Microbenchmarks for each pipeline stage (Lexer, Parser, Compiler, VM).
+//
+// Every workload script in the workload directory is pushed through each
+// stage; a stage is timed over `--runs` samples after `--warmup` untimed
+// runs. Results are written as JSON so they can be diffed against a stored
+// baseline.
+//
+// Besides time, every stage reports two deterministic counters: its work
+// (source bytes, AST nodes, bytecode bytes, instructions executed) and the
+// bytes it allocates. --check compares all three against a baseline file and
+// fails if any grew by more than its tolerance, so a regression in the
+// counters is caught even where timings are too noisy to trust.
+//
+// The workload "allocator" is not a script: it times the process-wide
+// counting operator new/delete against malloc/free (see benchAllocator).
+//
+// Usage: lua_bench [--warmup N] [--runs N] [--min-sample-us N]
+//                  [--filter substr] [--out file] [--no-jit]
+//                  [--check baseline] [--tolerances file] [--time-tolerance X]
+//                  [--update-baseline baseline] [workload_dir]
+
+#include "Lexer.h"
+#include "Parser.h"
+#include "AST.h"
+#include "Compiler.h"
+#include "VM.h"
+#include "Memory.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef LUA_BENCH_WORKLOAD_DIR
+#define LUA_BENCH_WORKLOAD_DIR "bench/workloads"
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchConfig {
+    int warmup = 3;
+    int runs = 20;
+    long minSampleUs = 1000; // Front-end stages are batched up to this duration
+    std::string filter;
+    std::string outPath;
+    std::string workloadDir = LUA_BENCH_WORKLOAD_DIR;
+    bool jit = true;
+    std::string checkPath;      // Baseline to compare against
+    std::string tolerancePath;  // Tolerances for --check
+    std::string timeTolerance;  // Overrides every time tolerance if not empty
+    std::string updatePath;     // Baseline to write (merged with what it holds)
+};
+
+struct StageResult {
+    std::string workload;
+    std::string stage;
+    std::string unit;
+    double work = 0;          // Units of work per single execution (bytes, nodes, ops)
+    double allocated = 0;     // Bytes allocated by a single execution
+    std::vector<double> samples; // Nanoseconds per single execution
+    bool timedWork = true;    // If false `work` was counted in a different configuration
+                              // from the samples, and throughput is in executions/s
+};
+
+// Counts AST nodes so the parser can be reported in nodes/sec.
+class NodeCounter : public ExprVisitor, public StmtVisitor {
+public:
+    size_t count = 0;
+
+    void countAll(const std::vector<std::unique_ptr<Stmt>>& statements) {
+        for (const auto& stmt : statements) visit(stmt.get());
+    }
+
+    void visitBinaryExpr(BinaryExpr* expr) override { count++; visit(expr->left.get()); visit(expr->right.get()); }
+    void visitGroupingExpr(GroupingExpr* expr) override { count++; visit(expr->expression.get()); }
+    void visitLiteralExpr(LiteralExpr* expr) override { count++; }
+    void visitUnaryExpr(UnaryExpr* expr) override { count++; visit(expr->right.get()); }
+    void visitVariableExpr(VariableExpr* expr) override { count++; }
+    void visitAssignmentExpr(AssignmentExpr* expr) override { count++; visit(expr->value.get()); }
+    void visitCallExpr(CallExpr* expr) override {
+        count++;
+        visit(expr->callee.get());
+        for (const auto& arg : expr->arguments) visit(arg.get());
+    }
+    void visitFunctionExpr(FunctionExpr* expr) override { count++; countAll(expr->body); }
+
+    void visitExpressionStmt(ExpressionStmt* stmt) override { count++; visit(stmt->expression.get()); }
+    void visitPrintStmt(PrintStmt* stmt) override { count++; visit(stmt->expression.get()); }
+    void visitVarDecl(VarDecl* stmt) override { count++; visit(stmt->initializer.get()); }
+    void visitBlockStmt(BlockStmt* stmt) override { count++; countAll(stmt->statements); }
+    void visitIfStmt(IfStmt* stmt) override {
+        count++;
+        visit(stmt->condition.get());
+        visit(stmt->thenBranch.get());
+        visit(stmt->elseBranch.get());
+    }
+    void visitWhileStmt(WhileStmt* stmt) override { count++; visit(stmt->condition.get()); visit(stmt->body.get()); }
+    void visitForStmt(ForStmt* stmt) override {
+        count++;
+        visit(stmt->start.get());
+        visit(stmt->limit.get());
+        visit(stmt->step.get());
+        visit(stmt->body.get());
+    }
+    void visitForInStmt(ForInStmt* stmt) override {
+        count++;
+        visit(stmt->iterator.get());
+        visit(stmt->body.get());
+    }
+    void visitFunctionStmt(FunctionStmt* stmt) override { count++; countAll(stmt->body); }
+    void visitReturnStmt(ReturnStmt* stmt) override { count++; visit(stmt->value.get()); }
+
+private:
+    void visit(Expr* expr) { if (expr) expr->accept(this); }
+    void visit(Stmt* stmt) { if (stmt) stmt->accept(this); }
+};
+
+double elapsedNs(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// Runs `body` enough times per sample to reach the minimum sample duration and
+// records the average time of a single execution.
+template <typename F>
+std::vector<double> measure(const BenchConfig& config, F body) {
+    for (int i = 0; i < config.warmup; i++) body();
+
+    Clock::time_point start = Clock::now();
+    body();
+    double single = std::max(1.0, elapsedNs(start, Clock::now()));
+    long batch = std::max(1L, static_cast<long>(config.minSampleUs * 1000.0 / single));
+
+    std::vector<double> samples;
+    samples.reserve(config.runs);
+    for (int r = 0; r < config.runs; r++) {
+        start = Clock::now();
+        for (long i = 0; i < batch; i++) body();
+        samples.push_back(elapsedNs(start, Clock::now()) / batch);
+    }
+    return samples;
+}
+
+// Bytes allocated while `body` runs. The counters are shared and never
+// destroyed: a block allocated here (a cache filled on first use, say) may be
+// freed long after `body` returns.
+template <typename F>
+double bytesAllocated(MemoryCategory category, F body) {
+    static MemoryStats* stats = new MemoryStats();
+    size_t before = stats->cumulativeTotal();
+    {
+        MemoryScope scope(stats, category);
+        body(stats);
+    }
+    return static_cast<double>(stats->cumulativeTotal() - before);
+}
+
+double percentile(std::vector<double> sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t idx = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+std::string jsonEscape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+bool benchWorkload(const BenchConfig& config, const std::string& name, const std::string& source,
+                   std::vector<StageResult>& results) {
+    // Lexer: MB/s over the raw source
+    StageResult lex{name, "lexer", "MB/s", static_cast<double>(source.size()) / 1e6, {}};
+    lex.samples = measure(config, [&]() {
+        Lexer lexer(source);
+        std::vector<Token> tokens = lexer.scanTokens();
+        return tokens.size();
+    });
+    lex.allocated = bytesAllocated(MemoryCategory::Lexer, [&](MemoryStats*) {
+        Lexer lexer(source);
+        lexer.scanTokens();
+    });
+    results.push_back(lex);
+
+    Lexer lexer(source);
+    std::vector<Token> tokens = lexer.scanTokens();
+
+    // Parser: AST nodes/sec
+    std::vector<std::unique_ptr<Stmt>> statements;
+    {
+        Parser parser(tokens);
+        statements = parser.parse();
+        if (parser.hadError()) {
+            for (const std::string& message : parser.errors()) std::cerr << name << ": " << message << std::endl;
+            return false;
+        }
+    }
+    NodeCounter counter;
+    counter.countAll(statements);
+    StageResult parse{name, "parser", "nodes/s", static_cast<double>(counter.count), {}};
+    parse.samples = measure(config, [&]() {
+        Parser parser(tokens);
+        return parser.parse().size();
+    });
+    parse.allocated = bytesAllocated(MemoryCategory::Parser, [&](MemoryStats*) {
+        Parser parser(tokens);
+        parser.parse();
+    });
+    results.push_back(parse);
+
+    // Compiler: bytecode bytes/sec
+    Chunk chunk;
+    Compiler compiler;
+    if (!compiler.compile(statements, &chunk)) {
+        std::cerr << name << ": compile error" << std::endl;
+        return false;
+    }
+    StageResult compile{name, "compiler", "bytes/s", static_cast<double>(chunk.code.size()), {}};
+    compile.samples = measure(config, [&]() {
+        Chunk c;
+        Compiler comp;
+        comp.compile(statements, &c);
+        return c.code.size();
+    });
+    compile.allocated = bytesAllocated(MemoryCategory::Compiler, [&](MemoryStats*) {
+        Chunk c;
+        Compiler comp;
+        comp.compile(statements, &c);
+    });
+    results.push_back(compile);
+
+    // VM: instructions/sec. Each run needs a fresh VM so globals start empty,
+    // and the script's output is discarded. Instructions can only be counted
+    // in the interpreter, so with the JIT on the timed runs execute a different
+    // number of them (none in native code) and only runs/sec is reported; the
+    // count still serves as the work counter for --check.
+    uint64_t ops = 0;
+    bool failed = false;
+    double allocated = bytesAllocated(MemoryCategory::Heap, [&](MemoryStats* stats) {
+        // Count with the interpreter: native code does not update the counter
+        VM vm;
+        vm.output().redirect(nullptr);
+        vm.setJitEnabled(false);
+        vm.setMemoryStats(stats);
+        failed = vm.interpret(&chunk) != InterpretResult::OK;
+        ops = vm.instructionCount;
+    });
+    if (failed) {
+        std::cerr << name << ": runtime error" << std::endl;
+        return false;
+    }
+    StageResult run{name, "vm", config.jit ? "runs/s" : "ops/s", static_cast<double>(ops), allocated, {},
+                    !config.jit};
+    for (int i = 0; i < config.warmup; i++) {
+        VM vm;
+        vm.output().redirect(nullptr);
+        vm.setJitEnabled(config.jit);
+        vm.interpret(&chunk);
+    }
+    for (int r = 0; r < config.runs; r++) {
+        VM vm;
+        vm.output().redirect(nullptr);
+        vm.setJitEnabled(config.jit);
+        Clock::time_point start = Clock::now();
+        vm.interpret(&chunk);
+        run.samples.push_back(elapsedNs(start, Clock::now()));
+    }
+    results.push_back(run);
+    return true;
+}
+
+// The counting operator new and delete (src/Memory.cpp) replace the global
+// ones for the whole process, so their cost is measured on its own: a small
+// block with no MemoryStats active, with one active, and with malloc/free
+// for comparison. Reported as the workload "allocator".
+void benchAllocator(const BenchConfig& config, std::vector<StageResult>& results) {
+    constexpr size_t kBlock = 32;
+    StageResult uncounted{"allocator", "new", "pairs/s", 1, 0, {}};
+    uncounted.samples = measure(config, [&]() {
+        void* volatile block = ::operator new(kBlock);
+        ::operator delete(block);
+    });
+    results.push_back(uncounted);
+
+    StageResult counted{"allocator", "new_counted", "pairs/s", 1, 0, {}};
+    counted.allocated = bytesAllocated(MemoryCategory::Heap, [&](MemoryStats*) {
+        void* volatile block = ::operator new(kBlock);
+        ::operator delete(block);
+    });
+    {
+        // Never destroyed, like the counters of bytesAllocated: the samples
+        // are allocated under it
+        static MemoryStats* stats = new MemoryStats();
+        MemoryScope scope(stats, MemoryCategory::Heap);
+        counted.samples = measure(config, [&]() {
+            void* volatile block = ::operator new(kBlock);
+            ::operator delete(block);
+        });
+    }
+    results.push_back(counted);
+
+    StageResult plain{"allocator", "malloc", "pairs/s", 1, 0, {}};
+    plain.samples = measure(config, [&]() {
+        void* volatile block = std::malloc(kBlock);
+        std::free(block);
+    });
+    results.push_back(plain);
+}
+
+// The fastest sample: noise from other processes only ever adds time, so
+// the minimum moves less from run to run than the median
+double fastest(const StageResult& r) {
+    return r.samples.empty() ? 0 : *std::min_element(r.samples.begin(), r.samples.end());
+}
+
+// Baselines are plain text, one measurement per line:
+//
+//     <workload> <stage> <metric> <value>
+//
+// where the metric is `work` or `alloc` (the deterministic counters) or
+// `time` (fastest sample, in nanoseconds). Tolerance files have the same
+// shape, with `*` matching any workload, stage or metric and the value being
+// how much the measurement may grow over its baseline (0.05 = 5%), or `off`;
+// the last matching line wins. '#' starts a comment in both.
+using MetricKey = std::string; // "<workload> <stage> <metric>"
+
+MetricKey metricKey(const std::string& workload, const std::string& stage, const std::string& metric) {
+    return workload + " " + stage + " " + metric;
+}
+
+std::map<MetricKey, double> measurements(const std::vector<StageResult>& results) {
+    std::map<MetricKey, double> metrics;
+    for (const StageResult& r : results) {
+        metrics[metricKey(r.workload, r.stage, "work")] = r.work;
+        metrics[metricKey(r.workload, r.stage, "alloc")] = r.allocated;
+        metrics[metricKey(r.workload, r.stage, "time")] = fastest(r);
+    }
+    return metrics;
+}
+
+struct TextRecord {
+    std::string fields[4];
+};
+
+// Records of a baseline or tolerance file; false if it cannot be read or a
+// line does not have four fields
+bool readRecords(const std::string& path, std::vector<TextRecord>& records) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)) {
+        number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        TextRecord record;
+        int count = 0;
+        std::string field;
+        while (fields >> field) {
+            if (count == 4) break;
+            record.fields[count++] = field;
+        }
+        if (count == 0) continue;
+        if (count != 4 || fields >> field) {
+            std::cerr << path << ":" << number << ": expected four fields" << std::endl;
+            return false;
+        }
+        records.push_back(record);
+    }
+    return true;
+}
+
+bool readBaseline(const std::string& path, std::map<MetricKey, double>& baseline) {
+    std::vector<TextRecord> records;
+    if (!readRecords(path, records)) return false;
+    for (const TextRecord& r : records) {
+        baseline[metricKey(r.fields[0], r.fields[1], r.fields[2])] = std::strtod(r.fields[3].c_str(), nullptr);
+    }
+    return true;
+}
+
+// Negative for `off`
+double parseTolerance(const std::string& text) {
+    return text == "off" ? -1 : std::strtod(text.c_str(), nullptr);
+}
+
+class Tolerances {
+public:
+    bool load(const std::string& path) { return readRecords(path, records); }
+    void overrideMetric(const std::string& metric, const std::string& tolerance) {
+        records.push_back({{"*", "*", metric, tolerance}});
+    }
+
+    double lookup(const std::string& workload, const std::string& stage, const std::string& metric) const {
+        double tolerance = 0;
+        for (const TextRecord& r : records) {
+            if (matches(r.fields[0], workload) && matches(r.fields[1], stage) && matches(r.fields[2], metric)) {
+                tolerance = parseTolerance(r.fields[3]);
+            }
+        }
+        return tolerance;
+    }
+
+private:
+    std::vector<TextRecord> records;
+
+    static bool matches(const std::string& pattern, const std::string& name) {
+        return pattern == "*" || pattern == name;
+    }
+};
+
+// Prints every measurement next to its baseline. Fails if one grew beyond its
+// tolerance or has no baseline.
+bool checkBaseline(const BenchConfig& config, const std::vector<StageResult>& results) {
+    std::map<MetricKey, double> baseline;
+    if (!readBaseline(config.checkPath, baseline)) {
+        std::cerr << "Cannot read baseline " << config.checkPath << std::endl;
+        return false;
+    }
+    Tolerances tolerances;
+    if (!config.tolerancePath.empty() && !tolerances.load(config.tolerancePath)) {
+        std::cerr << "Cannot read tolerances " << config.tolerancePath << std::endl;
+        return false;
+    }
+    if (!config.timeTolerance.empty()) tolerances.overrideMetric("time", config.timeTolerance);
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-14s %-9s %-6s %14s %14s %9s %8s\n",
+                  "workload", "stage", "metric", "baseline", "current", "change", "limit");
+    std::cout << line;
+    int regressions = 0;
+    int improvements = 0;
+    for (const StageResult& r : results) {
+        const std::pair<const char*, double> metrics[] = {
+            {"work", r.work}, {"alloc", r.allocated}, {"time", fastest(r)}};
+        for (const auto& [metric, current] : metrics) {
+            double tolerance = tolerances.lookup(r.workload, r.stage, metric);
+            auto found = baseline.find(metricKey(r.workload, r.stage, metric));
+            const char* verdict = "";
+            char change[32] = "";
+            char limit[32] = "off";
+            if (tolerance >= 0) std::snprintf(limit, sizeof(limit), "+%.1f%%", tolerance * 100);
+            double expected = found == baseline.end() ? 0 : found->second;
+            if (found == baseline.end()) {
+                verdict = "NO BASELINE";
+                regressions++;
+            } else {
+                if (expected > 0) std::snprintf(change, sizeof(change), "%+.1f%%", (current / expected - 1) * 100);
+                if (tolerance >= 0 && current > expected * (1 + tolerance)) {
+                    verdict = "REGRESSED";
+                    regressions++;
+                } else if (tolerance >= 0 && current < expected * (1 - tolerance)) {
+                    verdict = "improved";
+                    improvements++;
+                }
+            }
+            std::snprintf(line, sizeof(line), "%-14s %-9s %-6s %14.10g %14.10g %9s %8s  %s\n",
+                          r.workload.c_str(), r.stage.c_str(), metric, expected, current, change, limit, verdict);
+            std::cout << line;
+        }
+    }
+    if (improvements > 0) {
+        std::cout << improvements << " measurement(s) improved beyond their tolerance; "
+                     "refresh the baseline with --update-baseline" << std::endl;
+    }
+    if (regressions > 0) std::cout << regressions << " measurement(s) regressed" << std::endl;
+    return regressions == 0;
+}
+
+// Writes the measurements into the baseline at `path`, keeping the entries of
+// workloads that were not run
+bool updateBaseline(const BenchConfig& config, const std::vector<StageResult>& results) {
+    std::map<MetricKey, double> baseline;
+    if (std::filesystem::exists(config.updatePath) && !readBaseline(config.updatePath, baseline)) {
+        std::cerr << "Cannot read baseline " << config.updatePath << std::endl;
+        return false;
+    }
+    for (const auto& [key, value] : measurements(results)) baseline[key] = value;
+
+    std::ofstream out(config.updatePath);
+    if (!out) {
+        std::cerr << "Cannot write baseline " << config.updatePath << std::endl;
+        return false;
+    }
+    out << "# lua_bench baseline: <workload> <stage> <metric> <value>\n"
+        << "# Regenerate with: lua_bench --warmup " << config.warmup << " --runs " << config.runs
+        << (config.jit ? "" : " --no-jit") << " --update-baseline <this file>\n";
+    char line[160];
+    for (const auto& [key, value] : baseline) {
+        std::snprintf(line, sizeof(line), "%s %.10g\n", key.c_str(), value);
+        out << line;
+    }
+    return true;
+}
+
+void writeJson(std::ostream& out, const BenchConfig& config, const std::vector<StageResult>& results) {
+    out.precision(10);
+    out << "{\n";
+    out << "  \"config\": {\"warmup\": " << config.warmup << ", \"runs\": " << config.runs
+        << ", \"min_sample_us\": " << config.minSampleUs << ", \"jit\": " << (config.jit ? "true" : "false")
+        << "},\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const StageResult& r = results[i];
+        std::vector<double> sorted = r.samples;
+        std::sort(sorted.begin(), sorted.end());
+        double min = sorted.empty() ? 0 : sorted.front();
+        double median = percentile(sorted, 0.5);
+        double p99 = percentile(sorted, 0.99);
+        double throughput = median > 0 ? (r.timedWork ? r.work : 1) / (median / 1e9) : 0;
+
+        out << "    {\"workload\": \"" << jsonEscape(r.workload) << "\", \"stage\": \"" << r.stage
+            << "\", \"work\": " << r.work << ", \"allocated_bytes\": " << r.allocated
+            << ", \"min_ns\": " << min << ", \"median_ns\": " << median << ", \"p99_ns\": " << p99
+            << ", \"throughput\": " << throughput << ", \"unit\": \"" << r.unit << "\"}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+bool parseArgs(int argc, char* argv[], BenchConfig& config) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--warmup" && hasValue) {
+            config.warmup = std::atoi(argv[++i]);
+        } else if (arg == "--runs" && hasValue) {
+            config.runs = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--min-sample-us" && hasValue) {
+            config.minSampleUs = std::atol(argv[++i]);
+        } else if (arg == "--filter" && hasValue) {
+            config.filter = argv[++i];
+        } else if (arg == "--out" && hasValue) {
+            config.outPath = argv[++i];
+        } else if (arg == "--no-jit") {
+            config.jit = false;
+        } else if (arg == "--check" && hasValue) {
+            config.checkPath = argv[++i];
+        } else if (arg == "--tolerances" && hasValue) {
+            config.tolerancePath = argv[++i];
+        } else if (arg == "--time-tolerance" && hasValue) {
+            config.timeTolerance = argv[++i];
+        } else if (arg == "--update-baseline" && hasValue) {
+            config.updatePath = argv[++i];
+        } else if (!arg.empty() && arg[0] != '-') {
+            config.workloadDir = arg;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        std::cerr << "Usage: lua_bench [--warmup N] [--runs N] [--min-sample-us N] "
+                     "[--filter substr] [--out file] [--no-jit]\n"
+                     "                 [--check baseline] [--tolerances file] [--time-tolerance X]\n"
+                     "                 [--update-baseline baseline] [workload_dir]" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::filesystem::path> scripts;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(config.workloadDir, ec)) {
+        if (entry.path().extension() == ".lua") scripts.push_back(entry.path());
+    }
+    if (ec || scripts.empty()) {
+        std::cerr << "No workloads found in " << config.workloadDir << std::endl;
+        return 1;
+    }
+    std::sort(scripts.begin(), scripts.end());
+
+    std::vector<StageResult> results;
+    bool ok = true;
+    if (config.filter.empty() || std::string("allocator").find(config.filter) != std::string::npos) {
+        benchAllocator(config, results);
+    }
+    for (const auto& path : scripts) {
+        std::string name = path.stem().string();
+        if (!config.filter.empty() && name.find(config.filter) == std::string::npos) continue;
+        ok = benchWorkload(config, name, readFile(path.string()), results) && ok;
+    }
+
+    if (!config.outPath.empty()) {
+        std::ofstream out(config.outPath);
+        writeJson(out, config, results);
+    } else if (config.checkPath.empty() && config.updatePath.empty()) {
+        writeJson(std::cout, config, results);
+    }
+    if (!config.updatePath.empty()) ok = updateBaseline(config, results) && ok;
+    if (!config.checkPath.empty()) ok = checkBaseline(config, results) && ok;
+    return ok ? 0 : 1;
+}
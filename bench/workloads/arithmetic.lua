@@ -0,0 +1,11 @@
+-- Mixed floating point arithmetic in a loop body
+local i = 0
+local acc = 0
+while i < 100000 do
+  acc = acc + i * 2 - i / 4
+  if acc > 1000000 then
+    acc = acc / 3
+  end
+  i = i + 1
+end
+print(acc)
@@ -0,0 +1,9 @@
+-- String building: chained '..' and appends to a local string in a loop
+local s = ""
+local line = ""
+for i = 1, 50000 do
+  s = s .. i .. ","
+  line = "item " .. i .. " of " .. 50000
+end
+print(s == "")
+print(line)
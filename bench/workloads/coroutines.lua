@@ -0,0 +1,21 @@
+-- Generator-style coroutines: one long-lived producer and many short-lived ones
+function numbers(n)
+  for i = 1, n do
+    coroutine.yield(i)
+  end
+end
+
+local total = 0
+for i in coroutine.wrap(function() numbers(200000) end) do
+  total = total + i
+end
+
+function once(x)
+  coroutine.yield(x)
+  return x
+end
+for i = 1, 50000 do
+  local co = coroutine.create(once)
+  total = total + coroutine.resume(co, i) + coroutine.resume(co)
+end
+print(total)
@@ -0,0 +1,14 @@
+-- Global variable reads and writes (no 'local' declarations)
+a = 1
+b = 2
+c = 3
+d = 0
+n = 0
+while n < 50000 do
+  d = a + b + c
+  a = b
+  b = c
+  c = d - a - b
+  n = n + 1
+end
+print(d)
@@ -0,0 +1,14 @@
+-- Small script helpers called from a hot loop (inlined at -O1 and up)
+function clamp(x, lo, hi)
+  if x < lo then return lo end
+  if x > hi then return hi end
+  return x
+end
+function lerp(a, b, t)
+  return a + (b - a) * t
+end
+local total = 0
+for i = 1, 300000 do
+  total = total + clamp(i % 100, 10, 90) + lerp(0, 8, 0.25)
+end
+print(total)
@@ -0,0 +1,6 @@
+-- Tight counting loop: measures raw dispatch cost of compare, add and back-branch
+local i = 0
+while i < 200000 do
+  i = i + 1
+end
+print(i)
@@ -0,0 +1,6 @@
+-- Calls of host functions bound with VM::registerFunction
+local total = 0
+for i = 1, 1000000 do
+  total = total + math.sqrt(i) + math.floor(i / 3)
+end
+print(math.floor(total))
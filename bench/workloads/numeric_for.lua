@@ -0,0 +1,9 @@
+-- Numeric for loops: FORPREP/FORLOOP with locals in stack slots
+local sum = 0
+for i = 1, 200000 do
+  sum = sum + i
+end
+for i = 100000, 1, -1 do
+  sum = sum - i
+end
+print(sum)
@@ -0,0 +1,16 @@
+-- string library calls over log-like lines: plain find, patterns, sub and format
+local line = "2024-01-15 12:34:56 INFO request handled path=/api/items status=200 ms=17"
+local found = 0
+local statuses = 0
+local width = 0
+for i = 1, 20000 do
+  if string.find(line, "status=", 1, true) then
+    found = found + 1
+  end
+  local status = string.match(line, "status=(%d+)")
+  if status == "200" then
+    statuses = statuses + 1
+  end
+  width = width + string.len(string.format("%05d %-8s %.2f", i, string.sub(line, 21, 24), i / 7))
+end
+print(found .. " " .. statuses .. " " .. width)
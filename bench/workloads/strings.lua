@@ -0,0 +1,19 @@
+-- String constants, string equality and string-valued assignment
+local i = 0
+local state = "idle"
+local transitions = 0
+while i < 50000 do
+  if state == "idle" then
+    state = "running"
+  else
+    if state == "running" then
+      state = "done"
+    else
+      state = "idle"
+      transitions = transitions + 1
+    end
+  end
+  i = i + 1
+end
+print(state)
+print(transitions)
@@ -14,6 +14,7 @@ class UnaryExpr;
 class VariableExpr;
 class AssignmentExpr;
 class CallExpr;
+class FunctionExpr;
 
 class ExpressionStmt;
 class PrintStmt; // Using 'print' as a statement for simplicity in this basic version
@@ -21,6 +22,8 @@ class VarDecl;
 class BlockStmt;
 class IfStmt;
 class WhileStmt;
+class ForStmt;
+class ForInStmt;
 class FunctionStmt;
 class ReturnStmt;
 
@@ -34,6 +37,7 @@ public:
     virtual void visitVariableExpr(VariableExpr* expr) = 0;
     virtual void visitAssignmentExpr(AssignmentExpr* expr) = 0;
     virtual void visitCallExpr(CallExpr* expr) = 0;
+    virtual void visitFunctionExpr(FunctionExpr* expr) = 0;
 };
 
 class StmtVisitor {
@@ -45,18 +49,24 @@ public:
     virtual void visitBlockStmt(BlockStmt* stmt) = 0;
     virtual void visitIfStmt(IfStmt* stmt) = 0;
     virtual void visitWhileStmt(WhileStmt* stmt) = 0;
+    virtual void visitForStmt(ForStmt* stmt) = 0;
+    virtual void visitForInStmt(ForInStmt* stmt) = 0;
     virtual void visitFunctionStmt(FunctionStmt* stmt) = 0;
     virtual void visitReturnStmt(ReturnStmt* stmt) = 0;
 };
 
 class Expr {
 public:
+    int line = 0;   // Source position of the node's leading/operator token
+    int column = 0;
     virtual ~Expr() = default;
     virtual void accept(ExprVisitor* visitor) = 0;
 };
 
 class Stmt {
 public:
+    int line = 0;   // Source position of the statement's first token
+    int column = 0;
     virtual ~Stmt() = default;
     virtual void accept(StmtVisitor* visitor) = 0;
 };
@@ -83,7 +93,8 @@ public:
 class LiteralExpr : public Expr {
 public:
     std::string value; // Storing as string for simplicity
-    LiteralExpr(std::string value) : value(value) {}
+    TokenType type;    // NUMBER (float), INTEGER, STRING, TRUE, FALSE or NIL
+    LiteralExpr(std::string value, TokenType type) : value(value), type(type) {}
     void accept(ExprVisitor* visitor) override { visitor->visitLiteralExpr(this); }
 };
 
@@ -121,6 +132,17 @@ public:
     void accept(ExprVisitor* visitor) override { visitor->visitCallExpr(this); }
 };
 
+// Anonymous function: function (params) body end
+class FunctionExpr : public Expr {
+public:
+    std::vector<Token> params;
+    std::vector<std::unique_ptr<Stmt>> body;
+    std::unique_ptr<Token> deferred; // FUNCTION_BODY if the lexer skipped the body (then `body` is empty)
+    FunctionExpr(std::vector<Token> params, std::vector<std::unique_ptr<Stmt>> body)
+        : params(params), body(std::move(body)) {}
+    void accept(ExprVisitor* visitor) override { visitor->visitFunctionExpr(this); }
+};
+
 // --- Statements ---
 
 class ExpressionStmt : public Stmt {
@@ -173,11 +195,39 @@ public:
     void accept(StmtVisitor* visitor) override { visitor->visitWhileStmt(this); }
 };
 
+// Numeric for: for name = start, limit [, step] do body end
+class ForStmt : public Stmt {
+public:
+    Token name;
+    std::unique_ptr<Expr> start;
+    std::unique_ptr<Expr> limit;
+    std::unique_ptr<Expr> step; // nullptr means 1
+    std::unique_ptr<Stmt> body;
+    ForStmt(Token name, std::unique_ptr<Expr> start, std::unique_ptr<Expr> limit,
+            std::unique_ptr<Expr> step, std::unique_ptr<Stmt> body)
+        : name(name), start(std::move(start)), limit(std::move(limit)),
+          step(std::move(step)), body(std::move(body)) {}
+    void accept(StmtVisitor* visitor) override { visitor->visitForStmt(this); }
+};
+
+// Generic for: for name in iterator do body end. The iterator expression is
+// evaluated once and called with no arguments before every iteration.
+class ForInStmt : public Stmt {
+public:
+    Token name;
+    std::unique_ptr<Expr> iterator;
+    std::unique_ptr<Stmt> body;
+    ForInStmt(Token name, std::unique_ptr<Expr> iterator, std::unique_ptr<Stmt> body)
+        : name(name), iterator(std::move(iterator)), body(std::move(body)) {}
+    void accept(StmtVisitor* visitor) override { visitor->visitForInStmt(this); }
+};
+
 class FunctionStmt : public Stmt {
 public:
     Token name;
     std::vector<Token> params;
     std::vector<std::unique_ptr<Stmt>> body;
+    std::unique_ptr<Token> deferred; // FUNCTION_BODY if the lexer skipped the body (then `body` is empty)
     FunctionStmt(Token name, std::vector<Token> params, std::vector<std::unique_ptr<Stmt>> body)
         : name(name), params(params), body(std::move(body)) {}
     void accept(StmtVisitor* visitor) override { visitor->visitFunctionStmt(this); }
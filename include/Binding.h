@@ -0,0 +1,177 @@
+#ifndef BINDING_H
+#define BINDING_H
+
+#include "Library.h"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Binds ordinary C++ functions as built-ins (see VM::registerFunction).
+//
+// The trampoline for a signature R(Args...) is instantiated at compile time:
+// each argument is checked and converted by Argument<T>, the result by
+// Returned<R>. Nothing is looked up at run time and no std::function is
+// involved; a call costs the NativeFn dispatch plus one call through the
+// stored function pointer.
+//
+// Supported parameter types: double/float, int64_t and the other integer
+// types (numbers with an exact integer value), bool (Lua truthiness),
+// std::string / const std::string& / const char* (strings only) and
+// Value / const Value& (anything). Missing arguments are nil. The result
+// may be void (nil), any of these types, or Value.
+
+class VM;
+
+namespace binding {
+
+// Reports "bad argument #position to 'name' (expected expected, got ...)"
+// and returns false. Out of line so the trampolines stay small.
+bool argumentError(VM& vm, NativeFunction& self, int position, const char* expected, const Value& got);
+
+// Stands in for arguments the script did not pass
+inline const Value kMissing{};
+
+template <typename T, typename Enable = void>
+struct Argument;
+
+template <typename T>
+struct Argument<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static constexpr const char* expected = "number";
+    static bool check(const Value& value) { return isNumber(value); }
+    static T get(const Value& value) {
+        if (const double* d = std::get_if<double>(&value)) return static_cast<T>(*d);
+        return static_cast<T>(std::get<int64_t>(value));
+    }
+};
+
+template <typename T>
+struct Argument<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+    static constexpr const char* expected = "integer";
+    static bool check(const Value& value) {
+        if (const int64_t* i = std::get_if<int64_t>(&value)) return inRange(*i);
+        const double* d = std::get_if<double>(&value);
+        // Floats with an exact integer value are accepted, as in Lua
+        return d && std::floor(*d) == *d && *d >= -9223372036854775808.0 && *d < 9223372036854775808.0 &&
+               inRange(static_cast<int64_t>(*d));
+    }
+    static T get(const Value& value) {
+        if (const int64_t* i = std::get_if<int64_t>(&value)) return static_cast<T>(*i);
+        return static_cast<T>(std::get<double>(value));
+    }
+
+private:
+    static bool inRange(int64_t i) {
+        if constexpr (sizeof(T) >= sizeof(int64_t)) {
+            return std::is_signed_v<T> || i >= 0;
+        } else {
+            return i >= static_cast<int64_t>(std::numeric_limits<T>::min()) &&
+                   i <= static_cast<int64_t>(std::numeric_limits<T>::max());
+        }
+    }
+};
+
+template <>
+struct Argument<bool> {
+    static constexpr const char* expected = "value";
+    static bool check(const Value&) { return true; }
+    static bool get(const Value& value) { return !isFalsey(value); }
+};
+
+template <>
+struct Argument<const std::string&> {
+    static constexpr const char* expected = "string";
+    static bool check(const Value& value) { return std::holds_alternative<std::string>(value); }
+    static const std::string& get(const Value& value) { return std::get<std::string>(value); }
+};
+template <>
+struct Argument<std::string> : Argument<const std::string&> {};
+template <>
+struct Argument<const char*> : Argument<const std::string&> {
+    static const char* get(const Value& value) { return std::get<std::string>(value).c_str(); }
+};
+
+template <>
+struct Argument<const Value&> {
+    static constexpr const char* expected = "value";
+    static bool check(const Value&) { return true; }
+    static const Value& get(const Value& value) { return value; }
+};
+template <>
+struct Argument<Value> : Argument<const Value&> {};
+
+template <typename T, typename Enable = void>
+struct Returned {
+    // Value
+    static void set(Value& result, T value) { result = std::move(value); }
+};
+
+template <typename T>
+struct Returned<T, std::enable_if_t<std::is_arithmetic_v<T>>> {
+    static void set(Value& result, T value) {
+        if constexpr (std::is_same_v<T, bool>) result = value;
+        else if constexpr (std::is_floating_point_v<T>) result = static_cast<double>(value);
+        else result = static_cast<int64_t>(value);
+    }
+};
+
+template <>
+struct Returned<std::string> {
+    // Reuses a string already in the result slot (see NativeFn)
+    static void set(Value& result, std::string value) {
+        if (std::string* s = std::get_if<std::string>(&result)) *s = std::move(value);
+        else result = std::move(value);
+    }
+};
+
+template <>
+struct Returned<const char*> {
+    static void set(Value& result, const char* value) {
+        if (value) result = std::string(value);
+        else result = Nil{};
+    }
+};
+
+// The NativeFunction made for one C++ function
+template <typename R, typename... Args>
+struct BoundFunction : NativeFunction {
+    using Pointer = R (*)(Args...);
+    Pointer target;
+
+    BoundFunction(std::string name, Pointer target)
+        : NativeFunction(std::move(name), &call), target(target) {}
+
+    static bool call(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+        return invoke(vm, static_cast<BoundFunction&>(self), args, argCount, result,
+                      std::index_sequence_for<Args...>{});
+    }
+
+private:
+    static const Value& at(const Value* args, int argCount, size_t index) {
+        return static_cast<int>(index) < argCount ? args[index] : kMissing;
+    }
+
+    template <size_t... I>
+    static bool invoke(VM& vm, BoundFunction& self, Value* args, int argCount, Value& result,
+                       std::index_sequence<I...>) {
+        // Check everything first, so no conversion can fail halfway
+        if (!((Argument<Args>::check(at(args, argCount, I)) ||
+               argumentError(vm, self, static_cast<int>(I) + 1, Argument<Args>::expected, at(args, argCount, I))) &&
+              ...)) {
+            return false;
+        }
+        if constexpr (std::is_void_v<R>) {
+            self.target(Argument<Args>::get(at(args, argCount, I))...);
+            result = Nil{};
+        } else {
+            Returned<std::decay_t<R>>::set(result, self.target(Argument<Args>::get(at(args, argCount, I))...));
+        }
+        return true;
+    }
+};
+
+} // namespace binding
+
+#endif // BINDING_H
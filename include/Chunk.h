@@ -2,9 +2,13 @@
 #define CHUNK_H
 
 #include <vector>
+#include <memory>
 #include <cstdint>
+#include "LineTable.h"
 #include "Value.h"
 
+struct Function;
+
 enum class OpCode : uint8_t {
     OP_CONSTANT,
     OP_NIL,
@@ -27,24 +31,227 @@ enum class OpCode : uint8_t {
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,
-    OP_RETURN
+    OP_RETURN,
+    OP_GET_LOCAL,     // slot: push a copy of a local
+    OP_SET_LOCAL,     // slot: store the top into a local, leaving it on the stack
+    OP_FORPREP,       // base, offset: set up a numeric for loop, skip it if it runs zero times
+    OP_FORLOOP,       // base, offset: step the loop and jump back while it continues
+    OP_FLOOR_DIVIDE,
+    OP_MODULO,
+    OP_LESS_EQUAL,
+    OP_GREATER_EQUAL,
+    OP_JUMP_IF_TRUE,  // offset: like OP_JUMP_IF_FALSE, for 'or'
+    // Fused compare-and-branch, emitted for conditions of if/while. Each takes
+    // a sense byte and a forward offset, pops its operands and jumps when the
+    // outcome equals the sense.
+    OP_JLT,
+    OP_JLE,
+    OP_JGT,
+    OP_JGE,
+    OP_JEQ,
+    OP_JTEST,         // One operand: tests its truthiness
+    OP_CONCAT,        // n: concatenate the top n values into one string
+    OP_APPEND_LOCAL,  // slot, n: append the top n values to the string in a local, popping them
+    OP_CALL,          // n: call the value below the top n arguments, leaving its result
+    OP_TFORCALL,      // base: call the iterator in slot base for the next loop value
+    OP_TFORLOOP,      // base, off16: store that value in slot base+1; jump out of the loop when it is nil
+
+    // Quickened forms. The VM rewrites a generic opcode in place once it has
+    // seen its operand types (or resolved its global); a failed guard rewrites
+    // it back. The compiler never emits these.
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
+    OP_NEGATE_NUM,
+    OP_ADD_INT,
+    OP_SUBTRACT_INT,
+    OP_MULTIPLY_INT,
+    OP_GREATER_INT,
+    OP_LESS_INT,
+    OP_GET_GLOBAL_CACHED,
+    OP_SET_GLOBAL_CACHED,
+
+    // Typed forms, emitted by the optimizing compiler where type inference
+    // proved both operands integers (_II) or floats (_FF). They do not check
+    // the operands at all, so the VM never rewrites them.
+    OP_ADD_II,
+    OP_SUBTRACT_II,
+    OP_MULTIPLY_II,
+    OP_ADD_FF,
+    OP_SUBTRACT_FF,
+    OP_MULTIPLY_FF,
+    OP_DIVIDE_FF,
+    OP_JLT_II,
+    OP_JLE_II,
+    OP_JGT_II,
+    OP_JGE_II,
+    OP_JLT_FF,
+    OP_JLE_FF,
+    OP_JGT_FF,
+    OP_JGE_FF,
+
+    // Never in a chunk: VM::redispatch points ip at it so the running
+    // dispatch loop returns and execute() chooses the loop again
+    OP_REDISPATCH
+};
+
+// Operand types a typed opcode relies on
+enum class OperandType : uint8_t {
+    Unknown,
+    Integer,
+    Float,
+};
+
+inline OperandType operandType(OpCode op) {
+    switch (op) {
+        case OpCode::OP_ADD_II:
+        case OpCode::OP_SUBTRACT_II:
+        case OpCode::OP_MULTIPLY_II:
+        case OpCode::OP_JLT_II:
+        case OpCode::OP_JLE_II:
+        case OpCode::OP_JGT_II:
+        case OpCode::OP_JGE_II:
+            return OperandType::Integer;
+        case OpCode::OP_ADD_FF:
+        case OpCode::OP_SUBTRACT_FF:
+        case OpCode::OP_MULTIPLY_FF:
+        case OpCode::OP_DIVIDE_FF:
+        case OpCode::OP_JLT_FF:
+        case OpCode::OP_JLE_FF:
+        case OpCode::OP_JGT_FF:
+        case OpCode::OP_JGE_FF:
+            return OperandType::Float;
+        default:
+            return OperandType::Unknown;
+    }
+}
+
+// Typed form of the generic `op` for operands of type `type`; `op` itself
+// if there is none (integer '/' produces a float, so it has no _II form)
+inline OpCode typedOpcode(OpCode op, OperandType type) {
+    if (type == OperandType::Unknown) return op;
+    bool integers = type == OperandType::Integer;
+    switch (op) {
+        case OpCode::OP_ADD:      return integers ? OpCode::OP_ADD_II : OpCode::OP_ADD_FF;
+        case OpCode::OP_SUBTRACT: return integers ? OpCode::OP_SUBTRACT_II : OpCode::OP_SUBTRACT_FF;
+        case OpCode::OP_MULTIPLY: return integers ? OpCode::OP_MULTIPLY_II : OpCode::OP_MULTIPLY_FF;
+        case OpCode::OP_DIVIDE:   return integers ? op : OpCode::OP_DIVIDE_FF;
+        case OpCode::OP_JLT:      return integers ? OpCode::OP_JLT_II : OpCode::OP_JLT_FF;
+        case OpCode::OP_JLE:      return integers ? OpCode::OP_JLE_II : OpCode::OP_JLE_FF;
+        case OpCode::OP_JGT:      return integers ? OpCode::OP_JGT_II : OpCode::OP_JGT_FF;
+        case OpCode::OP_JGE:      return integers ? OpCode::OP_JGE_II : OpCode::OP_JGE_FF;
+        default:                  return op;
+    }
+}
+
+// Maps a quickened opcode back to the generic opcode it was rewritten from,
+// and a typed opcode to the generic one it specializes
+inline OpCode genericOpcode(OpCode op) {
+    switch (op) {
+        case OpCode::OP_ADD_NUM:           return OpCode::OP_ADD;
+        case OpCode::OP_SUBTRACT_NUM:      return OpCode::OP_SUBTRACT;
+        case OpCode::OP_MULTIPLY_NUM:      return OpCode::OP_MULTIPLY;
+        case OpCode::OP_DIVIDE_NUM:        return OpCode::OP_DIVIDE;
+        case OpCode::OP_GREATER_NUM:       return OpCode::OP_GREATER;
+        case OpCode::OP_LESS_NUM:          return OpCode::OP_LESS;
+        case OpCode::OP_NEGATE_NUM:        return OpCode::OP_NEGATE;
+        case OpCode::OP_ADD_INT:           return OpCode::OP_ADD;
+        case OpCode::OP_SUBTRACT_INT:      return OpCode::OP_SUBTRACT;
+        case OpCode::OP_MULTIPLY_INT:      return OpCode::OP_MULTIPLY;
+        case OpCode::OP_GREATER_INT:       return OpCode::OP_GREATER;
+        case OpCode::OP_LESS_INT:          return OpCode::OP_LESS;
+        case OpCode::OP_GET_GLOBAL_CACHED: return OpCode::OP_GET_GLOBAL;
+        case OpCode::OP_SET_GLOBAL_CACHED: return OpCode::OP_SET_GLOBAL;
+        case OpCode::OP_ADD_II:            return OpCode::OP_ADD;
+        case OpCode::OP_SUBTRACT_II:       return OpCode::OP_SUBTRACT;
+        case OpCode::OP_MULTIPLY_II:       return OpCode::OP_MULTIPLY;
+        case OpCode::OP_ADD_FF:            return OpCode::OP_ADD;
+        case OpCode::OP_SUBTRACT_FF:       return OpCode::OP_SUBTRACT;
+        case OpCode::OP_MULTIPLY_FF:       return OpCode::OP_MULTIPLY;
+        case OpCode::OP_DIVIDE_FF:         return OpCode::OP_DIVIDE;
+        case OpCode::OP_JLT_II:            return OpCode::OP_JLT;
+        case OpCode::OP_JLE_II:            return OpCode::OP_JLE;
+        case OpCode::OP_JGT_II:            return OpCode::OP_JGT;
+        case OpCode::OP_JGE_II:            return OpCode::OP_JGE;
+        case OpCode::OP_JLT_FF:            return OpCode::OP_JLT;
+        case OpCode::OP_JLE_FF:            return OpCode::OP_JLE;
+        case OpCode::OP_JGT_FF:            return OpCode::OP_JGT;
+        case OpCode::OP_JGE_FF:            return OpCode::OP_JGE;
+        default:                           return op;
+    }
+}
+
+// Inline cache for a global access site, indexed by the name's constant slot.
+// `version` must match the VM's globals version for `slot` to be valid.
+struct GlobalCache {
+    Value* slot = nullptr;
+    uint64_t version = 0;
+};
+
+// A call whose callee the optimizer compiled into the caller's bytecode.
+// Errors in that code are reported in `function`, called from `line`.
+struct InlinedCall {
+    std::string function;
+    int line = 0;
+};
+
+// Bytecode offsets [start, end) compiled from the body of inlinedCalls[call]
+struct InlinedRange {
+    uint32_t start;
+    uint32_t end;
+    uint32_t call;
 };
 
 class Chunk {
 public:
     std::vector<uint8_t> code;
     std::vector<Value> constants;
-    std::vector<int> lines; // Line number for each byte (for debug)
+    LineTable lines; // Source line and column of each byte (for errors and the profiler)
+    std::vector<GlobalCache> globalCaches; // Runtime inline caches, one per constant
+    std::vector<std::shared_ptr<Function>> functions; // Functions declared in this chunk
+    std::vector<InlinedCall> inlinedCalls;
+    std::vector<InlinedRange> inlinedCode; // Sorted and disjoint
+    int maxStack = 0; // Deepest the stack gets above local slot 0, set by the compiler
 
-    void write(uint8_t byte, int line) {
+    void write(uint8_t byte, int line, int column = 0) {
         code.push_back(byte);
-        lines.push_back(line);
+        lines.add(line, column);
     }
 
-    void writeOp(OpCode op, int line) {
-        write(static_cast<uint8_t>(op), line);
+    void writeOp(OpCode op, int line, int column = 0) {
+        write(static_cast<uint8_t>(op), line, column);
     }
 
+    // Empties the chunk for another compilation, keeping the buffers'
+    // capacity. Declared functions go too: move them out first if they
+    // must outlive the chunk.
+    void clear() {
+        code.clear();
+        constants.clear();
+        lines.clear();
+        globalCaches.clear();
+        functions.clear();
+        inlinedCalls.clear();
+        inlinedCode.clear();
+        maxStack = 0;
+    }
+
+    // Drops the debug info of this chunk and of the functions it declares
+    // (line table, function names, names of inlined calls), for code that
+    // will not be debugged.
+    // Stubs of lazily compiled functions are stripped once compiled.
+    void strip();
+
+    // The inlined call whose body the instruction at `offset` belongs to, or
+    // nullptr if it is the chunk's own code
+    const InlinedCall* inlinedAt(size_t offset) const;
+
+    // Index of a constant identical to `value` (same type and bits), or -1
+    int findConstant(const Value& value) const;
+
     int addConstant(Value value) {
         constants.push_back(value);
         return constants.size() - 1;
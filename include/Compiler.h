@@ -2,44 +2,132 @@
 #define COMPILER_H
 
 #include "AST.h"
+#include "FlatAst.h"
 #include "Chunk.h"
+#include "Function.h"
 #include <vector>
 #include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
 
-class Compiler : public ExprVisitor, public StmtVisitor {
+// Value of a literal: numerals follow Lua (hex integers wrap around, decimal
+// integers too large for int64 become floats). `text` must be NUL-terminated.
+Value literalValue(std::string_view text, TokenType type);
+Value literalValue(const LiteralExpr* expr);
+
+// Level 0 compiles the flat AST (FlatAst.h) straight to bytecode with one
+// switch per node; the tree goes through the IR (IrBuilder) at levels 1 and 2.
+class Compiler {
 public:
     Compiler();
+    // The tree is flattened first at level 0
     bool compile(const std::vector<std::unique_ptr<Stmt>>& statements, Chunk* chunk);
+    // Only when compilesFlat(): the IR is built from the tree
+    bool compile(const FlatAst& ast, Chunk* chunk);
+    bool compilesFlat() const { return optimizationLevel == 0 && !irDump; }
+
+    static constexpr int kDefaultOptimizationLevel = 1;
+
+    // Level 0 compiles straight from the flat AST. Levels 1 and 2 go through the
+    // optimizing IR pipeline (see IR.h); `irDump` receives the IR after each pass.
+    void setOptimizationLevel(int level, std::ostream* irDump = nullptr) {
+        optimizationLevel = level;
+        this->irDump = irDump;
+    }
+
+    // Level 1 and up also inline small leaf functions at their call sites;
+    // `report` gets a line per inlined call
+    void setInlineReport(std::ostream* report) { inlineReport = report; }
+
+    // Level 1 and up infer operand types and emit unchecked typed opcodes
+    // (OP_ADD_II, OP_JLT_FF, ...) where both operands are proved integers or
+    // floats; `report` gets a line per function with how many were typed
+    void setTypeReport(std::ostream* report) { typeReport = report; }
+
+    // Compiles for a VM that may run debug hooks (debug.sethook,
+    // VM::setHook). A hook can assign a global between any two instructions,
+    // so levels 1 and 2 then neither merge nor hoist reads of globals.
+    void setDebugHooks(bool enabled) { debugHooks = enabled; }
+
+    // Drops the line table of every chunk compiled (see Chunk::strip), so
+    // runtime errors report no line
+    void setStripDebugInfo(bool strip) { stripDebugInfo = strip; }
 
-    // Visitor methods
-    void visitBinaryExpr(BinaryExpr* expr) override;
-    void visitGroupingExpr(GroupingExpr* expr) override;
-    void visitLiteralExpr(LiteralExpr* expr) override;
-    void visitUnaryExpr(UnaryExpr* expr) override;
-    void visitVariableExpr(VariableExpr* expr) override;
-    void visitAssignmentExpr(AssignmentExpr* expr) override;
-    void visitCallExpr(CallExpr* expr) override;
-
-    void visitExpressionStmt(ExpressionStmt* stmt) override;
-    void visitPrintStmt(PrintStmt* stmt) override;
-    void visitVarDecl(VarDecl* stmt) override;
-    void visitBlockStmt(BlockStmt* stmt) override;
-    void visitIfStmt(IfStmt* stmt) override;
-    void visitWhileStmt(WhileStmt* stmt) override;
-    void visitFunctionStmt(FunctionStmt* stmt) override;
-    void visitReturnStmt(ReturnStmt* stmt) override;
+    // Records in Chunk::maxStack how deep the stack gets, for a chunk entered
+    // with `entryDepth` slots in use
+    static void computeMaxStack(Chunk& chunk, int entryDepth);
+
+    // Lexes, parses and compiles the body of a stub left by a lazy lexer (see
+    // LazyBody) into the function's chunk, with the settings of the compile
+    // that made the stub, and clears Function::lazy. Functions the body
+    // declares are stubs again. Errors go to stderr; the stub is then kept.
+    static bool compileLazy(Function* function);
 
 private:
+    // A local variable lives in a stack slot; its index in `locals` is the slot
+    struct Local {
+        std::string name;
+        int depth;
+    };
+
+    using Node = FlatAst::Node;
+
+    Compiler* enclosing = nullptr; // Compiler of the surrounding function
+    const FlatAst* ast = nullptr;
     Chunk* currentChunk;
-    
+    std::vector<Local> locals;
+    int scopeDepth = 0;
+    bool hadError = false;
+    int currentLine = 0;   // Source position attached to emitted bytes
+    int currentColumn = 0;
+    int optimizationLevel = kDefaultOptimizationLevel;
+    std::ostream* irDump = nullptr;
+    std::ostream* inlineReport = nullptr;
+    std::ostream* typeReport = nullptr;
+    bool stripDebugInfo = false;
+    bool debugHooks = false;
+
+    void setLocation(int line, int column);
+    void setLocation(Node node) { setLocation(ast->line(node), ast->column(node)); }
+    std::string name(Node node) const { return std::string(ast->string(ast->first(node))); }
     void emitByte(uint8_t byte);
     void emitOp(OpCode op);
     void emitBytes(uint8_t byte1, uint8_t byte2);
     void emitLoop(int loopStart);
     int emitJump(uint8_t instruction);
+    int emitConditionalJump(OpCode op, bool sense);
     void patchJump(int offset);
+    void patchJumps(const std::vector<int>& offsets);
+    void emitCondition(Node condition, bool jumpIf, std::vector<int>& jumps);
+    void collectConcat(Node expr, std::vector<Node>& operands);
+    int emitConcatOperands(const std::vector<Node>& operands, size_t first);
+    bool emitAppend(Node assignment);
     int makeConstant(Value value);
     void emitConstant(Value value);
+    void error(const char* message);
+
+    void beginScope();
+    void endScope();
+    void addLocal(const std::string& name);
+    int resolveLocal(const std::string& name) const;
+    void checkNotCaptured(const std::string& name);
+    Function* compileFunction(const std::string& name, Node function);
+    void compileBody(Function& function, const std::vector<std::string>& params, FlatAst::List body);
+    std::unique_ptr<LazyBody> lazyBody(const std::vector<std::string>& params, Node deferred) const;
+
+    void expression(Node node);
+    void binary(Node node);
+    void literal(Node node);
+    void variable(Node node);
+    void assignment(Node node);
+    void call(Node node);
+    void statement(Node node);
+    void block(Node node);
+    void ifStatement(Node node);
+    void whileStatement(Node node);
+    void forStatement(Node node);
+    void forInStatement(Node node);
 };
 
 #endif // COMPILER_H
@@ -0,0 +1,61 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include "Chunk.h"
+#include <cstddef>
+#include <vector>
+
+struct Function;
+
+// Registers of a suspended caller, saved by a call and restored by OP_RETURN.
+// `slots` is an offset into the value stack, which may move when it grows.
+struct CallFrame {
+    Chunk* chunk;
+    uint8_t* ip;
+    size_t slots;
+};
+
+// Value stack and frame array of one coroutine
+struct ExecutionStack {
+    std::vector<Value> values; // Fully constructed; the live part ends at stackTop
+    std::vector<CallFrame> frames;
+};
+
+// A Lua coroutine. The main script runs in one as well. While a coroutine is
+// not running, its VM registers are kept here; switching coroutines only
+// saves and loads these, so resume and yield never leave the dispatch loop.
+struct Coroutine {
+    enum class Status { Suspended, Running, Normal, Dead };
+
+    Status status = Status::Suspended;
+    Function* body = nullptr;    // nullptr for the main coroutine
+    bool started = false;
+    ExecutionStack stack;        // Empty until first resumed, returned to the pool when dead
+    Coroutine* resumer = nullptr; // Coroutine to return to on yield or return
+
+    // Saved registers
+    Chunk* chunk = nullptr;
+    uint8_t* ip = nullptr;
+    Value* stackTop = nullptr;
+    Value* slots = nullptr;
+};
+
+const char* statusName(Coroutine::Status status);
+
+// Recycles the stacks of dead coroutines. Stacks start small and grow on
+// demand, so a large number of suspended coroutines stays cheap; a stack that
+// grew large is trimmed back before it is pooled.
+class StackPool {
+public:
+    static constexpr size_t kInitialValues = 16;
+    static constexpr size_t kMaxPooledValues = 1024;
+    static constexpr size_t kMaxPooled = 256;
+
+    ExecutionStack acquire();
+    void release(ExecutionStack&& stack);
+
+private:
+    std::vector<ExecutionStack> free;
+};
+
+#endif // COROUTINE_H
@@ -0,0 +1,9 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include "Chunk.h"
+
+// Human-readable name of an opcode, e.g. "OP_ADD". Unknown bytes yield "OP_UNKNOWN".
+const char* opcodeName(uint8_t op);
+
+#endif // DEBUG_H
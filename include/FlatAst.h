@@ -0,0 +1,161 @@
+#ifndef FLAT_AST_H
+#define FLAT_AST_H
+
+#include "AST.h"
+#include "Token.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Node kinds of the flat AST; one per tree class in AST.h, plus DeferredBody
+enum class NodeKind : uint8_t {
+    None,         // Node 0, standing for a missing child
+    Literal,      // first: text; op: NUMBER, INTEGER, STRING, TRUE, FALSE or NIL
+    Variable,     // first: name
+    Assignment,   // first: name, second: value
+    Binary,       // first: left, second: right; op: operator
+    Unary,        // first: operand; op: operator
+    Grouping,     // first: expression
+    Call,         // first: callee, second: argument list
+    Function,     // first: name (0 for an anonymous function), second: parameter
+    FunctionDecl, //   list (names), third: body list
+    Expression,   // first: expression
+    VarDecl,      // first: name, second: initializer
+    Block,        // first: statement list
+    If,           // first: condition, second: then branch, third: else branch
+    While,        // first: condition, second: body
+    For,          // first: name, second: list of start, limit, step and body
+    ForIn,        // first: name, second: iterator, third: body
+    Return,       // first: value
+    DeferredBody, // first: source of a body the lexer skipped (FUNCTION_BODY)
+};
+
+// The AST as parallel arrays indexed by node: a kind, three 32-bit fields
+// whose meaning depends on the kind (see NodeKind), an operator and a source
+// position. Node 0 is a placeholder, so 0 means "no node" (an if without an
+// else, a for without a step). Names and literal text are indices into a
+// string pool; argument, parameter and statement lists are indices into a
+// list pool holding each list's length followed by its elements.
+//
+// A node takes 22 bytes, against 50 to 150 plus an allocation for a tree node
+// (a Token alone holds a std::string), and the nodes of a function are
+// adjacent, so a pass over them runs through a few arrays instead of chasing
+// pointers. Passes switch on kind() instead of dispatching through a visitor.
+// A function whose body the lexer skipped has a body list holding one
+// DeferredBody node, positioned where the body starts.
+class FlatAst {
+public:
+    using Node = uint32_t;
+    static constexpr Node kNone = 0;
+
+    // Elements of a list in the list pool
+    class List {
+    public:
+        List(const uint32_t* first, const uint32_t* last) : first(first), last(last) {}
+        const uint32_t* begin() const { return first; }
+        const uint32_t* end() const { return last; }
+        size_t size() const { return last - first; }
+        uint32_t operator[](size_t i) const { return first[i]; }
+
+    private:
+        const uint32_t* first;
+        const uint32_t* last;
+    };
+
+    FlatAst();
+
+    NodeKind kind(Node node) const { return kinds[node]; }
+    uint32_t first(Node node) const { return firsts[node]; }
+    uint32_t second(Node node) const { return seconds[node]; }
+    uint32_t third(Node node) const { return thirds[node]; }
+    TokenType op(Node node) const { return static_cast<TokenType>(ops[node]); }
+    int line(Node node) const { return lines[node]; }
+    int column(Node node) const { return columns[node]; }
+    size_t nodeCount() const { return kinds.size() - 1; }
+
+    // Pooled strings are NUL-terminated, so the view's data() is a C string
+    std::string_view string(uint32_t index) const {
+        return std::string_view(chars.data() + stringStarts[index], stringStarts[index + 1] - stringStarts[index] - 1);
+    }
+    List list(uint32_t index) const {
+        return List(lists.data() + index + 1, lists.data() + index + 1 + lists[index]);
+    }
+    // Top-level statements
+    List statements() const { return list(root); }
+
+    Node add(NodeKind kind, int line, int column, uint32_t first = 0, uint32_t second = 0,
+             uint32_t third = 0, TokenType op = TokenType::NIL);
+    uint32_t addString(std::string_view text);
+    uint32_t addList(const std::vector<uint32_t>& elements);
+    void setStatements(uint32_t list) { root = list; }
+
+    // Bytes held by the arrays and pools
+    size_t footprint() const;
+    // Drops the arrays' spare capacity once nothing more is added
+    void shrink();
+
+private:
+    std::vector<NodeKind> kinds;
+    std::vector<uint8_t> ops;
+    std::vector<uint32_t> firsts;
+    std::vector<uint32_t> seconds;
+    std::vector<uint32_t> thirds;
+    std::vector<int32_t> lines;
+    std::vector<int32_t> columns;
+    std::string chars;
+    std::vector<uint32_t> stringStarts; // One more than there are strings
+    std::vector<uint32_t> lists;
+    uint32_t root;
+};
+
+// Builds a FlatAst for BasicParser (see Parser.h; TreeBuilder is the
+// counterpart building the tree). Nodes are numbers, so a child is
+// complete before its parent is added and a list is pooled once all its
+// elements are.
+class FlatBuilder {
+public:
+    using Expr = FlatAst::Node;
+    using Stmt = FlatAst::Node;
+    using ExprList = std::vector<uint32_t>;
+    using StmtList = std::vector<uint32_t>;
+    using Result = FlatAst;
+
+    Expr literal(const Token& at, const std::string& value, TokenType type);
+    Expr variable(const Token& name);
+    bool isVariable(Expr expr) const { return ast.kind(expr) == NodeKind::Variable; }
+    // `target` must satisfy isVariable()
+    Expr assignment(Expr target, Expr value);
+    Expr binary(const Token& op, Expr left, Expr right);
+    Expr unary(const Token& op, Expr right);
+    Expr grouping(const Token& open, Expr expression);
+    Expr call(const Token& open, Expr callee, const Token& paren, ExprList arguments);
+    Expr function(const Token& keyword, const std::vector<Token>& params, StmtList body,
+                  const Token* deferred);
+
+    Stmt functionDecl(const Token& keyword, const Token& name, const std::vector<Token>& params,
+                      StmtList body, const Token* deferred);
+    Stmt expression(const Token& at, Expr expression);
+    Stmt varDecl(const Token& keyword, const Token& name, Expr initializer);
+    // `at` is nullptr for the implicit block of a branch or loop body
+    Stmt block(const Token* at, StmtList statements);
+    Stmt ifStmt(const Token& keyword, Expr condition, Stmt thenBranch, Stmt elseBranch);
+    Stmt whileStmt(const Token& keyword, Expr condition, Stmt body);
+    Stmt forStmt(const Token& keyword, const Token& name, Expr start, Expr limit, Expr step, Stmt body);
+    Stmt forInStmt(const Token& keyword, const Token& name, Expr iterator, Stmt body);
+    Stmt returnStmt(const Token& keyword, Expr value);
+
+    FlatAst finish(StmtList statements);
+
+private:
+    FlatAst ast;
+
+    Stmt function(NodeKind kind, const Token& keyword, uint32_t name, const std::vector<Token>& params,
+                  StmtList body, const Token* deferred);
+};
+
+// The same program as a FlatAst, for callers that already hold a tree
+FlatAst flatten(const std::vector<std::unique_ptr<Stmt>>& statements);
+
+#endif // FLAT_AST_H
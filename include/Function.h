@@ -0,0 +1,42 @@
+#ifndef FUNCTION_H
+#define FUNCTION_H
+
+#include "Chunk.h"
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The body of a function whose source the lexer skipped (see
+// Lexer::setLazyFunctions), with what compiling it later needs: the
+// compiler's settings and the names of the enclosing functions' locals,
+// which the body must not use (see Compiler::checkNotCaptured).
+struct LazyBody {
+    std::string source; // Between the parameter list and the closing 'end'
+    int line = 1;       // Where the source starts
+    int column = 1;
+    std::vector<std::string> params;
+    std::vector<std::string> outerLocals;
+    int optimizationLevel = 0;
+    std::ostream* irDump = nullptr;
+    std::ostream* inlineReport = nullptr;
+    std::ostream* typeReport = nullptr;
+    bool strip = false; // Drop the debug info once compiled (see Chunk::strip)
+    bool debugHooks = false; // See Compiler::setDebugHooks
+};
+
+// A compiled Lua function: its parameters are the first locals of `chunk`.
+// Functions are owned by the chunk that declares them (Chunk::functions) and
+// referenced from Values by pointer. They do not capture enclosing locals.
+//
+// A function with a `lazy` body is a stub with an empty chunk until its
+// first call, when the VM compiles the body (Compiler::compileLazy) into
+// `chunk` in place; Values referring to it stay valid.
+struct Function {
+    std::string name;
+    int arity = 0;
+    Chunk chunk;
+    std::unique_ptr<LazyBody> lazy;
+};
+
+#endif // FUNCTION_H
@@ -0,0 +1,139 @@
+#ifndef IR_H
+#define IR_H
+
+#include "Chunk.h"
+#include "Function.h"
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Intermediate representation between the AST and a Chunk, used by the
+// optimizing compiler (-O1 and up).
+//
+// A function is a control-flow graph of basic blocks. Temporaries are in SSA
+// form: each instruction that produces a value is that value, defined once
+// and referenced by pointer from its users. Local variables stay in their
+// stack slots and are read and written by GetLocal/SetLocal, the way the
+// bytecode treats them, so the only phis are the joins of value-context
+// 'and'/'or' and the returns of an inlined call. Passes (IrPasses.cpp) rewrite the graph; IrEmitter.cpp turns it
+// back into stack bytecode, keeping temporaries on the stack where it can and
+// in extra local slots where it cannot.
+
+enum class IrOp : uint8_t {
+    // Values without side effects
+    Constant,     // constant
+    GetLocal,     // slot
+    GetGlobal,    // name
+    Phi,          // one operand per predecessor, in IrBlock::preds order
+    // Operations on values; those other than Not and Equal may fail
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    FloorDivide,
+    Modulo,
+    Equal,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Not,
+    Negate,
+    Concat,       // operands...
+    Call,         // callee, arguments...
+    // Stores. SetLocal and SetGlobal also produce the stored value.
+    SetLocal,     // slot, value
+    SetGlobal,    // name, value
+    DefineGlobal, // name, value
+    DeclareLocal, // slot, value: the value becomes the next local
+    PopLocals,    // slot, count: the locals from `slot` go out of scope
+    AppendLocal,  // slot, operands...
+    Print,        // value
+    // Terminators, last in each block
+    Jump,         // -> target
+    Branch,       // test, sense, operands: -> target when the outcome equals sense, else next
+    BranchKeep,   // test, value: 'and'/'or'; -> target keeping the value, else next
+    Return,       // [value]
+    ForPrep,      // slot: numeric for; -> next to run the body, target to skip it
+    ForLoop,      // slot: -> target (the body) while it continues, else next
+    ForIn         // slot: generic for; -> next with the next value, target when it is nil
+};
+
+struct IrBlock;
+
+struct IrInstr {
+    IrOp op;
+    int id = 0;                     // Printed as vN
+    std::vector<IrInstr*> operands;
+    Value constant;                 // Constant
+    std::string name;               // Global accesses
+    int slot = 0;                   // Local accesses; first slot of a loop or PopLocals
+    int count = 0;                  // PopLocals
+    OpCode test = OpCode::OP_JTEST; // Branch: OP_JLT..OP_JTEST; BranchKeep: OP_JUMP_IF_FALSE/TRUE
+    bool sense = false;             // Branch
+    OperandType operandType = OperandType::Unknown; // Arithmetic and Branch: proved by type inference
+    IrBlock* target = nullptr;      // Terminators, see IrOp
+    IrBlock* next = nullptr;
+    int line = 0;
+    int column = 0;
+    int inlined = -1;               // Index into IrFunction::inlinedCalls for code of an inlined body
+    IrBlock* block = nullptr;
+    IrInstr* replacement = nullptr; // Set by a pass that replaces this value, see IrFunction::applyReplacements
+    bool removed = false;
+
+    bool isTerminator() const { return op >= IrOp::Jump; }
+    // True for instructions that produce a value
+    bool hasValue() const { return op <= IrOp::SetGlobal; }
+};
+
+struct IrBlock {
+    int id = 0;
+    std::vector<IrInstr*> instrs; // Phis first, a terminator last
+    std::vector<IrBlock*> preds;  // In the order phi operands use
+
+    IrInstr* terminator() const { return instrs.empty() ? nullptr : instrs.back(); }
+    // Successors of the terminator (target first); none for Return
+    std::vector<IrBlock*> successors() const;
+};
+
+struct IrFunction {
+    std::string name;
+    int arity = 0;      // Parameters are slots 0..arity-1
+    bool main = false;  // The top-level chunk returns nothing
+    bool hooks = false; // Debug hooks may assign globals between any two instructions
+    std::vector<IrBlock*> blocks; // Layout order; blocks[0] is the entry
+    std::vector<std::shared_ptr<Function>> functions; // Nested functions, moved into the chunk
+    std::vector<InlinedCall> inlinedCalls;            // Moved into the chunk
+
+    IrBlock* newBlock();
+    IrInstr* newInstr(IrOp op, int line, int column);
+
+    // Adds `from` as a predecessor of `to` (phis of `to` are the caller's job)
+    static void addEdge(IrBlock* from, IrBlock* to) { to->preds.push_back(from); }
+    // Removes one `from` -> `to` edge and its phi operands
+    static void removeEdge(IrBlock* from, IrBlock* to);
+    // Redirects every operand to the end of its value's replacement chain and
+    // drops replaced and removed instructions from their blocks.
+    void applyReplacements();
+
+private:
+    std::vector<std::unique_ptr<IrBlock>> ownedBlocks;
+    std::vector<std::unique_ptr<IrInstr>> ownedInstrs;
+    int nextBlock = 0;
+    int nextValue = 0;
+};
+
+// Prints `function` in a readable form for --dump-ir
+void printIr(const IrFunction& function, std::ostream& out);
+
+// Runs the passes for optimization level 1 or 2, printing the function after
+// each one to `dump` when it is not null. The last pass infers operand types;
+// `typeReport` gets a line saying how many operations it could type.
+void optimizeIr(IrFunction& function, int level, std::ostream* dump, std::ostream* typeReport = nullptr);
+
+// Emits `function` as bytecode into `chunk`. Reports errors (such as too many
+// locals) to std::cerr and returns false.
+bool emitIr(IrFunction& function, Chunk& chunk);
+
+#endif // IR_H
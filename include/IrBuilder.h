@@ -0,0 +1,148 @@
+#ifndef IR_BUILDER_H
+#define IR_BUILDER_H
+
+#include "AST.h"
+#include "IR.h"
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Lowers the AST to IR (see IR.h), one function at a time, then optimizes it
+// and emits it. The translation follows Compiler's statement by statement:
+// the same locals and slots, fused compare-and-branch conditions, in-place
+// appends and source positions, so an unoptimized function emits the code
+// Compiler would have produced and errors are reported at the same lines.
+//
+// At level 1 and up, calls to small leaf functions are inlined: the callee
+// must be a global defined once by a FunctionStmt (or a local initialized
+// with a function expression) that the script never assigns, whose body
+// makes no calls and costs at most kInlineBudget nodes. A global callee is
+// guarded: if the variable no longer holds that function when the call runs,
+// the real call is made instead.
+class IrBuilder : public ExprVisitor, public StmtVisitor {
+public:
+    static constexpr int kInlineBudget = 40;
+
+    // `report` gets a line per inlined call, `typeReport` one per function
+    // saying how many operations type inference could specialize
+    IrBuilder(int level, std::ostream* dump, std::ostream* report = nullptr, std::ostream* typeReport = nullptr)
+        : level(level), dump(dump), report(report), typeReport(typeReport) {}
+    // See Compiler::setDebugHooks
+    void setDebugHooks(bool enabled) { hooks = enabled; }
+    bool compile(const std::vector<std::unique_ptr<Stmt>>& statements, Chunk* chunk);
+    // Compiles the body of a lazy stub (see Compiler::compileLazy) into it, as
+    // nested in a function whose locals are `outerLocals`. Only calls within
+    // the body can be inlined.
+    bool compileLazy(Function& stub, const std::vector<Token>& params,
+                     const std::vector<std::unique_ptr<Stmt>>& body, const std::vector<std::string>& outerLocals);
+
+    void visitBinaryExpr(BinaryExpr* expr) override;
+    void visitGroupingExpr(GroupingExpr* expr) override;
+    void visitLiteralExpr(LiteralExpr* expr) override;
+    void visitUnaryExpr(UnaryExpr* expr) override;
+    void visitVariableExpr(VariableExpr* expr) override;
+    void visitAssignmentExpr(AssignmentExpr* expr) override;
+    void visitCallExpr(CallExpr* expr) override;
+    void visitFunctionExpr(FunctionExpr* expr) override;
+
+    void visitExpressionStmt(ExpressionStmt* stmt) override;
+    void visitPrintStmt(PrintStmt* stmt) override;
+    void visitVarDecl(VarDecl* stmt) override;
+    void visitBlockStmt(BlockStmt* stmt) override;
+    void visitIfStmt(IfStmt* stmt) override;
+    void visitWhileStmt(WhileStmt* stmt) override;
+    void visitForStmt(ForStmt* stmt) override;
+    void visitForInStmt(ForInStmt* stmt) override;
+    void visitFunctionStmt(FunctionStmt* stmt) override;
+    void visitReturnStmt(ReturnStmt* stmt) override;
+
+private:
+    // A function whose calls can be inlined
+    struct InlineCandidate {
+        const std::vector<Token>* params = nullptr;
+        const std::vector<std::unique_ptr<Stmt>>* body = nullptr;
+        int locals = 0;               // Slots the body declares at most
+        Function* compiled = nullptr; // Set once its definition is compiled
+    };
+
+    // Facts about the whole script, shared by the builders of all functions
+    struct ScriptInfo {
+        std::unordered_set<std::string> assigned;                // Assignment targets
+        std::unordered_map<std::string, int> definitions;        // FunctionStmt names
+        std::unordered_map<std::string, InlineCandidate> globals;
+    };
+
+    // The call being inlined
+    struct InlineFrame {
+        size_t base;                                         // First local of the body
+        const std::vector<Token>* params;
+        std::vector<IrInstr*> arguments;                     // Values of the parameters
+        std::vector<std::pair<IrBlock*, IrInstr*>> returns;  // Jumps to the join, with values
+        IrBlock* join;
+        int call;                                            // Index into IrFunction::inlinedCalls
+    };
+
+    struct Local {
+        std::string name;
+        int depth;
+        std::shared_ptr<InlineCandidate> function; // Set for inlinable local functions
+    };
+
+    int level;
+    std::ostream* dump;
+    std::ostream* report;
+    std::ostream* typeReport;
+    bool hooks = false;
+    std::shared_ptr<ScriptInfo> script;
+    InlineFrame* inlining = nullptr;
+    IrBuilder* enclosing = nullptr;
+    IrFunction* function = nullptr;
+    IrBlock* current = nullptr;   // Block being filled
+    IrInstr* result = nullptr;    // Value of the expression just visited
+    std::vector<Local> locals;
+    int scopeDepth = 0;
+    bool hadError = false;
+    int currentLine = 0;
+    int currentColumn = 0;
+
+    void setLocation(int line, int column);
+    template <typename Node>
+    void setLocation(const Node* node) { setLocation(node->line, node->column); }
+    void error(const char* message);
+
+    IrInstr* value(Expr* expr);
+    IrInstr* add(IrOp op, std::vector<IrInstr*> operands = {});
+    IrInstr* addConstant(Value constant);
+    void startBlock(IrBlock* block);
+    IrBlock* here();
+    IrInstr* addJump(IrBlock* target);
+    IrInstr* addBranch(IrOp op, OpCode test, bool sense, std::vector<IrInstr*> operands);
+    void patch(IrInstr* jump, IrBlock* target);
+    void patch(const std::vector<IrInstr*>& jumps, IrBlock* target);
+    void condition(Expr* condition, bool jumpIf, std::vector<IrInstr*>& jumps);
+    void collectConcat(Expr* expr, std::vector<Expr*>& operands);
+    std::vector<IrInstr*> concatOperands(const std::vector<Expr*>& operands, size_t first);
+    bool append(AssignmentExpr* assignment);
+    bool inlinable(const std::vector<Token>& params, const std::vector<std::unique_ptr<Stmt>>& body,
+                   InlineCandidate& candidate) const;
+    bool inlineCall(CallExpr* call, const std::string& name);
+    void inlineReturn(IrInstr* returned);
+    bool finish(IrFunction& ir, Chunk& chunk);
+    void survey(const std::vector<std::unique_ptr<Stmt>>& statements);
+
+    void beginScope();
+    void endScope();
+    void addLocal(const std::string& name);
+    int resolveLocal(const std::string& name) const;
+    void checkNotCaptured(const std::string& name);
+    Function* compileFunction(const std::string& name, const std::vector<Token>& params,
+                              const std::vector<std::unique_ptr<Stmt>>& body, const Token* deferred);
+    void compileBody(Function& compiled, const std::vector<Token>& params,
+                     const std::vector<std::unique_ptr<Stmt>>& body);
+    std::unique_ptr<LazyBody> lazyBody(const std::vector<Token>& params, const Token& deferred) const;
+};
+
+#endif // IR_BUILDER_H
@@ -0,0 +1,104 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "Chunk.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+// Baseline template JIT for Linux x86-64.
+//
+// A whole Chunk is translated instruction by instruction into native code in
+// mmap'd memory. The VM value stack stays in memory (its top lives in r12 and
+// the local slots start at r13), so
+// native code can be entered at any bytecode offset, which is how the
+// interpreter hands over a hot loop from OP_LOOP. Arithmetic, comparisons,
+// negation, literals, pops and branches have inline fast paths guarded on the
+// Value type tag; everything else (globals, strings, printing, type errors)
+// calls back into C++ helpers that reuse the VM's own operations. Calls of
+// Lua functions, returns and coroutine switches leave native code: the
+// interpreter maintains the call frames and re-enters the JIT from there.
+// Back-edges count down the VM's budget and leave native code with
+// SUSPENDED when it runs out.
+#if defined(__x86_64__) && defined(__linux__)
+#define LUA_HAS_JIT 1
+#endif
+
+class VM;
+enum class InterpretResult;
+
+// State shared between native code and the C++ helpers. Standard layout, so
+// generated code addresses its fields with offsetof.
+struct JitContext {
+    Value* stackTop;
+    Value* slots;    // Local slot 0
+    VM* vm;
+    const Chunk* chunk;
+    uint64_t branch; // Set by helpers of conditional instructions: nonzero takes the branch
+    uint64_t* budget; // VM::budget, counted down by back-edges
+};
+
+class Jit {
+public:
+    Jit() = default;
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // True when the platform is supported and std::variant has the layout the
+    // generated code expects (checked once by probing real Values).
+    static bool available();
+
+    // Translates `chunk` once; false if it contains an opcode the JIT cannot handle.
+    bool compile(const Chunk* chunk);
+    bool isCompiled(const Chunk* chunk) const { return compiled.count(chunk) != 0; }
+    // Frees the native code for `chunk`, if any, so the chunk can be
+    // rewritten (or freed and its address reused) and compiled again
+    void release(const Chunk* chunk);
+
+    // Runs the compiled `chunk` from bytecode position `ip` until it returns,
+    // calls a Lua function, switches coroutines or fails. OK means the VM's
+    // registers are set for the interpreter to continue.
+    InterpretResult execute(VM* vm, const Chunk* chunk, const uint8_t* ip);
+
+private:
+    using EntryFn = int (*)(JitContext* ctx, const void* entry);
+
+    struct CompiledChunk {
+        void* memory = nullptr;
+        size_t size = 0;
+        std::vector<uint32_t> entryOffsets; // Native offset for each bytecode offset
+    };
+
+    std::unordered_map<const Chunk*, CompiledChunk> compiled;
+
+    // Slow-path helpers called from native code. They return the new stack
+    // top, or nullptr after reporting a runtime error.
+    static Value* helperConstant(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperLiteral(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperGetGlobal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperSetGlobal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperDefineGlobal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperEqual(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperNot(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperPrint(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperArith(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperCompare(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperConcat(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperAppendLocal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperCall(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperForCall(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperForInLoop(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperExit(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperSuspend(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperCompareJump(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperNegate(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperGetLocal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperSetLocal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperForPrep(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+    static Value* helperForLoop(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset);
+
+    friend class JitCodegen;
+};
+
+#endif // JIT_H
@@ -7,16 +7,45 @@
 
 class Lexer {
 public:
-    Lexer(const std::string& source);
+    // `line` and `column` are where `source` starts in its file
+    Lexer(const std::string& source, int line = 1, int column = 1);
     std::vector<Token> scanTokens();
 
+    // A lazy lexer does not make tokens for function bodies: after the ')'
+    // of `function name(params)` or `function (params)` it only scans ahead
+    // to the matching 'end', counting the keywords that open a block, and
+    // emits the text in between as one FUNCTION_BODY token. The body is
+    // lexed when the function is first called, so code that never runs is
+    // never tokenized, parsed or compiled; its syntax errors only show then.
+    // A body without a matching 'end' is lexed normally, for the parser to
+    // report, and so is one shorter than kMinLazyBody bytes: it is cheap to
+    // compile and may be small enough to inline.
+    void setLazyFunctions(bool enabled) { lazy = enabled; }
+
+    static constexpr int kMinLazyBody = 256;
+
+    // Whether the name `debug` occurs outside strings and comments (bodies a
+    // lazy lexer skips included). Only then can the script reach the debug
+    // library, since library functions are globals with a dotted name.
+    bool mentionsDebug() const { return debugNamed; }
+
 private:
+    // How far a lazy lexer is into a function header
+    enum class Header { None, Name, Params };
+
     std::string source;
     std::vector<Token> tokens;
     int start = 0;
     int current = 0;
     int line = 1;
     int column = 1;
+    int startLine = 1;   // Position of the first character of the current token
+    int startColumn = 1;
+    bool lazy = false;
+    Header header = Header::None;
+    bool bodyNext = false; // The header just ended
+    int skipDepth = 0;     // Blocks open in the body being skipped; 0 when not skipping
+    bool debugNamed = false;
 
     bool isAtEnd();
     char advance();
@@ -26,6 +55,9 @@ private:
     void addToken(TokenType type);
     void addToken(TokenType type, std::string literal);
     void scanToken();
+    void trackHeader(TokenType type);
+    void skipBody();
+    void report(const std::string& message);
     
     // Scanners for specific types
     void string();
@@ -0,0 +1,49 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include "Value.h"
+
+class VM;
+
+// Built-in functions. `args` points at the `argCount` arguments on the VM
+// stack and the return value goes into `result`, which may still hold an
+// earlier value: a string there can be reused as an output buffer. Errors are
+// reported through VM::runtimeError followed by returning false.
+using NativeFn = bool (*)(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result);
+
+// Functions with state (such as the iterator returned by io.lines) derive
+// from this and recover themselves from `self`.
+struct NativeFunction {
+    std::string name; // Used in error messages
+    NativeFn function;
+
+    NativeFunction(std::string name, NativeFn function) : name(std::move(name)), function(function) {}
+    virtual ~NativeFunction() = default;
+};
+
+// Defines io.write, io.read, io.lines and io.flush. There are no tables yet,
+// so library functions are globals whose names contain the dot.
+void openIoLibrary(VM& vm);
+
+// Defines coroutine.create, coroutine.resume, coroutine.yield, coroutine.wrap
+// and coroutine.status. Values cross resume/yield one at a time: resume
+// returns the value passed to yield (or returned by the body), and an error
+// inside a coroutine stops the script.
+void openCoroutineLibrary(VM& vm);
+
+// Defines math.floor, math.ceil, math.sqrt, math.sin, math.cos, math.tan,
+// math.exp, math.log, math.tointeger and math.type, bound from plain C++
+// functions with VM::registerFunction.
+void openMathLibrary(VM& vm);
+
+// Defines string.len, string.sub, string.byte, string.rep, string.upper,
+// string.lower, string.find, string.match, string.gmatch and string.format,
+// with Lua 5.4 patterns. Each call returns one value: find gives the start
+// of the match, match and gmatch the first capture.
+void openStringLibrary(VM& vm);
+
+// Defines debug.sethook and debug.gethook (see VM::setHook). A hook is a Lua
+// function called as hook(event [, line]).
+void openDebugLibrary(VM& vm);
+
+#endif // LIBRARY_H
@@ -0,0 +1,85 @@
+#ifndef LINE_TABLE_H
+#define LINE_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Source position of every byte of a chunk's code, run-length encoded.
+//
+// Consecutive bytes at the same line and column form a run, stored as three
+// variable-length integers: the run's length in bytes, then the change of
+// line and of column from the previous run (zigzag-encoded, so small steps
+// back stay small). Most runs take 3 bytes and cover a whole instruction or
+// more, against 8 bytes per code byte for a plain line and column array.
+//
+// Every kCheckpointInterval runs a checkpoint records the code offset, the
+// position in the encoding and the absolute line and column there, so a
+// lookup binary-searches the checkpoints and decodes at most that many runs.
+// The run being appended to is kept unencoded until a byte at another
+// position arrives, so add() is a comparison and an increment in the common
+// case.
+class LineTable {
+public:
+    static constexpr size_t kCheckpointInterval = 16;
+
+    struct Position {
+        int line = 0;
+        int column = 0;
+    };
+
+    // Appends the position of the next code byte
+    void add(int line, int column) {
+        if (openCount > 0 && line == openLine && column == openColumn) {
+            openCount++;
+            return;
+        }
+        closeRun();
+        openLine = line;
+        openColumn = column;
+        openCount = 1;
+    }
+    // Forgets the position of the last code byte
+    void removeLast();
+    void clear();
+
+    // Position of the code byte at `offset`; line 0 if there is none (past
+    // the end, or the table was stripped)
+    Position at(size_t offset) const;
+    int line(size_t offset) const { return at(offset).line; }
+
+    // Number of code bytes covered
+    size_t size() const { return encodedBytes + openCount; }
+    // Bytes held by the encoding and the checkpoints
+    size_t footprint() const;
+
+    // Releases spare capacity once the chunk is complete
+    void shrink();
+    // Drops every position and releases the memory (see Chunk::strip);
+    // lookups return line 0 until the table is cleared and refilled
+    void strip();
+    bool stripped() const { return isStripped; }
+
+private:
+    struct Checkpoint {
+        uint32_t offset;   // Code offset where the run starts
+        uint32_t position; // Index of the run in `runs`
+        int32_t line;      // Position before the run, which its deltas apply to
+        int32_t column;
+    };
+
+    std::vector<uint8_t> runs;
+    std::vector<Checkpoint> checkpoints;
+    size_t runCount = 0;
+    uint32_t encodedBytes = 0; // Code bytes covered by `runs`
+    int encodedLine = 0;       // Position of the last encoded run
+    int encodedColumn = 0;
+    int openLine = 0;
+    int openColumn = 0;
+    uint32_t openCount = 0;
+    bool isStripped = false;
+
+    void closeRun();
+};
+
+#endif // LINE_TABLE_H
@@ -0,0 +1,102 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Subsystem an allocation is charged to
+enum class MemoryCategory : uint8_t {
+    Lexer,    // Tokens
+    Parser,   // AST
+    Compiler, // Chunks (code, constants, lines, functions) and the IR while it is built
+    Heap,     // Runtime objects: strings, globals, coroutines, natives
+    Stack,    // Value stacks and call frames
+};
+
+// Per-category byte counters (current and peak) for one script.
+//
+// Every operator new/delete in the process goes through src/Memory.cpp, which
+// keeps a small header in front of each block naming the MemoryStats and
+// category that were active (see MemoryScope) when it was allocated, so the
+// block is credited back to the same counters when it is freed, whoever
+// frees it. Blocks allocated while no MemoryStats is active are not counted.
+// A MemoryStats must therefore outlive everything allocated under it.
+//
+// The limit is not enforced by the allocator: the VM checks overLimit() after
+// each operation that can allocate (a call, a concatenation, a built-in) and
+// raises "not enough memory". Operations that build large strings ('..',
+// string.rep, io.read) also check headroom() before they allocate, so the
+// overshoot of one operation stays small.
+//
+// Replacing the global operator new and delete has a cost for everything in
+// the process, a host embedding the VM included: each block carries a
+// 16-byte header, and each allocation and release reads two thread_locals
+// and updates the counters if a MemoryStats is active. lua_bench reports
+// new/delete of a small block against malloc/free (workload "allocator").
+class MemoryStats {
+public:
+    static constexpr int kCategories = 5;
+
+    size_t current(MemoryCategory category) const { return bytes[index(category)]; }
+    size_t peak(MemoryCategory category) const { return peaks[index(category)]; }
+    size_t currentTotal() const { return total; }
+    size_t peakTotal() const { return totalPeak; }
+    // Bytes allocated so far, including blocks that have since been freed
+    size_t cumulativeTotal() const { return cumulative; }
+
+    // Upper bound on currentTotal() for the VM; 0 means unlimited
+    void setLimit(size_t bytes) { limit = bytes; }
+    size_t getLimit() const { return limit; }
+    bool overLimit() const { return limit != 0 && total > limit; }
+    // Bytes that can still be allocated under the limit; SIZE_MAX without one
+    size_t headroom() const { return limit == 0 ? SIZE_MAX : total < limit ? limit - total : 0; }
+
+    // Table of current and peak bytes per category
+    void print(std::ostream& out) const;
+
+    static const char* categoryName(MemoryCategory category);
+
+    // Called by the allocator
+    void allocated(MemoryCategory category, size_t size) {
+        size_t& count = bytes[index(category)];
+        count += size;
+        if (count > peaks[index(category)]) peaks[index(category)] = count;
+        total += size;
+        if (total > totalPeak) totalPeak = total;
+        cumulative += size;
+    }
+    void freed(MemoryCategory category, size_t size) {
+        bytes[index(category)] -= size;
+        total -= size;
+    }
+
+private:
+    size_t bytes[kCategories] = {};
+    size_t peaks[kCategories] = {};
+    size_t total = 0;
+    size_t totalPeak = 0;
+    size_t cumulative = 0;
+    size_t limit = 0;
+
+    static int index(MemoryCategory category) { return static_cast<int>(category); }
+};
+
+// Charges the current thread's allocations to `stats` under `category` until
+// the scope ends, then restores the previous setting. Scopes nest; the
+// one-argument form only changes the category.
+class MemoryScope {
+public:
+    MemoryScope(MemoryStats* stats, MemoryCategory category);
+    explicit MemoryScope(MemoryCategory category);
+    ~MemoryScope();
+
+    MemoryScope(const MemoryScope&) = delete;
+    MemoryScope& operator=(const MemoryScope&) = delete;
+
+private:
+    MemoryStats* previousStats;
+    MemoryCategory previousCategory;
+};
+
+#endif // MEMORY_H
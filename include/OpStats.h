@@ -0,0 +1,75 @@
+#ifndef OPSTATS_H
+#define OPSTATS_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Per-opcode execution statistics collected by VM::run when the VM is built
+// with LUA_OPSTATS. Every dispatched instruction is counted, along with the
+// (previous, current) opcode pair. Every `sampleInterval`-th instruction is
+// timed with rdtsc from its dispatch to the next dispatch; the sampled cycle
+// counts feed a per-opcode average and a log2 histogram.
+class OpStats {
+public:
+    static constexpr int kOpcodes = 256;
+    static constexpr int kHistogramBuckets = 24; // bucket i holds [2^i, 2^(i+1)) cycles
+    static constexpr uint8_t kNoOpcode = 0xff;   // "previous" before the first instruction
+
+    explicit OpStats(uint32_t sampleInterval = 64);
+
+    inline void record(uint8_t op) {
+        counts[op]++;
+        bigrams[previous * kOpcodes + op]++;
+        previous = op;
+
+        if (sampling) {
+            addSample(sampledOp, readCycles() - sampleStart);
+            sampling = false;
+        }
+        if (sampleInterval != 0 && --countdown == 0) {
+            countdown = sampleInterval;
+            sampling = true;
+            sampledOp = op;
+            sampleStart = readCycles();
+        }
+    }
+
+    uint64_t totalInstructions() const;
+
+    // Human-readable table: per-opcode counts and cycles, then the top bigrams.
+    void printTable(std::ostream& out, size_t topBigrams = 20) const;
+    void writeJson(std::ostream& out) const;
+
+    // Cycle counter: rdtsc on x86, steady_clock nanoseconds elsewhere.
+    static inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+private:
+    uint64_t counts[kOpcodes] = {};
+    uint64_t cycles[kOpcodes] = {};
+    uint64_t samples[kOpcodes] = {};
+    std::vector<uint64_t> histogram; // kOpcodes * kHistogramBuckets
+    std::vector<uint64_t> bigrams;   // kOpcodes * kOpcodes, indexed [previous][current]
+    uint8_t previous = kNoOpcode;
+
+    uint32_t sampleInterval;
+    uint32_t countdown;
+    bool sampling = false;
+    uint8_t sampledOp = 0;
+    uint64_t sampleStart = 0;
+
+    void addSample(uint8_t op, uint64_t elapsed);
+};
+
+#endif // OPSTATS_H
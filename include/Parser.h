@@ -3,47 +3,156 @@
 
 #include "Token.h"
 #include "AST.h"
+#include "FlatAst.h"
 #include <vector>
 #include <memory>
 #include <stdexcept>
+#include <string>
 
 class ParseError : public std::runtime_error {
 public:
     ParseError(const char* msg) : std::runtime_error(msg) {}
 };
 
-class Parser {
+// Builds the tree of AST.h for BasicParser. A builder supplies the node
+// handle types (Expr, Stmt, their lists) and one factory per construct; the
+// parser only moves handles around, so the same grammar builds either the
+// tree or a FlatAst (FlatBuilder). Every node is stamped with the position of
+// the token passed as its first argument.
+class TreeBuilder {
 public:
-    Parser(const std::vector<Token>& tokens);
-    std::vector<std::unique_ptr<Stmt>> parse();
+    using Expr = std::unique_ptr<::Expr>;
+    using Stmt = std::unique_ptr<::Stmt>;
+    using ExprList = std::vector<Expr>;
+    using StmtList = std::vector<Stmt>;
+    using Result = StmtList;
+
+    Expr literal(const Token& at, const std::string& value, TokenType type) {
+        return stamp(at, std::make_unique<LiteralExpr>(value, type));
+    }
+    Expr variable(const Token& name) { return stamp(name, std::make_unique<VariableExpr>(name)); }
+    bool isVariable(const Expr& expr) const { return dynamic_cast<VariableExpr*>(expr.get()) != nullptr; }
+    // `target` must satisfy isVariable()
+    Expr assignment(Expr target, Expr value) {
+        Token name = static_cast<VariableExpr*>(target.get())->name;
+        return stamp(name, std::make_unique<AssignmentExpr>(name, std::move(value)));
+    }
+    Expr binary(const Token& op, Expr left, Expr right) {
+        return stamp(op, std::make_unique<BinaryExpr>(std::move(left), op, std::move(right)));
+    }
+    Expr unary(const Token& op, Expr right) { return stamp(op, std::make_unique<UnaryExpr>(op, std::move(right))); }
+    Expr grouping(const Token& open, Expr expression) {
+        return stamp(open, std::make_unique<GroupingExpr>(std::move(expression)));
+    }
+    Expr call(const Token& open, Expr callee, const Token& paren, ExprList arguments) {
+        return stamp(open, std::make_unique<CallExpr>(std::move(callee), paren, std::move(arguments)));
+    }
+    Expr function(const Token& keyword, const std::vector<Token>& params, StmtList body, const Token* deferred) {
+        auto function = stamp(keyword, std::make_unique<FunctionExpr>(params, std::move(body)));
+        if (deferred) function->deferred = std::make_unique<Token>(*deferred);
+        return function;
+    }
+
+    Stmt functionDecl(const Token& keyword, const Token& name, const std::vector<Token>& params, StmtList body,
+                      const Token* deferred) {
+        auto function = stamp(keyword, std::make_unique<FunctionStmt>(name, params, std::move(body)));
+        if (deferred) function->deferred = std::make_unique<Token>(*deferred);
+        return function;
+    }
+    Stmt expression(const Token& at, Expr expression) {
+        return stamp(at, std::make_unique<ExpressionStmt>(std::move(expression)));
+    }
+    Stmt varDecl(const Token& keyword, const Token& name, Expr initializer) {
+        return stamp(keyword, std::make_unique<VarDecl>(name, std::move(initializer)));
+    }
+    // `at` is nullptr for the implicit block of a branch or loop body
+    Stmt block(const Token* at, StmtList statements) {
+        auto block = std::make_unique<BlockStmt>(std::move(statements));
+        return at ? stamp(*at, std::move(block)) : std::move(block);
+    }
+    Stmt ifStmt(const Token& keyword, Expr condition, Stmt thenBranch, Stmt elseBranch) {
+        return stamp(keyword, std::make_unique<IfStmt>(std::move(condition), std::move(thenBranch),
+                                                       std::move(elseBranch)));
+    }
+    Stmt whileStmt(const Token& keyword, Expr condition, Stmt body) {
+        return stamp(keyword, std::make_unique<WhileStmt>(std::move(condition), std::move(body)));
+    }
+    Stmt forStmt(const Token& keyword, const Token& name, Expr start, Expr limit, Expr step, Stmt body) {
+        return stamp(keyword, std::make_unique<ForStmt>(name, std::move(start), std::move(limit), std::move(step),
+                                                        std::move(body)));
+    }
+    Stmt forInStmt(const Token& keyword, const Token& name, Expr iterator, Stmt body) {
+        return stamp(keyword, std::make_unique<ForInStmt>(name, std::move(iterator), std::move(body)));
+    }
+    Stmt returnStmt(const Token& keyword, Expr value) {
+        return stamp(keyword, std::make_unique<ReturnStmt>(keyword, std::move(value)));
+    }
+
+    Result finish(StmtList statements) { return statements; }
+
+private:
+    // Stamps a freshly built node with the position of `token`
+    template <typename T>
+    static std::unique_ptr<T> stamp(const Token& token, std::unique_ptr<T> node) {
+        node->line = token.line;
+        node->column = token.column;
+        return node;
+    }
+};
+
+// Recursive descent parser for the grammar in docs/Parser.md, building
+// whatever `Builder` makes (TreeBuilder or FlatBuilder)
+template <typename Builder>
+class BasicParser {
+public:
+    using Expr = typename Builder::Expr;
+    using Stmt = typename Builder::Stmt;
+    using ExprList = typename Builder::ExprList;
+    using StmtList = typename Builder::StmtList;
+
+    BasicParser(const std::vector<Token>& tokens);
+    typename Builder::Result parse();
+
+    // Syntax errors found by parse(), formatted "[line N] Error at 'x': message".
+    // Statements containing one are left out of the result.
+    const std::vector<std::string>& errors() const { return errorMessages; }
+    bool hadError() const { return !errorMessages.empty(); }
+    // True if the first error was at the end of the input, i.e. more input
+    // could still make it valid (an interactive prompt then asks for more)
+    bool incomplete() const { return errorAtEnd; }
 
 private:
     const std::vector<Token>& tokens;
     int current = 0;
+    std::vector<std::string> errorMessages;
+    bool errorAtEnd = false;
+    Builder builder;
+
+    Stmt declaration();
+    Stmt varDeclaration();
+    Stmt functionDeclaration();
+    void functionBody(std::vector<Token>& parameters, StmtList& body, std::unique_ptr<Token>& deferred);
+    Stmt statement();
+    Stmt ifStatement();
+    Stmt whileStatement();
+    Stmt forStatement();
+    Stmt returnStatement();
+    StmtList block();
+    Stmt expressionStatement();
 
-    std::unique_ptr<Stmt> declaration();
-    std::unique_ptr<Stmt> varDeclaration();
-    std::unique_ptr<Stmt> functionDeclaration();
-    std::unique_ptr<Stmt> statement();
-    std::unique_ptr<Stmt> ifStatement();
-    std::unique_ptr<Stmt> whileStatement();
-    std::unique_ptr<Stmt> forStatement(); // Optional
-    std::unique_ptr<Stmt> returnStatement();
-    std::vector<std::unique_ptr<Stmt>> block();
-    std::unique_ptr<Stmt> expressionStatement();
-
-    std::unique_ptr<Expr> expression();
-    std::unique_ptr<Expr> assignment();
-    std::unique_ptr<Expr> orExpr();
-    std::unique_ptr<Expr> andExpr();
-    std::unique_ptr<Expr> equality();
-    std::unique_ptr<Expr> comparison();
-    std::unique_ptr<Expr> term();
-    std::unique_ptr<Expr> factor();
-    std::unique_ptr<Expr> unary();
-    std::unique_ptr<Expr> call();
-    std::unique_ptr<Expr> finishCall(std::unique_ptr<Expr> callee);
-    std::unique_ptr<Expr> primary();
+    Expr expression();
+    Expr assignment();
+    Expr orExpr();
+    Expr andExpr();
+    Expr equality();
+    Expr comparison();
+    Expr concat();
+    Expr term();
+    Expr factor();
+    Expr unary();
+    Expr call();
+    Expr finishCall(Expr callee);
+    Expr primary();
 
     bool match(const std::vector<TokenType>& types);
     bool check(TokenType type);
@@ -53,6 +162,10 @@ private:
     Token previous();
     Token consume(TokenType type, std::string message);
     void synchronize();
+    void error(const Token& token, const char* message);
 };
 
+using Parser = BasicParser<TreeBuilder>;
+using FlatParser = BasicParser<FlatBuilder>;
+
 #endif // PARSER_H
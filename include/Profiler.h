@@ -0,0 +1,76 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Chunk.h"
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Sampling profiler for VM::run, compiled in with LUA_PROFILER.
+//
+// Two sampling clocks are supported:
+//  - timer mode (default): setitimer(ITIMER_PROF) raises SIGPROF every
+//    `intervalUs` of CPU time and the handler only sets a flag; the dispatch
+//    loop notices the flag before the next instruction and records it.
+//  - instruction mode: every `instructionInterval`-th instruction is recorded.
+//
+// A sample is the call stack at that instruction, one frame key (function and
+// source line) per level, outermost first. Samples are written in the
+// "collapsed stack" format understood by flamegraph.pl and speedscope, where
+// the main chunk is named after the script:
+//     script.lua:14;outer:9;inner:3 57
+struct Function;
+
+class Profiler {
+public:
+    // One level of the stack being sampled: `function` is nullptr for the main
+    // chunk and `ip` is the instruction the level is at
+    struct Frame {
+        const Function* function;
+        const Chunk* chunk;
+        const uint8_t* ip;
+    };
+
+    explicit Profiler(std::string sourceName, long intervalUs = 1000, uint64_t instructionInterval = 0);
+    ~Profiler();
+
+    void start();
+    void stop();
+
+    inline bool shouldSample() {
+        if (instructionInterval != 0) return --countdown == 0;
+        return timerFired != 0;
+    }
+
+    // Record one sample of `stack`, outermost frame first
+    void sample(const std::vector<Frame>& stack);
+
+    uint64_t totalSamples() const { return total; }
+    void writeCollapsed(std::ostream& out) const;
+
+private:
+    std::string sourceName;
+    long intervalUs;
+    uint64_t instructionInterval;
+    uint64_t countdown;
+    uint64_t total = 0;
+    bool running = false;
+    struct FrameKey {
+        const Chunk* chunk;
+        int line;
+        bool operator<(const FrameKey& other) const {
+            return chunk != other.chunk ? chunk < other.chunk : line < other.line;
+        }
+    };
+    std::map<std::vector<FrameKey>, uint64_t> stackSamples; // stack -> samples
+    std::map<const Chunk*, std::string> names;              // Frame name of each sampled chunk
+    std::vector<FrameKey> key;                              // Scratch for sample()
+
+    static volatile std::sig_atomic_t timerFired;
+    static void onTimer(int);
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,76 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "Chunk.h"
+#include "VM.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Runs many scripts, each in its own VM, round-robin over a few threads.
+//
+// A script runs one slice at a time: its VM gets a budget of steps
+// (VM::setBudget) and goes to the back of the ready queue when the budget
+// runs out, so a runaway loop only ever holds a thread for one slice. Unless
+// the budget is fixed, each script's budget is rescaled after every slice so
+// that a slice takes about `slice` of CPU time whatever its steps cost. The
+// thread CPU time, slices and steps each script used are recorded.
+class Scheduler {
+public:
+    struct Options {
+        unsigned threads = 1;
+        std::chrono::microseconds slice{1000};
+        uint64_t fixedBudget = 0; // Steps per slice; 0 adapts the budget to `slice`
+    };
+
+    struct TaskStats {
+        std::string name;
+        InterpretResult result = InterpretResult::OK;
+        uint64_t slices = 0;
+        uint64_t steps = 0;
+        std::chrono::nanoseconds cpuTime{0};
+    };
+
+    static constexpr uint64_t kInitialBudget = 1000;
+    static constexpr uint64_t kMinBudget = 16;
+    static constexpr uint64_t kMaxBudget = uint64_t{1} << 32;
+
+    explicit Scheduler(Options options);
+
+    // Queues `chunk` to run under `name`. The returned VM can be configured
+    // (JIT, memory stats, host functions) until run() is called.
+    VM& add(std::string name, std::unique_ptr<Chunk> chunk);
+
+    // Runs every script to completion or error
+    void run();
+
+    std::vector<TaskStats> stats() const;
+    // Table of per-script results, slices, steps and CPU time
+    void printStats(std::ostream& out) const;
+
+private:
+    struct Task {
+        std::unique_ptr<Chunk> chunk;
+        std::unique_ptr<VM> vm;
+        uint64_t budget;
+        TaskStats stats;
+    };
+
+    Options options;
+    std::vector<std::unique_ptr<Task>> tasks;
+    std::deque<Task*> ready;
+    size_t unfinished = 0;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    void work();
+    void runSlice(Task& task);
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,57 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "Chunk.h"
+#include "Compiler.h"
+#include "Function.h"
+#include "Memory.h"
+#include "VM.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// A long-lived interpreter for the interactive prompt (or any host that feeds
+// code piece by piece): one VM, so globals and the functions stored in them
+// persist from one input to the next.
+//
+// Every input is compiled into the same chunk, which is cleared (keeping its
+// buffers) and refilled each time; the functions an input declares are moved
+// out of it into the session, which keeps them as long as it lives, since
+// globals and coroutines may still refer to them. As in Lua's REPL, top-level
+// locals only last for their own input, and constants are per input (a chunk
+// holds at most 256).
+class Session {
+public:
+    enum class Status {
+        Ok,           // Ran to the end
+        Incomplete,   // Syntax error at the end of the input: more lines may complete it
+        CompileError, // Reported on stderr; nothing ran
+        RuntimeError, // Reported on stderr; globals set before the error stay set
+    };
+
+    // Compilation and execution are charged to `memory`, if not nullptr,
+    // which must outlive the session
+    explicit Session(MemoryStats* memory = nullptr);
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    // Configure before the first execute()
+    VM& vm() { return *machine; }
+    Compiler& compiler() { return compiler_; }
+
+    // Compiles and runs `source`. An input that is a single expression (not
+    // a call or an assignment) prints its value, so `x` shows x. If `final`
+    // (a whole file, or the end of input) a syntax error at the end is
+    // reported like any other instead of returning Incomplete.
+    Status execute(const std::string& source, bool final = false);
+
+private:
+    MemoryStats* memory;
+    Compiler compiler_;
+    Chunk chunk;
+    std::vector<std::shared_ptr<Function>> functions; // Declared by earlier inputs
+    std::unique_ptr<VM> machine;
+};
+
+#endif // SESSION_H
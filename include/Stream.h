@@ -0,0 +1,102 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "Value.h"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+// Buffered byte streams used by print and the io library.
+//
+// Output is collected in a fixed buffer and written with one call when the
+// buffer fills up or flush() is called explicitly, instead of flushing per
+// print. Numbers are formatted with std::to_chars straight into the buffer.
+class OutputBuffer {
+public:
+    static constexpr size_t kDefaultCapacity = 64 * 1024;
+
+    // Output to a null file is discarded
+    explicit OutputBuffer(FILE* file, size_t capacity = kDefaultCapacity);
+    ~OutputBuffer();
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void write(const char* bytes, size_t length) {
+        if (length > capacity - used) {
+            writeSlow(bytes, length);
+            return;
+        }
+        std::memcpy(data.get() + used, bytes, length);
+        used += length;
+    }
+    void write(const std::string& text) { write(text.data(), text.size()); }
+    void put(char c) {
+        if (used == capacity) flush();
+        data[used++] = c;
+    }
+
+    // Writes the same text print shows for `value`
+    void writeValue(const Value& value);
+
+    // Hands everything buffered so far to the file
+    void flush();
+    // Flushes, then sends later output to `target` (nullptr discards it)
+    void redirect(FILE* target) {
+        flush();
+        file = target;
+    }
+
+private:
+    FILE* file;
+    size_t capacity;
+    size_t used = 0;
+    std::unique_ptr<char[]> data;
+
+    void writeSlow(const char* bytes, size_t length);
+};
+
+// Reads a file through one large buffer. Lines and blocks are copied into a
+// caller-provided string, so a reader that passes the same string every time
+// (like the io.lines loop variable) does not allocate per line.
+class InputBuffer {
+public:
+    static constexpr size_t kDefaultCapacity = 64 * 1024;
+
+    // An owned file is closed by the destructor
+    InputBuffer(FILE* file, bool owned, size_t capacity = kDefaultCapacity);
+    ~InputBuffer();
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer& operator=(const InputBuffer&) = delete;
+
+    // Output flushed before every refill, so prompts appear before the
+    // program waits for input (like std::cin.tie)
+    void tie(OutputBuffer* output) { tied = output; }
+
+    // Next line into `line`, with or without its '\n'. False at end of file.
+    // Stops after `maxLength` bytes, leaving the rest of the line unread.
+    bool readLine(std::string& line, bool keepNewline, size_t maxLength = SIZE_MAX);
+    // Up to `count` bytes into `block`. False at end of file.
+    bool readBlock(std::string& block, size_t count);
+    // Everything up to end of file (possibly nothing), or `maxLength` bytes
+    void readAll(std::string& text, size_t maxLength = SIZE_MAX);
+    // A decimal or hexadecimal numeral after optional whitespace; nil if
+    // the input does not start with one
+    Value readNumber();
+    // True at end of file; may refill the buffer to find out
+    bool atEnd();
+
+private:
+    FILE* file;
+    bool owned;
+    size_t capacity;
+    std::unique_ptr<char[]> data;
+    size_t begin = 0; // Unread bytes are data[begin, end)
+    size_t end = 0;
+    bool eof = false;
+    OutputBuffer* tied = nullptr;
+
+    bool fill();
+};
+
+#endif // STREAM_H
@@ -7,21 +7,26 @@
 enum class TokenType {
     // Single-character tokens
     LEFT_PAREN, RIGHT_PAREN, LEFT_BRACE, RIGHT_BRACE,
-    COMMA, DOT, MINUS, PLUS, SEMICOLON, SLASH, STAR,
+    COMMA, DOT, MINUS, PLUS, SEMICOLON, SLASH, STAR, PERCENT,
     
     // One or two character tokens
     BANG, BANG_EQUAL,
     EQUAL, EQUAL_EQUAL,
     GREATER, GREATER_EQUAL,
     LESS, LESS_EQUAL,
+    SLASH_SLASH, DOT_DOT,
     
     // Literals
-    IDENTIFIER, STRING, NUMBER,
+    IDENTIFIER, STRING, NUMBER, INTEGER, // NUMBER is a float literal
     
     // Keywords
     AND, BREAK, DO, ELSE, ELSEIF, END, FALSE, FOR, FUNCTION,
     IF, IN, LOCAL, NIL, NOT, OR, REPEAT, RETURN, THEN,
     TRUE, UNTIL, WHILE,
+
+    // The unlexed text of a function body, made by a lazy lexer
+    // (Lexer::setLazyFunctions) in place of the body's tokens
+    FUNCTION_BODY,
     
     TOKEN_EOF
 };
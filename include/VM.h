@@ -1,16 +1,31 @@
 #ifndef VM_H
 #define VM_H
 
+#include "Binding.h"
 #include "Chunk.h"
+#include "Coroutine.h"
+#include "Function.h"
+#include "Jit.h"
+#include "Library.h"
+#include "Memory.h"
+#include "Stream.h"
+#ifdef LUA_OPSTATS
+#include "OpStats.h"
+#endif
+#ifdef LUA_PROFILER
+#include "Profiler.h"
+#endif
 #include <vector>
 #include <stack>
 #include <unordered_map>
 #include <string>
+#include <memory>
 
 enum class InterpretResult {
     OK,
     COMPILE_ERROR,
-    RUNTIME_ERROR
+    RUNTIME_ERROR,
+    SUSPENDED // The budget ran out; resumeScript() continues
 };
 
 class VM {
@@ -18,22 +33,219 @@ public:
     VM();
     InterpretResult interpret(Chunk* chunk);
 
+    // Execution budget, in steps: one step per loop back-edge (OP_LOOP, a
+    // repeating OP_FORLOOP) and per call that enters a Lua function or
+    // switches coroutines, so straight-line code between two steps is
+    // bounded by the size of the chunk. When the budget reaches zero
+    // interpret() or resumeScript() returns SUSPENDED with the registers
+    // saved; set a new budget and call resumeScript() to continue from
+    // there. 0 means unlimited (the default).
+    void setBudget(uint64_t steps);
+    uint64_t remainingBudget() const { return budget == kUnlimitedBudget ? 0 : budget; }
+    InterpretResult resumeScript();
+    bool isSuspended() const { return suspended; }
+
+    // JIT control; both are no-ops where the JIT is unavailable. A threshold of
+    // 0 compiles the chunk before its first instruction, otherwise the chunk is
+    // compiled after that many loop back-edges.
+    void setJitEnabled(bool enabled);
+    void setJitThreshold(uint32_t backEdges) { jitThreshold = backEdges; }
+    // Drops what the VM keeps for `chunk` (native code), so that the caller
+    // can clear and refill it, or free it, before the next interpret()
+    void releaseChunk(const Chunk* chunk);
+
+    // Standard output and input. print and io.write only fill the output
+    // buffer; it is flushed when full, by io.flush, before reading from
+    // standard input, on errors and when interpret() returns.
+    OutputBuffer& output() { return stdoutBuffer; }
+    InputBuffer& input() { return stdinBuffer; }
+
+    // Makes `function` callable as the global `name`
+    void defineNative(const std::string& name, NativeFn function);
+    // Makes a plain C++ function callable as the global `name`, e.g.
+    // vm.registerFunction("math.sqrt", &mySqrt). Argument conversion is
+    // generated from the signature; see Binding.h for the supported types.
+    template <typename R, typename... Args>
+    void registerFunction(const std::string& name, R (*function)(Args...)) {
+        globals[name] = adoptNative(std::make_unique<binding::BoundFunction<R, Args...>>(name, function));
+    }
+    // Takes ownership of a function created at run time (e.g. an iterator)
+    NativeFunction* adoptNative(std::unique_ptr<NativeFunction> native);
+
+    // Reports an error at the current instruction; natives use it as well
+    void runtimeError(const char* format, ...);
+    // Reports the C++ exception being handled (inside a catch block) as a
+    // runtime error: std::bad_alloc as "not enough memory", others by what()
+    void exceptionError();
+
+    // Coroutines, for the coroutine library. resume and yield are called by
+    // natives with their arguments at `args` and switch the running
+    // coroutine. The side that is suspended gets the value passed across
+    // later, pushed at `resultSlot` (for resume) or at the yield's callee slot.
+    Coroutine* newCoroutine(Function* body);
+    bool resume(Coroutine* coroutine, Value* resultSlot, Value* args, int argCount);
+    bool yield(Value* args, int argCount);
+    Coroutine* running() const { return current; }
+    bool isMainCoroutine() const { return current == &mainCoroutine; }
+
+    // Memory accounting. While interpret() runs, allocations are charged to
+    // `stats` (runtime heap, or stack for value stacks and call frames); if
+    // the stats have a limit, going over it is a runtime error ("not enough
+    // memory") that stops the script with RUNTIME_ERROR and leaves the VM
+    // usable. nullptr turns accounting off.
+    void setMemoryStats(MemoryStats* stats) { memory = stats; }
+    // For built-ins about to allocate `bytes` at once: false, after raising
+    // "not enough memory", if that would go over the limit
+    bool checkMemoryHeadroom(size_t bytes);
+    size_t memoryHeadroom() const { return memory ? memory->headroom() : SIZE_MAX; }
+
+    // Debug hooks (debug.sethook). The Lua function `function` is called
+    // with the event name and, for "line", the line: "call" when a Lua
+    // function is entered, "line" before an instruction of a new line (or
+    // after a jump back) and "count" every `count` instructions, for the
+    // events in `mask` (kHookCount is implied by count > 0). nullptr or no
+    // events turn hooks off. Events do not fire while the hook runs. Hooks
+    // are served by separate instantiations of the dispatch loop, switched
+    // to before the next instruction; the JIT is not entered while any are
+    // set. Code hooks may run under must be compiled with
+    // Compiler::setDebugHooks.
+    static constexpr uint8_t kHookCall = 1;
+    static constexpr uint8_t kHookLine = 2;
+    static constexpr uint8_t kHookCount = 4;
+    void setHook(Function* function, uint8_t mask, uint32_t count);
+    Function* hookFunction() const { return hooks.function; }
+    // Prints each instruction and the stack of its function to stderr
+    void setTrace(bool enabled);
+
+#ifdef LUA_COUNT_INSTRUCTIONS
+    // Number of instructions dispatched by run() (benchmark builds only)
+    uint64_t instructionCount = 0;
+#endif
+
+#ifdef LUA_OPSTATS
+    // Attach a statistics sink for run(); nullptr disables collection
+    void setOpStats(OpStats* stats) { opStats = stats; }
+#endif
+
+#ifdef LUA_PROFILER
+    // Attach a sampling profiler for run(); nullptr disables sampling
+    void setProfiler(Profiler* p) { profiler = p; }
+#endif
+
 private:
+    static constexpr size_t kInitialStack = 256;
+    static constexpr size_t kMaxFrames = 10000;
+    static constexpr uint64_t kUnlimitedBudget = UINT64_MAX;
+
+    // Registers of the running coroutine. Its stack is a fixed block of
+    // constructed Values addressed through stackTop, so that JIT code can work
+    // on it directly; it only reallocates when it fills up.
     Chunk* chunk;
     uint8_t* ip; // Instruction pointer
-    std::vector<Value> stack; // Stack
+    Value* stackTop;          // One past the topmost value
+    Value* stackLimit;        // End of the backing store
+    Value* slots;             // Local slot 0 of the running function
+    Coroutine* current;       // Owner of the stack and frames in use
+    Coroutine mainCoroutine;
+    std::vector<std::unique_ptr<Coroutine>> coroutines;
+    StackPool stackPool;
     std::unordered_map<std::string, Value> globals;
+    std::vector<std::unique_ptr<NativeFunction>> natives;
+    Value nativeResult;       // Result slot for native calls made by OP_CALL
+    OutputBuffer stdoutBuffer{stdout};
+    InputBuffer stdinBuffer{stdin, false};
+    // Stamp checked by global inline caches. Node pointers into `globals`
+    // survive inserts and entries are never erased (a nil global keeps its
+    // node), so it is set once; it is unique across VMs because chunks (and
+    // their caches) can outlive a VM.
+    uint64_t globalsVersion;
+    MemoryStats* memory = nullptr;
+#ifdef LUA_OPSTATS
+    OpStats* opStats = nullptr;
+#endif
+#ifdef LUA_PROFILER
+    Profiler* profiler = nullptr;
+    std::vector<Profiler::Frame> profileStack; // Reused by sampleProfile
+#endif
+    bool jitEnabled = false;
+    uint32_t jitThreshold = 1000;
+    uint32_t backEdges = 0;
+    uint64_t budget = kUnlimitedBudget; // Steps left; calls, resume and yield spend them too
+    bool suspended = false;
+    // Debug hooks (see setHook) and what the hooked loops track between
+    // instructions
+    struct HookState {
+        Function* function = nullptr;
+        uint8_t mask = 0;
+        uint32_t count = 0;             // Instructions between count events
+        uint32_t countLeft = 0;
+        bool trace = false;             // --trace
+        bool changed = false;           // The dispatch loop has to be chosen again
+        uint8_t* resumeIp = nullptr; // Where ip pointed before redispatch()
+        bool running = false;           // A hook is running; no events fire
+        bool resuming = false;          // Back at the instruction a hook interrupted
+        uint8_t pending = 0;            // Events of that instruction still to fire
+        int line = 0;                   // Its line, for a line event
+        Coroutine* owner = nullptr;     // Coroutine and frame depth of a running Lua hook
+        size_t ownerFrames = 0;
+        Coroutine* coroutine = nullptr; // Coroutine and frame depth last seen (call events)
+        size_t frames = 0;
+        const Chunk* lastChunk = nullptr; // Instruction last seen (line events)
+        const uint8_t* lastIp = nullptr;
+        int lastLine = 0;
+    } hooks;
+#ifdef LUA_HAS_JIT
+    Jit jit;
+    bool enterJit(InterpretResult& result);
+#endif
 
     void push(Value value);
-    Value pop();
-    Value peek(int distance);
-    InterpretResult run();
-
-    void runtimeError(const char* format, ...);
+    void reserveStack(size_t count);
+    void growStack(size_t count);
+    void growFrames();
+    bool checkMemoryLimit();
+    Value* stackBase() { return current->stack.values.data(); }
+    void saveRegisters();
+    void loadRegisters(Coroutine* coroutine);
+    bool callFunction(Function* function, int argCount);
+    bool compileLazy(Function* function);
+    void enterFunction(Function* function, int argCount);
+    void returnFromFunction();
+    void finishCoroutine();
+    InterpretResult execute();
+    InterpretResult dispatch();
+    // The dispatch loop; `Hooks` (NoHooks, CountHook, LineHook or Trace in
+    // VM.cpp) selects what it does besides running instructions
+    template <typename Hooks> InterpretResult run();
+    void redispatch();
+    template <bool Lines> uint8_t collectHookEvents();
+    bool callHook();
+    void traceInstruction();
+#ifdef LUA_PROFILER
+    void sampleProfile();
+#endif
+    // Calls visit(function, chunk, instruction) for every active call, the
+    // running one first (at `top`), then its callers and those of the
+    // coroutines that resumed it; `function` is nullptr for the main chunk
+    template <typename Visit> void walkFrames(const uint8_t* top, Visit visit);
+    const Function* runningFunction(const Value* locals, const Value* base);
 
     // Helpers for operations
-    void binaryOp(OpCode op);
-    bool valuesEqual(Value a, Value b);
+    bool binaryOp(OpCode op);
+    bool compareOp(OpCode op);
+    bool compareValues(OpCode op, const Value& a, const Value& b, bool& result);
+    bool negateOp();
+    bool appendConcat(std::string& out, const Value& value);
+    bool concatenate(int count);
+    bool appendToLocal(uint8_t slot, int count);
+    bool callValue(int argCount);
+    bool forCall(Value* loop);
+    bool forPrepare(Value* loop, bool& enter);
+    bool forLoop(Value* loop);
+    void cacheGlobal(uint8_t constant, Value* slot);
+    bool valuesEqual(const Value& a, const Value& b);
+
+    friend class Jit;
 };
 
 #endif // VM_H
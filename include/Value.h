@@ -4,23 +4,83 @@
 #include <variant>
 #include <string>
 #include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <charconv>
 
 // Simple Value representation
-// Supports: nil, boolean, double, string
+// Supports: nil, boolean, float, string, integer, built-in function, Lua
+// function and coroutine. Like Lua 5.3 a number is either a 64-bit integer or
+// a double; integer arithmetic wraps around. The last three are pointers to
+// objects owned elsewhere: built-ins and coroutines by the VM that created
+// them, Lua functions by the chunk that declares them.
+// New alternatives go at the end: the JIT depends on the existing indices.
 struct Nil {};
+struct NativeFunction;
+struct Function;
+struct Coroutine;
 
-using Value = std::variant<Nil, bool, double, std::string>;
+using Value = std::variant<Nil, bool, double, std::string, int64_t, NativeFunction*, Function*, Coroutine*>;
 
-// Helper to print values
-inline void printValue(const Value& value) {
+inline bool isNumber(const Value& value) {
+    return std::holds_alternative<double>(value) || std::holds_alternative<int64_t>(value);
+}
+
+// Float value of a number (integers convert, possibly rounding)
+inline double toDouble(const Value& value) {
+    if (const int64_t* i = std::get_if<int64_t>(&value)) return static_cast<double>(*i);
+    return std::get<double>(value);
+}
+
+inline const char* typeName(const Value& value) {
+    switch (value.index()) {
+        case 0: return "nil";
+        case 1: return "boolean";
+        case 3: return "string";
+        case 5:
+        case 6: return "function";
+        case 7: return "thread";
+        default: return "number";
+    }
+}
+
+// Formats a float the way Lua does ("%.14g"), keeping a ".0" on integral
+// values so they read differently from integers. Writes at most 32 bytes to
+// `buffer` and returns the length.
+inline size_t formatNumber(double number, char* buffer) {
+    size_t length = std::to_chars(buffer, buffer + 29, number, std::chars_format::general, 14).ptr - buffer;
+    buffer[length] = '\0';
+    if (std::strspn(buffer, "-0123456789") == length) {
+        buffer[length++] = '.';
+        buffer[length++] = '0';
+    }
+    return length;
+}
+
+inline std::string formatNumber(double number) {
+    char buffer[32];
+    return std::string(buffer, formatNumber(number, buffer));
+}
+
+// Helper to print values, to standard output by default
+inline void printValue(const Value& value, std::ostream& out = std::cout) {
     if (std::get_if<Nil>(&value) != nullptr) {
-        std::cout << "nil";
+        out << "nil";
     } else if (const bool* b = std::get_if<bool>(&value)) {
-        std::cout << (*b ? "true" : "false");
+        out << (*b ? "true" : "false");
     } else if (const double* d = std::get_if<double>(&value)) {
-        std::cout << *d;
+        out << formatNumber(*d);
+    } else if (const int64_t* i = std::get_if<int64_t>(&value)) {
+        out << *i;
     } else if (const std::string* s = std::get_if<std::string>(&value)) {
-        std::cout << *s;
+        out << *s;
+    } else if (NativeFunction* const* native = std::get_if<NativeFunction*>(&value)) {
+        out << "function: builtin: " << static_cast<const void*>(*native);
+    } else if (Function* const* function = std::get_if<Function*>(&value)) {
+        out << "function: " << static_cast<const void*>(*function);
+    } else {
+        out << "thread: " << static_cast<const void*>(std::get<Coroutine*>(value));
     }
 }
 
@@ -0,0 +1,48 @@
+#include "Chunk.h"
+#include "Function.h"
+#include <algorithm>
+#include <cstring>
+
+void Chunk::strip() {
+    lines.strip();
+    for (InlinedCall& call : inlinedCalls) {
+        call.function.clear();
+        call.line = 0;
+    }
+    for (const auto& function : functions) {
+        function->name.clear();
+        function->name.shrink_to_fit();
+        if (function->lazy) {
+            function->lazy->strip = true;
+        } else {
+            function->chunk.strip();
+        }
+    }
+}
+
+static bool sameConstant(const Value& a, const Value& b) {
+    if (a.index() != b.index()) return false;
+    if (const double* x = std::get_if<double>(&a)) {
+        double y = std::get<double>(b);
+        return std::memcmp(x, &y, sizeof y) == 0; // Keeps 0.0 and -0.0 apart
+    }
+    if (const int64_t* x = std::get_if<int64_t>(&a)) return *x == std::get<int64_t>(b);
+    if (const std::string* x = std::get_if<std::string>(&a)) return *x == std::get<std::string>(b);
+    if (const bool* x = std::get_if<bool>(&a)) return *x == std::get<bool>(b);
+    if (Function* const* x = std::get_if<Function*>(&a)) return *x == std::get<Function*>(b);
+    return std::holds_alternative<Nil>(a);
+}
+
+int Chunk::findConstant(const Value& value) const {
+    for (size_t i = 0; i < constants.size(); i++) {
+        if (sameConstant(constants[i], value)) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+const InlinedCall* Chunk::inlinedAt(size_t offset) const {
+    auto range = std::upper_bound(inlinedCode.begin(), inlinedCode.end(), offset,
+                                  [](size_t at, const InlinedRange& r) { return at < r.start; });
+    if (range == inlinedCode.begin() || offset >= (--range)->end) return nullptr;
+    return &inlinedCalls[range->call];
+}
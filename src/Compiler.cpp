@@ -1,19 +1,222 @@
 #include "Compiler.h"
+#include "IrBuilder.h"
+#include "Lexer.h"
+#include "Parser.h"
 #include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 
 Compiler::Compiler() : currentChunk(nullptr) {}
 
 bool Compiler::compile(const std::vector<std::unique_ptr<Stmt>>& statements, Chunk* chunk) {
+    if (!compilesFlat()) { // -O0 --dump-ir shows the unoptimized IR
+        IrBuilder builder(optimizationLevel, irDump, inlineReport, typeReport);
+        builder.setDebugHooks(debugHooks);
+        if (!builder.compile(statements, chunk)) return false;
+        if (stripDebugInfo) chunk->strip();
+        return true;
+    }
+    return compile(flatten(statements), chunk);
+}
+
+bool Compiler::compile(const FlatAst& ast, Chunk* chunk) {
+    this->ast = &ast;
     currentChunk = chunk;
-    for (const auto& stmt : statements) {
-        stmt->accept(this);
+    locals.clear();
+    scopeDepth = 0;
+    hadError = false;
+    for (Node stmt : ast.statements()) {
+        statement(stmt);
     }
     emitOp(OpCode::OP_RETURN);
-    return true;
+    computeMaxStack(*currentChunk, 0);
+    currentChunk->lines.shrink();
+    this->ast = nullptr;
+    if (stripDebugInfo) chunk->strip();
+    return !hadError;
+}
+
+// Walks every path through the finished chunk, tracking the stack depth
+// (locals included) before each instruction, and records the largest in
+// Chunk::maxStack. The VM reserves that much when the chunk is entered, so
+// pushes inside it never check for room. Statements leave the stack as they
+// found it, so each instruction is reached at one depth; where that would not
+// hold, the larger depth is kept.
+void Compiler::computeMaxStack(Chunk& chunk, int entryDepth) {
+    const std::vector<uint8_t>& code = chunk.code;
+    std::vector<int> depthAt(code.size(), -1);
+    std::vector<size_t> pending{0};
+    depthAt[0] = entryDepth;
+    int maxDepth = entryDepth;
+
+    auto reach = [&](size_t target, int depth) {
+        if (target < code.size() && depth > depthAt[target]) {
+            depthAt[target] = depth;
+            pending.push_back(target);
+        }
+    };
+
+    while (!pending.empty()) {
+        size_t pc = pending.back();
+        pending.pop_back();
+        int depth = depthAt[pc];
+        auto offset = [&](size_t at) { return static_cast<size_t>((code[at] << 8) | code[at + 1]); };
+
+        size_t length = 1;
+        int after = depth; // Depth on the fall-through path
+        bool fallsThrough = true;
+        switch (static_cast<OpCode>(code[pc])) {
+            case OpCode::OP_NIL:
+            case OpCode::OP_TRUE:
+            case OpCode::OP_FALSE:
+                after = depth + 1;
+                break;
+            case OpCode::OP_CONSTANT:
+            case OpCode::OP_GET_GLOBAL:
+            case OpCode::OP_GET_GLOBAL_CACHED:
+            case OpCode::OP_GET_LOCAL:
+                length = 2;
+                after = depth + 1;
+                break;
+            case OpCode::OP_SET_GLOBAL:
+            case OpCode::OP_SET_GLOBAL_CACHED:
+            case OpCode::OP_SET_LOCAL:
+                length = 2;
+                break;
+            case OpCode::OP_DEFINE_GLOBAL:
+                length = 2;
+                after = depth - 1;
+                break;
+            case OpCode::OP_POP:
+            case OpCode::OP_PRINT:
+            case OpCode::OP_EQUAL:
+            case OpCode::OP_GREATER:
+            case OpCode::OP_LESS:
+            case OpCode::OP_LESS_EQUAL:
+            case OpCode::OP_GREATER_EQUAL:
+            case OpCode::OP_ADD:
+            case OpCode::OP_SUBTRACT:
+            case OpCode::OP_MULTIPLY:
+            case OpCode::OP_DIVIDE:
+            case OpCode::OP_FLOOR_DIVIDE:
+            case OpCode::OP_MODULO:
+            case OpCode::OP_ADD_NUM:
+            case OpCode::OP_SUBTRACT_NUM:
+            case OpCode::OP_MULTIPLY_NUM:
+            case OpCode::OP_DIVIDE_NUM:
+            case OpCode::OP_GREATER_NUM:
+            case OpCode::OP_LESS_NUM:
+            case OpCode::OP_ADD_INT:
+            case OpCode::OP_SUBTRACT_INT:
+            case OpCode::OP_MULTIPLY_INT:
+            case OpCode::OP_GREATER_INT:
+            case OpCode::OP_LESS_INT:
+            case OpCode::OP_ADD_II:
+            case OpCode::OP_SUBTRACT_II:
+            case OpCode::OP_MULTIPLY_II:
+            case OpCode::OP_ADD_FF:
+            case OpCode::OP_SUBTRACT_FF:
+            case OpCode::OP_MULTIPLY_FF:
+            case OpCode::OP_DIVIDE_FF:
+                after = depth - 1;
+                break;
+            case OpCode::OP_NOT:
+            case OpCode::OP_NEGATE:
+            case OpCode::OP_NEGATE_NUM:
+                break;
+            case OpCode::OP_RETURN:
+                fallsThrough = false;
+                break;
+            case OpCode::OP_JUMP:
+                reach(pc + 3 + offset(pc + 1), depth);
+                fallsThrough = false;
+                break;
+            case OpCode::OP_LOOP:
+                reach(pc + 3 - offset(pc + 1), depth);
+                fallsThrough = false;
+                break;
+            case OpCode::OP_JUMP_IF_FALSE:
+            case OpCode::OP_JUMP_IF_TRUE:
+                length = 3;
+                reach(pc + 3 + offset(pc + 1), depth);
+                break;
+            case OpCode::OP_JLT:
+            case OpCode::OP_JLE:
+            case OpCode::OP_JGT:
+            case OpCode::OP_JGE:
+            case OpCode::OP_JEQ:
+            case OpCode::OP_JTEST:
+            case OpCode::OP_JLT_II:
+            case OpCode::OP_JLE_II:
+            case OpCode::OP_JGT_II:
+            case OpCode::OP_JGE_II:
+            case OpCode::OP_JLT_FF:
+            case OpCode::OP_JLE_FF:
+            case OpCode::OP_JGT_FF:
+            case OpCode::OP_JGE_FF: {
+                length = 4;
+                int operands = code[pc] == static_cast<uint8_t>(OpCode::OP_JTEST) ? 1 : 2;
+                after = depth - operands;
+                reach(pc + 4 + offset(pc + 2), after);
+                break;
+            }
+            case OpCode::OP_FORPREP:
+                length = 4;
+                reach(pc + 4 + offset(pc + 2), depth);
+                break;
+            case OpCode::OP_FORLOOP:
+                length = 4;
+                reach(pc + 4 - offset(pc + 2), depth);
+                break;
+            case OpCode::OP_CONCAT:
+                length = 2;
+                after = depth - code[pc + 1] + 1;
+                break;
+            case OpCode::OP_APPEND_LOCAL:
+                length = 3;
+                after = depth - code[pc + 2];
+                break;
+            case OpCode::OP_CALL:
+                // A Lua callee reserves its own stack when it is entered
+                length = 2;
+                after = depth - code[pc + 1];
+                break;
+            case OpCode::OP_TFORCALL:
+                // Pushes the iterator to call it; a Lua iterator leaves its
+                // result there for OP_TFORLOOP
+                length = 2;
+                after = depth + 1;
+                break;
+            case OpCode::OP_TFORLOOP:
+                length = 4;
+                after = depth - 1;
+                reach(pc + 4 + offset(pc + 2), after);
+                break;
+            case OpCode::OP_REDISPATCH:
+                fallsThrough = false;
+                break;
+        }
+        maxDepth = std::max(maxDepth, after);
+        if (fallsThrough) reach(pc + length, after);
+    }
+    chunk.maxStack = maxDepth;
+}
+
+void Compiler::error(const char* message) {
+    std::cerr << "[line " << currentLine << "] Error: " << message << std::endl;
+    hadError = true;
+}
+
+void Compiler::setLocation(int line, int column) {
+    // Synthesized nodes (e.g. loop bodies) carry no position; keep the enclosing one
+    if (line == 0) return;
+    currentLine = line;
+    currentColumn = column;
 }
 
 void Compiler::emitByte(uint8_t byte) {
-    currentChunk->write(byte, 0); // TODO: Pass line number
+    currentChunk->write(byte, currentLine, currentColumn);
 }
 
 void Compiler::emitOp(OpCode op) {
@@ -44,6 +247,19 @@ int Compiler::emitJump(uint8_t instruction) {
     return currentChunk->code.size() - 2;
 }
 
+// Fused branch: opcode, sense, 16-bit offset. Returns the offset's position.
+int Compiler::emitConditionalJump(OpCode op, bool sense) {
+    emitOp(op);
+    emitByte(sense ? 1 : 0);
+    emitByte(0xff);
+    emitByte(0xff);
+    return currentChunk->code.size() - 2;
+}
+
+void Compiler::patchJumps(const std::vector<int>& offsets) {
+    for (int offset : offsets) patchJump(offset);
+}
+
 void Compiler::patchJump(int offset) {
     // -2 to adjust for the jump offset itself
     int jump = currentChunk->code.size() - offset - 2;
@@ -57,216 +273,615 @@ void Compiler::patchJump(int offset) {
 }
 
 int Compiler::makeConstant(Value value) {
-    return currentChunk->addConstant(value);
+    int found = currentChunk->findConstant(value);
+    if (found >= 0) return found;
+    if (currentChunk->constants.size() > UINT8_MAX) {
+        // Reported once, like IrEmitter: every later constant would fail too
+        if (!hadError) error("Too many constants in one chunk.");
+        return 0;
+    }
+    return currentChunk->addConstant(std::move(value));
 }
 
 void Compiler::emitConstant(Value value) {
     emitBytes(static_cast<uint8_t>(OpCode::OP_CONSTANT), makeConstant(value));
 }
 
-// --- Visitors ---
+void Compiler::beginScope() {
+    scopeDepth++;
+}
+
+void Compiler::endScope() {
+    scopeDepth--;
+    while (!locals.empty() && locals.back().depth > scopeDepth) {
+        emitOp(OpCode::OP_POP);
+        locals.pop_back();
+    }
+}
+
+// The value for the new local must already be on top of the stack
+void Compiler::addLocal(const std::string& name) {
+    if (locals.size() > UINT8_MAX) {
+        error("Too many local variables in scope.");
+        return;
+    }
+    locals.push_back({name, scopeDepth});
+}
+
+int Compiler::resolveLocal(const std::string& name) const {
+    // Innermost declaration wins, so later redeclarations shadow earlier ones
+    for (int i = static_cast<int>(locals.size()) - 1; i >= 0; i--) {
+        if (locals[i].name == name) return i;
+    }
+    return -1;
+}
+
+// A name that is not local to the current function would silently fall back
+// to a global; refuse it if it names a local of an enclosing function, since
+// functions cannot capture locals (there are no upvalues).
+void Compiler::checkNotCaptured(const std::string& name) {
+    for (Compiler* outer = enclosing; outer; outer = outer->enclosing) {
+        if (outer->resolveLocal(name) >= 0) {
+            std::string message = "Cannot use local '" + name + "' of an enclosing function.";
+            error(message.c_str());
+            return;
+        }
+    }
+}
+
+// Compiles a Function or FunctionDecl node's body into a new Function owned
+// by the current chunk. A body the lexer skipped (a DeferredBody) only gets
+// a stub, compiled on its first call.
+Function* Compiler::compileFunction(const std::string& name, Node node) {
+    std::vector<std::string> params;
+    for (uint32_t param : ast->list(ast->second(node))) params.emplace_back(ast->string(param));
+    FlatAst::List body = ast->list(ast->third(node));
+
+    auto function = std::make_shared<Function>();
+    function->name = name;
+    function->arity = static_cast<int>(params.size());
+    currentChunk->functions.push_back(function);
+    if (body.size() == 1 && ast->kind(body[0]) == NodeKind::DeferredBody) {
+        function->lazy = lazyBody(params, body[0]);
+    } else {
+        compileBody(*function, params, body);
+    }
+    return function.get();
+}
+
+// Everything compiling a skipped body later needs to know from here
+std::unique_ptr<LazyBody> Compiler::lazyBody(const std::vector<std::string>& params, Node deferred) const {
+    auto lazy = std::make_unique<LazyBody>();
+    lazy->source = ast->string(ast->first(deferred));
+    lazy->line = ast->line(deferred);
+    lazy->column = ast->column(deferred);
+    lazy->params = params;
+    for (const Compiler* outer = this; outer; outer = outer->enclosing) {
+        for (const Local& local : outer->locals) lazy->outerLocals.push_back(local.name);
+    }
+    lazy->optimizationLevel = optimizationLevel;
+    lazy->irDump = irDump;
+    lazy->inlineReport = inlineReport;
+    lazy->typeReport = typeReport;
+    lazy->debugHooks = debugHooks;
+    return lazy;
+}
+
+// Compiles a function body into `function`, as a function nested in this one
+void Compiler::compileBody(Function& function, const std::vector<std::string>& params, FlatAst::List body) {
+    Compiler inner;
+    inner.enclosing = this;
+    inner.ast = ast;
+    inner.optimizationLevel = optimizationLevel;
+    inner.irDump = irDump;
+    inner.inlineReport = inlineReport;
+    inner.typeReport = typeReport;
+    inner.debugHooks = debugHooks;
+    inner.currentChunk = &function.chunk;
+    inner.currentLine = currentLine;
+    inner.currentColumn = currentColumn;
+    inner.beginScope();
+    for (const std::string& param : params) {
+        inner.addLocal(param);
+    }
+    for (Node stmt : body) {
+        inner.statement(stmt);
+    }
+    // Falling off the end returns nil
+    inner.emitOp(OpCode::OP_NIL);
+    inner.emitOp(OpCode::OP_RETURN);
+    computeMaxStack(function.chunk, function.arity);
+    function.chunk.lines.shrink();
+    function.chunk.globalCaches.resize(function.chunk.constants.size());
+    if (inner.hadError) hadError = true;
+}
+
+bool Compiler::compileLazy(Function* function) {
+    const LazyBody& lazy = *function->lazy;
+    Lexer lexer(lazy.source, lazy.line, lazy.column);
+    lexer.setLazyFunctions(true);
+    std::vector<Token> tokens = lexer.scanTokens();
+
+    bool compiled;
+    if (lazy.optimizationLevel > 0 || lazy.irDump) {
+        Parser parser(tokens);
+        std::vector<std::unique_ptr<Stmt>> body = parser.parse();
+        if (parser.hadError()) {
+            for (const std::string& message : parser.errors()) std::cerr << message << std::endl;
+            return false;
+        }
+        std::vector<Token> params;
+        for (const std::string& name : lazy.params) params.emplace_back(TokenType::IDENTIFIER, name, lazy.line, lazy.column);
+        IrBuilder builder(lazy.optimizationLevel, lazy.irDump, lazy.inlineReport, lazy.typeReport);
+        builder.setDebugHooks(lazy.debugHooks);
+        compiled = builder.compileLazy(*function, params, body, lazy.outerLocals);
+    } else {
+        FlatParser parser(tokens);
+        FlatAst body = parser.parse();
+        if (parser.hadError()) {
+            for (const std::string& message : parser.errors()) std::cerr << message << std::endl;
+            return false;
+        }
+        // The body is compiled as nested in a function whose locals are the
+        // enclosing ones, which it must not use
+        Compiler outer;
+        outer.ast = &body;
+        outer.optimizationLevel = lazy.optimizationLevel;
+        outer.debugHooks = lazy.debugHooks;
+        outer.currentLine = lazy.line;
+        outer.currentColumn = lazy.column;
+        for (const std::string& name : lazy.outerLocals) outer.locals.push_back({name, 0});
+        outer.compileBody(*function, lazy.params, body.statements());
+        compiled = !outer.hadError;
+    }
+    if (!compiled) return false;
+    if (lazy.strip) function->chunk.strip();
+    function->lazy.reset();
+    return true;
+}
+
+// Compiles `condition` in branch context: control jumps (through an entry
+// appended to `jumps`, patched by the caller) when its truthiness equals
+// `jumpIf` and falls through otherwise. No value is left on the stack on
+// either path. Comparisons become fused compare-and-branch instructions and
+// 'and'/'or'/'not' become jump chains, so nothing is materialized as a boolean.
+void Compiler::emitCondition(Node condition, bool jumpIf, std::vector<int>& jumps) {
+    switch (ast->kind(condition)) {
+        case NodeKind::Grouping:
+            emitCondition(ast->first(condition), jumpIf, jumps);
+            return;
+        case NodeKind::Unary:
+            if (ast->op(condition) == TokenType::NOT) {
+                emitCondition(ast->first(condition), !jumpIf, jumps);
+                return;
+            }
+            break;
+        case NodeKind::Binary: {
+            TokenType type = ast->op(condition);
+            Node left = ast->first(condition);
+            Node right = ast->second(condition);
+            if (type == TokenType::AND || type == TokenType::OR) {
+                // 'and' jumping on false (or 'or' jumping on true) can leave from
+                // either operand; otherwise the left operand decides whether the
+                // right one runs at all.
+                bool shortCircuit = type == TokenType::AND ? false : true;
+                if (jumpIf == shortCircuit) {
+                    emitCondition(left, jumpIf, jumps);
+                    emitCondition(right, jumpIf, jumps);
+                } else {
+                    std::vector<int> skipRight;
+                    emitCondition(left, shortCircuit, skipRight);
+                    emitCondition(right, jumpIf, jumps);
+                    patchJumps(skipRight);
+                }
+                return;
+            }
+
+            OpCode fused;
+            bool sense = jumpIf;
+            switch (type) {
+                case TokenType::LESS:          fused = OpCode::OP_JLT; break;
+                case TokenType::LESS_EQUAL:    fused = OpCode::OP_JLE; break;
+                case TokenType::GREATER:       fused = OpCode::OP_JGT; break;
+                case TokenType::GREATER_EQUAL: fused = OpCode::OP_JGE; break;
+                case TokenType::EQUAL_EQUAL:   fused = OpCode::OP_JEQ; break;
+                case TokenType::BANG_EQUAL:    fused = OpCode::OP_JEQ; sense = !jumpIf; break;
+                default:                       fused = OpCode::OP_JTEST; break;
+            }
+            if (fused != OpCode::OP_JTEST) {
+                expression(left);
+                expression(right);
+                setLocation(condition);
+                jumps.push_back(emitConditionalJump(fused, sense));
+                return;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    expression(condition);
+    setLocation(condition);
+    jumps.push_back(emitConditionalJump(OpCode::OP_JTEST, jumpIf));
+}
+
+Value literalValue(std::string_view text, TokenType type) {
+    const char* val = text.data();
+    switch (type) {
+        case TokenType::NIL:   return Nil{};
+        case TokenType::TRUE:  return true;
+        case TokenType::FALSE: return false;
+        case TokenType::NUMBER:
+            return std::strtod(val, nullptr);
+        case TokenType::INTEGER: {
+            // Hex literals wrap around like in Lua; decimal ones too large
+            // for an integer become floats
+            bool hex = text.size() > 2 && (val[1] == 'x' || val[1] == 'X');
+            errno = 0;
+            if (hex) return static_cast<int64_t>(std::strtoull(val + 2, nullptr, 16));
+            long long integer = std::strtoll(val, nullptr, 10);
+            if (errno == ERANGE) return std::strtod(val, nullptr);
+            return static_cast<int64_t>(integer);
+        }
+        default:
+            return std::string(text);
+    }
+}
+
+Value literalValue(const LiteralExpr* expr) {
+    return literalValue(expr->value, expr->type);
+}
+
+// --- Expressions ---
+
+void Compiler::expression(Node node) {
+    switch (ast->kind(node)) {
+        case NodeKind::Literal:    literal(node); break;
+        case NodeKind::Variable:   variable(node); break;
+        case NodeKind::Assignment: assignment(node); break;
+        case NodeKind::Binary:     binary(node); break;
+        case NodeKind::Grouping:   expression(ast->first(node)); break;
+        case NodeKind::Call:       call(node); break;
+        case NodeKind::Unary:
+            expression(ast->first(node));
+            setLocation(node);
+            switch (ast->op(node)) {
+                case TokenType::MINUS: emitOp(OpCode::OP_NEGATE); break;
+                case TokenType::NOT: emitOp(OpCode::OP_NOT); break;
+                default: break;
+            }
+            break;
+        case NodeKind::Function: {
+            setLocation(node);
+            Function* function = compileFunction("anonymous", node);
+            setLocation(node);
+            emitConstant(function);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void Compiler::binary(Node node) {
+    TokenType type = ast->op(node);
+    // Value context: 'a and b' / 'a or b' keep the left operand when it
+    // decides the result, and only evaluate the right one otherwise
+    if (type == TokenType::AND || type == TokenType::OR) {
+        expression(ast->first(node));
+        setLocation(node);
+        int endJump = emitJump(static_cast<uint8_t>(
+            type == TokenType::AND ? OpCode::OP_JUMP_IF_FALSE : OpCode::OP_JUMP_IF_TRUE));
+        emitOp(OpCode::OP_POP);
+        expression(ast->second(node));
+        patchJump(endJump);
+        return;
+    }
+
+    if (type == TokenType::DOT_DOT) {
+        std::vector<Node> operands;
+        collectConcat(node, operands);
+        int pending = emitConcatOperands(operands, 0);
+        setLocation(node);
+        emitBytes(static_cast<uint8_t>(OpCode::OP_CONCAT), pending);
+        return;
+    }
 
-void Compiler::visitBinaryExpr(BinaryExpr* expr) {
-    expr->left->accept(this);
-    expr->right->accept(this);
+    expression(ast->first(node));
+    expression(ast->second(node));
+    setLocation(node);
 
-    TokenType type = expr->op.type;
     switch (type) {
         case TokenType::PLUS:          emitOp(OpCode::OP_ADD); break;
         case TokenType::MINUS:         emitOp(OpCode::OP_SUBTRACT); break;
         case TokenType::STAR:          emitOp(OpCode::OP_MULTIPLY); break;
         case TokenType::SLASH:         emitOp(OpCode::OP_DIVIDE); break;
+        case TokenType::SLASH_SLASH:   emitOp(OpCode::OP_FLOOR_DIVIDE); break;
+        case TokenType::PERCENT:       emitOp(OpCode::OP_MODULO); break;
         case TokenType::EQUAL_EQUAL:   emitOp(OpCode::OP_EQUAL); break;
         case TokenType::GREATER:       emitOp(OpCode::OP_GREATER); break;
         case TokenType::LESS:          emitOp(OpCode::OP_LESS); break;
-        // Handle other operators like >=, <=, != by combining logic or adding opcodes
-        // For now simplified
+        case TokenType::GREATER_EQUAL: emitOp(OpCode::OP_GREATER_EQUAL); break;
+        case TokenType::LESS_EQUAL:    emitOp(OpCode::OP_LESS_EQUAL); break;
+        case TokenType::BANG_EQUAL:
+            emitOp(OpCode::OP_EQUAL);
+            emitOp(OpCode::OP_NOT);
+            break;
         default: break;
     }
 }
 
-void Compiler::visitGroupingExpr(GroupingExpr* expr) {
-    expr->expression->accept(this);
+void Compiler::literal(Node node) {
+    setLocation(node);
+    switch (ast->op(node)) {
+        case TokenType::NIL:   emitOp(OpCode::OP_NIL); break;
+        case TokenType::TRUE:  emitOp(OpCode::OP_TRUE); break;
+        case TokenType::FALSE: emitOp(OpCode::OP_FALSE); break;
+        default:               emitConstant(literalValue(ast->string(ast->first(node)), ast->op(node))); break;
+    }
 }
 
-void Compiler::visitLiteralExpr(LiteralExpr* expr) {
-    std::string& val = expr->value;
-    // Check if it's a number, boolean, or nil
-    if (val == "nil") {
-        emitOp(OpCode::OP_NIL);
-    } else if (val == "true") {
-        emitOp(OpCode::OP_TRUE);
-    } else if (val == "false") {
-        emitOp(OpCode::OP_FALSE);
+void Compiler::variable(Node node) {
+    setLocation(node);
+    std::string variable = name(node);
+    int slot = resolveLocal(variable);
+    if (slot >= 0) {
+        emitBytes(static_cast<uint8_t>(OpCode::OP_GET_LOCAL), slot);
     } else {
-        // Try parsing as double
-        try {
-            size_t idx;
-            double num = std::stod(val, &idx);
-            if (idx == val.length()) {
-                emitConstant(num);
-                return;
-            }
-        } catch (...) {}
-        
-        // It's a string
-        // Remove quotes if present
-        if (val.length() >= 2 && val.front() == '"' && val.back() == '"') {
-            emitConstant(val.substr(1, val.length() - 2));
-        } else {
-             emitConstant(val);
-        }
+        checkNotCaptured(variable);
+        emitBytes(static_cast<uint8_t>(OpCode::OP_GET_GLOBAL), makeConstant(variable));
     }
 }
 
-void Compiler::visitUnaryExpr(UnaryExpr* expr) {
-    expr->right->accept(this);
-
-    switch (expr->op.type) {
-        case TokenType::MINUS: emitOp(OpCode::OP_NEGATE); break;
-        case TokenType::NOT: emitOp(OpCode::OP_NOT); break;
-        default: break;
+void Compiler::assignment(Node node) {
+    expression(ast->second(node));
+    setLocation(node);
+    std::string variable = name(node);
+    int slot = resolveLocal(variable);
+    if (slot >= 0) {
+        emitBytes(static_cast<uint8_t>(OpCode::OP_SET_LOCAL), slot);
+    } else {
+        checkNotCaptured(variable);
+        emitBytes(static_cast<uint8_t>(OpCode::OP_SET_GLOBAL), makeConstant(variable));
     }
 }
 
-void Compiler::visitVariableExpr(VariableExpr* expr) {
-    emitBytes(static_cast<uint8_t>(OpCode::OP_GET_GLOBAL), makeConstant(expr->name.lexeme));
+void Compiler::call(Node node) {
+    Node callee = ast->first(node);
+    FlatAst::List arguments = ast->list(ast->second(node));
+    // For now, only support 'print' specially
+    if (ast->kind(callee) == NodeKind::Variable && ast->string(ast->first(callee)) == "print") {
+        // Evaluate arguments
+        for (Node arg : arguments) {
+            expression(arg);
+            setLocation(node);
+            emitOp(OpCode::OP_PRINT);
+        }
+        // Push nil as return value of print
+        emitOp(OpCode::OP_NIL);
+        return;
+    }
+
+    expression(callee);
+    for (Node arg : arguments) {
+        expression(arg);
+    }
+    if (arguments.size() > UINT8_MAX) {
+        error("Can't have more than 255 arguments.");
+    }
+    setLocation(node);
+    emitBytes(static_cast<uint8_t>(OpCode::OP_CALL), static_cast<uint8_t>(arguments.size()));
 }
 
-void Compiler::visitAssignmentExpr(AssignmentExpr* expr) {
-    expr->value->accept(this);
-    emitBytes(static_cast<uint8_t>(OpCode::OP_SET_GLOBAL), makeConstant(expr->name.lexeme));
+// Flattens a chain a .. b .. c (right associative) into its operands
+void Compiler::collectConcat(Node expr, std::vector<Node>& operands) {
+    if (ast->kind(expr) == NodeKind::Binary && ast->op(expr) == TokenType::DOT_DOT) {
+        collectConcat(ast->first(expr), operands);
+        collectConcat(ast->second(expr), operands);
+    } else {
+        operands.push_back(expr);
+    }
 }
 
-void Compiler::visitCallExpr(CallExpr* expr) {
-    // For now, only support 'print' specially
-    if (VariableExpr* v = dynamic_cast<VariableExpr*>(expr->callee.get())) {
-        if (v->name.lexeme == "print") {
-            // Evaluate arguments
-            for (const auto& arg : expr->arguments) {
-                arg->accept(this);
-                emitOp(OpCode::OP_PRINT);
-            }
-            // Push nil as return value of print
-            emitOp(OpCode::OP_NIL); 
-            return;
+// Pushes operands[first..]; every UINT8_MAX values are folded with an
+// OP_CONCAT so the count fits its operand. Returns how many values are left.
+int Compiler::emitConcatOperands(const std::vector<Node>& operands, size_t first) {
+    int pending = 0;
+    for (size_t i = first; i < operands.size(); i++) {
+        expression(operands[i]);
+        if (++pending == UINT8_MAX) {
+            emitBytes(static_cast<uint8_t>(OpCode::OP_CONCAT), pending);
+            pending = 1;
         }
     }
-    // TODO: Generic function call
+    return pending;
 }
 
-void Compiler::visitExpressionStmt(ExpressionStmt* stmt) {
-    stmt->expression->accept(this);
-    emitOp(OpCode::OP_POP);
+// `s = s .. a .. b` on a local, used as a statement: append a and b to the
+// string in s's slot. Copying s onto the stack and back would make building
+// a string in a loop quadratic; appending in place grows the slot's buffer
+// geometrically, and the result is never flattened or copied.
+bool Compiler::emitAppend(Node assignment) {
+    Node value = ast->second(assignment);
+    if (ast->kind(value) != NodeKind::Binary || ast->op(value) != TokenType::DOT_DOT) return false;
+    int slot = resolveLocal(name(assignment));
+    if (slot < 0) return false;
+
+    std::vector<Node> operands;
+    collectConcat(value, operands);
+    Node head = operands[0];
+    if (ast->kind(head) != NodeKind::Variable || resolveLocal(name(head)) != slot) return false;
+
+    int pending = emitConcatOperands(operands, 1);
+    setLocation(assignment);
+    emitBytes(static_cast<uint8_t>(OpCode::OP_APPEND_LOCAL), slot);
+    emitByte(pending);
+    return true;
 }
 
-void Compiler::visitPrintStmt(PrintStmt* stmt) {
-    // Not used in our parser (handled as call)
+// --- Statements ---
+
+void Compiler::statement(Node node) {
+    switch (ast->kind(node)) {
+        case NodeKind::Expression: {
+            setLocation(node);
+            Node expr = ast->first(node);
+            if (ast->kind(expr) == NodeKind::Assignment && emitAppend(expr)) return;
+            expression(expr);
+            emitOp(OpCode::OP_POP);
+            break;
+        }
+        case NodeKind::VarDecl:
+            setLocation(node);
+            if (ast->second(node) != FlatAst::kNone) {
+                expression(ast->second(node));
+            } else {
+                emitOp(OpCode::OP_NIL);
+            }
+            // The initializer's value stays where it is and becomes the local's slot.
+            // It is declared afterwards so `local x = x` reads the outer x.
+            addLocal(name(node));
+            break;
+        case NodeKind::Block:   block(node); break;
+        case NodeKind::If:      ifStatement(node); break;
+        case NodeKind::While:   whileStatement(node); break;
+        case NodeKind::For:     forStatement(node); break;
+        case NodeKind::ForIn:   forInStatement(node); break;
+        case NodeKind::FunctionDecl: {
+            // function name(params) ... end assigns a global, as in Lua
+            setLocation(node);
+            Function* function = compileFunction(name(node), node);
+            setLocation(node);
+            emitConstant(function);
+            emitBytes(static_cast<uint8_t>(OpCode::OP_DEFINE_GLOBAL), makeConstant(name(node)));
+            break;
+        }
+        case NodeKind::Return:
+            setLocation(node);
+            if (ast->first(node) != FlatAst::kNone) {
+                expression(ast->first(node));
+            } else {
+                emitOp(OpCode::OP_NIL);
+            }
+            emitOp(OpCode::OP_RETURN);
+            break;
+        default:
+            break;
+    }
 }
 
-void Compiler::visitVarDecl(VarDecl* stmt) {
-    if (stmt->initializer) {
-        stmt->initializer->accept(this);
-    } else {
-        emitOp(OpCode::OP_NIL);
+void Compiler::block(Node node) {
+    beginScope();
+    for (Node stmt : ast->list(ast->first(node))) {
+        statement(stmt);
     }
-    emitBytes(static_cast<uint8_t>(OpCode::OP_DEFINE_GLOBAL), makeConstant(stmt->name.lexeme));
-}
-
-void Compiler::visitBlockStmt(BlockStmt* stmt) {
-    for (const auto& s : stmt->statements) {
-        s->accept(this);
-    }
-}
-
-void Compiler::visitIfStmt(IfStmt* stmt) {
-    stmt->condition->accept(this);
-
-    int thenJump = emitJump(static_cast<uint8_t>(OpCode::OP_JUMP_IF_FALSE));
-    emitOp(OpCode::OP_POP); // Pop condition
-
-    stmt->thenBranch->accept(this);
-
-    int elseJump = emitJump(static_cast<uint8_t>(OpCode::OP_JUMP));
-
-    patchJump(thenJump);
-    emitOp(OpCode::OP_POP); // Pop condition if we jumped here (wait, jump_if_false doesn't pop in some VMs, but here we popped in then block. 
-    // Actually: JUMP_IF_FALSE usually leaves value on stack if false? 
-    // Let's assume JUMP_IF_FALSE does NOT pop.
-    // So if true: fall through, we should pop.
-    // If false: jump, we should pop at target.
-    // My implementation:
-    //   condition
-    //   JUMP_IF_FALSE else_label
-    //   POP (pop true condition)
-    //   then_block
-    //   JUMP end_label
-    // else_label:
-    //   POP (pop false condition)
-    //   else_block
-    // end_label:
-    
-    // Correct logic:
-    // stmt->condition->accept(this);
-    // int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    // emitOp(OP_POP); // Pop condition (true path)
-    // stmt->thenBranch->accept(this);
-    // int elseJump = emitJump(OP_JUMP);
-    // patchJump(thenJump);
-    // emitOp(OP_POP); // Pop condition (false path)
-    // if (stmt->elseBranch) stmt->elseBranch->accept(this);
-    // patchJump(elseJump);
-
-    // Let's re-implement strictly
-    // My previous logic was slightly off in the manual code above.
-    
-    // Correction:
-    //   condition
-    //   JUMP_IF_FALSE -> jump to ELSE
-    //   POP (condition was true, discard it)
+    endScope();
+}
+
+void Compiler::ifStatement(Node node) {
+    setLocation(node);
+    //   <condition, jumping to ELSE when false>
     //   THEN branch
-    //   JUMP -> jump to END
+    //   JUMP -> END      (only with an else branch)
     // ELSE:
-    //   POP (condition was false, discard it)
     //   ELSE branch
     // END:
-    
-    // But wait, my VM implementation of OP_JUMP_IF_FALSE does NOT pop.
-    // So yes, we need explicit POPs.
-    
-    // Wait, I already wrote `emitOp(OpCode::OP_POP); // Pop condition` after jump.
-    // That handles the TRUE case.
-    // Now I need to handle the FALSE case (target of jump).
-    
-    if (stmt->elseBranch) {
-        stmt->elseBranch->accept(this);
+    std::vector<int> elseJumps;
+    emitCondition(ast->first(node), false, elseJumps);
+
+    statement(ast->second(node));
+
+    if (ast->third(node) != FlatAst::kNone) {
+        int endJump = emitJump(static_cast<uint8_t>(OpCode::OP_JUMP));
+        patchJumps(elseJumps);
+        statement(ast->third(node));
+        patchJump(endJump);
+    } else {
+        patchJumps(elseJumps);
     }
-    patchJump(elseJump);
 }
 
-void Compiler::visitWhileStmt(WhileStmt* stmt) {
+void Compiler::whileStatement(Node node) {
+    setLocation(node);
     int loopStart = currentChunk->code.size();
-    
-    stmt->condition->accept(this);
-    int exitJump = emitJump(static_cast<uint8_t>(OpCode::OP_JUMP_IF_FALSE));
-    emitOp(OpCode::OP_POP);
-    
-    stmt->body->accept(this);
+
+    std::vector<int> exitJumps;
+    emitCondition(ast->first(node), false, exitJumps);
+
+    statement(ast->second(node));
+    setLocation(node);
     emitLoop(loopStart);
-    
-    patchJump(exitJump);
-    emitOp(OpCode::OP_POP);
-}
 
-void Compiler::visitFunctionStmt(FunctionStmt* stmt) {
-    // Not implemented yet
+    patchJumps(exitJumps);
 }
 
-void Compiler::visitReturnStmt(ReturnStmt* stmt) {
-    if (stmt->value) {
-        stmt->value->accept(this);
+// Stack layout, from the first slot: internal index, limit, step, iteration
+// count (nil for a float loop), then the visible loop variable. FORPREP
+// validates and precomputes; FORLOOP steps the index, tests it and branches
+// back in a single instruction.
+void Compiler::forStatement(Node node) {
+    FlatAst::List parts = ast->list(ast->second(node)); // start, limit, step, body
+    setLocation(node);
+    beginScope();
+    expression(parts[0]);
+    expression(parts[1]);
+    if (parts[2] != FlatAst::kNone) {
+        expression(parts[2]);
     } else {
-        emitOp(OpCode::OP_NIL);
+        setLocation(node);
+        emitConstant(int64_t{1});
     }
-    emitOp(OpCode::OP_RETURN);
+    setLocation(node);
+    emitOp(OpCode::OP_NIL);
+    emitOp(OpCode::OP_NIL);
+    int base = static_cast<int>(locals.size());
+    // Names start with '(' so no identifier can resolve to them
+    addLocal("(for index)");
+    addLocal("(for limit)");
+    addLocal("(for step)");
+    addLocal("(for count)");
+    addLocal(name(node));
+
+    emitBytes(static_cast<uint8_t>(OpCode::OP_FORPREP), base);
+    int exitJump = currentChunk->code.size();
+    emitBytes(0xff, 0xff);
+    int bodyStart = currentChunk->code.size();
+
+    statement(parts[3]);
+
+    setLocation(node);
+    emitBytes(static_cast<uint8_t>(OpCode::OP_FORLOOP), base);
+    int offset = currentChunk->code.size() - bodyStart + 2;
+    if (offset > UINT16_MAX) {
+        error("Loop body too large.");
+    }
+    emitBytes((offset >> 8) & 0xff, offset & 0xff);
+
+    patchJump(exitJump);
+    endScope();
+}
+
+void Compiler::forInStatement(Node node) {
+    setLocation(node);
+    beginScope();
+    expression(ast->second(node));
+    setLocation(node);
+    emitOp(OpCode::OP_NIL);
+    int base = static_cast<int>(locals.size());
+    addLocal("(for iterator)");
+    addLocal(name(node));
+
+    int loopStart = currentChunk->code.size();
+    emitBytes(static_cast<uint8_t>(OpCode::OP_TFORCALL), base);
+    emitBytes(static_cast<uint8_t>(OpCode::OP_TFORLOOP), base);
+    int exitJump = currentChunk->code.size();
+    emitBytes(0xff, 0xff);
+
+    statement(ast->third(node));
+
+    setLocation(node);
+    emitLoop(loopStart);
+    patchJump(exitJump);
+    endScope();
 }
@@ -0,0 +1,33 @@
+#include "Coroutine.h"
+
+const char* statusName(Coroutine::Status status) {
+    switch (status) {
+        case Coroutine::Status::Suspended: return "suspended";
+        case Coroutine::Status::Running:   return "running";
+        case Coroutine::Status::Normal:    return "normal";
+        default:                           return "dead";
+    }
+}
+
+ExecutionStack StackPool::acquire() {
+    if (free.empty()) {
+        ExecutionStack stack;
+        stack.values.resize(kInitialValues);
+        return stack;
+    }
+    ExecutionStack stack = std::move(free.back());
+    free.pop_back();
+    return stack;
+}
+
+void StackPool::release(ExecutionStack&& stack) {
+    if (free.size() >= kMaxPooled) return;
+    if (stack.values.size() > kMaxPooledValues) {
+        stack.values.resize(kInitialValues);
+        stack.values.shrink_to_fit();
+    }
+    // Drop whatever the coroutine left behind (strings own memory)
+    for (Value& value : stack.values) value = Nil{};
+    stack.frames.clear();
+    free.push_back(std::move(stack));
+}
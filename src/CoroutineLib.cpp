@@ -0,0 +1,66 @@
+#include "Library.h"
+#include "VM.h"
+
+namespace {
+
+bool argumentError(VM& vm, NativeFunction& self, int position, const char* expected, const Value* got) {
+    vm.runtimeError("bad argument #%d to '%s' (%s expected, got %s)", position, self.name.c_str(), expected,
+                    got ? typeName(*got) : "no value");
+    return false;
+}
+
+// coroutine.create(f): a suspended coroutine that runs f when first resumed.
+// It has no stack until then.
+bool coroutineCreate(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    Function* const* body = argCount > 0 ? std::get_if<Function*>(&args[0]) : nullptr;
+    if (!body) return argumentError(vm, self, 1, "Lua function", argCount > 0 ? &args[0] : nullptr);
+    result = vm.newCoroutine(*body);
+    return true;
+}
+
+bool coroutineResume(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    Coroutine* const* coroutine = argCount > 0 ? std::get_if<Coroutine*>(&args[0]) : nullptr;
+    if (!coroutine) return argumentError(vm, self, 1, "coroutine", argCount > 0 ? &args[0] : nullptr);
+    // The coroutine itself is not passed on
+    return vm.resume(*coroutine, args - 1, args + 1, argCount - 1);
+}
+
+bool coroutineYield(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    return vm.yield(args, argCount);
+}
+
+bool coroutineStatus(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    Coroutine* const* coroutine = argCount > 0 ? std::get_if<Coroutine*>(&args[0]) : nullptr;
+    if (!coroutine) return argumentError(vm, self, 1, "coroutine", argCount > 0 ? &args[0] : nullptr);
+    result = std::string(statusName((*coroutine)->status));
+    return true;
+}
+
+// Function returned by coroutine.wrap: calling it resumes the coroutine
+struct WrappedCoroutine : NativeFunction {
+    Coroutine* coroutine;
+
+    WrappedCoroutine(NativeFn function, Coroutine* coroutine)
+        : NativeFunction("wrap", function), coroutine(coroutine) {}
+};
+
+bool resumeWrapped(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    return vm.resume(static_cast<WrappedCoroutine&>(self).coroutine, args - 1, args, argCount);
+}
+
+bool coroutineWrap(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    Function* const* body = argCount > 0 ? std::get_if<Function*>(&args[0]) : nullptr;
+    if (!body) return argumentError(vm, self, 1, "Lua function", argCount > 0 ? &args[0] : nullptr);
+    result = vm.adoptNative(std::make_unique<WrappedCoroutine>(&resumeWrapped, vm.newCoroutine(*body)));
+    return true;
+}
+
+} // namespace
+
+void openCoroutineLibrary(VM& vm) {
+    vm.defineNative("coroutine.create", &coroutineCreate);
+    vm.defineNative("coroutine.resume", &coroutineResume);
+    vm.defineNative("coroutine.yield", &coroutineYield);
+    vm.defineNative("coroutine.status", &coroutineStatus);
+    vm.defineNative("coroutine.wrap", &coroutineWrap);
+}
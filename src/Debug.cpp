@@ -0,0 +1,79 @@
+#include "Debug.h"
+
+const char* opcodeName(uint8_t op) {
+    switch (static_cast<OpCode>(op)) {
+        case OpCode::OP_CONSTANT:       return "OP_CONSTANT";
+        case OpCode::OP_NIL:            return "OP_NIL";
+        case OpCode::OP_TRUE:           return "OP_TRUE";
+        case OpCode::OP_FALSE:          return "OP_FALSE";
+        case OpCode::OP_POP:            return "OP_POP";
+        case OpCode::OP_GET_GLOBAL:     return "OP_GET_GLOBAL";
+        case OpCode::OP_SET_GLOBAL:     return "OP_SET_GLOBAL";
+        case OpCode::OP_DEFINE_GLOBAL:  return "OP_DEFINE_GLOBAL";
+        case OpCode::OP_EQUAL:          return "OP_EQUAL";
+        case OpCode::OP_GREATER:        return "OP_GREATER";
+        case OpCode::OP_LESS:           return "OP_LESS";
+        case OpCode::OP_ADD:            return "OP_ADD";
+        case OpCode::OP_SUBTRACT:       return "OP_SUBTRACT";
+        case OpCode::OP_MULTIPLY:       return "OP_MULTIPLY";
+        case OpCode::OP_DIVIDE:         return "OP_DIVIDE";
+        case OpCode::OP_NOT:            return "OP_NOT";
+        case OpCode::OP_NEGATE:         return "OP_NEGATE";
+        case OpCode::OP_PRINT:          return "OP_PRINT";
+        case OpCode::OP_JUMP:           return "OP_JUMP";
+        case OpCode::OP_JUMP_IF_FALSE:  return "OP_JUMP_IF_FALSE";
+        case OpCode::OP_LOOP:           return "OP_LOOP";
+        case OpCode::OP_RETURN:         return "OP_RETURN";
+        case OpCode::OP_GET_LOCAL:      return "OP_GET_LOCAL";
+        case OpCode::OP_SET_LOCAL:      return "OP_SET_LOCAL";
+        case OpCode::OP_FORPREP:        return "OP_FORPREP";
+        case OpCode::OP_FORLOOP:        return "OP_FORLOOP";
+        case OpCode::OP_FLOOR_DIVIDE:   return "OP_FLOOR_DIVIDE";
+        case OpCode::OP_MODULO:         return "OP_MODULO";
+        case OpCode::OP_LESS_EQUAL:     return "OP_LESS_EQUAL";
+        case OpCode::OP_GREATER_EQUAL:  return "OP_GREATER_EQUAL";
+        case OpCode::OP_JUMP_IF_TRUE:   return "OP_JUMP_IF_TRUE";
+        case OpCode::OP_JLT:            return "OP_JLT";
+        case OpCode::OP_JLE:            return "OP_JLE";
+        case OpCode::OP_JGT:            return "OP_JGT";
+        case OpCode::OP_JGE:            return "OP_JGE";
+        case OpCode::OP_JEQ:            return "OP_JEQ";
+        case OpCode::OP_JTEST:          return "OP_JTEST";
+        case OpCode::OP_CONCAT:         return "OP_CONCAT";
+        case OpCode::OP_APPEND_LOCAL:   return "OP_APPEND_LOCAL";
+        case OpCode::OP_CALL:           return "OP_CALL";
+        case OpCode::OP_TFORCALL:       return "OP_TFORCALL";
+        case OpCode::OP_TFORLOOP:       return "OP_TFORLOOP";
+        case OpCode::OP_ADD_NUM:        return "OP_ADD_NUM";
+        case OpCode::OP_SUBTRACT_NUM:   return "OP_SUBTRACT_NUM";
+        case OpCode::OP_MULTIPLY_NUM:   return "OP_MULTIPLY_NUM";
+        case OpCode::OP_DIVIDE_NUM:     return "OP_DIVIDE_NUM";
+        case OpCode::OP_GREATER_NUM:    return "OP_GREATER_NUM";
+        case OpCode::OP_LESS_NUM:       return "OP_LESS_NUM";
+        case OpCode::OP_NEGATE_NUM:     return "OP_NEGATE_NUM";
+        case OpCode::OP_ADD_INT:        return "OP_ADD_INT";
+        case OpCode::OP_SUBTRACT_INT:   return "OP_SUBTRACT_INT";
+        case OpCode::OP_MULTIPLY_INT:   return "OP_MULTIPLY_INT";
+        case OpCode::OP_GREATER_INT:    return "OP_GREATER_INT";
+        case OpCode::OP_LESS_INT:       return "OP_LESS_INT";
+        case OpCode::OP_GET_GLOBAL_CACHED: return "OP_GET_GLOBAL_CACHED";
+        case OpCode::OP_SET_GLOBAL_CACHED: return "OP_SET_GLOBAL_CACHED";
+        case OpCode::OP_ADD_II:         return "OP_ADD_II";
+        case OpCode::OP_SUBTRACT_II:    return "OP_SUBTRACT_II";
+        case OpCode::OP_MULTIPLY_II:    return "OP_MULTIPLY_II";
+        case OpCode::OP_ADD_FF:         return "OP_ADD_FF";
+        case OpCode::OP_SUBTRACT_FF:    return "OP_SUBTRACT_FF";
+        case OpCode::OP_MULTIPLY_FF:    return "OP_MULTIPLY_FF";
+        case OpCode::OP_DIVIDE_FF:      return "OP_DIVIDE_FF";
+        case OpCode::OP_JLT_II:         return "OP_JLT_II";
+        case OpCode::OP_JLE_II:         return "OP_JLE_II";
+        case OpCode::OP_JGT_II:         return "OP_JGT_II";
+        case OpCode::OP_JGE_II:         return "OP_JGE_II";
+        case OpCode::OP_JLT_FF:         return "OP_JLT_FF";
+        case OpCode::OP_JLE_FF:         return "OP_JLE_FF";
+        case OpCode::OP_JGT_FF:         return "OP_JGT_FF";
+        case OpCode::OP_JGE_FF:         return "OP_JGE_FF";
+        case OpCode::OP_REDISPATCH:     return "OP_REDISPATCH";
+    }
+    return "OP_UNKNOWN";
+}
@@ -0,0 +1,52 @@
+#include "Library.h"
+#include "VM.h"
+#include <algorithm>
+
+namespace {
+
+bool argumentError(VM& vm, NativeFunction& self, int position, const char* expected, const Value* got) {
+    vm.runtimeError("bad argument #%d to '%s' (%s expected, got %s)", position, self.name.c_str(), expected,
+                    got ? typeName(*got) : "no value");
+    return false;
+}
+
+// debug.sethook([f, mask [, count]]): calls the Lua function f on the
+// events in mask ("c" for call, "l" for line; other letters are ignored)
+// and every count instructions if count is positive. Without f, or with
+// f nil, hooks are turned off.
+bool debugSetHook(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    result = Nil{};
+    if (argCount == 0 || std::holds_alternative<Nil>(args[0])) {
+        vm.setHook(nullptr, 0, 0);
+        return true;
+    }
+    Function* const* function = std::get_if<Function*>(&args[0]);
+    if (!function) return argumentError(vm, self, 1, "Lua function", &args[0]);
+    const std::string* events = argCount > 1 ? std::get_if<std::string>(&args[1]) : nullptr;
+    if (!events) return argumentError(vm, self, 2, "string", argCount > 1 ? &args[1] : nullptr);
+    uint8_t mask = 0;
+    if (events->find('c') != std::string::npos) mask |= VM::kHookCall;
+    if (events->find('l') != std::string::npos) mask |= VM::kHookLine;
+    int64_t count = 0;
+    if (argCount > 2 && !std::holds_alternative<Nil>(args[2])) {
+        const int64_t* value = std::get_if<int64_t>(&args[2]);
+        if (!value) return argumentError(vm, self, 3, "integer", &args[2]);
+        count = std::max<int64_t>(0, std::min<int64_t>(*value, UINT32_MAX));
+    }
+    vm.setHook(*function, mask, static_cast<uint32_t>(count));
+    return true;
+}
+
+// debug.gethook(): the current hook function, or nil
+bool debugGetHook(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    if (Function* function = vm.hookFunction()) result = function;
+    else result = Nil{};
+    return true;
+}
+
+} // namespace
+
+void openDebugLibrary(VM& vm) {
+    vm.defineNative("debug.sethook", &debugSetHook);
+    vm.defineNative("debug.gethook", &debugGetHook);
+}
@@ -0,0 +1,263 @@
+#include "FlatAst.h"
+
+FlatAst::FlatAst() : stringStarts{0}, lists{0}, root(0) {
+    // Node 0, string 0 ("") and list 0 (empty) stand for "none"
+    add(NodeKind::None, 0, 0);
+    addString("");
+}
+
+FlatAst::Node FlatAst::add(NodeKind kind, int line, int column, uint32_t first, uint32_t second,
+                           uint32_t third, TokenType op) {
+    kinds.push_back(kind);
+    ops.push_back(static_cast<uint8_t>(op));
+    firsts.push_back(first);
+    seconds.push_back(second);
+    thirds.push_back(third);
+    lines.push_back(line);
+    columns.push_back(column);
+    return static_cast<Node>(kinds.size() - 1);
+}
+
+uint32_t FlatAst::addString(std::string_view text) {
+    chars.append(text);
+    chars.push_back('\0');
+    stringStarts.push_back(static_cast<uint32_t>(chars.size()));
+    return static_cast<uint32_t>(stringStarts.size() - 2);
+}
+
+uint32_t FlatAst::addList(const std::vector<uint32_t>& elements) {
+    if (elements.empty()) return 0;
+    uint32_t index = static_cast<uint32_t>(lists.size());
+    lists.push_back(static_cast<uint32_t>(elements.size()));
+    lists.insert(lists.end(), elements.begin(), elements.end());
+    return index;
+}
+
+size_t FlatAst::footprint() const {
+    return kinds.capacity() * sizeof(NodeKind) + ops.capacity() + firsts.capacity() * sizeof(uint32_t) +
+           seconds.capacity() * sizeof(uint32_t) + thirds.capacity() * sizeof(uint32_t) +
+           lines.capacity() * sizeof(int32_t) + columns.capacity() * sizeof(int32_t) + chars.capacity() +
+           stringStarts.capacity() * sizeof(uint32_t) + lists.capacity() * sizeof(uint32_t);
+}
+
+void FlatAst::shrink() {
+    kinds.shrink_to_fit();
+    ops.shrink_to_fit();
+    firsts.shrink_to_fit();
+    seconds.shrink_to_fit();
+    thirds.shrink_to_fit();
+    lines.shrink_to_fit();
+    columns.shrink_to_fit();
+    chars.shrink_to_fit();
+    stringStarts.shrink_to_fit();
+    lists.shrink_to_fit();
+}
+
+// --- FlatBuilder ---
+
+FlatBuilder::Expr FlatBuilder::literal(const Token& at, const std::string& value, TokenType type) {
+    return ast.add(NodeKind::Literal, at.line, at.column, ast.addString(value), 0, 0, type);
+}
+
+FlatBuilder::Expr FlatBuilder::variable(const Token& name) {
+    return ast.add(NodeKind::Variable, name.line, name.column, ast.addString(name.lexeme));
+}
+
+// The target node is left unused; its name is shared with the assignment
+FlatBuilder::Expr FlatBuilder::assignment(Expr target, Expr value) {
+    return ast.add(NodeKind::Assignment, ast.line(target), ast.column(target), ast.first(target), value);
+}
+
+FlatBuilder::Expr FlatBuilder::binary(const Token& op, Expr left, Expr right) {
+    return ast.add(NodeKind::Binary, op.line, op.column, left, right, 0, op.type);
+}
+
+FlatBuilder::Expr FlatBuilder::unary(const Token& op, Expr right) {
+    return ast.add(NodeKind::Unary, op.line, op.column, right, 0, 0, op.type);
+}
+
+FlatBuilder::Expr FlatBuilder::grouping(const Token& open, Expr expression) {
+    return ast.add(NodeKind::Grouping, open.line, open.column, expression);
+}
+
+FlatBuilder::Expr FlatBuilder::call(const Token& open, Expr callee, const Token&, ExprList arguments) {
+    return ast.add(NodeKind::Call, open.line, open.column, callee, ast.addList(arguments));
+}
+
+FlatBuilder::Expr FlatBuilder::function(const Token& keyword, const std::vector<Token>& params, StmtList body,
+                                        const Token* deferred) {
+    return function(NodeKind::Function, keyword, 0, params, std::move(body), deferred);
+}
+
+FlatBuilder::Stmt FlatBuilder::functionDecl(const Token& keyword, const Token& name, const std::vector<Token>& params,
+                                            StmtList body, const Token* deferred) {
+    return function(NodeKind::FunctionDecl, keyword, ast.addString(name.lexeme), params, std::move(body), deferred);
+}
+
+FlatBuilder::Stmt FlatBuilder::function(NodeKind kind, const Token& keyword, uint32_t name,
+                                        const std::vector<Token>& params, StmtList body, const Token* deferred) {
+    std::vector<uint32_t> names;
+    names.reserve(params.size());
+    for (const Token& param : params) names.push_back(ast.addString(param.lexeme));
+    if (deferred) {
+        body.assign(1, ast.add(NodeKind::DeferredBody, deferred->line, deferred->column,
+                               ast.addString(deferred->lexeme)));
+    }
+    return ast.add(kind, keyword.line, keyword.column, name, ast.addList(names), ast.addList(body));
+}
+
+FlatBuilder::Stmt FlatBuilder::expression(const Token& at, Expr expression) {
+    return ast.add(NodeKind::Expression, at.line, at.column, expression);
+}
+
+FlatBuilder::Stmt FlatBuilder::varDecl(const Token& keyword, const Token& name, Expr initializer) {
+    return ast.add(NodeKind::VarDecl, keyword.line, keyword.column, ast.addString(name.lexeme), initializer);
+}
+
+FlatBuilder::Stmt FlatBuilder::block(const Token* at, StmtList statements) {
+    return ast.add(NodeKind::Block, at ? at->line : 0, at ? at->column : 0, ast.addList(statements));
+}
+
+FlatBuilder::Stmt FlatBuilder::ifStmt(const Token& keyword, Expr condition, Stmt thenBranch, Stmt elseBranch) {
+    return ast.add(NodeKind::If, keyword.line, keyword.column, condition, thenBranch, elseBranch);
+}
+
+FlatBuilder::Stmt FlatBuilder::whileStmt(const Token& keyword, Expr condition, Stmt body) {
+    return ast.add(NodeKind::While, keyword.line, keyword.column, condition, body);
+}
+
+FlatBuilder::Stmt FlatBuilder::forStmt(const Token& keyword, const Token& name, Expr start, Expr limit, Expr step,
+                                       Stmt body) {
+    return ast.add(NodeKind::For, keyword.line, keyword.column, ast.addString(name.lexeme),
+                   ast.addList({start, limit, step, body}));
+}
+
+FlatBuilder::Stmt FlatBuilder::forInStmt(const Token& keyword, const Token& name, Expr iterator, Stmt body) {
+    return ast.add(NodeKind::ForIn, keyword.line, keyword.column, ast.addString(name.lexeme), iterator, body);
+}
+
+FlatBuilder::Stmt FlatBuilder::returnStmt(const Token& keyword, Expr value) {
+    return ast.add(NodeKind::Return, keyword.line, keyword.column, value);
+}
+
+FlatAst FlatBuilder::finish(StmtList statements) {
+    ast.setStatements(ast.addList(statements));
+    ast.shrink();
+    return std::move(ast);
+}
+
+// --- Flattening a tree ---
+
+namespace {
+// Rebuilds each node through a FlatBuilder, children first, so the result
+// compiles as what FlatParser would have produced from the same tokens
+class Flattener : public ExprVisitor, public StmtVisitor {
+public:
+    FlatBuilder builder;
+
+    FlatAst::Node expr(Expr* node) {
+        if (!node) return FlatAst::kNone;
+        node->accept(this);
+        return result;
+    }
+    FlatAst::Node stmt(Stmt* node) {
+        if (!node) return FlatAst::kNone;
+        node->accept(this);
+        return result;
+    }
+    FlatBuilder::StmtList stmts(const std::vector<std::unique_ptr<Stmt>>& statements) {
+        FlatBuilder::StmtList nodes;
+        for (const auto& statement : statements) nodes.push_back(stmt(statement.get()));
+        return nodes;
+    }
+
+    void visitBinaryExpr(BinaryExpr* node) override {
+        FlatAst::Node left = expr(node->left.get());
+        FlatAst::Node right = expr(node->right.get());
+        result = builder.binary(at(node, node->op), left, right);
+    }
+    void visitGroupingExpr(GroupingExpr* node) override {
+        result = builder.grouping(at(node), expr(node->expression.get()));
+    }
+    void visitLiteralExpr(LiteralExpr* node) override {
+        result = builder.literal(at(node), node->value, node->type);
+    }
+    void visitUnaryExpr(UnaryExpr* node) override {
+        FlatAst::Node right = expr(node->right.get());
+        result = builder.unary(at(node, node->op), right);
+    }
+    void visitVariableExpr(VariableExpr* node) override {
+        result = builder.variable(at(node, node->name));
+    }
+    void visitAssignmentExpr(AssignmentExpr* node) override {
+        FlatAst::Node value = expr(node->value.get());
+        result = builder.assignment(builder.variable(at(node, node->name)), value);
+    }
+    void visitCallExpr(CallExpr* node) override {
+        FlatAst::Node callee = expr(node->callee.get());
+        FlatBuilder::ExprList arguments;
+        for (const auto& argument : node->arguments) arguments.push_back(expr(argument.get()));
+        result = builder.call(at(node), callee, node->paren, std::move(arguments));
+    }
+    void visitFunctionExpr(FunctionExpr* node) override {
+        result = builder.function(at(node), node->params, stmts(node->body), node->deferred.get());
+    }
+
+    void visitExpressionStmt(ExpressionStmt* node) override {
+        result = builder.expression(at(node), expr(node->expression.get()));
+    }
+    void visitPrintStmt(PrintStmt* node) override {
+        // Never produced by the parser; a call to print does the same
+        Token name(TokenType::IDENTIFIER, "print", node->line, node->column);
+        FlatBuilder::ExprList arguments{expr(node->expression.get())};
+        result = builder.expression(at(node), builder.call(at(node), builder.variable(name), name, arguments));
+    }
+    void visitVarDecl(VarDecl* node) override {
+        result = builder.varDecl(at(node), node->name, expr(node->initializer.get()));
+    }
+    void visitBlockStmt(BlockStmt* node) override {
+        Token position = at(node);
+        result = builder.block(node->line ? &position : nullptr, stmts(node->statements));
+    }
+    void visitIfStmt(IfStmt* node) override {
+        FlatAst::Node condition = expr(node->condition.get());
+        FlatAst::Node thenBranch = stmt(node->thenBranch.get());
+        result = builder.ifStmt(at(node), condition, thenBranch, stmt(node->elseBranch.get()));
+    }
+    void visitWhileStmt(WhileStmt* node) override {
+        FlatAst::Node condition = expr(node->condition.get());
+        result = builder.whileStmt(at(node), condition, stmt(node->body.get()));
+    }
+    void visitForStmt(ForStmt* node) override {
+        FlatAst::Node start = expr(node->start.get());
+        FlatAst::Node limit = expr(node->limit.get());
+        FlatAst::Node step = expr(node->step.get());
+        result = builder.forStmt(at(node), node->name, start, limit, step, stmt(node->body.get()));
+    }
+    void visitForInStmt(ForInStmt* node) override {
+        FlatAst::Node iterator = expr(node->iterator.get());
+        result = builder.forInStmt(at(node), node->name, iterator, stmt(node->body.get()));
+    }
+    void visitFunctionStmt(FunctionStmt* node) override {
+        result = builder.functionDecl(at(node), node->name, node->params, stmts(node->body), node->deferred.get());
+    }
+    void visitReturnStmt(ReturnStmt* node) override {
+        result = builder.returnStmt(at(node), expr(node->value.get()));
+    }
+
+private:
+    FlatAst::Node result = FlatAst::kNone;
+
+    // A token carrying the node's position (and `token`'s type and text)
+    template <typename Node>
+    static Token at(const Node* node, const Token& token = Token(TokenType::NIL, "", 0, 0)) {
+        return Token(token.type, token.lexeme, node->line, node->column);
+    }
+};
+}
+
+FlatAst flatten(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    Flattener flattener;
+    FlatBuilder::StmtList roots = flattener.stmts(statements);
+    return flattener.builder.finish(std::move(roots));
+}
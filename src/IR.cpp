@@ -0,0 +1,181 @@
+#include "IR.h"
+#include <algorithm>
+
+std::vector<IrBlock*> IrBlock::successors() const {
+    std::vector<IrBlock*> result;
+    IrInstr* last = terminator();
+    if (!last || !last->isTerminator()) return result;
+    if (last->target) result.push_back(last->target);
+    if (last->next) result.push_back(last->next);
+    return result;
+}
+
+IrBlock* IrFunction::newBlock() {
+    ownedBlocks.push_back(std::make_unique<IrBlock>());
+    IrBlock* block = ownedBlocks.back().get();
+    block->id = nextBlock++;
+    return block;
+}
+
+IrInstr* IrFunction::newInstr(IrOp op, int line, int column) {
+    ownedInstrs.push_back(std::make_unique<IrInstr>());
+    IrInstr* instr = ownedInstrs.back().get();
+    instr->op = op;
+    instr->id = nextValue++;
+    instr->line = line;
+    instr->column = column;
+    return instr;
+}
+
+void IrFunction::removeEdge(IrBlock* from, IrBlock* to) {
+    auto it = std::find(to->preds.begin(), to->preds.end(), from);
+    if (it == to->preds.end()) return;
+    size_t index = it - to->preds.begin();
+    to->preds.erase(it);
+    for (IrInstr* instr : to->instrs) {
+        if (instr->op != IrOp::Phi) break;
+        instr->operands.erase(instr->operands.begin() + index);
+    }
+}
+
+void IrFunction::applyReplacements() {
+    auto resolve = [](IrInstr* value) {
+        while (value->replacement) value = value->replacement;
+        return value;
+    };
+    for (IrBlock* block : blocks) {
+        for (IrInstr* instr : block->instrs) {
+            for (IrInstr*& operand : instr->operands) operand = resolve(operand);
+        }
+        block->instrs.erase(std::remove_if(block->instrs.begin(), block->instrs.end(),
+                                           [](IrInstr* instr) { return instr->removed || instr->replacement; }),
+                            block->instrs.end());
+    }
+}
+
+namespace {
+
+const char* irOpName(IrOp op) {
+    switch (op) {
+        case IrOp::Constant:     return "const";
+        case IrOp::GetLocal:     return "local";
+        case IrOp::GetGlobal:    return "global";
+        case IrOp::Phi:          return "phi";
+        case IrOp::Add:          return "add";
+        case IrOp::Subtract:     return "sub";
+        case IrOp::Multiply:     return "mul";
+        case IrOp::Divide:       return "div";
+        case IrOp::FloorDivide:  return "idiv";
+        case IrOp::Modulo:       return "mod";
+        case IrOp::Equal:        return "eq";
+        case IrOp::Less:         return "lt";
+        case IrOp::LessEqual:    return "le";
+        case IrOp::Greater:      return "gt";
+        case IrOp::GreaterEqual: return "ge";
+        case IrOp::Not:          return "not";
+        case IrOp::Negate:       return "neg";
+        case IrOp::Concat:       return "concat";
+        case IrOp::Call:         return "call";
+        case IrOp::SetLocal:     return "set.local";
+        case IrOp::SetGlobal:    return "set.global";
+        case IrOp::DefineGlobal: return "define.global";
+        case IrOp::DeclareLocal: return "declare";
+        case IrOp::PopLocals:    return "pop.locals";
+        case IrOp::AppendLocal:  return "append";
+        case IrOp::Print:        return "print";
+        case IrOp::Jump:         return "jump";
+        case IrOp::Branch:       return "branch";
+        case IrOp::BranchKeep:   return "branch.keep";
+        case IrOp::Return:       return "return";
+        case IrOp::ForPrep:      return "for.prep";
+        case IrOp::ForLoop:      return "for.loop";
+        case IrOp::ForIn:        return "for.in";
+    }
+    return "?";
+}
+
+const char* branchTestName(OpCode test) {
+    switch (test) {
+        case OpCode::OP_JLT: return "lt";
+        case OpCode::OP_JLE: return "le";
+        case OpCode::OP_JGT: return "gt";
+        case OpCode::OP_JGE: return "ge";
+        case OpCode::OP_JEQ: return "eq";
+        default:             return "test";
+    }
+}
+
+void printConstant(const Value& value, std::ostream& out) {
+    if (const std::string* s = std::get_if<std::string>(&value)) {
+        out << '"' << *s << '"';
+    } else if (Function* const* function = std::get_if<Function*>(&value)) {
+        out << "function " << (*function)->name;
+    } else if (const double* d = std::get_if<double>(&value)) {
+        out << formatNumber(*d);
+    } else if (std::holds_alternative<Nil>(value)) {
+        out << "nil";
+    } else if (const bool* b = std::get_if<bool>(&value)) {
+        out << (*b ? "true" : "false");
+    } else {
+        out << std::get<int64_t>(value);
+    }
+}
+
+} // namespace
+
+void printIr(const IrFunction& function, std::ostream& out) {
+    out << "function " << function.name << " (" << function.arity << " params)\n";
+    for (const IrBlock* block : function.blocks) {
+        out << "b" << block->id << ":";
+        if (!block->preds.empty()) {
+            out << " <-";
+            for (const IrBlock* pred : block->preds) out << " b" << pred->id;
+        }
+        out << "\n";
+        for (const IrInstr* instr : block->instrs) {
+            out << "  ";
+            if (instr->hasValue()) out << "v" << instr->id << " = ";
+            out << irOpName(instr->op);
+            if (instr->operandType == OperandType::Integer) out << ".int";
+            if (instr->operandType == OperandType::Float) out << ".float";
+            switch (instr->op) {
+                case IrOp::Constant:
+                    out << " ";
+                    printConstant(instr->constant, out);
+                    break;
+                case IrOp::GetGlobal:
+                case IrOp::SetGlobal:
+                case IrOp::DefineGlobal:
+                    out << " " << instr->name;
+                    break;
+                case IrOp::GetLocal:
+                case IrOp::SetLocal:
+                case IrOp::DeclareLocal:
+                case IrOp::AppendLocal:
+                case IrOp::ForPrep:
+                case IrOp::ForLoop:
+                case IrOp::ForIn:
+                    out << " $" << instr->slot;
+                    break;
+                case IrOp::PopLocals:
+                    out << " $" << instr->slot << " x" << instr->count;
+                    break;
+                case IrOp::Branch:
+                    // "not": taken when the test fails
+                    out << "." << branchTestName(instr->test) << (instr->sense ? "" : " not");
+                    break;
+                case IrOp::BranchKeep:
+                    out << (instr->test == OpCode::OP_JUMP_IF_FALSE ? ".false" : ".true");
+                    break;
+                default:
+                    break;
+            }
+            for (size_t i = 0; i < instr->operands.size(); i++) {
+                out << (i == 0 ? " " : ", ") << "v" << instr->operands[i]->id;
+            }
+            if (instr->target) out << " -> b" << instr->target->id;
+            if (instr->next) out << (instr->target ? " else b" : " -> b") << instr->next->id;
+            out << "\n";
+        }
+    }
+}
@@ -0,0 +1,158 @@
+#include "Library.h"
+#include "VM.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+bool argumentError(VM& vm, NativeFunction& self, int position, const char* message) {
+    vm.runtimeError("bad argument #%d to '%s' (%s)", position, self.name.c_str(), message);
+    return false;
+}
+
+// The string held by `result`, keeping its capacity when it already is one
+std::string& reuseString(Value& result) {
+    if (std::string* s = std::get_if<std::string>(&result)) return *s;
+    return result.emplace<std::string>();
+}
+
+// False, after raising the error, if `text` was read past `headroom`
+bool withinHeadroom(VM& vm, const std::string& text, size_t headroom) {
+    if (text.size() <= headroom) return true;
+    vm.runtimeError("not enough memory");
+    return false;
+}
+
+// Reads one item from `in` as described by `format`: "l" (line), "L" (line
+// with its newline), "n" (number), "a" (rest of the input), each optionally
+// prefixed by '*', or an integer byte count. Sets nil at end of input.
+// Reading stops one byte past the script's memory headroom, which is then
+// a "not enough memory" error instead of an allocation the size of the input.
+bool readFormat(VM& vm, NativeFunction& self, InputBuffer& in, const Value& format, Value& result) {
+    size_t headroom = vm.memoryHeadroom();
+    size_t maxLength = headroom == SIZE_MAX ? SIZE_MAX : headroom + 1;
+    if (const int64_t* count = std::get_if<int64_t>(&format)) {
+        if (*count < 0) return argumentError(vm, self, 1, "invalid format");
+        if (*count == 0) {
+            // Only tests for end of input
+            if (in.atEnd()) result = Nil{};
+            else reuseString(result).clear();
+            return true;
+        }
+        std::string& block = reuseString(result);
+        if (!in.readBlock(block, std::min(static_cast<uint64_t>(*count), static_cast<uint64_t>(maxLength)))) {
+            result = Nil{};
+            return true;
+        }
+        return withinHeadroom(vm, block, headroom);
+    }
+
+    const std::string* name = std::get_if<std::string>(&format);
+    char kind = '\0';
+    if (name) {
+        size_t start = !name->empty() && (*name)[0] == '*' ? 1 : 0;
+        if (start < name->size()) kind = (*name)[start];
+    }
+    switch (kind) {
+        case 'l':
+        case 'L':
+            if (!in.readLine(reuseString(result), kind == 'L', maxLength)) {
+                result = Nil{};
+                return true;
+            }
+            return withinHeadroom(vm, std::get<std::string>(result), headroom);
+        case 'n':
+            result = in.readNumber();
+            return true;
+        case 'a':
+            in.readAll(reuseString(result), maxLength);
+            return withinHeadroom(vm, std::get<std::string>(result), headroom);
+        default:
+            return argumentError(vm, self, 1, "invalid format");
+    }
+}
+
+const Value kLineFormat = std::string("l");
+
+// io.write(...): strings and numbers, without separators or a newline
+bool ioWrite(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    OutputBuffer& out = vm.output();
+    for (int i = 0; i < argCount; i++) {
+        if (!std::holds_alternative<std::string>(args[i]) && !isNumber(args[i])) {
+            std::string message = std::string("string expected, got ") + typeName(args[i]);
+            return argumentError(vm, self, i + 1, message.c_str());
+        }
+        out.writeValue(args[i]);
+    }
+    result = Nil{};
+    return true;
+}
+
+// io.read([format]) from standard input. Only a single format is supported
+// since a call produces one value.
+bool ioRead(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    if (argCount > 1) return argumentError(vm, self, 2, "only one format is supported");
+    return readFormat(vm, self, vm.input(), argCount == 1 ? args[0] : kLineFormat, result);
+}
+
+bool ioFlush(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    vm.output().flush();
+    result = Nil{};
+    return true;
+}
+
+// Iterator returned by io.lines. A file it opened is closed at end of input.
+struct LineIterator : NativeFunction {
+    std::unique_ptr<InputBuffer> file; // nullptr reads standard input
+    bool closed = false;
+    Value format;
+
+    LineIterator(NativeFn function, std::unique_ptr<InputBuffer> file, Value format)
+        : NativeFunction("for iterator", function), file(std::move(file)), format(std::move(format)) {}
+};
+
+bool nextLine(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    LineIterator& iterator = static_cast<LineIterator&>(self);
+    if (iterator.closed) {
+        result = Nil{};
+        return true;
+    }
+    InputBuffer& in = iterator.file ? *iterator.file : vm.input();
+    if (!readFormat(vm, self, in, iterator.format, result)) return false;
+    if (std::holds_alternative<Nil>(result) && iterator.file) {
+        iterator.file.reset();
+        iterator.closed = true;
+    }
+    return true;
+}
+
+// io.lines([filename [, format]]): an iterator over the lines of a file, or
+// of standard input without a file name. The iterator is owned by the VM
+// until it is destroyed.
+bool ioLines(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::unique_ptr<InputBuffer> file;
+    if (argCount > 0 && !std::holds_alternative<Nil>(args[0])) {
+        const std::string* path = std::get_if<std::string>(&args[0]);
+        if (!path) return argumentError(vm, self, 1, "string expected");
+        FILE* handle = std::fopen(path->c_str(), "rb");
+        if (!handle) {
+            vm.runtimeError("%s: %s", path->c_str(), std::strerror(errno));
+            return false;
+        }
+        file = std::make_unique<InputBuffer>(handle, true);
+    }
+    Value format = argCount > 1 ? args[1] : kLineFormat;
+    result = vm.adoptNative(std::make_unique<LineIterator>(&nextLine, std::move(file), std::move(format)));
+    return true;
+}
+
+} // namespace
+
+void openIoLibrary(VM& vm) {
+    vm.defineNative("io.write", &ioWrite);
+    vm.defineNative("io.read", &ioRead);
+    vm.defineNative("io.lines", &ioLines);
+    vm.defineNative("io.flush", &ioFlush);
+}
@@ -0,0 +1,862 @@
+#include "IrBuilder.h"
+#include "Compiler.h"
+#include <functional>
+#include <iostream>
+
+namespace {
+
+// Calls `onStmt`/`onExpr` for every node below the given statements,
+// parents before children
+struct AstWalk {
+    std::function<void(Stmt*)> onStmt = [](Stmt*) {};
+    std::function<void(Expr*)> onExpr = [](Expr*) {};
+
+    void statements(const std::vector<std::unique_ptr<Stmt>>& list) {
+        for (const auto& stmt : list) statement(stmt.get());
+    }
+
+    void statement(Stmt* stmt) {
+        if (!stmt) return;
+        onStmt(stmt);
+        if (auto* s = dynamic_cast<ExpressionStmt*>(stmt)) {
+            expression(s->expression.get());
+        } else if (auto* s = dynamic_cast<PrintStmt*>(stmt)) {
+            expression(s->expression.get());
+        } else if (auto* s = dynamic_cast<VarDecl*>(stmt)) {
+            expression(s->initializer.get());
+        } else if (auto* s = dynamic_cast<BlockStmt*>(stmt)) {
+            statements(s->statements);
+        } else if (auto* s = dynamic_cast<IfStmt*>(stmt)) {
+            expression(s->condition.get());
+            statement(s->thenBranch.get());
+            statement(s->elseBranch.get());
+        } else if (auto* s = dynamic_cast<WhileStmt*>(stmt)) {
+            expression(s->condition.get());
+            statement(s->body.get());
+        } else if (auto* s = dynamic_cast<ForStmt*>(stmt)) {
+            expression(s->start.get());
+            expression(s->limit.get());
+            expression(s->step.get());
+            statement(s->body.get());
+        } else if (auto* s = dynamic_cast<ForInStmt*>(stmt)) {
+            expression(s->iterator.get());
+            statement(s->body.get());
+        } else if (auto* s = dynamic_cast<FunctionStmt*>(stmt)) {
+            statements(s->body);
+        } else if (auto* s = dynamic_cast<ReturnStmt*>(stmt)) {
+            expression(s->value.get());
+        }
+    }
+
+    void expression(Expr* expr) {
+        if (!expr) return;
+        onExpr(expr);
+        if (auto* e = dynamic_cast<BinaryExpr*>(expr)) {
+            expression(e->left.get());
+            expression(e->right.get());
+        } else if (auto* e = dynamic_cast<GroupingExpr*>(expr)) {
+            expression(e->expression.get());
+        } else if (auto* e = dynamic_cast<UnaryExpr*>(expr)) {
+            expression(e->right.get());
+        } else if (auto* e = dynamic_cast<AssignmentExpr*>(expr)) {
+            expression(e->value.get());
+        } else if (auto* e = dynamic_cast<CallExpr*>(expr)) {
+            expression(e->callee.get());
+            for (const auto& arg : e->arguments) expression(arg.get());
+        } else if (auto* e = dynamic_cast<FunctionExpr*>(expr)) {
+            statements(e->body);
+        }
+    }
+};
+
+bool containsFunction(Expr* expr) {
+    bool found = false;
+    AstWalk walk;
+    walk.onExpr = [&](Expr* e) { found = found || dynamic_cast<FunctionExpr*>(e) != nullptr; };
+    walk.expression(expr);
+    return found;
+}
+
+} // namespace
+
+bool IrBuilder::compile(const std::vector<std::unique_ptr<Stmt>>& statements, Chunk* chunk) {
+    survey(statements);
+
+    IrFunction ir;
+    ir.name = "main";
+    ir.main = true;
+    ir.hooks = hooks;
+    function = &ir;
+    startBlock(ir.newBlock());
+    for (const auto& stmt : statements) {
+        stmt->accept(this);
+    }
+    add(IrOp::Return);
+    return finish(ir, *chunk);
+}
+
+bool IrBuilder::compileLazy(Function& stub, const std::vector<Token>& params,
+                            const std::vector<std::unique_ptr<Stmt>>& body,
+                            const std::vector<std::string>& outerLocals) {
+    survey(body);
+    for (const std::string& name : outerLocals) locals.push_back({name, 0, nullptr});
+    currentLine = stub.lazy->line;
+    currentColumn = stub.lazy->column;
+    compileBody(stub, params, body);
+    return !hadError;
+}
+
+// Finds the functions whose calls can be inlined, which depends on every
+// assignment in the script. Bodies the lexer skipped are not seen: their
+// functions are not inlined, and a global they assign is still guarded.
+void IrBuilder::survey(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    script = std::make_shared<ScriptInfo>();
+    std::vector<FunctionStmt*> definitions;
+    AstWalk walk;
+    walk.onStmt = [&](Stmt* stmt) {
+        if (auto* definition = dynamic_cast<FunctionStmt*>(stmt)) {
+            definitions.push_back(definition);
+            script->definitions[definition->name.lexeme]++;
+        }
+    };
+    walk.onExpr = [&](Expr* expr) {
+        if (auto* assignment = dynamic_cast<AssignmentExpr*>(expr)) script->assigned.insert(assignment->name.lexeme);
+    };
+    walk.statements(statements);
+    for (FunctionStmt* definition : definitions) {
+        const std::string& name = definition->name.lexeme;
+        InlineCandidate candidate;
+        if (script->definitions[name] == 1 && !script->assigned.count(name) && !definition->deferred &&
+            inlinable(definition->params, definition->body, candidate)) {
+            script->globals[name] = candidate;
+        }
+    }
+}
+
+// Optimizes and emits a completed function
+bool IrBuilder::finish(IrFunction& ir, Chunk& chunk) {
+    if (hadError) return false;
+    if (dump) {
+        *dump << "== " << ir.name << ": built ==\n";
+        printIr(ir, *dump);
+    }
+    optimizeIr(ir, level, dump, typeReport);
+    if (!emitIr(ir, chunk)) hadError = true;
+    return !hadError;
+}
+
+void IrBuilder::error(const char* message) {
+    std::cerr << "[line " << currentLine << "] Error: " << message << std::endl;
+    hadError = true;
+}
+
+// Whether calls to a function with this body can be inlined: it must call
+// nothing (print is an instruction, not a call), define no functions, leave
+// its parameters unassigned and fit the budget
+bool IrBuilder::inlinable(const std::vector<Token>& params, const std::vector<std::unique_ptr<Stmt>>& body,
+                          InlineCandidate& candidate) const {
+    if (level < 1) return false;
+    std::unordered_set<std::string> names;
+    for (const Token& param : params) names.insert(param.lexeme);
+    int cost = 0;
+    bool leaf = true;
+    AstWalk walk;
+    walk.onStmt = [&](Stmt* stmt) {
+        cost++;
+        if (dynamic_cast<FunctionStmt*>(stmt) || dynamic_cast<ForInStmt*>(stmt)) leaf = false;
+        if (dynamic_cast<VarDecl*>(stmt)) candidate.locals++;
+        if (dynamic_cast<ForStmt*>(stmt)) candidate.locals += 5;
+    };
+    walk.onExpr = [&](Expr* expr) {
+        cost++;
+        if (dynamic_cast<FunctionExpr*>(expr)) leaf = false;
+        if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+            auto* callee = dynamic_cast<VariableExpr*>(call->callee.get());
+            if (!callee || callee->name.lexeme != "print") leaf = false;
+        }
+        if (auto* assignment = dynamic_cast<AssignmentExpr*>(expr)) {
+            if (names.count(assignment->name.lexeme)) leaf = false;
+        }
+    };
+    walk.statements(body);
+    candidate.params = &params;
+    candidate.body = &body;
+    return leaf && cost <= kInlineBudget;
+}
+
+// Replaces a call to an inlinable function by its body. Parameters are the
+// argument values themselves; each `return` pops the body's locals and jumps
+// to a join block, where a phi picks the result.
+bool IrBuilder::inlineCall(CallExpr* call, const std::string& name) {
+    if (!script || inlining || call->arguments.size() > UINT8_MAX) return false;
+    const InlineCandidate* candidate = nullptr;
+    bool guard = false;
+    int slot = resolveLocal(name);
+    if (slot >= 0) {
+        candidate = locals[slot].function.get();
+    } else {
+        for (IrBuilder* outer = enclosing; outer; outer = outer->enclosing) {
+            if (outer->resolveLocal(name) >= 0) return false;
+        }
+        auto found = script->globals.find(name);
+        if (found != script->globals.end()) candidate = &found->second;
+        guard = true;
+    }
+    // The guarded call compiles its arguments twice, which would make two
+    // copies of a function expression
+    if (!candidate || !candidate->compiled || locals.size() + candidate->locals > UINT8_MAX) return false;
+    if (guard) {
+        for (const auto& arg : call->arguments) {
+            if (containsFunction(arg.get())) return false;
+        }
+    }
+
+    const std::vector<Token>& params = *candidate->params;
+    InlineFrame frame{locals.size(), &params, {}, {}, function->newBlock(),
+                      static_cast<int>(function->inlinedCalls.size())};
+    function->inlinedCalls.push_back({candidate->compiled->name, call->line});
+    IrInstr* check = nullptr;
+    if (guard) {
+        setLocation(call->callee.get());
+        IrInstr* current = add(IrOp::GetGlobal);
+        current->name = name;
+        setLocation(call);
+        IrInstr* expected = addConstant(candidate->compiled);
+        check = addBranch(IrOp::Branch, OpCode::OP_JEQ, false, {current, expected});
+    }
+    for (size_t i = 0; i < call->arguments.size(); i++) {
+        IrInstr* argument = value(call->arguments[i].get());
+        if (i < params.size()) frame.arguments.push_back(argument);
+    }
+    setLocation(call);
+    while (frame.arguments.size() < params.size()) frame.arguments.push_back(addConstant(Nil{}));
+
+    inlining = &frame;
+    beginScope();
+    for (const auto& stmt : *candidate->body) {
+        stmt->accept(this);
+    }
+    // Falling off the end returns nil
+    setLocation(call);
+    inlineReturn(addConstant(Nil{}));
+    locals.resize(frame.base);
+    scopeDepth--;
+    inlining = nullptr;
+
+    if (guard) {
+        // The variable holds something else now: make the call
+        patch(check, current);
+        setLocation(call->callee.get());
+        std::vector<IrInstr*> operands{add(IrOp::GetGlobal)};
+        operands[0]->name = name;
+        for (const auto& arg : call->arguments) {
+            operands.push_back(value(arg.get()));
+        }
+        setLocation(call);
+        IrInstr* called = add(IrOp::Call, std::move(operands));
+        frame.returns.push_back({current, called});
+        patch(add(IrOp::Jump), frame.join);
+    }
+
+    startBlock(frame.join);
+    if (frame.returns.size() == 1) {
+        result = frame.returns[0].second;
+    } else {
+        result = add(IrOp::Phi);
+        for (IrBlock* pred : frame.join->preds) {
+            for (const auto& [from, returned] : frame.returns) {
+                if (from == pred) result->operands.push_back(returned);
+            }
+        }
+    }
+    if (report) {
+        *report << "inlined " << name << " into " << function->name << " at line " << call->line
+                << (guard ? " (guarded)" : "") << "\n";
+    }
+    return true;
+}
+
+// `return` inside an inlined body
+void IrBuilder::inlineReturn(IrInstr* returned) {
+    size_t count = locals.size() - inlining->base;
+    if (count > 0) {
+        IrInstr* pop = add(IrOp::PopLocals);
+        pop->slot = static_cast<int>(inlining->base);
+        pop->count = static_cast<int>(count);
+    }
+    inlining->returns.push_back({current, returned});
+    patch(add(IrOp::Jump), inlining->join);
+    startBlock(function->newBlock());
+}
+
+void IrBuilder::setLocation(int line, int column) {
+    // Synthesized nodes (e.g. loop bodies) carry no position; keep the enclosing one
+    if (line == 0) return;
+    currentLine = line;
+    currentColumn = column;
+}
+
+IrInstr* IrBuilder::value(Expr* expr) {
+    expr->accept(this);
+    return result;
+}
+
+// Appends an instruction at the current source position
+IrInstr* IrBuilder::add(IrOp op, std::vector<IrInstr*> operands) {
+    IrInstr* instr = function->newInstr(op, currentLine, currentColumn);
+    if (inlining) instr->inlined = inlining->call;
+    instr->operands = std::move(operands);
+    instr->block = current;
+    current->instrs.push_back(instr);
+    return instr;
+}
+
+IrInstr* IrBuilder::addConstant(Value constant) {
+    IrInstr* instr = add(IrOp::Constant);
+    instr->constant = std::move(constant);
+    return instr;
+}
+
+void IrBuilder::startBlock(IrBlock* block) {
+    function->blocks.push_back(block);
+    current = block;
+}
+
+// A block starting at the current position, for jumps to land on
+IrBlock* IrBuilder::here() {
+    if (current->instrs.empty()) return current;
+    IrBlock* block = function->newBlock();
+    patch(add(IrOp::Jump), block);
+    startBlock(block);
+    return block;
+}
+
+// Ends the current block with a jump. Code that follows is unreachable
+// until something jumps to it.
+IrInstr* IrBuilder::addJump(IrBlock* target) {
+    IrInstr* jump = add(IrOp::Jump);
+    if (target) patch(jump, target);
+    startBlock(function->newBlock());
+    return jump;
+}
+
+// Ends the current block with a two-way branch whose `next` successor starts
+// here; its target is patched by the caller
+IrInstr* IrBuilder::addBranch(IrOp op, OpCode test, bool sense, std::vector<IrInstr*> operands) {
+    IrInstr* branch = add(op, std::move(operands));
+    branch->test = test;
+    branch->sense = sense;
+    IrBlock* next = function->newBlock();
+    branch->next = next;
+    IrFunction::addEdge(current, next);
+    startBlock(next);
+    return branch;
+}
+
+void IrBuilder::patch(IrInstr* jump, IrBlock* target) {
+    jump->target = target;
+    IrFunction::addEdge(jump->block, target);
+}
+
+void IrBuilder::patch(const std::vector<IrInstr*>& jumps, IrBlock* target) {
+    for (IrInstr* jump : jumps) patch(jump, target);
+}
+
+void IrBuilder::beginScope() {
+    scopeDepth++;
+}
+
+void IrBuilder::endScope() {
+    scopeDepth--;
+    int count = 0;
+    while (!locals.empty() && locals.back().depth > scopeDepth) {
+        locals.pop_back();
+        count++;
+    }
+    if (count > 0) {
+        IrInstr* pop = add(IrOp::PopLocals);
+        pop->slot = static_cast<int>(locals.size());
+        pop->count = count;
+    }
+}
+
+void IrBuilder::addLocal(const std::string& name) {
+    if (locals.size() > UINT8_MAX) {
+        error("Too many local variables in scope.");
+        return;
+    }
+    locals.push_back({name, scopeDepth});
+}
+
+// An inlined body sees only its own locals
+int IrBuilder::resolveLocal(const std::string& name) const {
+    int floor = inlining ? static_cast<int>(inlining->base) : 0;
+    for (int i = static_cast<int>(locals.size()) - 1; i >= floor; i--) {
+        if (locals[i].name == name) return i;
+    }
+    return -1;
+}
+
+// See Compiler::checkNotCaptured
+void IrBuilder::checkNotCaptured(const std::string& name) {
+    for (IrBuilder* outer = enclosing; outer; outer = outer->enclosing) {
+        if (outer->resolveLocal(name) >= 0) {
+            std::string message = "Cannot use local '" + name + "' of an enclosing function.";
+            error(message.c_str());
+            return;
+        }
+    }
+}
+
+// Builds, optimizes and emits a function body into a new Function, which the
+// current function's chunk will own. A body the lexer skipped (`deferred`)
+// only gets a stub, compiled on its first call.
+Function* IrBuilder::compileFunction(const std::string& name, const std::vector<Token>& params,
+                                     const std::vector<std::unique_ptr<Stmt>>& body, const Token* deferred) {
+    auto compiled = std::make_shared<Function>();
+    compiled->name = name;
+    compiled->arity = static_cast<int>(params.size());
+    function->functions.push_back(compiled);
+    if (deferred) {
+        compiled->lazy = lazyBody(params, *deferred);
+    } else {
+        compileBody(*compiled, params, body);
+    }
+    return compiled.get();
+}
+
+// See Compiler::lazyBody
+std::unique_ptr<LazyBody> IrBuilder::lazyBody(const std::vector<Token>& params, const Token& deferred) const {
+    auto lazy = std::make_unique<LazyBody>();
+    lazy->source = deferred.lexeme;
+    lazy->line = deferred.line;
+    lazy->column = deferred.column;
+    for (const Token& param : params) lazy->params.push_back(param.lexeme);
+    for (const IrBuilder* outer = this; outer; outer = outer->enclosing) {
+        for (const Local& local : outer->locals) lazy->outerLocals.push_back(local.name);
+    }
+    lazy->optimizationLevel = level;
+    lazy->irDump = dump;
+    lazy->inlineReport = report;
+    lazy->typeReport = typeReport;
+    lazy->debugHooks = hooks;
+    return lazy;
+}
+
+// Builds, optimizes and emits a function body into `compiled`, as a function
+// nested in this one
+void IrBuilder::compileBody(Function& compiled, const std::vector<Token>& params,
+                            const std::vector<std::unique_ptr<Stmt>>& body) {
+    IrFunction ir;
+    ir.name = compiled.name;
+    ir.arity = compiled.arity;
+    ir.hooks = hooks;
+    IrBuilder inner(level, dump, report, typeReport);
+    inner.hooks = hooks;
+    inner.script = script;
+    inner.enclosing = this;
+    inner.function = &ir;
+    inner.currentLine = currentLine;
+    inner.currentColumn = currentColumn;
+    inner.startBlock(ir.newBlock());
+    inner.beginScope();
+    for (const Token& param : params) {
+        inner.addLocal(param.lexeme);
+    }
+    for (const auto& stmt : body) {
+        stmt->accept(&inner);
+    }
+    // Falling off the end returns nil
+    inner.add(IrOp::Return, {inner.addConstant(Nil{})});
+    if (!inner.finish(ir, compiled.chunk)) hadError = true;
+}
+
+// Branch-context condition, as in Compiler::emitCondition: each jump appended
+// to `jumps` is taken when the truthiness of `condition` equals `jumpIf`;
+// control falls through into a new block otherwise.
+void IrBuilder::condition(Expr* condition, bool jumpIf, std::vector<IrInstr*>& jumps) {
+    if (GroupingExpr* group = dynamic_cast<GroupingExpr*>(condition)) {
+        this->condition(group->expression.get(), jumpIf, jumps);
+        return;
+    }
+    if (UnaryExpr* unary = dynamic_cast<UnaryExpr*>(condition)) {
+        if (unary->op.type == TokenType::NOT) {
+            this->condition(unary->right.get(), !jumpIf, jumps);
+            return;
+        }
+    }
+    if (BinaryExpr* binary = dynamic_cast<BinaryExpr*>(condition)) {
+        TokenType type = binary->op.type;
+        if (type == TokenType::AND || type == TokenType::OR) {
+            bool shortCircuit = type == TokenType::AND ? false : true;
+            if (jumpIf == shortCircuit) {
+                this->condition(binary->left.get(), jumpIf, jumps);
+                this->condition(binary->right.get(), jumpIf, jumps);
+            } else {
+                std::vector<IrInstr*> skipRight;
+                this->condition(binary->left.get(), shortCircuit, skipRight);
+                this->condition(binary->right.get(), jumpIf, jumps);
+                patch(skipRight, here());
+            }
+            return;
+        }
+
+        OpCode fused;
+        bool sense = jumpIf;
+        switch (type) {
+            case TokenType::LESS:          fused = OpCode::OP_JLT; break;
+            case TokenType::LESS_EQUAL:    fused = OpCode::OP_JLE; break;
+            case TokenType::GREATER:       fused = OpCode::OP_JGT; break;
+            case TokenType::GREATER_EQUAL: fused = OpCode::OP_JGE; break;
+            case TokenType::EQUAL_EQUAL:   fused = OpCode::OP_JEQ; break;
+            case TokenType::BANG_EQUAL:    fused = OpCode::OP_JEQ; sense = !jumpIf; break;
+            default:                       fused = OpCode::OP_JTEST; break;
+        }
+        if (fused != OpCode::OP_JTEST) {
+            IrInstr* left = value(binary->left.get());
+            IrInstr* right = value(binary->right.get());
+            setLocation(binary);
+            jumps.push_back(addBranch(IrOp::Branch, fused, sense, {left, right}));
+            return;
+        }
+    }
+
+    IrInstr* tested = value(condition);
+    setLocation(condition);
+    jumps.push_back(addBranch(IrOp::Branch, OpCode::OP_JTEST, jumpIf, {tested}));
+}
+
+// --- Visitors ---
+
+void IrBuilder::visitBinaryExpr(BinaryExpr* expr) {
+    if (expr->op.type == TokenType::AND || expr->op.type == TokenType::OR) {
+        // The left operand is kept as the result on the short-circuit edge
+        IrInstr* left = value(expr->left.get());
+        setLocation(expr);
+        OpCode test = expr->op.type == TokenType::AND ? OpCode::OP_JUMP_IF_FALSE : OpCode::OP_JUMP_IF_TRUE;
+        IrInstr* keep = addBranch(IrOp::BranchKeep, test, false, {left});
+        IrInstr* right = value(expr->right.get());
+        IrBlock* join = function->newBlock();
+        patch(keep, join);
+        patch(add(IrOp::Jump), join);
+        startBlock(join);
+        result = add(IrOp::Phi, {left, right});
+        return;
+    }
+
+    if (expr->op.type == TokenType::DOT_DOT) {
+        std::vector<Expr*> operands;
+        collectConcat(expr, operands);
+        std::vector<IrInstr*> values = concatOperands(operands, 0);
+        setLocation(expr);
+        result = add(IrOp::Concat, std::move(values));
+        return;
+    }
+
+    IrInstr* left = value(expr->left.get());
+    IrInstr* right = value(expr->right.get());
+    setLocation(expr);
+
+    IrOp op;
+    switch (expr->op.type) {
+        case TokenType::PLUS:          op = IrOp::Add; break;
+        case TokenType::MINUS:         op = IrOp::Subtract; break;
+        case TokenType::STAR:          op = IrOp::Multiply; break;
+        case TokenType::SLASH:         op = IrOp::Divide; break;
+        case TokenType::SLASH_SLASH:   op = IrOp::FloorDivide; break;
+        case TokenType::PERCENT:       op = IrOp::Modulo; break;
+        case TokenType::GREATER:       op = IrOp::Greater; break;
+        case TokenType::LESS:          op = IrOp::Less; break;
+        case TokenType::GREATER_EQUAL: op = IrOp::GreaterEqual; break;
+        case TokenType::LESS_EQUAL:    op = IrOp::LessEqual; break;
+        case TokenType::BANG_EQUAL:
+            result = add(IrOp::Not, {add(IrOp::Equal, {left, right})});
+            return;
+        default:                       op = IrOp::Equal; break;
+    }
+    result = add(op, {left, right});
+}
+
+void IrBuilder::visitGroupingExpr(GroupingExpr* expr) {
+    expr->expression->accept(this);
+}
+
+void IrBuilder::visitLiteralExpr(LiteralExpr* expr) {
+    setLocation(expr);
+    result = addConstant(literalValue(expr));
+}
+
+void IrBuilder::visitUnaryExpr(UnaryExpr* expr) {
+    IrInstr* operand = value(expr->right.get());
+    setLocation(expr);
+    result = add(expr->op.type == TokenType::MINUS ? IrOp::Negate : IrOp::Not, {operand});
+}
+
+void IrBuilder::visitVariableExpr(VariableExpr* expr) {
+    setLocation(expr);
+    int slot = resolveLocal(expr->name.lexeme);
+    if (slot >= 0) {
+        result = add(IrOp::GetLocal);
+        result->slot = slot;
+        return;
+    }
+    if (inlining) {
+        const std::vector<Token>& params = *inlining->params;
+        for (size_t i = params.size(); i-- > 0;) {
+            if (params[i].lexeme == expr->name.lexeme) {
+                result = inlining->arguments[i];
+                return;
+            }
+        }
+        // Anything else in the callee's body is a global
+        result = add(IrOp::GetGlobal);
+        result->name = expr->name.lexeme;
+    } else {
+        checkNotCaptured(expr->name.lexeme);
+        result = add(IrOp::GetGlobal);
+        result->name = expr->name.lexeme;
+    }
+}
+
+void IrBuilder::visitAssignmentExpr(AssignmentExpr* expr) {
+    IrInstr* assigned = value(expr->value.get());
+    setLocation(expr);
+    int slot = resolveLocal(expr->name.lexeme);
+    if (slot >= 0) {
+        result = add(IrOp::SetLocal, {assigned});
+        result->slot = slot;
+    } else {
+        if (!inlining) checkNotCaptured(expr->name.lexeme);
+        result = add(IrOp::SetGlobal, {assigned});
+        result->name = expr->name.lexeme;
+    }
+}
+
+void IrBuilder::visitCallExpr(CallExpr* expr) {
+    if (VariableExpr* v = dynamic_cast<VariableExpr*>(expr->callee.get())) {
+        if (v->name.lexeme == "print") {
+            for (const auto& arg : expr->arguments) {
+                IrInstr* printed = value(arg.get());
+                setLocation(expr);
+                add(IrOp::Print, {printed});
+            }
+            result = addConstant(Nil{});
+            return;
+        }
+        if (inlineCall(expr, v->name.lexeme)) return;
+    }
+
+    std::vector<IrInstr*> operands{value(expr->callee.get())};
+    for (const auto& arg : expr->arguments) {
+        operands.push_back(value(arg.get()));
+    }
+    if (expr->arguments.size() > UINT8_MAX) {
+        error("Can't have more than 255 arguments.");
+    }
+    setLocation(expr);
+    result = add(IrOp::Call, std::move(operands));
+}
+
+void IrBuilder::visitFunctionExpr(FunctionExpr* expr) {
+    setLocation(expr);
+    Function* compiled = compileFunction("anonymous", expr->params, expr->body, expr->deferred.get());
+    setLocation(expr);
+    result = addConstant(compiled);
+}
+
+void IrBuilder::collectConcat(Expr* expr, std::vector<Expr*>& operands) {
+    BinaryExpr* binary = dynamic_cast<BinaryExpr*>(expr);
+    if (binary && binary->op.type == TokenType::DOT_DOT) {
+        collectConcat(binary->left.get(), operands);
+        collectConcat(binary->right.get(), operands);
+    } else {
+        operands.push_back(expr);
+    }
+}
+
+// Values of operands[first..], folded every UINT8_MAX values like
+// Compiler::emitConcatOperands so each concatenation fits one instruction
+std::vector<IrInstr*> IrBuilder::concatOperands(const std::vector<Expr*>& operands, size_t first) {
+    std::vector<IrInstr*> values;
+    for (size_t i = first; i < operands.size(); i++) {
+        values.push_back(value(operands[i]));
+        if (values.size() == UINT8_MAX) {
+            IrInstr* folded = add(IrOp::Concat, std::move(values));
+            values = {folded};
+        }
+    }
+    return values;
+}
+
+// `s = s .. a .. b` on a local, as in Compiler::emitAppend
+bool IrBuilder::append(AssignmentExpr* assignment) {
+    BinaryExpr* value = dynamic_cast<BinaryExpr*>(assignment->value.get());
+    if (!value || value->op.type != TokenType::DOT_DOT) return false;
+    int slot = resolveLocal(assignment->name.lexeme);
+    if (slot < 0) return false;
+
+    std::vector<Expr*> operands;
+    collectConcat(value, operands);
+    VariableExpr* head = dynamic_cast<VariableExpr*>(operands[0]);
+    if (!head || resolveLocal(head->name.lexeme) != slot) return false;
+
+    std::vector<IrInstr*> values = concatOperands(operands, 1);
+    setLocation(assignment);
+    add(IrOp::AppendLocal, std::move(values))->slot = slot;
+    return true;
+}
+
+void IrBuilder::visitExpressionStmt(ExpressionStmt* stmt) {
+    setLocation(stmt);
+    if (AssignmentExpr* assignment = dynamic_cast<AssignmentExpr*>(stmt->expression.get())) {
+        if (append(assignment)) return;
+    }
+    // The value is unused; the emitter pops it
+    stmt->expression->accept(this);
+}
+
+void IrBuilder::visitPrintStmt(PrintStmt* stmt) {
+    // Not used in our parser (handled as call)
+}
+
+void IrBuilder::visitVarDecl(VarDecl* stmt) {
+    setLocation(stmt);
+    IrInstr* initial = stmt->initializer ? value(stmt->initializer.get()) : addConstant(Nil{});
+    // Declared afterwards so `local x = x` reads the outer x
+    size_t before = locals.size();
+    addLocal(stmt->name.lexeme);
+    if (locals.size() == before) return;
+    add(IrOp::DeclareLocal, {initial})->slot = static_cast<int>(before);
+
+    // `local f = function ... end`, never assigned: calls to f can be inlined
+    auto* literal = dynamic_cast<FunctionExpr*>(stmt->initializer.get());
+    auto candidate = std::make_shared<InlineCandidate>();
+    if (literal && !literal->deferred && script && !script->assigned.count(stmt->name.lexeme) &&
+        inlinable(literal->params, literal->body, *candidate)) {
+        candidate->compiled = std::get<Function*>(initial->constant);
+        locals.back().function = candidate;
+    }
+}
+
+void IrBuilder::visitBlockStmt(BlockStmt* stmt) {
+    beginScope();
+    for (const auto& s : stmt->statements) {
+        s->accept(this);
+    }
+    endScope();
+}
+
+void IrBuilder::visitIfStmt(IfStmt* stmt) {
+    setLocation(stmt);
+    std::vector<IrInstr*> elseJumps;
+    condition(stmt->condition.get(), false, elseJumps);
+
+    stmt->thenBranch->accept(this);
+
+    if (stmt->elseBranch) {
+        IrInstr* endJump = addJump(nullptr);
+        patch(elseJumps, current);
+        stmt->elseBranch->accept(this);
+        patch(endJump, here());
+    } else {
+        patch(elseJumps, here());
+    }
+}
+
+void IrBuilder::visitWhileStmt(WhileStmt* stmt) {
+    setLocation(stmt);
+    IrBlock* loopStart = here();
+
+    std::vector<IrInstr*> exitJumps;
+    condition(stmt->condition.get(), false, exitJumps);
+
+    stmt->body->accept(this);
+    setLocation(stmt);
+    addJump(loopStart);
+
+    patch(exitJumps, current);
+}
+
+// Same slots as Compiler::forStatement: index, limit, step, count, variable
+void IrBuilder::visitForStmt(ForStmt* stmt) {
+    setLocation(stmt);
+    beginScope();
+    std::vector<IrInstr*> initial;
+    initial.push_back(value(stmt->start.get()));
+    initial.push_back(value(stmt->limit.get()));
+    if (stmt->step) {
+        initial.push_back(value(stmt->step.get()));
+    } else {
+        setLocation(stmt);
+        initial.push_back(addConstant(int64_t{1}));
+    }
+    setLocation(stmt);
+    initial.push_back(addConstant(Nil{}));
+    initial.push_back(addConstant(Nil{}));
+    int base = static_cast<int>(locals.size());
+    addLocal("(for index)");
+    addLocal("(for limit)");
+    addLocal("(for step)");
+    addLocal("(for count)");
+    addLocal(stmt->name.lexeme);
+    for (int i = 0; i < 5; i++) {
+        add(IrOp::DeclareLocal, {initial[i]})->slot = base + i;
+    }
+
+    IrInstr* prep = addBranch(IrOp::ForPrep, OpCode::OP_FORPREP, false, {});
+    prep->slot = base;
+    IrBlock* body = current;
+
+    stmt->body->accept(this);
+
+    setLocation(stmt);
+    IrInstr* loop = addBranch(IrOp::ForLoop, OpCode::OP_FORLOOP, false, {});
+    loop->slot = base;
+    patch(loop, body);
+    patch(prep, current);
+    endScope();
+}
+
+void IrBuilder::visitForInStmt(ForInStmt* stmt) {
+    setLocation(stmt);
+    beginScope();
+    IrInstr* iterator = value(stmt->iterator.get());
+    setLocation(stmt);
+    IrInstr* variable = addConstant(Nil{});
+    int base = static_cast<int>(locals.size());
+    addLocal("(for iterator)");
+    addLocal(stmt->name.lexeme);
+    add(IrOp::DeclareLocal, {iterator})->slot = base;
+    add(IrOp::DeclareLocal, {variable})->slot = base + 1;
+
+    IrBlock* loopStart = here();
+    IrInstr* next = addBranch(IrOp::ForIn, OpCode::OP_TFORLOOP, false, {});
+    next->slot = base;
+
+    stmt->body->accept(this);
+
+    setLocation(stmt);
+    addJump(loopStart);
+    patch(next, current);
+    endScope();
+}
+
+void IrBuilder::visitFunctionStmt(FunctionStmt* stmt) {
+    setLocation(stmt);
+    Function* compiled = compileFunction(stmt->name.lexeme, stmt->params, stmt->body, stmt->deferred.get());
+    auto candidate = script->globals.find(stmt->name.lexeme);
+    if (candidate != script->globals.end()) candidate->second.compiled = compiled;
+    setLocation(stmt);
+    add(IrOp::DefineGlobal, {addConstant(compiled)})->name = stmt->name.lexeme;
+}
+
+void IrBuilder::visitReturnStmt(ReturnStmt* stmt) {
+    setLocation(stmt);
+    IrInstr* returned = stmt->value ? value(stmt->value.get()) : addConstant(Nil{});
+    if (inlining) {
+        inlineReturn(returned);
+        return;
+    }
+    add(IrOp::Return, {returned});
+    startBlock(function->newBlock());
+}
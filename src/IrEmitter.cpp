@@ -0,0 +1,689 @@
+#include "IR.h"
+#include "Compiler.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+// Where a value lives between its definition and its uses
+enum class Placement : uint8_t {
+    Stack, // Left on the stack for its single user
+    Spill, // Stored in a spill slot and loaded at each use
+    Remat, // A constant pushed again at each use
+    Drop   // Unused: popped (or not emitted at all, when it has no effects)
+};
+
+// Turns an IrFunction back into stack bytecode.
+//
+// Instructions are emitted in layout order while the emitter tracks which
+// values sit on the stack above the locals. A value with a single use is
+// normally left there for its user; values with several uses, or whose user
+// does not find them on top in operand order, get a spill slot: an extra local
+// after the parameters (user locals move up to make room). Emission starts
+// over whenever a placement has to change, until every use lines up.
+class Emitter {
+public:
+    Emitter(IrFunction& function, Chunk& chunk) : function(function), chunk(chunk) {}
+
+    bool run();
+
+private:
+    enum class Outcome { Done, Retry, Failed };
+
+    struct Fixup {
+        size_t at;       // Position of the 16-bit offset
+        IrBlock* target;
+        bool backward;
+    };
+
+    IrFunction& function;
+    Chunk& chunk;
+    std::vector<int> uses;             // By value id
+    std::vector<Placement> placement;  // By value id
+    std::vector<int> spillSlot;        // By value id
+    std::unordered_map<const IrBlock*, size_t> layout;
+    int spillCount = 0;
+
+    // Per attempt
+    std::vector<IrInstr*> temps;       // Values on the stack above the locals
+    std::vector<std::vector<IrInstr*>> entryTemps;
+    std::vector<bool> entryKnown;
+    std::vector<size_t> blockStart;
+    std::vector<Fixup> fixups;
+    std::unordered_map<std::string, int> nameConstants;
+    int line = 0;
+    int column = 0;
+    int inlined = -1; // IrInstr::inlined of the instruction being emitted
+    size_t storeEnd = SIZE_MAX;        // Code size right after "SET_LOCAL storeSlot; POP"
+    int storeSlot = -1;
+    bool failed = false;
+
+    Outcome attempt();
+    Outcome emitBlock(size_t index);
+    Outcome emitInstr(IrInstr* instr, size_t index);
+    Outcome emitTerminator(IrInstr* instr, size_t index);
+    Outcome gather(const std::vector<IrInstr*>& values);
+    Outcome edge(IrBlock* to, std::vector<IrInstr*> state);
+    Outcome requireEmpty();
+    void spill(IrInstr* value);
+    void load(IrInstr* value);
+    void define(IrInstr* value);
+
+    void fail(const char* message);
+    void emitByte(uint8_t byte) {
+        chunk.write(byte, line, column);
+        if (inlined >= 0) markInlined();
+    }
+    void emitOp(OpCode op) { emitByte(static_cast<uint8_t>(op)); }
+    void emitConstant(const Value& value);
+    void emitGetLocal(int slot);
+    void emitJump(OpCode op, IrBlock* target, int sense = -1);
+    int physical(int slot);
+    int constantIndex(const Value& value);
+    int nameIndex(const std::string& name);
+    void at(const IrInstr* instr) {
+        line = instr->line;
+        column = instr->column;
+        inlined = instr->inlined;
+    }
+    void markInlined();
+};
+
+bool Emitter::run() {
+    size_t values = 0;
+    for (IrBlock* block : function.blocks) {
+        layout[block] = layout.size();
+        for (IrInstr* instr : block->instrs) values = std::max(values, static_cast<size_t>(instr->id) + 1);
+    }
+    uses.assign(values, 0);
+    std::vector<IrInstr*> user(values, nullptr);
+    for (IrBlock* block : function.blocks) {
+        for (IrInstr* instr : block->instrs) {
+            for (IrInstr* operand : instr->operands) {
+                uses[operand->id]++;
+                user[operand->id] = instr;
+            }
+        }
+    }
+
+    placement.assign(values, Placement::Stack);
+    spillSlot.assign(values, -1);
+    for (IrBlock* block : function.blocks) {
+        for (IrInstr* instr : block->instrs) {
+            if (!instr->hasValue()) continue;
+            int count = uses[instr->id];
+            if (count == 0) {
+                placement[instr->id] = Placement::Drop;
+            } else if (instr->op == IrOp::Constant) {
+                // A constant used once where it was computed is pushed there;
+                // otherwise it is cheaper to push it again than to keep it
+                bool local = count == 1 && user[instr->id]->block == block && user[instr->id]->op != IrOp::Phi;
+                placement[instr->id] = local ? Placement::Stack : Placement::Remat;
+            } else if (count > 1) {
+                placement[instr->id] = Placement::Spill;
+            }
+        }
+    }
+
+    for (;;) {
+        std::vector<Placement> before = placement;
+        spillCount = 0;
+        for (IrBlock* block : function.blocks) {
+            for (IrInstr* instr : block->instrs) {
+                if (instr->hasValue() && placement[instr->id] == Placement::Spill) {
+                    spillSlot[instr->id] = function.arity + spillCount++;
+                }
+            }
+        }
+        Outcome outcome = attempt();
+        if (outcome == Outcome::Failed) return false;
+        if (outcome == Outcome::Done) break;
+        if (placement == before) {
+            fail("Unsupported control flow.");
+            return false;
+        }
+    }
+
+    chunk.functions = std::move(function.functions);
+    chunk.inlinedCalls = std::move(function.inlinedCalls);
+    chunk.globalCaches.resize(chunk.constants.size());
+    Compiler::computeMaxStack(chunk, function.arity);
+    chunk.lines.shrink();
+    return true;
+}
+
+// Adds the byte just written to the range of its inlined call
+void Emitter::markInlined() {
+    uint32_t offset = static_cast<uint32_t>(chunk.code.size() - 1);
+    uint32_t call = static_cast<uint32_t>(inlined);
+    if (!chunk.inlinedCode.empty() && chunk.inlinedCode.back().end == offset &&
+        chunk.inlinedCode.back().call == call) {
+        chunk.inlinedCode.back().end++;
+    } else {
+        chunk.inlinedCode.push_back({offset, offset + 1, call});
+    }
+}
+
+void Emitter::fail(const char* message) {
+    if (!failed) std::cerr << "[line " << line << "] Error: " << message << std::endl;
+    failed = true;
+}
+
+Emitter::Outcome Emitter::attempt() {
+    chunk.code.clear();
+    chunk.lines.clear();
+    chunk.inlinedCode.clear();
+    chunk.constants.clear();
+    nameConstants.clear();
+    fixups.clear();
+    size_t count = function.blocks.size();
+    entryTemps.assign(count, {});
+    entryKnown.assign(count, false);
+    blockStart.assign(count, 0);
+    entryKnown[0] = true;
+
+    // Spill slots start out nil, like locals declared without a value
+    IrBlock* entry = function.blocks[0];
+    if (!entry->instrs.empty()) at(entry->instrs[0]);
+    for (int i = 0; i < spillCount; i++) emitOp(OpCode::OP_NIL);
+
+    for (size_t i = 0; i < count; i++) {
+        Outcome outcome = emitBlock(i);
+        if (failed) return Outcome::Failed;
+        if (outcome != Outcome::Done) return outcome;
+    }
+
+    for (const Fixup& fixup : fixups) {
+        size_t target = blockStart[layout[fixup.target]];
+        size_t after = fixup.at + 2;
+        if (fixup.backward ? target > after : target < after) {
+            fail("Unsupported control flow.");
+            return Outcome::Failed;
+        }
+        size_t offset = fixup.backward ? after - target : target - after;
+        if (offset > UINT16_MAX) {
+            fail(fixup.backward ? "Loop body too large." : "Too much code to jump over.");
+            return Outcome::Failed;
+        }
+        chunk.code[fixup.at] = (offset >> 8) & 0xff;
+        chunk.code[fixup.at + 1] = offset & 0xff;
+    }
+    return Outcome::Done;
+}
+
+Emitter::Outcome Emitter::emitBlock(size_t index) {
+    IrBlock* block = function.blocks[index];
+    blockStart[index] = chunk.code.size();
+    storeEnd = SIZE_MAX;
+    // Reached only by backward jumps (or not at all): start with an empty stack
+    entryKnown[index] = true;
+    temps = entryTemps[index];
+
+    // Phis arrive on top of the stack; spilled or unused ones are stored or
+    // dropped right away, from the top down
+    size_t phis = 0;
+    while (phis < block->instrs.size() && block->instrs[phis]->op == IrOp::Phi) phis++;
+    bool storePhis = false;
+    for (size_t i = 0; i < phis; i++) {
+        if (placement[block->instrs[i]->id] != Placement::Stack) storePhis = true;
+    }
+    if (storePhis) {
+        bool retry = false;
+        for (size_t i = 0; i < phis; i++) {
+            IrInstr* phi = block->instrs[i];
+            if (placement[phi->id] == Placement::Stack) {
+                spill(phi);
+                retry = true;
+            }
+        }
+        if (retry) return Outcome::Retry;
+        for (size_t i = phis; i-- > 0;) {
+            at(block->instrs[i]);
+            define(block->instrs[i]);
+        }
+    }
+
+    for (size_t i = phis; i < block->instrs.size(); i++) {
+        IrInstr* instr = block->instrs[i];
+        Outcome outcome = instr->isTerminator() ? emitTerminator(instr, index) : emitInstr(instr, index);
+        if (outcome != Outcome::Done) return outcome;
+    }
+    return Outcome::Done;
+}
+
+// Physical slot of a local: spill slots sit between the parameters and the
+// other locals
+int Emitter::physical(int slot) {
+    int result = slot < function.arity ? slot : slot + spillCount;
+    if (result > UINT8_MAX) fail("Too many local variables in function.");
+    return result;
+}
+
+int Emitter::constantIndex(const Value& value) {
+    int found = chunk.findConstant(value);
+    if (found >= 0) return found;
+    if (chunk.constants.size() > UINT8_MAX) {
+        fail("Too many constants in one chunk.");
+        return 0;
+    }
+    return chunk.addConstant(value);
+}
+
+int Emitter::nameIndex(const std::string& name) {
+    auto found = nameConstants.find(name);
+    if (found != nameConstants.end()) return found->second;
+    int index = constantIndex(name);
+    nameConstants[name] = index;
+    return index;
+}
+
+void Emitter::emitConstant(const Value& value) {
+    if (std::holds_alternative<Nil>(value)) {
+        emitOp(OpCode::OP_NIL);
+    } else if (const bool* b = std::get_if<bool>(&value)) {
+        emitOp(*b ? OpCode::OP_TRUE : OpCode::OP_FALSE);
+    } else {
+        emitOp(OpCode::OP_CONSTANT);
+        emitByte(constantIndex(value));
+    }
+}
+
+// GET_LOCAL, or nothing when the previous instructions are
+// "SET_LOCAL slot; POP": dropping the POP leaves the same value
+void Emitter::emitGetLocal(int slot) {
+    if (storeEnd == chunk.code.size() && storeSlot == slot) {
+        chunk.code.pop_back();
+        chunk.lines.removeLast();
+        if (!chunk.inlinedCode.empty() && chunk.inlinedCode.back().end > chunk.code.size()) {
+            if (--chunk.inlinedCode.back().end == chunk.inlinedCode.back().start) chunk.inlinedCode.pop_back();
+        }
+        storeEnd = SIZE_MAX;
+        return;
+    }
+    emitOp(OpCode::OP_GET_LOCAL);
+    emitByte(slot);
+}
+
+// Jump or conditional branch to `target`; `sense` >= 0 adds a sense byte
+void Emitter::emitJump(OpCode op, IrBlock* target, int sense) {
+    emitOp(op);
+    if (sense >= 0) emitByte(sense);
+    bool backward = op == OpCode::OP_LOOP || op == OpCode::OP_FORLOOP;
+    fixups.push_back({chunk.code.size(), target, backward});
+    emitByte(0xff);
+    emitByte(0xff);
+}
+
+// Marks `value` for a spill slot (constants are pushed again instead); the
+// caller retries
+void Emitter::spill(IrInstr* value) {
+    if (placement[value->id] == Placement::Stack || placement[value->id] == Placement::Drop) {
+        placement[value->id] = value->op == IrOp::Constant ? Placement::Remat : Placement::Spill;
+    }
+}
+
+// Pushes a value that is not kept on the stack
+void Emitter::load(IrInstr* value) {
+    if (placement[value->id] == Placement::Remat) {
+        emitConstant(value->constant);
+    } else {
+        emitGetLocal(spillSlot[value->id]);
+    }
+    temps.push_back(value);
+}
+
+// Finishes a value that was just pushed: it stays for its user, moves to its
+// spill slot or is dropped
+void Emitter::define(IrInstr* value) {
+    switch (placement[value->id]) {
+        case Placement::Stack:
+        case Placement::Remat:
+            break;
+        case Placement::Spill:
+            emitOp(OpCode::OP_SET_LOCAL);
+            emitByte(spillSlot[value->id]);
+            emitOp(OpCode::OP_POP);
+            storeEnd = chunk.code.size();
+            storeSlot = spillSlot[value->id];
+            temps.pop_back();
+            break;
+        case Placement::Drop:
+            emitOp(OpCode::OP_POP);
+            temps.pop_back();
+            break;
+    }
+}
+
+// Puts `values` on top of the stack in order. The leading ones that are kept
+// on the stack must already be there; the rest are loaded now.
+Emitter::Outcome Emitter::gather(const std::vector<IrInstr*>& values) {
+    size_t kept = 0;
+    while (kept < values.size() && placement[values[kept]->id] == Placement::Stack) kept++;
+    bool retry = false;
+    for (size_t i = kept; i < values.size(); i++) {
+        if (placement[values[i]->id] == Placement::Stack) {
+            // Would have to be loaded under a value pushed after it
+            spill(values[i]);
+            retry = true;
+        }
+    }
+    if (kept > 0 && (temps.size() < kept || !std::equal(values.begin(), values.begin() + kept, temps.end() - kept))) {
+        auto first = std::find(temps.begin(), temps.end(), values[0]);
+        for (auto it = first; it != temps.end(); ++it) spill(*it);
+        for (size_t i = 0; i < kept; i++) spill(values[i]);
+        retry = true;
+    }
+    if (retry) return Outcome::Retry;
+    for (size_t i = kept; i < values.size(); i++) load(values[i]);
+    return Outcome::Done;
+}
+
+// Locals are declared, dropped and looped over with nothing above them
+Emitter::Outcome Emitter::requireEmpty() {
+    if (temps.empty()) return Outcome::Done;
+    for (IrInstr* value : temps) spill(value);
+    return Outcome::Retry;
+}
+
+// Records the stack on the edge `from` -> `to`, where the values for the
+// phis of `to` are on top. Every edge into a block must agree.
+Emitter::Outcome Emitter::edge(IrBlock* to, std::vector<IrInstr*> state) {
+    size_t phis = 0;
+    while (phis < to->instrs.size() && to->instrs[phis]->op == IrOp::Phi) phis++;
+    if (state.size() < phis) {
+        fail("Unsupported control flow.");
+        return Outcome::Failed;
+    }
+    // The incoming values become the phis themselves
+    for (size_t i = 0; i < phis; i++) state[state.size() - phis + i] = to->instrs[i];
+
+    size_t index = layout[to];
+    if (!entryKnown[index]) {
+        entryKnown[index] = true;
+        entryTemps[index] = std::move(state);
+        return Outcome::Done;
+    }
+    if (entryTemps[index] == state) return Outcome::Done;
+    // Disagreement: spill whatever was to be carried into the block below
+    // its phis
+    for (const std::vector<IrInstr*>* temps : {&entryTemps[index], &state}) {
+        for (size_t i = 0; i + phis < temps->size(); i++) spill((*temps)[i]);
+    }
+    return Outcome::Retry;
+}
+
+Emitter::Outcome Emitter::emitInstr(IrInstr* instr, size_t index) {
+    at(instr);
+    Outcome outcome = Outcome::Done;
+    auto simple = [&](OpCode op) {
+        outcome = gather(instr->operands);
+        if (outcome != Outcome::Done) return;
+        at(instr);
+        emitOp(op);
+        temps.resize(temps.size() - instr->operands.size());
+        temps.push_back(instr);
+        define(instr);
+    };
+
+    switch (instr->op) {
+        case IrOp::Constant:
+            if (placement[instr->id] == Placement::Stack) {
+                emitConstant(instr->constant);
+                temps.push_back(instr);
+            }
+            break;
+        case IrOp::GetLocal:
+            if (placement[instr->id] == Placement::Drop) break;
+            emitGetLocal(physical(instr->slot));
+            temps.push_back(instr);
+            define(instr);
+            break;
+        case IrOp::GetGlobal:
+            if (placement[instr->id] == Placement::Drop) break;
+            emitOp(OpCode::OP_GET_GLOBAL);
+            emitByte(nameIndex(instr->name));
+            temps.push_back(instr);
+            define(instr);
+            break;
+        case IrOp::Add:          simple(typedOpcode(OpCode::OP_ADD, instr->operandType)); break;
+        case IrOp::Subtract:     simple(typedOpcode(OpCode::OP_SUBTRACT, instr->operandType)); break;
+        case IrOp::Multiply:     simple(typedOpcode(OpCode::OP_MULTIPLY, instr->operandType)); break;
+        case IrOp::Divide:       simple(typedOpcode(OpCode::OP_DIVIDE, instr->operandType)); break;
+        case IrOp::FloorDivide:  simple(OpCode::OP_FLOOR_DIVIDE); break;
+        case IrOp::Modulo:       simple(OpCode::OP_MODULO); break;
+        case IrOp::Equal:        simple(OpCode::OP_EQUAL); break;
+        case IrOp::Less:         simple(OpCode::OP_LESS); break;
+        case IrOp::LessEqual:    simple(OpCode::OP_LESS_EQUAL); break;
+        case IrOp::Greater:      simple(OpCode::OP_GREATER); break;
+        case IrOp::GreaterEqual: simple(OpCode::OP_GREATER_EQUAL); break;
+        case IrOp::Not:          simple(OpCode::OP_NOT); break;
+        case IrOp::Negate:       simple(OpCode::OP_NEGATE); break;
+        case IrOp::Concat:
+        case IrOp::Call:
+            outcome = gather(instr->operands);
+            if (outcome != Outcome::Done) break;
+            at(instr);
+            emitOp(instr->op == IrOp::Concat ? OpCode::OP_CONCAT : OpCode::OP_CALL);
+            emitByte(instr->op == IrOp::Concat ? instr->operands.size() : instr->operands.size() - 1);
+            temps.resize(temps.size() - instr->operands.size());
+            temps.push_back(instr);
+            define(instr);
+            break;
+        case IrOp::SetLocal:
+        case IrOp::SetGlobal:
+            outcome = gather(instr->operands);
+            if (outcome != Outcome::Done) break;
+            at(instr);
+            if (instr->op == IrOp::SetLocal) {
+                emitOp(OpCode::OP_SET_LOCAL);
+                emitByte(physical(instr->slot));
+            } else {
+                emitOp(OpCode::OP_SET_GLOBAL);
+                emitByte(nameIndex(instr->name));
+            }
+            temps.back() = instr;
+            if (instr->op == IrOp::SetLocal && placement[instr->id] == Placement::Drop) {
+                emitOp(OpCode::OP_POP);
+                temps.pop_back();
+                storeEnd = chunk.code.size();
+                storeSlot = physical(instr->slot);
+            } else {
+                define(instr);
+            }
+            break;
+        case IrOp::DefineGlobal:
+        case IrOp::Print:
+            outcome = gather(instr->operands);
+            if (outcome != Outcome::Done) break;
+            at(instr);
+            if (instr->op == IrOp::Print) {
+                emitOp(OpCode::OP_PRINT);
+            } else {
+                emitOp(OpCode::OP_DEFINE_GLOBAL);
+                emitByte(nameIndex(instr->name));
+            }
+            temps.pop_back();
+            break;
+        case IrOp::DeclareLocal: {
+            // The value must be the lowest temporary: that is the new local's slot
+            IrInstr* value = instr->operands[0];
+            if (placement[value->id] == Placement::Stack) {
+                if (temps.empty() || temps.front() != value) {
+                    for (IrInstr* other : temps) spill(other);
+                    spill(value);
+                    return Outcome::Retry;
+                }
+            } else {
+                outcome = requireEmpty();
+                if (outcome != Outcome::Done) break;
+                load(value);
+            }
+            physical(instr->slot);
+            temps.erase(temps.begin());
+            break;
+        }
+        case IrOp::PopLocals:
+            outcome = requireEmpty();
+            if (outcome != Outcome::Done) break;
+            for (int i = 0; i < instr->count; i++) emitOp(OpCode::OP_POP);
+            break;
+        case IrOp::AppendLocal:
+            outcome = gather(instr->operands);
+            if (outcome != Outcome::Done) break;
+            at(instr);
+            emitOp(OpCode::OP_APPEND_LOCAL);
+            emitByte(physical(instr->slot));
+            emitByte(instr->operands.size());
+            temps.resize(temps.size() - instr->operands.size());
+            break;
+        default:
+            fail("Unsupported instruction.");
+            return Outcome::Failed;
+    }
+    (void)index;
+    return failed ? Outcome::Failed : outcome;
+}
+
+Emitter::Outcome Emitter::emitTerminator(IrInstr* instr, size_t index) {
+    IrBlock* block = instr->block;
+    IrBlock* following = index + 1 < function.blocks.size() ? function.blocks[index + 1] : nullptr;
+    Outcome outcome = Outcome::Done;
+    auto fallInto = [&](IrBlock* next) {
+        if (next != following) emitJump(OpCode::OP_JUMP, next);
+    };
+    auto jumpTo = [&](IrBlock* target) {
+        if (target == following) return;
+        bool backward = layout[target] <= index;
+        emitJump(backward ? OpCode::OP_LOOP : OpCode::OP_JUMP, target);
+    };
+
+    switch (instr->op) {
+        case IrOp::Jump: {
+            // Values for the target's phis go on top
+            std::vector<IrInstr*> incoming;
+            size_t pred = std::find(instr->target->preds.begin(), instr->target->preds.end(), block) -
+                          instr->target->preds.begin();
+            for (IrInstr* phi : instr->target->instrs) {
+                if (phi->op != IrOp::Phi) break;
+                incoming.push_back(phi->operands[pred]);
+            }
+            outcome = gather(incoming);
+            if (outcome != Outcome::Done) break;
+            at(instr);
+            outcome = edge(instr->target, temps);
+            if (outcome != Outcome::Done) break;
+            jumpTo(instr->target);
+            break;
+        }
+        case IrOp::Branch: {
+            outcome = gather(instr->operands);
+            if (outcome != Outcome::Done) break;
+            at(instr);
+            temps.resize(temps.size() - instr->operands.size());
+            OpCode test = typedOpcode(instr->test, instr->operandType);
+            if (layout[instr->target] > index) {
+                emitJump(test, instr->target, instr->sense);
+            } else {
+                // Conditional branches only go forward: skip over a LOOP instead
+                emitOp(test);
+                emitByte(!instr->sense);
+                emitByte(0);
+                emitByte(3);
+                emitJump(OpCode::OP_LOOP, instr->target);
+            }
+            outcome = edge(instr->target, temps);
+            if (outcome != Outcome::Done) break;
+            outcome = edge(instr->next, temps);
+            if (outcome != Outcome::Done) break;
+            fallInto(instr->next);
+            break;
+        }
+        case IrOp::BranchKeep:
+            outcome = gather(instr->operands);
+            if (outcome != Outcome::Done) break;
+            at(instr);
+            if (layout[instr->target] <= index) {
+                fail("Unsupported control flow.");
+                return Outcome::Failed;
+            }
+            // The target's phi takes the kept value
+            if (instr->target->instrs.empty() || instr->target->instrs[0]->op != IrOp::Phi ||
+                instr->target->instrs[0]->operands[std::find(instr->target->preds.begin(), instr->target->preds.end(),
+                                                             block) - instr->target->preds.begin()] != instr->operands[0]) {
+                fail("Unsupported control flow.");
+                return Outcome::Failed;
+            }
+            emitJump(instr->test, instr->target);
+            outcome = edge(instr->target, temps);
+            if (outcome != Outcome::Done) break;
+            emitOp(OpCode::OP_POP);
+            temps.pop_back();
+            outcome = edge(instr->next, temps);
+            if (outcome != Outcome::Done) break;
+            fallInto(instr->next);
+            break;
+        case IrOp::Return:
+            outcome = gather(instr->operands);
+            if (outcome != Outcome::Done) break;
+            at(instr);
+            emitOp(OpCode::OP_RETURN);
+            break;
+        case IrOp::ForPrep:
+        case IrOp::ForIn: {
+            outcome = requireEmpty();
+            if (outcome != Outcome::Done) break;
+            int base = physical(instr->slot);
+            if (layout[instr->target] <= index) {
+                fail("Unsupported control flow.");
+                return Outcome::Failed;
+            }
+            if (instr->op == IrOp::ForIn) {
+                emitOp(OpCode::OP_TFORCALL);
+                emitByte(base);
+            }
+            emitOp(instr->op == IrOp::ForIn ? OpCode::OP_TFORLOOP : OpCode::OP_FORPREP);
+            emitByte(base);
+            fixups.push_back({chunk.code.size(), instr->target, false});
+            emitByte(0xff);
+            emitByte(0xff);
+            outcome = edge(instr->target, temps);
+            if (outcome != Outcome::Done) break;
+            outcome = edge(instr->next, temps);
+            if (outcome != Outcome::Done) break;
+            fallInto(instr->next);
+            break;
+        }
+        case IrOp::ForLoop: {
+            outcome = requireEmpty();
+            if (outcome != Outcome::Done) break;
+            if (layout[instr->target] > index) {
+                fail("Unsupported control flow.");
+                return Outcome::Failed;
+            }
+            emitOp(OpCode::OP_FORLOOP);
+            emitByte(physical(instr->slot));
+            fixups.push_back({chunk.code.size(), instr->target, true});
+            emitByte(0xff);
+            emitByte(0xff);
+            outcome = edge(instr->target, temps);
+            if (outcome != Outcome::Done) break;
+            outcome = edge(instr->next, temps);
+            if (outcome != Outcome::Done) break;
+            fallInto(instr->next);
+            break;
+        }
+        default:
+            fail("Unsupported instruction.");
+            return Outcome::Failed;
+    }
+    return failed ? Outcome::Failed : outcome;
+}
+
+} // namespace
+
+bool emitIr(IrFunction& function, Chunk& chunk) {
+    Emitter emitter(function, chunk);
+    return emitter.run();
+}
@@ -0,0 +1,1180 @@
+#include "IR.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+// Optimization passes over the IR. Each leaves the function valid for the
+// next one and for the emitter: blocks in layout order, phis first, a
+// terminator last, predecessor lists matching the terminators.
+//
+//   -O1: constant and copy propagation (with folding and branch folding),
+//        common-subexpression elimination within blocks, dead-code elimination
+//   -O2: the same with CSE across blocks (along the dominator tree), plus
+//        loop-invariant code motion into a new preheader block
+//   Both then infer types, marking operations whose operands are proved
+//   integers or floats for the emitter's unchecked typed opcodes
+//
+// No pass may change what a script prints or the error it stops with, so an
+// operation that can fail is only removed or moved when it is known not to
+// fail, or when it would fail at the same point anyway.
+
+namespace {
+
+// --- Analysis helpers ---
+
+bool hasEffects(const IrInstr* instr) {
+    return instr->op == IrOp::Call || instr->op >= IrOp::SetLocal;
+}
+
+bool isNumberConstant(const IrInstr* value) {
+    return value->op == IrOp::Constant && isNumber(value->constant);
+}
+
+// Values known to be numbers: numeric constants and arithmetic results
+// (an arithmetic instruction either produces a number or stops the script)
+bool producesNumber(const IrInstr* value) {
+    switch (value->op) {
+        case IrOp::Constant:
+            return isNumber(value->constant);
+        case IrOp::Add:
+        case IrOp::Subtract:
+        case IrOp::Multiply:
+        case IrOp::Divide:
+        case IrOp::FloorDivide:
+        case IrOp::Modulo:
+        case IrOp::Negate:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool producesString(const IrInstr* value) {
+    return value->op == IrOp::Concat ||
+           (value->op == IrOp::Constant && std::holds_alternative<std::string>(value->constant));
+}
+
+// True unless `instr` is known not to raise a runtime error
+bool mayFail(const IrInstr* instr) {
+    const std::vector<IrInstr*>& operands = instr->operands;
+    switch (instr->op) {
+        case IrOp::Constant:
+        case IrOp::GetLocal:
+        case IrOp::GetGlobal:
+        case IrOp::Phi:
+        case IrOp::Not:
+        case IrOp::Equal:
+            return false;
+        case IrOp::Add:
+        case IrOp::Subtract:
+        case IrOp::Multiply:
+        case IrOp::Divide:
+            return !producesNumber(operands[0]) || !producesNumber(operands[1]);
+        case IrOp::FloorDivide:
+        case IrOp::Modulo:
+            // Integer division by zero fails
+            return !producesNumber(operands[0]) || !isNumberConstant(operands[1]) ||
+                   (std::holds_alternative<int64_t>(operands[1]->constant) &&
+                    std::get<int64_t>(operands[1]->constant) == 0);
+        case IrOp::Less:
+        case IrOp::LessEqual:
+        case IrOp::Greater:
+        case IrOp::GreaterEqual:
+            return !(producesNumber(operands[0]) && producesNumber(operands[1])) &&
+                   !(producesString(operands[0]) && producesString(operands[1]));
+        case IrOp::Negate:
+            return !producesNumber(operands[0]);
+        case IrOp::Concat:
+            return std::any_of(operands.begin(), operands.end(), [](const IrInstr* operand) {
+                return !producesNumber(operand) && !producesString(operand);
+            });
+        default:
+            return true;
+    }
+}
+
+// Operations that compute a value from their operands alone
+bool isComputation(const IrInstr* instr) {
+    return instr->op >= IrOp::Add && instr->op <= IrOp::Concat;
+}
+
+// Blocks reachable from the entry, in reverse postorder
+std::vector<IrBlock*> reversePostorder(const IrFunction& function) {
+    std::vector<IrBlock*> order;
+    std::unordered_set<IrBlock*> visited;
+    std::vector<std::pair<IrBlock*, size_t>> stack{{function.blocks[0], 0}};
+    visited.insert(function.blocks[0]);
+    while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        std::vector<IrBlock*> successors = block->successors();
+        if (next < successors.size()) {
+            IrBlock* successor = successors[next++];
+            if (visited.insert(successor).second) stack.push_back({successor, 0});
+        } else {
+            order.push_back(block);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+// Immediate dominators (Cooper, Harvey and Kennedy), for reachable blocks
+struct Dominators {
+    std::unordered_map<IrBlock*, IrBlock*> idom;
+    std::unordered_map<IrBlock*, int> rank; // Position in reverse postorder
+
+    explicit Dominators(const std::vector<IrBlock*>& order) {
+        for (size_t i = 0; i < order.size(); i++) rank[order[i]] = static_cast<int>(i);
+        idom[order[0]] = order[0];
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t i = 1; i < order.size(); i++) {
+                IrBlock* block = order[i];
+                IrBlock* dominator = nullptr;
+                for (IrBlock* pred : block->preds) {
+                    if (!idom.count(pred)) continue;
+                    dominator = dominator ? intersect(pred, dominator) : pred;
+                }
+                if (dominator && idom[block] != dominator) {
+                    idom[block] = dominator;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    IrBlock* intersect(IrBlock* a, IrBlock* b) {
+        while (a != b) {
+            while (rank[a] > rank[b]) a = idom[a];
+            while (rank[b] > rank[a]) b = idom[b];
+        }
+        return a;
+    }
+
+    bool dominates(IrBlock* a, IrBlock* b) {
+        if (!idom.count(b)) return false;
+        for (;;) {
+            if (a == b) return true;
+            IrBlock* up = idom[b];
+            if (up == b) return false;
+            b = up;
+        }
+    }
+};
+
+// --- CFG cleanup ---
+
+// Drops blocks the entry cannot reach, with their edges
+void removeUnreachable(IrFunction& function) {
+    std::vector<IrBlock*> order = reversePostorder(function);
+    std::unordered_set<IrBlock*> reachable(order.begin(), order.end());
+    for (IrBlock* block : function.blocks) {
+        if (reachable.count(block)) continue;
+        for (IrBlock* successor : block->successors()) IrFunction::removeEdge(block, successor);
+    }
+    function.blocks.erase(std::remove_if(function.blocks.begin(), function.blocks.end(),
+                                         [&](IrBlock* block) { return !reachable.count(block); }),
+                          function.blocks.end());
+}
+
+// Appends a block to its only predecessor when that ends in a plain jump to
+// it, so straight-line code left over from folded branches is one block again
+void mergeBlocks(IrFunction& function) {
+    std::unordered_set<IrBlock*> merged;
+    for (IrBlock* block : function.blocks) {
+        if (merged.count(block)) continue;
+        for (;;) {
+            IrInstr* last = block->terminator();
+            IrBlock* next = last->op == IrOp::Jump ? last->target : nullptr;
+            if (!next || next == block || next == function.blocks[0] || next->preds.size() != 1 ||
+                next->instrs.front()->op == IrOp::Phi) {
+                break;
+            }
+            block->instrs.pop_back();
+            for (IrInstr* instr : next->instrs) {
+                instr->block = block;
+                block->instrs.push_back(instr);
+            }
+            for (IrBlock* successor : next->successors()) {
+                std::replace(successor->preds.begin(), successor->preds.end(), next, block);
+            }
+            next->instrs.clear();
+            merged.insert(next);
+        }
+    }
+    function.blocks.erase(std::remove_if(function.blocks.begin(), function.blocks.end(),
+                                         [&](IrBlock* block) { return merged.count(block) != 0; }),
+                          function.blocks.end());
+}
+
+// A phi left with one predecessor is just that predecessor's value
+void simplifyPhis(IrFunction& function) {
+    bool changed = false;
+    for (IrBlock* block : function.blocks) {
+        for (IrInstr* instr : block->instrs) {
+            if (instr->op != IrOp::Phi) break;
+            if (instr->operands.size() == 1) {
+                instr->replacement = instr->operands[0];
+                changed = true;
+            }
+        }
+    }
+    if (changed) function.applyReplacements();
+}
+
+// Replaces a two-way terminator by a jump to `kept`
+void foldBranch(IrInstr* branch, IrBlock* kept) {
+    IrBlock* dropped = branch->target == kept ? branch->next : branch->target;
+    if (dropped != kept) IrFunction::removeEdge(branch->block, dropped);
+    branch->op = IrOp::Jump;
+    branch->operands.clear();
+    branch->target = kept;
+    branch->next = nullptr;
+}
+
+// --- Constant folding ---
+
+int64_t wrap(uint64_t value) { return static_cast<int64_t>(value); }
+
+// Evaluates a comparison of two constants the way the VM does; false when
+// the outcome depends on something folding does not model (or would fail)
+bool foldCompare(IrOp op, const Value& a, const Value& b, bool& result) {
+    if (op == IrOp::Equal) {
+        if (isNumber(a) && isNumber(b) && a.index() != b.index()) return false; // 1 == 1.0
+        // Otherwise the rules of VM::valuesEqual
+        if (a.index() != b.index()) result = false;
+        else if (std::holds_alternative<Nil>(a)) result = true;
+        else if (const bool* x = std::get_if<bool>(&a)) result = *x == std::get<bool>(b);
+        else if (const int64_t* x = std::get_if<int64_t>(&a)) result = *x == std::get<int64_t>(b);
+        else if (const double* x = std::get_if<double>(&a)) result = *x == std::get<double>(b);
+        else if (const std::string* x = std::get_if<std::string>(&a)) result = *x == std::get<std::string>(b);
+        else if (Function* const* x = std::get_if<Function*>(&a)) result = *x == std::get<Function*>(b);
+        else return false;
+        return true;
+    }
+    bool swap = op == IrOp::Greater || op == IrOp::GreaterEqual;
+    bool orEqual = op == IrOp::LessEqual || op == IrOp::GreaterEqual;
+    const Value& left = swap ? b : a;
+    const Value& right = swap ? a : b;
+    if (left.index() != right.index()) return false;
+    if (const int64_t* x = std::get_if<int64_t>(&left)) {
+        int64_t y = std::get<int64_t>(right);
+        result = orEqual ? *x <= y : *x < y;
+    } else if (const double* x = std::get_if<double>(&left)) {
+        double y = std::get<double>(right);
+        result = orEqual ? *x <= y : *x < y;
+    } else if (const std::string* x = std::get_if<std::string>(&left)) {
+        int order = x->compare(std::get<std::string>(right));
+        result = orEqual ? order <= 0 : order < 0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool foldArithmetic(IrOp op, const Value& a, const Value& b, Value& result) {
+    if (!isNumber(a) || !isNumber(b)) return false;
+    const int64_t* x = std::get_if<int64_t>(&a);
+    const int64_t* y = std::get_if<int64_t>(&b);
+    if (x && y) {
+        switch (op) {
+            case IrOp::Add:      result = wrap(static_cast<uint64_t>(*x) + static_cast<uint64_t>(*y)); return true;
+            case IrOp::Subtract: result = wrap(static_cast<uint64_t>(*x) - static_cast<uint64_t>(*y)); return true;
+            case IrOp::Multiply: result = wrap(static_cast<uint64_t>(*x) * static_cast<uint64_t>(*y)); return true;
+            case IrOp::Divide:   break;
+            default:             return false; // Integer '//' and '%' are left to the VM
+        }
+    }
+    double p = toDouble(a), q = toDouble(b);
+    switch (op) {
+        case IrOp::Add:      result = p + q; return true;
+        case IrOp::Subtract: result = p - q; return true;
+        case IrOp::Multiply: result = p * q; return true;
+        case IrOp::Divide:   result = p / q; return true;
+        default:             return false;
+    }
+}
+
+// Computes `instr` from constant operands into `result`
+bool fold(const IrInstr* instr, Value& result) {
+    const std::vector<IrInstr*>& operands = instr->operands;
+    if (operands.empty()) return false;
+    for (const IrInstr* operand : operands) {
+        if (operand->op != IrOp::Constant) return false;
+    }
+    const Value& a = operands[0]->constant;
+    switch (instr->op) {
+        case IrOp::Add:
+        case IrOp::Subtract:
+        case IrOp::Multiply:
+        case IrOp::Divide:
+            return foldArithmetic(instr->op, a, operands[1]->constant, result);
+        case IrOp::Equal:
+        case IrOp::Less:
+        case IrOp::LessEqual:
+        case IrOp::Greater:
+        case IrOp::GreaterEqual: {
+            bool outcome;
+            if (!foldCompare(instr->op, a, operands[1]->constant, outcome)) return false;
+            result = outcome;
+            return true;
+        }
+        case IrOp::Not:
+            result = isFalsey(a);
+            return true;
+        case IrOp::Negate:
+            if (const int64_t* i = std::get_if<int64_t>(&a)) result = wrap(0 - static_cast<uint64_t>(*i));
+            else if (const double* d = std::get_if<double>(&a)) result = -*d;
+            else return false;
+            return true;
+        case IrOp::Concat: {
+            std::string text;
+            for (const IrInstr* operand : operands) {
+                const Value& part = operand->constant;
+                if (const std::string* s = std::get_if<std::string>(&part)) {
+                    text += *s;
+                } else if (const int64_t* i = std::get_if<int64_t>(&part)) {
+                    char buffer[24];
+                    text.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), *i).ptr);
+                } else if (const double* d = std::get_if<double>(&part)) {
+                    text += formatNumber(*d);
+                } else {
+                    return false;
+                }
+            }
+            result = std::move(text);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Outcome of a Branch on constants: true when it is taken
+bool foldBranchTest(const IrInstr* branch, bool& taken) {
+    const std::vector<IrInstr*>& operands = branch->operands;
+    for (const IrInstr* operand : operands) {
+        if (operand->op != IrOp::Constant) return false;
+    }
+    bool outcome;
+    switch (branch->test) {
+        case OpCode::OP_JTEST:
+            outcome = !isFalsey(operands[0]->constant);
+            break;
+        case OpCode::OP_JLT:
+        case OpCode::OP_JLE:
+        case OpCode::OP_JGT:
+        case OpCode::OP_JGE:
+        case OpCode::OP_JEQ: {
+            IrOp op = branch->test == OpCode::OP_JLT ? IrOp::Less
+                    : branch->test == OpCode::OP_JLE ? IrOp::LessEqual
+                    : branch->test == OpCode::OP_JGT ? IrOp::Greater
+                    : branch->test == OpCode::OP_JGE ? IrOp::GreaterEqual : IrOp::Equal;
+            if (!foldCompare(op, operands[0]->constant, operands[1]->constant, outcome)) return false;
+            break;
+        }
+        default:
+            return false;
+    }
+    taken = outcome == branch->sense;
+    return true;
+}
+
+void makeConstant(IrInstr* instr, Value value) {
+    instr->op = IrOp::Constant;
+    instr->constant = std::move(value);
+    instr->operands.clear();
+}
+
+// --- Constant and copy propagation ---
+
+// What is known about a local slot at some point
+struct Known {
+    enum Kind : uint8_t { Unknown, Constant, Copy } kind = Unknown;
+    int copy = 0;   // Copy: holds the same value as this slot
+    Value constant; // Constant
+
+    bool operator==(const Known& other) const {
+        if (kind != other.kind) return false;
+        if (kind == Copy) return copy == other.copy;
+        if (kind == Constant) {
+            if (constant.index() != other.constant.index()) return false;
+            if (const double* x = std::get_if<double>(&constant)) {
+                double y = std::get<double>(other.constant);
+                return std::memcmp(x, &y, sizeof y) == 0;
+            }
+            bool equal;
+            return foldCompare(IrOp::Equal, constant, other.constant, equal) && equal;
+        }
+        return true;
+    }
+};
+
+using SlotState = std::vector<Known>;
+
+class Propagation {
+public:
+    explicit Propagation(IrFunction& function) : function(function) {}
+
+    // Returns true if anything changed
+    bool run() {
+        int slots = function.arity;
+        for (IrBlock* block : function.blocks) {
+            for (IrInstr* instr : block->instrs) slots = std::max(slots, instr->slot + 5);
+        }
+        std::vector<IrBlock*> order = reversePostorder(function);
+
+        // Iterate to a fixed point; blocks not yet reached contribute nothing
+        std::unordered_map<IrBlock*, SlotState> in, out;
+        in[order[0]] = SlotState(slots);
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (IrBlock* block : order) {
+                SlotState state;
+                if (block == order[0]) {
+                    state = in[block];
+                } else {
+                    bool first = true;
+                    for (IrBlock* pred : block->preds) {
+                        auto found = out.find(pred);
+                        if (found == out.end()) continue;
+                        if (first) {
+                            state = found->second;
+                            first = false;
+                        } else {
+                            for (int i = 0; i < slots; i++) {
+                                if (!(state[i] == found->second[i])) state[i] = Known{};
+                            }
+                        }
+                    }
+                    if (first) continue;
+                }
+                in[block] = state;
+                for (IrInstr* instr : block->instrs) transfer(state, instr, false);
+                auto found = out.find(block);
+                if (found == out.end() || found->second != state) {
+                    out[block] = std::move(state);
+                    changed = true;
+                }
+            }
+        }
+
+        // Rewrite loads and fold what became constant
+        rewrote = false;
+        for (IrBlock* block : order) {
+            SlotState state = in[block];
+            for (IrInstr* instr : block->instrs) transfer(state, instr, true);
+        }
+        for (IrBlock* block : order) {
+            IrInstr* last = block->terminator();
+            bool taken;
+            if (last->op == IrOp::Branch && foldBranchTest(last, taken)) {
+                foldBranch(last, taken ? last->target : last->next);
+                rewrote = true;
+            } else if (last->op == IrOp::BranchKeep && last->operands[0]->op == IrOp::Constant) {
+                bool falsey = isFalsey(last->operands[0]->constant);
+                taken = last->test == OpCode::OP_JUMP_IF_FALSE ? falsey : !falsey;
+                // Taken, the kept constant stays the phi's operand
+                foldBranch(last, taken ? last->target : last->next);
+                rewrote = true;
+            }
+        }
+        if (rewrote) {
+            removeUnreachable(function);
+            simplifyPhis(function);
+        }
+        return rewrote;
+    }
+
+private:
+    IrFunction& function;
+    bool rewrote = false;
+
+    static void kill(SlotState& state, int slot) {
+        if (slot >= static_cast<int>(state.size())) return;
+        state[slot] = Known{};
+        for (Known& known : state) {
+            if (known.kind == Known::Copy && known.copy == slot) known = Known{};
+        }
+    }
+
+    // What a store of `value` puts in a slot. `previous` is the instruction
+    // before the store: a copy is only recorded straight from the load, so
+    // the source cannot have changed in between.
+    static Known stored(const SlotState& state, const IrInstr* value, const IrInstr* previous) {
+        Known known;
+        if (value->op == IrOp::Constant) {
+            known.kind = Known::Constant;
+            known.constant = value->constant;
+        } else if (value->op == IrOp::GetLocal && value == previous) {
+            const Known& source = state[value->slot];
+            if (source.kind != Known::Unknown) return source;
+            known.kind = Known::Copy;
+            known.copy = value->slot;
+        }
+        return known;
+    }
+
+    void transfer(SlotState& state, IrInstr* instr, bool rewrite) {
+        switch (instr->op) {
+            case IrOp::GetLocal: {
+                if (!rewrite) break;
+                const Known& known = state[instr->slot];
+                if (known.kind == Known::Constant) {
+                    makeConstant(instr, known.constant);
+                    rewrote = true;
+                } else if (known.kind == Known::Copy) {
+                    instr->slot = known.copy;
+                    rewrote = true;
+                }
+                break;
+            }
+            case IrOp::SetLocal:
+            case IrOp::DeclareLocal: {
+                std::vector<IrInstr*>& instrs = instr->block->instrs;
+                auto position = std::find(instrs.begin(), instrs.end(), instr);
+                const IrInstr* previous = position == instrs.begin() ? nullptr : *(position - 1);
+                Known known = stored(state, instr->operands[0], previous);
+                kill(state, instr->slot);
+                if (known.kind == Known::Copy && known.copy == instr->slot) known = Known{};
+                state[instr->slot] = known;
+                break;
+            }
+            case IrOp::AppendLocal:
+                kill(state, instr->slot);
+                break;
+            case IrOp::PopLocals:
+                for (int i = 0; i < instr->count; i++) kill(state, instr->slot + i);
+                break;
+            case IrOp::ForPrep:
+            case IrOp::ForLoop:
+                for (int i = 0; i < 5; i++) kill(state, instr->slot + i);
+                break;
+            case IrOp::ForIn:
+                kill(state, instr->slot + 1);
+                break;
+            default:
+                if (rewrite && isComputation(instr)) {
+                    Value result;
+                    if (fold(instr, result)) {
+                        makeConstant(instr, std::move(result));
+                        rewrote = true;
+                    }
+                }
+                break;
+        }
+    }
+};
+
+void propagate(IrFunction& function) {
+    // Folding can expose more constants; a few rounds reach nearly everything
+    for (int round = 0; round < 4 && Propagation(function).run(); round++) {
+    }
+}
+
+// --- Common-subexpression elimination ---
+
+// Value numbering: a load's number identifies the value it reads (slot
+// contents between two stores, a global between two possible writes, which
+// with debug hooks is any two instructions); an
+// operation's number is that of its operator and operands' numbers. A later
+// operation numbered like an available earlier one is replaced by it. With
+// `global`, operations stay available in the blocks they dominate; otherwise
+// only within their own block.
+class ValueNumbering {
+public:
+    ValueNumbering(IrFunction& function, bool global) : function(function), global(global) {}
+
+    void run() {
+        std::vector<IrBlock*> order = reversePostorder(function);
+        // Slots written once (by their declaration) hold one value wherever
+        // they are readable, so their loads agree across blocks
+        std::unordered_map<int, int> writes;
+        for (IrBlock* block : order) {
+            for (IrInstr* instr : block->instrs) {
+                for (int slot : writtenSlots(instr)) writes[slot]++;
+            }
+        }
+        for (const auto& [slot, count] : writes) {
+            if (count > 1) unstable.insert(slot);
+        }
+
+        if (!global) {
+            for (IrBlock* block : order) {
+                std::vector<std::string> scope;
+                numberBlock(block, scope);
+                for (const std::string& key : scope) available.erase(key);
+            }
+        } else {
+            Dominators dominators(order);
+            std::unordered_map<IrBlock*, std::vector<IrBlock*>> children;
+            for (IrBlock* block : order) {
+                if (block != order[0]) children[dominators.idom[block]].push_back(block);
+            }
+            walk(order[0], children);
+        }
+        function.applyReplacements();
+    }
+
+private:
+    IrFunction& function;
+    bool global;
+    std::unordered_set<int> unstable;
+    std::unordered_map<std::string, IrInstr*> available;
+    std::unordered_map<const IrInstr*, int> numbers;
+    std::unordered_map<std::string, int> keys;
+    std::unordered_map<int, int> versions; // Slot -> current version
+    int nextNumber = 0;
+    int epoch = 0;                         // Version of all globals
+
+    static std::vector<int> writtenSlots(const IrInstr* instr) {
+        switch (instr->op) {
+            case IrOp::SetLocal:
+            case IrOp::DeclareLocal:
+            case IrOp::AppendLocal:
+                return {instr->slot};
+            case IrOp::ForPrep:
+            case IrOp::ForLoop:
+                return {instr->slot, instr->slot + 1, instr->slot + 2, instr->slot + 3, instr->slot + 4};
+            case IrOp::ForIn:
+                return {instr->slot + 1};
+            default:
+                return {};
+        }
+    }
+
+    void walk(IrBlock* block, std::unordered_map<IrBlock*, std::vector<IrBlock*>>& children) {
+        std::vector<std::string> scope;
+        numberBlock(block, scope);
+        for (IrBlock* child : children[block]) walk(child, children);
+        for (const std::string& key : scope) available.erase(key);
+    }
+
+    int numberOf(const std::string& key) {
+        auto found = keys.find(key);
+        if (found != keys.end()) return found->second;
+        return keys[key] = nextNumber++;
+    }
+
+    std::string loadKey(const IrInstr* instr) {
+        if (instr->op == IrOp::GetGlobal) {
+            // With debug hooks any instruction may write globals: no two reads agree
+            if (function.hooks) return "g" + std::to_string(nextNumber++);
+            return "g" + std::to_string(epoch) + ":" + instr->name;
+        }
+        int version = unstable.count(instr->slot) ? versions[instr->slot] : 0;
+        return "l" + std::to_string(instr->slot) + ":" + std::to_string(version);
+    }
+
+    void numberBlock(IrBlock* block, std::vector<std::string>& scope) {
+        // Unstable slots and globals may have changed on the way in
+        for (int slot : unstable) versions[slot] = nextNumber++;
+        epoch = nextNumber++;
+
+        for (IrInstr* instr : block->instrs) {
+            switch (instr->op) {
+                case IrOp::Constant: {
+                    std::string key = "c" + std::to_string(instr->constant.index()) + ":";
+                    const Value& value = instr->constant;
+                    if (const double* d = std::get_if<double>(&value)) {
+                        char bits[sizeof(double)];
+                        std::memcpy(bits, d, sizeof bits);
+                        key.append(bits, sizeof bits);
+                    } else if (const int64_t* i = std::get_if<int64_t>(&value)) {
+                        key += std::to_string(*i);
+                    } else if (const std::string* s = std::get_if<std::string>(&value)) {
+                        key += *s;
+                    } else if (const bool* b = std::get_if<bool>(&value)) {
+                        key += *b ? "t" : "f";
+                    } else if (Function* const* f = std::get_if<Function*>(&value)) {
+                        key += std::to_string(reinterpret_cast<uintptr_t>(*f));
+                    }
+                    numbers[instr] = numberOf(key);
+                    break;
+                }
+                case IrOp::GetLocal:
+                case IrOp::GetGlobal:
+                    numbers[instr] = numberOf(loadKey(instr));
+                    break;
+                default:
+                    if (isComputation(instr)) {
+                        std::string key = "o" + std::to_string(static_cast<int>(instr->op));
+                        for (const IrInstr* operand : instr->operands) {
+                            auto found = numbers.find(operand);
+                            key += ":" + std::to_string(found != numbers.end() ? found->second : nextNumber++);
+                        }
+                        auto match = available.find(key);
+                        if (match != available.end()) {
+                            instr->replacement = match->second;
+                            numbers[instr] = numbers[match->second];
+                        } else {
+                            available[key] = instr;
+                            scope.push_back(key);
+                            numbers[instr] = nextNumber++;
+                        }
+                        break;
+                    }
+                    numbers[instr] = nextNumber++;
+                    for (int slot : writtenSlots(instr)) versions[slot] = nextNumber++;
+                    if (instr->op == IrOp::Call || instr->op == IrOp::SetGlobal ||
+                        instr->op == IrOp::DefineGlobal || instr->op == IrOp::ForIn) {
+                        epoch = nextNumber++;
+                    }
+                    break;
+            }
+        }
+    }
+};
+
+// --- Loop-invariant code motion ---
+
+// Moves computations whose operands cannot change inside a loop into a new
+// block run once before it. Only operations that cannot fail are moved,
+// except from the start of the loop header: the header runs right after the
+// preheader, so an error there happens at the same point either way.
+class LoopInvariants {
+public:
+    explicit LoopInvariants(IrFunction& function) : function(function) {}
+
+    void run() {
+        std::vector<IrBlock*> order = reversePostorder(function);
+        Dominators dominators(order);
+
+        // Natural loops: a back edge latch -> header where the header
+        // dominates the latch; the body is what reaches the latch without
+        // going through the header
+        std::unordered_map<IrBlock*, std::unordered_set<IrBlock*>> loops;
+        for (IrBlock* latch : order) {
+            for (IrBlock* header : latch->successors()) {
+                if (!dominators.dominates(header, latch)) continue;
+                std::unordered_set<IrBlock*>& body = loops[header];
+                body.insert(header);
+                std::vector<IrBlock*> work{latch};
+                while (!work.empty()) {
+                    IrBlock* block = work.back();
+                    work.pop_back();
+                    if (!body.insert(block).second) continue;
+                    for (IrBlock* pred : block->preds) work.push_back(pred);
+                }
+            }
+        }
+
+        // Inner loops first, so their invariants can move further out
+        std::vector<IrBlock*> headers;
+        for (const auto& entry : loops) headers.push_back(entry.first);
+        std::sort(headers.begin(), headers.end(), [&](IrBlock* a, IrBlock* b) {
+            if (loops[a].size() != loops[b].size()) return loops[a].size() < loops[b].size();
+            return dominators.rank[a] < dominators.rank[b];
+        });
+        for (IrBlock* header : headers) hoist(header, loops[header]);
+    }
+
+private:
+    IrFunction& function;
+
+    void hoist(IrBlock* header, const std::unordered_set<IrBlock*>& body) {
+        if (!header->instrs.empty() && header->instrs[0]->op == IrOp::Phi) return;
+        std::vector<IrBlock*> outside;
+        for (IrBlock* pred : header->preds) {
+            if (!body.count(pred)) outside.push_back(pred);
+        }
+        if (outside.empty()) return;
+
+        std::unordered_set<int> writtenSlots;
+        std::unordered_set<std::string> writtenGlobals;
+        bool calls = false;
+        for (IrBlock* block : body) {
+            for (IrInstr* instr : block->instrs) {
+                switch (instr->op) {
+                    case IrOp::SetLocal:
+                    case IrOp::DeclareLocal:
+                    case IrOp::AppendLocal:
+                        writtenSlots.insert(instr->slot);
+                        break;
+                    case IrOp::ForPrep:
+                    case IrOp::ForLoop:
+                        for (int i = 0; i < 5; i++) writtenSlots.insert(instr->slot + i);
+                        break;
+                    case IrOp::ForIn:
+                        writtenSlots.insert(instr->slot + 1);
+                        calls = true;
+                        break;
+                    case IrOp::SetGlobal:
+                    case IrOp::DefineGlobal:
+                        writtenGlobals.insert(instr->name);
+                        break;
+                    case IrOp::Call:
+                        calls = true;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        // Candidates in layout order; leaves (constants, local loads) only
+        // move along with an operation that uses them
+        std::unordered_set<IrInstr*> invariant;
+        std::vector<IrInstr*> moved;
+        std::unordered_set<IrInstr*> movedSet;
+        auto isInvariant = [&](IrInstr* value) { return !body.count(value->block) || invariant.count(value); };
+        for (IrBlock* block : function.blocks) {
+            if (!body.count(block)) continue;
+            bool headerPrefix = block == header;
+            for (IrInstr* instr : block->instrs) {
+                bool candidate = false;
+                switch (instr->op) {
+                    case IrOp::Constant:
+                        candidate = true;
+                        break;
+                    case IrOp::GetLocal:
+                        candidate = !writtenSlots.count(instr->slot);
+                        break;
+                    case IrOp::GetGlobal:
+                        // A debug hook may assign it between any two instructions
+                        candidate = !function.hooks && !calls && !writtenGlobals.count(instr->name);
+                        break;
+                    default:
+                        candidate = isComputation(instr) &&
+                                    std::all_of(instr->operands.begin(), instr->operands.end(), isInvariant) &&
+                                    (headerPrefix || !mayFail(instr));
+                        break;
+                }
+                if (candidate) {
+                    invariant.insert(instr);
+                    if (isComputation(instr) || instr->op == IrOp::GetGlobal) {
+                        moved.push_back(instr);
+                        movedSet.insert(instr);
+                    }
+                } else if (hasEffects(instr) || mayFail(instr)) {
+                    headerPrefix = false;
+                }
+            }
+        }
+        if (moved.empty()) return;
+
+        // Leaves used by moved operations go with them
+        std::vector<IrInstr*> all;
+        for (IrBlock* block : function.blocks) {
+            if (!body.count(block)) continue;
+            for (IrInstr* instr : block->instrs) {
+                if (movedSet.count(instr)) {
+                    all.push_back(instr);
+                    continue;
+                }
+                if (!invariant.count(instr)) continue;
+                bool feedsMoved = false;
+                for (IrInstr* user : moved) {
+                    if (std::find(user->operands.begin(), user->operands.end(), instr) != user->operands.end()) {
+                        feedsMoved = true;
+                    }
+                }
+                if (feedsMoved) all.push_back(instr);
+            }
+        }
+
+        IrBlock* preheader = makePreheader(header, outside, body);
+        IrInstr* jump = preheader->instrs.back();
+        preheader->instrs.pop_back();
+        std::unordered_set<IrInstr*> moving(all.begin(), all.end());
+        for (IrBlock* block : function.blocks) {
+            if (!body.count(block)) continue;
+            block->instrs.erase(std::remove_if(block->instrs.begin(), block->instrs.end(),
+                                               [&](IrInstr* instr) { return moving.count(instr) != 0; }),
+                                block->instrs.end());
+        }
+        for (IrInstr* instr : all) {
+            instr->block = preheader;
+            preheader->instrs.push_back(instr);
+        }
+        preheader->instrs.push_back(jump);
+    }
+
+    // A block that jumps to `header`, placed just before it, taking over the
+    // edges from outside the loop
+    IrBlock* makePreheader(IrBlock* header, const std::vector<IrBlock*>& outside,
+                           const std::unordered_set<IrBlock*>& body) {
+        IrBlock* preheader = function.newBlock();
+        IrInstr* first = header->instrs.front();
+        IrInstr* jump = function.newInstr(IrOp::Jump, first->line, first->column);
+        jump->block = preheader;
+        jump->target = header;
+        preheader->instrs.push_back(jump);
+        for (IrBlock* pred : outside) {
+            IrInstr* last = pred->terminator();
+            if (last->target == header) last->target = preheader;
+            if (last->next == header) last->next = preheader;
+            preheader->preds.push_back(pred);
+        }
+        header->preds.erase(std::remove_if(header->preds.begin(), header->preds.end(),
+                                           [&](IrBlock* pred) { return !body.count(pred); }),
+                            header->preds.end());
+        header->preds.insert(header->preds.begin(), preheader);
+        function.blocks.insert(std::find(function.blocks.begin(), function.blocks.end(), header), preheader);
+        return preheader;
+    }
+};
+
+// --- Dead-code elimination ---
+
+// Removes unreachable blocks and values nobody uses whose computation has no
+// effect and cannot fail. Phis stay: the emitter needs one wherever
+// control flow joins with a value on the stack.
+void eliminateDeadCode(IrFunction& function) {
+    removeUnreachable(function);
+    mergeBlocks(function);
+    std::unordered_map<IrInstr*, int> uses;
+    for (IrBlock* block : function.blocks) {
+        for (IrInstr* instr : block->instrs) {
+            for (IrInstr* operand : instr->operands) uses[operand]++;
+        }
+    }
+    std::vector<IrInstr*> work;
+    for (IrBlock* block : function.blocks) {
+        for (IrInstr* instr : block->instrs) work.push_back(instr);
+    }
+    while (!work.empty()) {
+        IrInstr* instr = work.back();
+        work.pop_back();
+        if (instr->removed || uses[instr] != 0 || !instr->hasValue() || instr->op == IrOp::Phi ||
+            hasEffects(instr) || mayFail(instr)) {
+            continue;
+        }
+        instr->removed = true;
+        for (IrInstr* operand : instr->operands) {
+            if (--uses[operand] == 0) work.push_back(operand);
+        }
+    }
+    function.applyReplacements();
+}
+
+// --- Type inference ---
+
+// The types a value may have at run time, one bit each
+using TypeSet = uint8_t;
+constexpr TypeSet kNilType = 1, kBoolType = 2, kIntegerType = 4, kFloatType = 8, kStringType = 16,
+                  kOtherType = 32; // Functions and coroutines
+constexpr TypeSet kNumberType = kIntegerType | kFloatType;
+constexpr TypeSet kAnyType = 63;
+
+TypeSet typeOfConstant(const Value& value) {
+    switch (value.index()) {
+        case 0:  return kNilType;
+        case 1:  return kBoolType;
+        case 2:  return kFloatType;
+        case 3:  return kStringType;
+        case 4:  return kIntegerType;
+        default: return kOtherType;
+    }
+}
+
+// Result of arithmetic that did not fail: its operands were numbers. Integer
+// operands give an integer except for '/', a float operand gives a float.
+TypeSet arithmeticType(IrOp op, TypeSet a, TypeSet b) {
+    a &= kNumberType;
+    b &= kNumberType;
+    if (!a || !b) return kNumberType; // Always fails; nothing sees the result
+    if (op == IrOp::Divide) return kFloatType;
+    TypeSet result = 0;
+    if ((a & kIntegerType) && (b & kIntegerType)) result |= kIntegerType;
+    if ((a & kFloatType) || (b & kFloatType)) result |= kFloatType;
+    return result;
+}
+
+// Flow-sensitive inference of value and local-slot types. Locals can only
+// change through this function's own instructions (there are no upvalues),
+// so a slot's type set is the union of what reaches it along every path;
+// globals, call results and parameters can be anything. Where both operands
+// of an arithmetic operation or an ordered compare-and-branch are proved
+// integers, or proved floats, the instruction is marked with that operand
+// type and the emitter uses the unchecked typed opcode.
+class TypeInference {
+public:
+    explicit TypeInference(IrFunction& function) : function(function) {}
+
+    // Counts the operations that could be typed and those that were
+    void run(int& candidates, int& typedCount) {
+        int slots = function.arity;
+        for (IrBlock* block : function.blocks) {
+            for (IrInstr* instr : block->instrs) slots = std::max(slots, instr->slot + 5);
+        }
+        std::vector<IrBlock*> order = reversePostorder(function);
+
+        // Blocks not yet reached contribute nothing to a join
+        std::unordered_map<IrBlock*, std::vector<TypeSet>> out;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (IrBlock* block : order) {
+                std::vector<TypeSet> state(slots, block == order[0] ? kAnyType : 0);
+                for (IrBlock* pred : block->preds) {
+                    auto found = out.find(pred);
+                    if (found == out.end()) continue;
+                    for (int i = 0; i < slots; i++) state[i] |= found->second[i];
+                }
+                for (IrInstr* instr : block->instrs) transfer(state, instr);
+                auto found = out.find(block);
+                if (found == out.end() || found->second != state) {
+                    out[block] = std::move(state);
+                    changed = true;
+                }
+            }
+        }
+
+        for (IrBlock* block : order) {
+            for (IrInstr* instr : block->instrs) {
+                bool ordered = instr->op == IrOp::Branch && instr->test != OpCode::OP_JEQ &&
+                               instr->test != OpCode::OP_JTEST;
+                bool arithmetic = instr->op >= IrOp::Add && instr->op <= IrOp::Modulo;
+                if (!ordered && !arithmetic && !(instr->op >= IrOp::Less && instr->op <= IrOp::GreaterEqual)) {
+                    continue;
+                }
+                candidates++;
+                instr->operandType = OperandType::Unknown;
+                // Only these have typed opcodes
+                bool typedForm = ordered || instr->op == IrOp::Add || instr->op == IrOp::Subtract ||
+                                 instr->op == IrOp::Multiply || instr->op == IrOp::Divide;
+                if (!typedForm) continue;
+                TypeSet a = typeOf(instr->operands[0]), b = typeOf(instr->operands[1]);
+                if (a == kIntegerType && b == kIntegerType && instr->op != IrOp::Divide) {
+                    instr->operandType = OperandType::Integer;
+                } else if (a == kFloatType && b == kFloatType) {
+                    instr->operandType = OperandType::Float;
+                }
+                if (instr->operandType != OperandType::Unknown) typedCount++;
+            }
+        }
+    }
+
+private:
+    IrFunction& function;
+    std::unordered_map<const IrInstr*, TypeSet> types;
+
+    TypeSet typeOf(const IrInstr* value) const {
+        auto found = types.find(value);
+        return found == types.end() ? kAnyType : found->second;
+    }
+
+    static void setSlot(std::vector<TypeSet>& state, int slot, TypeSet type) {
+        if (slot < static_cast<int>(state.size())) state[slot] = type;
+    }
+
+    void transfer(std::vector<TypeSet>& state, const IrInstr* instr) {
+        const std::vector<IrInstr*>& operands = instr->operands;
+        TypeSet type = kAnyType;
+        switch (instr->op) {
+            case IrOp::Constant:
+                type = typeOfConstant(instr->constant);
+                break;
+            case IrOp::GetLocal:
+                type = instr->slot < static_cast<int>(state.size()) ? state[instr->slot] : kAnyType;
+                break;
+            case IrOp::Phi:
+                type = 0;
+                for (const IrInstr* operand : operands) type |= typeOf(operand);
+                break;
+            case IrOp::Add:
+            case IrOp::Subtract:
+            case IrOp::Multiply:
+            case IrOp::Divide:
+            case IrOp::FloorDivide:
+            case IrOp::Modulo:
+                type = arithmeticType(instr->op, typeOf(operands[0]), typeOf(operands[1]));
+                break;
+            case IrOp::Negate:
+                type = typeOf(operands[0]) & kNumberType;
+                if (!type) type = kNumberType;
+                break;
+            case IrOp::Equal:
+            case IrOp::Less:
+            case IrOp::LessEqual:
+            case IrOp::Greater:
+            case IrOp::GreaterEqual:
+            case IrOp::Not:
+                type = kBoolType;
+                break;
+            case IrOp::Concat:
+                type = kStringType;
+                break;
+            case IrOp::SetLocal:
+            case IrOp::DeclareLocal:
+                type = typeOf(operands[0]);
+                setSlot(state, instr->slot, type);
+                break;
+            case IrOp::SetGlobal:
+                type = typeOf(operands[0]);
+                break;
+            case IrOp::AppendLocal:
+                setSlot(state, instr->slot, kStringType);
+                break;
+            case IrOp::PopLocals:
+                for (int i = 0; i < instr->count; i++) setSlot(state, instr->slot + i, kAnyType);
+                break;
+            case IrOp::ForPrep: {
+                // Integer start and step make an integer loop (the limit is
+                // converted); otherwise everything becomes a float
+                int base = instr->slot;
+                TypeSet start = state[base] & kNumberType, step = state[base + 2] & kNumberType;
+                TypeSet index = 0;
+                if ((start & kIntegerType) && (step & kIntegerType)) index |= kIntegerType;
+                if ((start & kFloatType) || (step & kFloatType) || !start || !step) index |= kFloatType;
+                state[base] = index;
+                state[base + 1] = index;
+                state[base + 2] = index;
+                state[base + 3] = (index & kIntegerType ? kIntegerType : 0) | (index & kFloatType ? kNilType : 0);
+                state[base + 4] = index;
+                break;
+            }
+            case IrOp::ForLoop:
+                // The body may have assigned the visible variable
+                state[instr->slot + 4] = state[instr->slot];
+                break;
+            case IrOp::ForIn:
+                setSlot(state, instr->slot, kAnyType);
+                setSlot(state, instr->slot + 1, kAnyType);
+                break;
+            default:
+                break;
+        }
+        if (instr->hasValue()) types[instr] = type;
+    }
+};
+
+} // namespace
+
+void optimizeIr(IrFunction& function, int level, std::ostream* dump, std::ostream* typeReport) {
+    auto after = [&](const char* pass) {
+        if (!dump) return;
+        *dump << "== " << function.name << ": after " << pass << " ==\n";
+        printIr(function, *dump);
+    };
+
+    if (level <= 0) return;
+    removeUnreachable(function);
+    simplifyPhis(function);
+    mergeBlocks(function);
+    propagate(function);
+    mergeBlocks(function);
+    after("propagation");
+    ValueNumbering(function, level >= 2).run();
+    after("cse");
+    if (level >= 2) {
+        LoopInvariants(function).run();
+        after("licm");
+    }
+    eliminateDeadCode(function);
+    after("dce");
+    int candidates = 0, typedCount = 0;
+    TypeInference(function).run(candidates, typedCount);
+    after("types");
+    if (typeReport && candidates > 0) {
+        *typeReport << "typed " << typedCount << " of " << candidates << " arithmetic and comparison ops in "
+                    << function.name << " (" << typedCount * 100 / candidates << "%)\n";
+    }
+}
@@ -0,0 +1,1050 @@
+#include "Jit.h"
+
+#ifdef LUA_HAS_JIT
+
+#include "VM.h"
+#include <sys/mman.h>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace {
+
+// Where std::variant keeps its type tag. The generated code reads and writes
+// the tag byte and the payload directly, so the layout is probed at startup
+// instead of being assumed.
+struct ValueLayout {
+    bool ok = false;
+    int32_t size = 0;
+    int32_t indexOffset = 0;
+};
+
+// Type tags, in the order of the alternatives of Value
+constexpr uint8_t kTagNil = 0;
+constexpr uint8_t kTagBool = 1;
+constexpr uint8_t kTagDouble = 2;
+constexpr uint8_t kTagString = 3;
+constexpr uint8_t kTagInteger = 4;
+constexpr int kTagCount = 5;
+
+template <typename T>
+void constructInto(unsigned char* bytes, unsigned char fill, T alternative) {
+    std::memset(bytes, fill, sizeof(Value));
+    new (bytes) Value(alternative);
+}
+
+ValueLayout probeValueLayout() {
+    ValueLayout layout;
+    layout.size = sizeof(Value);
+
+    alignas(Value) unsigned char probes[2][kTagCount][sizeof(Value)];
+    const unsigned char fills[2] = {0x00, 0xff};
+    for (int f = 0; f < 2; f++) {
+        constructInto(probes[f][kTagNil], fills[f], Nil{});
+        constructInto(probes[f][kTagBool], fills[f], true);
+        constructInto(probes[f][kTagDouble], fills[f], 1.5);
+        constructInto(probes[f][kTagString], fills[f], std::string("probe"));
+        constructInto(probes[f][kTagInteger], fills[f], int64_t{-2});
+    }
+
+    // The tag must sit at the same offset for every alternative and fill
+    // pattern, past the 8-byte scalar payload.
+    for (size_t offset = sizeof(double); offset < sizeof(Value) && !layout.ok; offset++) {
+        bool match = true;
+        for (int f = 0; f < 2 && match; f++) {
+            for (uint8_t tag = 0; tag < kTagCount && match; tag++) {
+                match = probes[f][tag][offset] == tag;
+            }
+        }
+        if (match) {
+            layout.ok = true;
+            layout.indexOffset = static_cast<int32_t>(offset);
+        }
+    }
+
+    // Scalars must live at offset 0 of the storage
+    for (int f = 0; f < 2 && layout.ok; f++) {
+        double d;
+        int64_t i;
+        std::memcpy(&d, probes[f][kTagDouble], sizeof(double));
+        std::memcpy(&i, probes[f][kTagInteger], sizeof(int64_t));
+        layout.ok = d == 1.5 && i == -2 && probes[f][kTagBool][0] == 1;
+    }
+
+    for (int f = 0; f < 2; f++) {
+        for (int tag = 0; tag < kTagCount; tag++) {
+            reinterpret_cast<Value*>(probes[f][tag])->~Value();
+        }
+    }
+    return layout;
+}
+
+const ValueLayout& valueLayout() {
+    static const ValueLayout layout = probeValueLayout();
+    return layout;
+}
+
+// --- x86-64 encoding ---
+
+enum Reg : int {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+enum Cond : int {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+    CC_L = 0xc, CC_GE = 0xd, CC_LE = 0xe, CC_G = 0xf
+};
+
+class Assembler {
+public:
+    std::vector<uint8_t> code;
+
+    size_t size() const { return code.size(); }
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; i++) byte((v >> (8 * i)) & 0xff); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; i++) byte((v >> (8 * i)) & 0xff); }
+
+    void patch32(size_t at, int32_t v) { std::memcpy(&code[at], &v, 4); }
+
+    // REX prefix for a reg field and an r/m (or base) field
+    void rex(bool w, int reg, int rm) {
+        uint8_t r = 0x40 | (w ? 8 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+        if (r != 0x40) byte(r);
+    }
+
+    // ModRM (+SIB) for [base + disp32]
+    void mem(int reg, int base, int32_t disp) {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) byte(0x24);
+        u32(static_cast<uint32_t>(disp));
+    }
+
+    void push(int r) { rex(false, 0, r); byte(0x50 | (r & 7)); }
+    void pop(int r) { rex(false, 0, r); byte(0x58 | (r & 7)); }
+    void ret() { byte(0xc3); }
+
+    void movRegReg(int dst, int src) { rex(true, src, dst); byte(0x89); byte(0xc0 | ((src & 7) << 3) | (dst & 7)); }
+    void movRegMem(int dst, int base, int32_t disp) { rex(true, dst, base); byte(0x8b); mem(dst, base, disp); }
+    void movMemReg(int base, int32_t disp, int src) { rex(true, src, base); byte(0x89); mem(src, base, disp); }
+    void movRegImm64(int dst, uint64_t imm) { rex(true, 0, dst); byte(0xb8 | (dst & 7)); u64(imm); }
+    void movRegImm32(int dst, uint32_t imm) { rex(false, 0, dst); byte(0xb8 | (dst & 7)); u32(imm); }
+
+    void addRegImm(int r, int32_t imm) { rex(true, 0, r); byte(0x81); byte(0xc0 | (r & 7)); u32(imm); }
+    void subRegImm(int r, int32_t imm) { rex(true, 0, r); byte(0x81); byte(0xe8 | (r & 7)); u32(imm); }
+    void cmpRegMem(int r, int base, int32_t disp) { rex(true, r, base); byte(0x3b); mem(r, base, disp); }
+    void addRegMem(int r, int base, int32_t disp) { rex(true, r, base); byte(0x03); mem(r, base, disp); }
+    void subRegMem(int r, int base, int32_t disp) { rex(true, r, base); byte(0x2b); mem(r, base, disp); }
+    void imulRegMem(int r, int base, int32_t disp) { rex(true, r, base); byte(0x0f); byte(0xaf); mem(r, base, disp); }
+    void leaRegMem(int r, int base, int32_t disp) { rex(true, r, base); byte(0x8d); mem(r, base, disp); }
+    void negMem(int base, int32_t disp) { rex(true, 0, base); byte(0xf7); mem(3, base, disp); }
+    void subMemImm8(int base, int32_t disp, int8_t imm) { rex(true, 0, base); byte(0x83); mem(5, base, disp); byte(static_cast<uint8_t>(imm)); }
+    void testRegReg(int a, int b) { rex(true, b, a); byte(0x85); byte(0xc0 | ((b & 7) << 3) | (a & 7)); }
+    void cmpEaxImm8(int8_t imm) { byte(0x83); byte(0xf8); byte(static_cast<uint8_t>(imm)); }
+
+    void cmpMem8Imm(int base, int32_t disp, uint8_t imm) { rex(false, 0, base); byte(0x80); mem(7, base, disp); byte(imm); }
+    void movMem8Imm(int base, int32_t disp, uint8_t imm) { rex(false, 0, base); byte(0xc6); mem(0, base, disp); byte(imm); }
+    void movMem8Al(int base, int32_t disp) { rex(false, 0, base); byte(0x88); mem(RAX, base, disp); }
+    void xorMem8Imm(int base, int32_t disp, uint8_t imm) { rex(false, 0, base); byte(0x80); mem(6, base, disp); byte(imm); }
+    void movzxEaxMem8(int base, int32_t disp) { rex(false, RAX, base); byte(0x0f); byte(0xb6); mem(RAX, base, disp); }
+    void setccAl(Cond cc) { byte(0x0f); byte(0x90 | cc); byte(0xc0); }
+
+    // SSE2 scalar double ops on xmm0 with a memory operand
+    void sse(uint8_t prefix, uint8_t op, int xmm, int base, int32_t disp) {
+        byte(prefix);
+        rex(false, xmm, base);
+        byte(0x0f);
+        byte(op);
+        mem(xmm, base, disp);
+    }
+    void movsdLoad(int base, int32_t disp) { sse(0xf2, 0x10, 0, base, disp); }
+    void movsdStore(int base, int32_t disp) { sse(0xf2, 0x11, 0, base, disp); }
+    void arithsd(uint8_t op, int base, int32_t disp) { sse(0xf2, op, 0, base, disp); }
+    void ucomisd(int base, int32_t disp) { sse(0x66, 0x2e, 0, base, disp); }
+    void callReg(int r) { rex(false, 0, r); byte(0xff); byte(0xd0 | (r & 7)); }
+    void jmpReg(int r) { rex(false, 0, r); byte(0xff); byte(0xe0 | (r & 7)); }
+
+    // Jumps with a rel32 to be patched; return the position of the rel32
+    size_t jmp() { byte(0xe9); u32(0); return size() - 4; }
+    size_t jcc(Cond cc) { byte(0x0f); byte(0x80 | cc); u32(0); return size() - 4; }
+
+    void bind(size_t rel32At, size_t target) {
+        patch32(rel32At, static_cast<int32_t>(target - (rel32At + 4)));
+    }
+};
+
+} // namespace
+
+// Translates one chunk. Register conventions inside generated code:
+//   rbx = JitContext*, r12 = stack top (one past the topmost Value),
+//   r13 = local slot 0 (reloaded after helpers, which may move the stack).
+class JitCodegen {
+public:
+    using Helper = Value* (*)(JitContext*, Value*, uint64_t, uint64_t);
+
+    JitCodegen(const Chunk* chunk, const ValueLayout& layout)
+        : chunk(chunk), V(layout.size), TAG(layout.indexOffset) {}
+
+    bool generate(std::vector<uint8_t>& out, std::vector<uint32_t>& entryOffsets) {
+        const std::vector<uint8_t>& bc = chunk->code;
+        nativeAt.assign(bc.size() + 1, 0);
+
+        emitPrologue();
+        for (size_t pc = 0; pc < bc.size();) {
+            nativeAt[pc] = static_cast<uint32_t>(a.size());
+            size_t length = emitInstruction(pc);
+            if (length == 0) return false;
+            pc += length;
+        }
+        nativeAt[bc.size()] = static_cast<uint32_t>(a.size());
+        // Falling off the end behaves like OP_RETURN
+        branches.push_back({a.jmp(), Target::Ok});
+
+        size_t okExit = a.size();
+        a.movRegImm32(RAX, static_cast<uint32_t>(InterpretResult::OK));
+        size_t okToEpilogue = a.jmp();
+        size_t suspendedExit = a.size();
+        a.movRegImm32(RAX, static_cast<uint32_t>(InterpretResult::SUSPENDED));
+        size_t suspendedToEpilogue = a.jmp();
+        size_t errorExit = a.size();
+        a.movRegImm32(RAX, static_cast<uint32_t>(InterpretResult::RUNTIME_ERROR));
+        a.bind(okToEpilogue, a.size());
+        a.bind(suspendedToEpilogue, a.size());
+        a.movMemReg(RBX, offsetof(JitContext, stackTop), R12);
+        a.pop(R15); a.pop(R14); a.pop(R13); a.pop(R12); a.pop(RBX);
+        a.ret();
+
+        for (SlowPath& slow : slowPaths) {
+            size_t stub = a.size();
+            for (size_t site : slow.sites) a.bind(site, stub);
+            emitHelperCall(slow.helper, slow.operand, slow.pc);
+            if (slow.branch != kNoBranch) emitBranchIfSet(slow.branch, slow.branchKind);
+            branches.push_back({a.jmp(), Target::Bytecode, slow.resume});
+        }
+
+        // Budget exhausted at a back-edge: leave with ip at the loop target
+        for (const Suspension& suspension : suspensions) {
+            a.bind(suspension.site, a.size());
+            emitHelperCall(&Jit::helperSuspend, suspension.target, suspension.pc);
+            branches.push_back({a.jmp(), Target::Suspended});
+        }
+
+        for (const Branch& b : branches) {
+            size_t target = b.kind == Target::Ok ? okExit
+                          : b.kind == Target::Error ? errorExit
+                          : b.kind == Target::Suspended ? suspendedExit
+                          : b.kind == Target::Native ? b.pc
+                          : nativeAt[b.pc];
+            a.bind(b.at, target);
+        }
+
+        out = std::move(a.code);
+        entryOffsets = std::move(nativeAt);
+        return true;
+    }
+
+private:
+    enum class Target { Bytecode, Native, Ok, Suspended, Error };
+    struct Branch {
+        size_t at;
+        Target kind;
+        size_t pc = 0; // Bytecode offset, or native offset for Target::Native
+    };
+    struct Suspension {
+        size_t site;   // rel32 of the jump taken when the budget runs out
+        size_t pc;     // The back-edge instruction
+        size_t target; // Bytecode offset to resume at
+    };
+    struct SlowPath {
+        std::vector<size_t> sites;
+        Helper helper;
+        uint64_t operand;
+        size_t pc;     // Bytecode offset of the instruction (for error lines)
+        size_t resume; // Bytecode offset to continue at
+        size_t branch = kNoBranch; // Taken instead of `resume` if the helper sets ctx->branch
+        Target branchKind = Target::Bytecode;
+    };
+    static constexpr size_t kNoBranch = SIZE_MAX;
+
+    const Chunk* chunk;
+    Assembler a;
+    std::vector<uint32_t> nativeAt;
+    std::vector<Branch> branches;
+    std::vector<SlowPath> slowPaths;
+    std::vector<Suspension> suspensions;
+    int32_t V;   // sizeof(Value)
+    int32_t TAG; // Offset of the type tag inside a Value
+
+    int32_t slot(int fromTop) const { return -V * fromTop; } // slot(1) is the top value
+
+    void emitPrologue() {
+        // Five pushes keep rsp 16-byte aligned for helper calls
+        a.push(RBX); a.push(R12); a.push(R13); a.push(R14); a.push(R15);
+        a.movRegReg(RBX, RDI);
+        a.movRegMem(R12, RBX, offsetof(JitContext, stackTop));
+        a.movRegMem(R13, RBX, offsetof(JitContext, slots));
+        a.jmpReg(RSI);
+    }
+
+    void emitHelperCall(Helper helper, uint64_t operand, size_t pc) {
+        a.movRegReg(RDI, RBX);
+        a.movRegReg(RSI, R12);
+        a.movRegImm64(RDX, operand);
+        a.movRegImm64(RCX, pc);
+        a.movRegImm64(RAX, reinterpret_cast<uint64_t>(helper));
+        a.callReg(RAX);
+        a.testRegReg(RAX, RAX);
+        branches.push_back({a.jcc(CC_E), Target::Error});
+        a.movRegReg(R12, RAX);
+        a.movRegMem(R13, RBX, offsetof(JitContext, slots));
+    }
+
+    void emitBranchIfSet(size_t target, Target kind = Target::Bytecode) {
+        a.cmpMem8Imm(RBX, offsetof(JitContext, branch), 0);
+        branches.push_back({a.jcc(CC_NE), kind, target});
+    }
+
+    // Leaves native code when the helper set ctx->branch; it has already
+    // pointed the VM's registers where the interpreter must continue
+    void emitExitIfSet() {
+        a.cmpMem8Imm(RBX, offsetof(JitContext, branch), 0);
+        branches.push_back({a.jcc(CC_NE), Target::Ok});
+    }
+
+    int32_t local(int index) const { return V * index; } // Displacement from r13
+
+    // Loop back-edge from the instruction at `pc` to bytecode `target`,
+    // spending one step of the budget
+    void emitBackEdge(size_t pc, size_t target) {
+        a.movRegMem(RAX, RBX, offsetof(JitContext, budget));
+        a.subMemImm8(RAX, 0, 1);
+        suspensions.push_back({a.jcc(CC_E), pc, target});
+        branches.push_back({a.jmp(), Target::Bytecode, target});
+    }
+
+    SlowPath& slowPath(Helper helper, uint64_t operand, size_t pc, size_t resume) {
+        slowPaths.push_back({{}, helper, operand, pc, resume});
+        return slowPaths.back();
+    }
+
+    // Guard for writing a scalar into the slot at the top: the slot must not
+    // still own a string. Room is not checked; the chunk reserved its maximum
+    // depth on entry.
+    void guardPushSlot(SlowPath& slow) {
+        a.cmpMem8Imm(R12, TAG, kTagString);
+        slow.sites.push_back(a.jcc(CC_E));
+    }
+
+    void guardDoubles(SlowPath& slow, int count) {
+        for (int i = 1; i <= count; i++) {
+            a.cmpMem8Imm(R12, slot(i) + TAG, kTagDouble);
+            slow.sites.push_back(a.jcc(CC_NE));
+        }
+    }
+
+    // Both operands integers: falls through into the integer code. Otherwise
+    // returns the position of a jump to be bound to the double code, which
+    // must then start with guardDoubles.
+    size_t guardIntegers(SlowPath& slow) {
+        a.cmpMem8Imm(R12, slot(2) + TAG, kTagInteger);
+        size_t notInteger = a.jcc(CC_NE);
+        a.cmpMem8Imm(R12, slot(1) + TAG, kTagInteger);
+        slow.sites.push_back(a.jcc(CC_NE));
+        return notInteger;
+    }
+
+    size_t emitInstruction(size_t pc) {
+        const uint8_t* bc = chunk->code.data();
+        // Quickened opcodes get the same guarded code as their generic forms;
+        // typed ones drop the guards
+        OpCode op = genericOpcode(static_cast<OpCode>(bc[pc]));
+        OperandType typed = operandType(static_cast<OpCode>(bc[pc]));
+        switch (op) {
+            case OpCode::OP_CONSTANT: {
+                uint8_t index = bc[pc + 1];
+                const Value& constant = chunk->constants[index];
+                if (std::holds_alternative<double>(constant) || std::holds_alternative<int64_t>(constant)) {
+                    SlowPath& slow = slowPath(&Jit::helperConstant, index, pc, pc + 2);
+                    guardPushSlot(slow);
+                    uint64_t bits;
+                    if (const double* d = std::get_if<double>(&constant)) {
+                        std::memcpy(&bits, d, sizeof(bits));
+                    } else {
+                        bits = static_cast<uint64_t>(std::get<int64_t>(constant));
+                    }
+                    a.movRegImm64(RAX, bits);
+                    a.movMemReg(R12, 0, RAX);
+                    a.movMem8Imm(R12, TAG, static_cast<uint8_t>(constant.index()));
+                    a.addRegImm(R12, V);
+                } else {
+                    emitHelperCall(&Jit::helperConstant, index, pc);
+                }
+                return 2;
+            }
+            case OpCode::OP_NIL:
+            case OpCode::OP_TRUE:
+            case OpCode::OP_FALSE: {
+                SlowPath& slow = slowPath(&Jit::helperLiteral, static_cast<uint64_t>(op), pc, pc + 1);
+                guardPushSlot(slow);
+                if (op == OpCode::OP_NIL) {
+                    a.movMem8Imm(R12, TAG, kTagNil);
+                } else {
+                    a.movMem8Imm(R12, 0, op == OpCode::OP_TRUE ? 1 : 0);
+                    a.movMem8Imm(R12, TAG, kTagBool);
+                }
+                a.addRegImm(R12, V);
+                return 1;
+            }
+            case OpCode::OP_POP:
+                // The slot stays a constructed Value; a later write replaces it
+                a.subRegImm(R12, V);
+                return 1;
+
+            case OpCode::OP_GET_GLOBAL:
+                emitHelperCall(&Jit::helperGetGlobal, bc[pc + 1], pc);
+                return 2;
+            case OpCode::OP_SET_GLOBAL:
+                emitHelperCall(&Jit::helperSetGlobal, bc[pc + 1], pc);
+                return 2;
+            case OpCode::OP_DEFINE_GLOBAL:
+                emitHelperCall(&Jit::helperDefineGlobal, bc[pc + 1], pc);
+                return 2;
+
+            case OpCode::OP_EQUAL:
+                emitHelperCall(&Jit::helperEqual, 0, pc);
+                return 1;
+
+            case OpCode::OP_GREATER:
+            case OpCode::OP_LESS: {
+                SlowPath& slow = slowPath(&Jit::helperCompare, static_cast<uint64_t>(op), pc, pc + 1);
+                size_t notInteger = guardIntegers(slow);
+                a.movRegMem(RAX, R12, slot(2));
+                a.cmpRegMem(RAX, R12, slot(1));
+                a.setccAl(op == OpCode::OP_GREATER ? CC_G : CC_L);
+                a.movMem8Al(R12, slot(2));
+                a.movMem8Imm(R12, slot(2) + TAG, kTagBool);
+                a.subRegImm(R12, V);
+                size_t done = a.jmp();
+
+                a.bind(notInteger, a.size());
+                guardDoubles(slow, 2);
+                // a > b  is  a above b;  a < b  is  b above a (false when unordered)
+                if (op == OpCode::OP_GREATER) {
+                    a.movsdLoad(R12, slot(2));
+                    a.ucomisd(R12, slot(1));
+                } else {
+                    a.movsdLoad(R12, slot(1));
+                    a.ucomisd(R12, slot(2));
+                }
+                a.setccAl(CC_A);
+                a.movMem8Al(R12, slot(2));
+                a.movMem8Imm(R12, slot(2) + TAG, kTagBool);
+                a.subRegImm(R12, V);
+                a.bind(done, a.size());
+                return 1;
+            }
+
+            case OpCode::OP_ADD:
+            case OpCode::OP_SUBTRACT:
+            case OpCode::OP_MULTIPLY:
+            case OpCode::OP_DIVIDE: {
+                static const uint8_t sseOps[] = {0x58, 0x5c, 0x59, 0x5e}; // add, sub, mul, div
+                uint8_t sseOp = sseOps[static_cast<int>(op) - static_cast<int>(OpCode::OP_ADD)];
+                if (typed == OperandType::Integer) {
+                    a.movRegMem(RAX, R12, slot(2));
+                    if (op == OpCode::OP_ADD) a.addRegMem(RAX, R12, slot(1));
+                    else if (op == OpCode::OP_SUBTRACT) a.subRegMem(RAX, R12, slot(1));
+                    else a.imulRegMem(RAX, R12, slot(1));
+                    a.movMemReg(R12, slot(2), RAX);
+                    a.subRegImm(R12, V);
+                    return 1;
+                }
+                if (typed == OperandType::Float) {
+                    a.movsdLoad(R12, slot(2));
+                    a.arithsd(sseOp, R12, slot(1));
+                    a.movsdStore(R12, slot(2));
+                    a.subRegImm(R12, V);
+                    return 1;
+                }
+                SlowPath& slow = slowPath(&Jit::helperArith, static_cast<uint64_t>(op), pc, pc + 1);
+                size_t done = 0, notInteger = 0;
+                if (op != OpCode::OP_DIVIDE) {
+                    // Integer operands: wrapping 64-bit arithmetic, the tag stays
+                    notInteger = guardIntegers(slow);
+                    a.movRegMem(RAX, R12, slot(2));
+                    if (op == OpCode::OP_ADD) a.addRegMem(RAX, R12, slot(1));
+                    else if (op == OpCode::OP_SUBTRACT) a.subRegMem(RAX, R12, slot(1));
+                    else a.imulRegMem(RAX, R12, slot(1));
+                    a.movMemReg(R12, slot(2), RAX);
+                    a.subRegImm(R12, V);
+                    done = a.jmp();
+                    a.bind(notInteger, a.size());
+                }
+                guardDoubles(slow, 2);
+                a.movsdLoad(R12, slot(2));
+                a.arithsd(sseOp, R12, slot(1));
+                a.movsdStore(R12, slot(2));
+                a.subRegImm(R12, V);
+                if (op != OpCode::OP_DIVIDE) a.bind(done, a.size());
+                return 1;
+            }
+
+            case OpCode::OP_FLOOR_DIVIDE:
+            case OpCode::OP_MODULO:
+                emitHelperCall(&Jit::helperArith, static_cast<uint64_t>(op), pc);
+                return 1;
+
+            case OpCode::OP_LESS_EQUAL:
+            case OpCode::OP_GREATER_EQUAL:
+                emitHelperCall(&Jit::helperCompare, static_cast<uint64_t>(op), pc);
+                return 1;
+
+            case OpCode::OP_JLT:
+            case OpCode::OP_JLE:
+            case OpCode::OP_JGT:
+            case OpCode::OP_JGE:
+            case OpCode::OP_JEQ: {
+                bool sense = bc[pc + 1] != 0;
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 2] << 8) | bc[pc + 3]);
+                size_t target = pc + 4 + offset;
+                // Condition codes for "jump": signed integer compare of a with b,
+                // and ucomisd of the operand order below (false when unordered)
+                struct Fused { OpCode generic; Cond integer; Cond negInteger; bool bFirst; Cond real; Cond negReal; };
+                static const Fused fused[] = {
+                    {OpCode::OP_LESS,          CC_L,  CC_GE, true,  CC_A,  CC_BE}, // b > a
+                    {OpCode::OP_LESS_EQUAL,    CC_LE, CC_G,  true,  CC_AE, CC_B},  // b >= a
+                    {OpCode::OP_GREATER,       CC_G,  CC_LE, false, CC_A,  CC_BE}, // a > b
+                    {OpCode::OP_GREATER_EQUAL, CC_GE, CC_L,  false, CC_AE, CC_B},  // a >= b
+                    {OpCode::OP_EQUAL,         CC_E,  CC_NE, false, CC_E,  CC_NE},
+                };
+                const Fused& f = fused[static_cast<int>(op) - static_cast<int>(OpCode::OP_JLT)];
+                if (typed == OperandType::Integer) {
+                    a.movRegMem(RAX, R12, slot(2));
+                    a.cmpRegMem(RAX, R12, slot(1));
+                    a.leaRegMem(R12, R12, -2 * V);
+                    branches.push_back({a.jcc(sense ? f.integer : f.negInteger), Target::Bytecode, target});
+                    return 4;
+                }
+                if (typed == OperandType::Float) {
+                    a.movsdLoad(R12, f.bFirst ? slot(1) : slot(2));
+                    a.ucomisd(R12, f.bFirst ? slot(2) : slot(1));
+                    a.leaRegMem(R12, R12, -2 * V);
+                    branches.push_back({a.jcc(sense ? f.real : f.negReal), Target::Bytecode, target});
+                    return 4;
+                }
+                SlowPath& slow = slowPath(&Jit::helperCompareJump,
+                                          static_cast<uint64_t>(f.generic) | (uint64_t{sense} << 8), pc, pc + 4);
+                slow.branch = target;
+
+                size_t notInteger = guardIntegers(slow);
+                a.movRegMem(RAX, R12, slot(2));
+                a.cmpRegMem(RAX, R12, slot(1));
+                a.leaRegMem(R12, R12, -2 * V); // Pop without touching the flags
+                branches.push_back({a.jcc(sense ? f.integer : f.negInteger), Target::Bytecode, target});
+                size_t done = a.jmp();
+
+                a.bind(notInteger, a.size());
+                if (op == OpCode::OP_JEQ) {
+                    // Equality of other types (and mixed numbers) goes through the helper
+                    slow.sites.push_back(a.jmp());
+                    a.bind(done, a.size());
+                    return 4;
+                }
+                guardDoubles(slow, 2);
+                a.movsdLoad(R12, f.bFirst ? slot(1) : slot(2));
+                a.ucomisd(R12, f.bFirst ? slot(2) : slot(1));
+                a.leaRegMem(R12, R12, -2 * V);
+                branches.push_back({a.jcc(sense ? f.real : f.negReal), Target::Bytecode, target});
+                a.bind(done, a.size());
+                return 4;
+            }
+
+            case OpCode::OP_CONCAT:
+                emitHelperCall(&Jit::helperConcat, bc[pc + 1], pc);
+                return 2;
+            case OpCode::OP_APPEND_LOCAL:
+                emitHelperCall(&Jit::helperAppendLocal, bc[pc + 1] | (bc[pc + 2] << 8), pc);
+                return 3;
+
+            // Calls of built-ins run in the helper; anything that changes the
+            // frame or the coroutine makes native code exit (see helperCall)
+            case OpCode::OP_CALL:
+                emitHelperCall(&Jit::helperCall, bc[pc + 1], pc);
+                emitExitIfSet();
+                return 2;
+            case OpCode::OP_TFORCALL:
+                emitHelperCall(&Jit::helperForCall, bc[pc + 1], pc);
+                emitExitIfSet();
+                return 2;
+            case OpCode::OP_TFORLOOP: {
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 2] << 8) | bc[pc + 3]);
+                emitHelperCall(&Jit::helperForInLoop, bc[pc + 1], pc);
+                emitBranchIfSet(pc + 4 + offset);
+                return 4;
+            }
+
+            case OpCode::OP_JTEST: {
+                bool sense = bc[pc + 1] != 0;
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 2] << 8) | bc[pc + 3]);
+                size_t target = pc + 4 + offset;
+                // Pop first; the slot stays readable. nil is falsy, bools test
+                // the payload, everything above bool is truthy.
+                a.subRegImm(R12, V);
+                a.movzxEaxMem8(R12, TAG);
+                a.cmpEaxImm8(kTagBool);
+                if (sense) {
+                    branches.push_back({a.jcc(CC_A), Target::Bytecode, target});
+                    size_t falsy = a.jcc(CC_B);
+                    a.cmpMem8Imm(R12, 0, 0);
+                    branches.push_back({a.jcc(CC_NE), Target::Bytecode, target});
+                    a.bind(falsy, a.size());
+                } else {
+                    size_t truthy = a.jcc(CC_A);
+                    branches.push_back({a.jcc(CC_B), Target::Bytecode, target});
+                    a.cmpMem8Imm(R12, 0, 0);
+                    branches.push_back({a.jcc(CC_E), Target::Bytecode, target});
+                    a.bind(truthy, a.size());
+                }
+                return 4;
+            }
+
+            case OpCode::OP_NOT:
+                emitHelperCall(&Jit::helperNot, 0, pc);
+                return 1;
+
+            case OpCode::OP_NEGATE: {
+                SlowPath& slow = slowPath(&Jit::helperNegate, 0, pc, pc + 1);
+                a.cmpMem8Imm(R12, slot(1) + TAG, kTagInteger);
+                size_t notInteger = a.jcc(CC_NE);
+                a.negMem(R12, slot(1));
+                size_t done = a.jmp();
+                a.bind(notInteger, a.size());
+                guardDoubles(slow, 1);
+                a.xorMem8Imm(R12, slot(1) + 7, 0x80); // Flip the sign bit in place
+                a.bind(done, a.size());
+                return 1;
+            }
+
+            case OpCode::OP_PRINT:
+                emitHelperCall(&Jit::helperPrint, 0, pc);
+                return 1;
+
+            case OpCode::OP_JUMP: {
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 1] << 8) | bc[pc + 2]);
+                branches.push_back({a.jmp(), Target::Bytecode, pc + 3 + offset});
+                return 3;
+            }
+            case OpCode::OP_LOOP: {
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 1] << 8) | bc[pc + 2]);
+                emitBackEdge(pc, pc + 3 - offset);
+                return 3;
+            }
+
+            case OpCode::OP_JUMP_IF_TRUE: {
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 1] << 8) | bc[pc + 2]);
+                size_t target = pc + 3 + offset;
+                a.movzxEaxMem8(R12, slot(1) + TAG);
+                a.cmpEaxImm8(kTagBool);
+                branches.push_back({a.jcc(CC_A), Target::Bytecode, target});
+                size_t falsy = a.jcc(CC_B);
+                a.cmpMem8Imm(R12, slot(1), 0);
+                branches.push_back({a.jcc(CC_NE), Target::Bytecode, target});
+                a.bind(falsy, a.size());
+                return 3;
+            }
+
+            case OpCode::OP_JUMP_IF_FALSE: {
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 1] << 8) | bc[pc + 2]);
+                size_t target = pc + 3 + offset;
+                // nil -> jump; numbers and strings -> fall through; bools test the payload
+                a.movzxEaxMem8(R12, slot(1) + TAG);
+                a.cmpEaxImm8(kTagBool);
+                size_t truthy = a.jcc(CC_A);
+                branches.push_back({a.jcc(CC_B), Target::Bytecode, target});
+                a.cmpMem8Imm(R12, slot(1), 0);
+                branches.push_back({a.jcc(CC_E), Target::Bytecode, target});
+                a.bind(truthy, a.size());
+                return 3;
+            }
+
+            case OpCode::OP_GET_LOCAL: {
+                int32_t source = local(bc[pc + 1]);
+                SlowPath& slow = slowPath(&Jit::helperGetLocal, bc[pc + 1], pc, pc + 2);
+                guardPushSlot(slow);
+                a.cmpMem8Imm(R13, source + TAG, kTagString);
+                slow.sites.push_back(a.jcc(CC_E));
+                a.movRegMem(RAX, R13, source);
+                a.movMemReg(R12, 0, RAX);
+                a.movzxEaxMem8(R13, source + TAG);
+                a.movMem8Al(R12, TAG);
+                a.addRegImm(R12, V);
+                return 2;
+            }
+            case OpCode::OP_SET_LOCAL: {
+                int32_t target = local(bc[pc + 1]);
+                SlowPath& slow = slowPath(&Jit::helperSetLocal, bc[pc + 1], pc, pc + 2);
+                a.cmpMem8Imm(R12, slot(1) + TAG, kTagString);
+                slow.sites.push_back(a.jcc(CC_E));
+                a.cmpMem8Imm(R13, target + TAG, kTagString);
+                slow.sites.push_back(a.jcc(CC_E));
+                a.movRegMem(RAX, R12, slot(1));
+                a.movMemReg(R13, target, RAX);
+                a.movzxEaxMem8(R12, slot(1) + TAG);
+                a.movMem8Al(R13, target + TAG);
+                return 2;
+            }
+
+            case OpCode::OP_FORPREP: {
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 2] << 8) | bc[pc + 3]);
+                emitHelperCall(&Jit::helperForPrep, bc[pc + 1], pc);
+                emitBranchIfSet(pc + 4 + offset);
+                return 4;
+            }
+            case OpCode::OP_FORLOOP: {
+                // Integer loops count down inline; float loops and a loop
+                // variable that holds a string go through the helper.
+                uint8_t base = bc[pc + 1];
+                uint16_t offset = static_cast<uint16_t>((bc[pc + 2] << 8) | bc[pc + 3]);
+                size_t target = pc + 4 - offset;
+                int32_t index = local(base), step = local(base + 2);
+                int32_t count = local(base + 3), variable = local(base + 4);
+                SlowPath& slow = slowPath(&Jit::helperForLoop, base, pc, pc + 4);
+                a.cmpMem8Imm(R13, count + TAG, kTagInteger);
+                slow.sites.push_back(a.jcc(CC_NE));
+                a.cmpMem8Imm(R13, variable + TAG, kTagString);
+                slow.sites.push_back(a.jcc(CC_E));
+
+                a.movRegMem(RAX, R13, count);
+                a.testRegReg(RAX, RAX);
+                branches.push_back({a.jcc(CC_E), Target::Bytecode, pc + 4});
+                a.subRegImm(RAX, 1);
+                a.movMemReg(R13, count, RAX);
+                a.movRegMem(RAX, R13, index);
+                a.addRegMem(RAX, R13, step);
+                a.movMemReg(R13, index, RAX);
+                a.movMemReg(R13, variable, RAX);
+                a.movMem8Imm(R13, variable + TAG, kTagInteger);
+                // The slow path joins here when it repeats the loop
+                slow.branch = a.size();
+                slow.branchKind = Target::Native;
+                emitBackEdge(pc, target);
+                return 4;
+            }
+
+            case OpCode::OP_RETURN:
+                // The interpreter pops the frame
+                emitHelperCall(&Jit::helperExit, 0, pc);
+                branches.push_back({a.jmp(), Target::Ok});
+                return 1;
+
+            default:
+                break;
+        }
+        return 0; // Unknown opcode
+    }
+};
+
+// --- Jit ---
+
+bool Jit::available() {
+    return valueLayout().ok;
+}
+
+Jit::~Jit() {
+    for (auto& entry : compiled) {
+        munmap(entry.second.memory, entry.second.size);
+    }
+}
+
+bool Jit::compile(const Chunk* chunk) {
+    if (!available()) return false;
+
+    std::vector<uint8_t> code;
+    CompiledChunk result;
+    JitCodegen codegen(chunk, valueLayout());
+    if (!codegen.generate(code, result.entryOffsets)) return false;
+
+    // Write the code into RW pages, then flip them to RX
+    result.size = code.size();
+    void* memory = mmap(nullptr, result.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return false;
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, result.size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, result.size);
+        return false;
+    }
+    result.memory = memory;
+    compiled[chunk] = std::move(result);
+    return true;
+}
+
+void Jit::release(const Chunk* chunk) {
+    auto entry = compiled.find(chunk);
+    if (entry == compiled.end()) return;
+    munmap(entry->second.memory, entry->second.size);
+    compiled.erase(entry);
+}
+
+InterpretResult Jit::execute(VM* vm, const Chunk* chunk, const uint8_t* ip) {
+    const CompiledChunk& code = compiled.at(chunk);
+    size_t pc = ip - chunk->code.data();
+
+    JitContext ctx;
+    ctx.stackTop = vm->stackTop;
+    ctx.slots = vm->slots;
+    ctx.vm = vm;
+    ctx.chunk = chunk;
+    ctx.branch = 0;
+    ctx.budget = &vm->budget;
+
+    const uint8_t* base = static_cast<const uint8_t*>(code.memory);
+    EntryFn entry = reinterpret_cast<EntryFn>(code.memory);
+    InterpretResult status = static_cast<InterpretResult>(entry(&ctx, base + code.entryOffsets[pc]));
+
+    // On success (or suspension) the exiting helper has set the registers.
+    // After an error native code may not have the latest top; drop the operands.
+    if (status == InterpretResult::RUNTIME_ERROR) vm->stackTop = vm->stackBase();
+    return status;
+}
+
+// --- Helpers ---
+//
+// Each helper publishes the native stack top to the VM, points ip just past
+// the current opcode (so runtimeError reports the right line), performs the
+// operation with the VM's own primitives, then hands the possibly reallocated
+// stack back to native code. Generated code has no unwind info, so a C++
+// exception must not leave a helper: JIT_EXIT turns it into a runtime error.
+
+#define JIT_ENTER()                                                              \
+    VM* vm = ctx->vm;                                                            \
+    vm->stackTop = top;                                                          \
+    vm->ip = const_cast<uint8_t*>(ctx->chunk->code.data()) + offset + 1;         \
+    try {
+#define JIT_EXIT()                                                               \
+    } catch (...) {                                                              \
+        vm->exceptionError();                                                    \
+        return nullptr;                                                          \
+    }
+#define JIT_LEAVE() (ctx->slots = vm->slots, vm->stackTop)
+
+Value* Jit::helperConstant(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    vm->push(ctx->chunk->constants[operand]);
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperLiteral(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    switch (static_cast<OpCode>(operand)) {
+        case OpCode::OP_TRUE: vm->push(true); break;
+        case OpCode::OP_FALSE: vm->push(false); break;
+        default: vm->push(Nil{}); break;
+    }
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperGetGlobal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    const std::string& name = std::get<std::string>(ctx->chunk->constants[operand]);
+    auto it = vm->globals.find(name);
+    vm->push(it == vm->globals.end() ? Value(Nil{}) : it->second);
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperSetGlobal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    const std::string& name = std::get<std::string>(ctx->chunk->constants[operand]);
+    vm->globals[name] = vm->stackTop[-1];
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperDefineGlobal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    const std::string& name = std::get<std::string>(ctx->chunk->constants[operand]);
+    vm->globals[name] = std::move(*--vm->stackTop);
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperEqual(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    bool equal = vm->valuesEqual(vm->stackTop[-2], vm->stackTop[-1]);
+    vm->stackTop--;
+    vm->stackTop[-1] = equal;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperNot(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    vm->stackTop[-1] = isFalsey(vm->stackTop[-1]);
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperPrint(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    vm->stdoutBuffer.writeValue(vm->stackTop[-1]);
+    vm->stdoutBuffer.put('\n');
+    vm->stackTop--;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperArith(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    if (!vm->binaryOp(static_cast<OpCode>(operand))) return nullptr;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperCompare(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    if (!vm->compareOp(static_cast<OpCode>(operand))) return nullptr;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperConcat(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    if (!vm->concatenate(static_cast<int>(operand))) return nullptr;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+// Built-ins are called here. A Lua function (or a non-callable value) is left
+// to the interpreter: native code exits with ip at the OP_CALL. If the
+// built-in switched coroutines, the registers already belong to the other
+// coroutine and native code exits as well; so it does if the built-in set
+// a hook (VM::redispatch), for the interpreter to switch loops.
+Value* Jit::helperCall(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    ctx->branch = 0;
+    if (!std::holds_alternative<NativeFunction*>(top[-static_cast<int64_t>(operand) - 1])) {
+        vm->ip--;
+        ctx->branch = 1;
+        return top;
+    }
+    Coroutine* caller = vm->current;
+    vm->ip++; // Past the operand: a coroutine switch saves this as the return point
+    if (!vm->callValue(static_cast<int>(operand))) return nullptr;
+    ctx->branch = vm->current != caller || vm->hooks.changed;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperForCall(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    ctx->branch = 0;
+    Value* loop = vm->slots + operand;
+    if (!std::holds_alternative<NativeFunction*>(loop[0])) {
+        vm->ip--;
+        ctx->branch = 1;
+        return top;
+    }
+    Coroutine* caller = vm->current;
+    vm->ip++;
+    if (!vm->forCall(loop)) return nullptr;
+    ctx->branch = vm->current != caller || vm->hooks.changed;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperForInLoop(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    Value* loop = vm->slots + operand;
+    if (vm->stackTop != loop + 2) loop[1] = std::move(*--vm->stackTop);
+    ctx->branch = std::holds_alternative<Nil>(loop[1]);
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+// Hands control back to the interpreter at the current instruction
+Value* Jit::helperExit(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    vm->ip--;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+// The budget ran out at a back-edge: the script continues at bytecode
+// `operand` (the loop start) when it is resumed
+Value* Jit::helperSuspend(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    vm->ip = const_cast<uint8_t*>(ctx->chunk->code.data()) + operand;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+// operand: slot | count << 8
+Value* Jit::helperAppendLocal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    if (!vm->appendToLocal(operand & 0xff, static_cast<int>(operand >> 8))) return nullptr;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+// operand: generic comparison opcode (OP_EQUAL for OP_JEQ) | sense << 8
+Value* Jit::helperCompareJump(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    OpCode op = static_cast<OpCode>(operand & 0xff);
+    bool sense = (operand >> 8) != 0;
+    bool result;
+    if (op == OpCode::OP_EQUAL) {
+        result = vm->valuesEqual(vm->stackTop[-2], vm->stackTop[-1]);
+    } else if (!vm->compareValues(op, vm->stackTop[-2], vm->stackTop[-1], result)) {
+        return nullptr;
+    }
+    vm->stackTop -= 2;
+    ctx->branch = result == sense;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperNegate(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    if (!vm->negateOp()) return nullptr;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperGetLocal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    vm->push(vm->slots[operand]);
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperSetLocal(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    vm->slots[operand] = vm->stackTop[-1];
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperForPrep(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    bool enter;
+    if (!vm->forPrepare(vm->slots + operand, enter)) return nullptr;
+    ctx->branch = !enter;
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+Value* Jit::helperForLoop(JitContext* ctx, Value* top, uint64_t operand, uint64_t offset) {
+    JIT_ENTER();
+    ctx->branch = vm->forLoop(vm->slots + operand);
+    return JIT_LEAVE();
+    JIT_EXIT()
+}
+
+#undef JIT_ENTER
+#undef JIT_EXIT
+#undef JIT_LEAVE
+
+#endif // LUA_HAS_JIT
@@ -2,11 +2,46 @@
 #include <unordered_map>
 #include <cctype>
 
-Lexer::Lexer(const std::string& source) : source(source) {}
+namespace {
+// Built during static initialization, so it is never charged to a
+// script's MemoryStats (which it would outlive)
+const std::unordered_map<std::string, TokenType> keywords = {
+    {"and", TokenType::AND},
+    {"break", TokenType::BREAK},
+    {"do", TokenType::DO},
+    {"else", TokenType::ELSE},
+    {"elseif", TokenType::ELSEIF},
+    {"end", TokenType::END},
+    {"false", TokenType::FALSE},
+    {"for", TokenType::FOR},
+    {"function", TokenType::FUNCTION},
+    {"if", TokenType::IF},
+    {"in", TokenType::IN},
+    {"local", TokenType::LOCAL},
+    {"nil", TokenType::NIL},
+    {"not", TokenType::NOT},
+    {"or", TokenType::OR},
+    {"repeat", TokenType::REPEAT},
+    {"return", TokenType::RETURN},
+    {"then", TokenType::THEN},
+    {"true", TokenType::TRUE},
+    {"until", TokenType::UNTIL},
+    {"while", TokenType::WHILE}
+};
+}
+
+Lexer::Lexer(const std::string& source, int line, int column) : source(source), line(line), column(column) {}
 
 std::vector<Token> Lexer::scanTokens() {
     while (!isAtEnd()) {
+        if (bodyNext) {
+            bodyNext = false;
+            skipBody();
+            continue;
+        }
         start = current;
+        startLine = line;
+        startColumn = column;
         scanToken();
     }
     tokens.emplace_back(TokenType::TOKEN_EOF, "", line, column);
@@ -41,11 +76,81 @@ bool Lexer::match(char expected) {
 }
 
 void Lexer::addToken(TokenType type) {
+    if (skipDepth > 0) {
+        // Skipping a body: only the keywords that open or close a block count
+        if (type == TokenType::FUNCTION || type == TokenType::IF || type == TokenType::DO) {
+            skipDepth++;
+        } else if (type == TokenType::END) {
+            skipDepth--;
+        }
+        return;
+    }
     addToken(type, source.substr(start, current - start));
 }
 
 void Lexer::addToken(TokenType type, std::string literal) {
-    tokens.emplace_back(type, literal, line, column);
+    tokens.emplace_back(type, literal, startLine, startColumn);
+    if (lazy) trackHeader(type);
+}
+
+// Follows `function name(params)` (or `function (params)`) so that a lazy
+// lexer knows where the body starts
+void Lexer::trackHeader(TokenType type) {
+    switch (header) {
+        case Header::None:
+            if (type == TokenType::FUNCTION) header = Header::Name;
+            break;
+        case Header::Name:
+            if (type == TokenType::LEFT_PAREN) {
+                header = Header::Params;
+            } else if (type != TokenType::IDENTIFIER) {
+                header = Header::None;
+            }
+            break;
+        case Header::Params:
+            if (type == TokenType::RIGHT_PAREN) {
+                header = Header::None;
+                bodyNext = true;
+            } else if (type != TokenType::IDENTIFIER && type != TokenType::COMMA) {
+                header = Header::None;
+            }
+            break;
+    }
+}
+
+// Scans a function body without making tokens, up to the 'end' that closes
+// it, and emits the text before that 'end' as a FUNCTION_BODY token. Every
+// 'function', 'if' and 'do' (which ends the header of while and for) opens a
+// block closed by an 'end'. If the input runs out first, or the body is
+// short, it is left to be lexed normally.
+void Lexer::skipBody() {
+    int bodyStart = current;
+    int bodyLine = line;
+    int bodyColumn = column;
+    skipDepth = 1;
+    while (!isAtEnd()) {
+        start = current;
+        startLine = line;
+        startColumn = column;
+        scanToken();
+        if (skipDepth == 0) {
+            if (start - bodyStart < kMinLazyBody) break;
+            tokens.emplace_back(TokenType::FUNCTION_BODY, source.substr(bodyStart, start - bodyStart),
+                                bodyLine, bodyColumn);
+            tokens.emplace_back(TokenType::END, "end", startLine, startColumn);
+            return;
+        }
+    }
+    skipDepth = 0;
+    current = bodyStart;
+    line = bodyLine;
+    column = bodyColumn;
+}
+
+// Lexical errors go to stderr, except in a body being skipped: they are
+// reported when it is lexed for real
+void Lexer::report(const std::string& message) {
+    if (skipDepth == 0) std::cerr << message << std::endl;
 }
 
 void Lexer::scanToken() {
@@ -56,7 +161,7 @@ void Lexer::scanToken() {
         case '{': addToken(TokenType::LEFT_BRACE); break;
         case '}': addToken(TokenType::RIGHT_BRACE); break;
         case ',': addToken(TokenType::COMMA); break;
-        case '.': addToken(TokenType::DOT); break;
+        case '.': addToken(match('.') ? TokenType::DOT_DOT : TokenType::DOT); break;
         case '-': 
             if (match('-')) {
                 // Comment
@@ -69,10 +174,19 @@ void Lexer::scanToken() {
         case ';': addToken(TokenType::SEMICOLON); break;
         case '*': addToken(TokenType::STAR); break;
         case '!': addToken(match('=') ? TokenType::BANG_EQUAL : TokenType::BANG); break;
+        case '~':
+            // Lua's inequality; a lone '~' (bitwise xor) is not supported
+            if (match('=')) {
+                addToken(TokenType::BANG_EQUAL);
+            } else {
+                report("Unexpected character at line " + std::to_string(line) + ": " + c);
+            }
+            break;
         case '=': addToken(match('=') ? TokenType::EQUAL_EQUAL : TokenType::EQUAL); break;
         case '<': addToken(match('=') ? TokenType::LESS_EQUAL : TokenType::LESS); break;
         case '>': addToken(match('=') ? TokenType::GREATER_EQUAL : TokenType::GREATER); break;
-        case '/': addToken(TokenType::SLASH); break;
+        case '/': addToken(match('/') ? TokenType::SLASH_SLASH : TokenType::SLASH); break;
+        case '%': addToken(TokenType::PERCENT); break;
         
         case ' ':
         case '\r':
@@ -91,7 +205,7 @@ void Lexer::scanToken() {
                 identifier();
             } else {
                 // Error: Unexpected character
-                std::cerr << "Unexpected character at line " << line << ": " << c << std::endl;
+                report("Unexpected character at line " + std::to_string(line) + ": " + c);
             }
             break;
     }
@@ -103,30 +217,100 @@ void Lexer::string() {
             line++;
             column = 1;
         }
+        if (peek() == '\\' && peekNext() != '\0') advance(); // An escaped quote does not end the string
         advance();
     }
 
     if (isAtEnd()) {
-        std::cerr << "Unterminated string at line " << line << std::endl;
+        report("Unterminated string at line " + std::to_string(line));
         return;
     }
 
     advance(); // The closing "
+    if (skipDepth > 0) return;
 
-    // Trim the surrounding quotes
-    std::string value = source.substr(start + 1, current - start - 2);
+    // Trim the surrounding quotes and decode escape sequences
+    std::string value;
+    for (int i = start + 1; i < current - 1; i++) {
+        char c = source[i];
+        if (c != '\\') {
+            value += c;
+            continue;
+        }
+        c = source[++i];
+        switch (c) {
+            case 'n': value += '\n'; break;
+            case 't': value += '\t'; break;
+            case 'r': value += '\r'; break;
+            case 'a': value += '\a'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'v': value += '\v'; break;
+            default:
+                if (isdigit(c)) {
+                    // \ddd: up to three decimal digits
+                    int code = 0;
+                    for (int digits = 0; digits < 3 && i < current - 1 && isdigit(source[i]); digits++) {
+                        code = code * 10 + (source[i++] - '0');
+                    }
+                    i--;
+                    value += static_cast<char>(code);
+                } else {
+                    value += c; // \\, \", \' and anything unknown stand for themselves
+                }
+        }
+    }
     addToken(TokenType::STRING, value);
 }
 
 void Lexer::number() {
+    // Hexadecimal integer (0xff) or float (0x1.8p+3, as string.format's %q
+    // writes floats)
+    if (source[start] == '0' && (peek() == 'x' || peek() == 'X') && isxdigit(peekNext())) {
+        advance();
+        while (isxdigit(peek())) advance();
+        bool isFloat = false;
+        if (peek() == '.' && isxdigit(peekNext())) {
+            isFloat = true;
+            advance();
+            while (isxdigit(peek())) advance();
+        }
+        if (peek() == 'p' || peek() == 'P') {
+            int length = static_cast<int>(source.length());
+            int digit = current + 1;
+            if (digit < length && (source[digit] == '+' || source[digit] == '-')) digit++;
+            if (digit < length && isdigit(source[digit])) {
+                isFloat = true;
+                while (current < digit) advance();
+                while (isdigit(peek())) advance();
+            }
+        }
+        addToken(isFloat ? TokenType::NUMBER : TokenType::INTEGER);
+        return;
+    }
+
+    bool isFloat = false;
     while (isdigit(peek())) advance();
 
     if (peek() == '.' && isdigit(peekNext())) {
+        isFloat = true;
         advance(); // Consume the "."
         while (isdigit(peek())) advance();
     }
 
-    addToken(TokenType::NUMBER);
+    // Exponent: 1e10, 2.5E-3
+    if (peek() == 'e' || peek() == 'E') {
+        int length = static_cast<int>(source.length());
+        int digit = current + 1;
+        if (digit < length && (source[digit] == '+' || source[digit] == '-')) digit++;
+        if (digit < length && isdigit(source[digit])) {
+            isFloat = true;
+            while (current < digit) advance();
+            while (isdigit(peek())) advance();
+        }
+    }
+
+    addToken(isFloat ? TokenType::NUMBER : TokenType::INTEGER);
 }
 
 void Lexer::identifier() {
@@ -134,30 +318,7 @@ void Lexer::identifier() {
 
     std::string text = source.substr(start, current - start);
     TokenType type = TokenType::IDENTIFIER;
-    
-    static const std::unordered_map<std::string, TokenType> keywords = {
-        {"and", TokenType::AND},
-        {"break", TokenType::BREAK},
-        {"do", TokenType::DO},
-        {"else", TokenType::ELSE},
-        {"elseif", TokenType::ELSEIF},
-        {"end", TokenType::END},
-        {"false", TokenType::FALSE},
-        {"for", TokenType::FOR},
-        {"function", TokenType::FUNCTION},
-        {"if", TokenType::IF},
-        {"in", TokenType::IN},
-        {"local", TokenType::LOCAL},
-        {"nil", TokenType::NIL},
-        {"not", TokenType::NOT},
-        {"or", TokenType::OR},
-        {"repeat", TokenType::REPEAT},
-        {"return", TokenType::RETURN},
-        {"then", TokenType::THEN},
-        {"true", TokenType::TRUE},
-        {"until", TokenType::UNTIL},
-        {"while", TokenType::WHILE}
-    };
+    if (text == "debug") debugNamed = true;
 
     auto it = keywords.find(text);
     if (it != keywords.end()) {
@@ -0,0 +1,126 @@
+#include "LineTable.h"
+#include <algorithm>
+
+namespace {
+void writeVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint32_t readVarint(const uint8_t*& in) {
+    uint32_t value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= static_cast<uint32_t>(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | static_cast<uint32_t>(*in++) << shift;
+}
+
+uint32_t zigzag(int delta) {
+    return (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+}
+
+int unzigzag(uint32_t value) {
+    return static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+}
+}
+
+void LineTable::closeRun() {
+    if (openCount == 0) return;
+    if (runCount % kCheckpointInterval == 0) {
+        checkpoints.push_back({encodedBytes, static_cast<uint32_t>(runs.size()), encodedLine, encodedColumn});
+    }
+    writeVarint(runs, openCount);
+    writeVarint(runs, zigzag(openLine - encodedLine));
+    writeVarint(runs, zigzag(openColumn - encodedColumn));
+    runCount++;
+    encodedBytes += openCount;
+    encodedLine = openLine;
+    encodedColumn = openColumn;
+    openCount = 0;
+}
+
+// Reopens the last encoded run when the open one runs out: decodes from the
+// last checkpoint to find where that run starts and what it is relative to
+void LineTable::removeLast() {
+    if (openCount == 0) {
+        if (runCount == 0) return;
+        const Checkpoint& checkpoint = checkpoints.back();
+        const uint8_t* in = runs.data() + checkpoint.position;
+        const uint8_t* end = runs.data() + runs.size();
+        const uint8_t* last = in;
+        int line = checkpoint.line;
+        int column = checkpoint.column;
+        int previousLine = line;
+        int previousColumn = column;
+        uint32_t count = 0;
+        while (in < end) {
+            last = in;
+            previousLine = line;
+            previousColumn = column;
+            count = readVarint(in);
+            line += unzigzag(readVarint(in));
+            column += unzigzag(readVarint(in));
+        }
+        runs.resize(last - runs.data());
+        runCount--;
+        if (runCount % kCheckpointInterval == 0) checkpoints.pop_back();
+        encodedBytes -= count;
+        encodedLine = previousLine;
+        encodedColumn = previousColumn;
+        openLine = line;
+        openColumn = column;
+        openCount = count;
+    }
+    openCount--;
+}
+
+void LineTable::clear() {
+    runs.clear();
+    checkpoints.clear();
+    runCount = 0;
+    encodedBytes = 0;
+    encodedLine = 0;
+    encodedColumn = 0;
+    openCount = 0;
+    isStripped = false;
+}
+
+LineTable::Position LineTable::at(size_t offset) const {
+    if (offset >= size()) return {};
+    if (offset >= encodedBytes) return {openLine, openColumn};
+
+    // Last checkpoint at or before `offset`; the first is at offset 0
+    auto checkpoint = std::upper_bound(checkpoints.begin(), checkpoints.end(), offset,
+                                       [](size_t target, const Checkpoint& c) { return target < c.offset; });
+    --checkpoint;
+    const uint8_t* in = runs.data() + checkpoint->position;
+    size_t start = checkpoint->offset;
+    Position position{checkpoint->line, checkpoint->column};
+    while (true) {
+        uint32_t count = readVarint(in);
+        position.line += unzigzag(readVarint(in));
+        position.column += unzigzag(readVarint(in));
+        start += count;
+        if (offset < start) return position;
+    }
+}
+
+size_t LineTable::footprint() const {
+    return runs.capacity() + checkpoints.capacity() * sizeof(Checkpoint);
+}
+
+void LineTable::shrink() {
+    runs.shrink_to_fit();
+    checkpoints.shrink_to_fit();
+}
+
+void LineTable::strip() {
+    clear();
+    shrink();
+    isStripped = true;
+}
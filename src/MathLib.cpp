@@ -0,0 +1,68 @@
+#include "Library.h"
+#include "VM.h"
+#include <cmath>
+
+// The math library is written as plain C++ functions and bound through
+// VM::registerFunction; argument checking comes from the signatures.
+namespace {
+
+constexpr double kTwoTo63 = 9223372036854775808.0;
+
+// An integer when `f` has an exact integer value in range, else the float
+Value integerIfExact(double f) {
+    if (f >= -kTwoTo63 && f < kTwoTo63 && std::floor(f) == f) return static_cast<int64_t>(f);
+    return f;
+}
+
+// Integer arguments go through double, so beyond 2^53 they are rounded
+Value mathFloor(double x) { return integerIfExact(std::floor(x)); }
+Value mathCeil(double x) { return integerIfExact(std::ceil(x)); }
+
+double mathSqrt(double x) { return std::sqrt(x); }
+double mathSin(double x) { return std::sin(x); }
+double mathCos(double x) { return std::cos(x); }
+double mathTan(double x) { return std::tan(x); }
+double mathExp(double x) { return std::exp(x); }
+
+// math.log(x [, base])
+double mathLog(double x, const Value& base) {
+    if (std::holds_alternative<Nil>(base)) return std::log(x);
+    if (!isNumber(base)) return std::nan("");
+    double b = std::holds_alternative<int64_t>(base) ? static_cast<double>(std::get<int64_t>(base))
+                                                     : std::get<double>(base);
+    if (b == 2.0) return std::log2(x);
+    if (b == 10.0) return std::log10(x);
+    return std::log(x) / std::log(b);
+}
+
+// math.tointeger(x): x as an integer, or nil if it has no exact integer value
+Value mathToInteger(const Value& x) {
+    if (std::holds_alternative<int64_t>(x)) return x;
+    const double* f = std::get_if<double>(&x);
+    if (!f) return Nil{};
+    Value converted = integerIfExact(*f);
+    if (std::holds_alternative<int64_t>(converted)) return converted;
+    return Nil{};
+}
+
+// math.type(x): "integer", "float", or nil for anything but a number
+const char* mathType(const Value& x) {
+    if (std::holds_alternative<int64_t>(x)) return "integer";
+    if (std::holds_alternative<double>(x)) return "float";
+    return nullptr;
+}
+
+} // namespace
+
+void openMathLibrary(VM& vm) {
+    vm.registerFunction("math.floor", &mathFloor);
+    vm.registerFunction("math.ceil", &mathCeil);
+    vm.registerFunction("math.sqrt", &mathSqrt);
+    vm.registerFunction("math.sin", &mathSin);
+    vm.registerFunction("math.cos", &mathCos);
+    vm.registerFunction("math.tan", &mathTan);
+    vm.registerFunction("math.exp", &mathExp);
+    vm.registerFunction("math.log", &mathLog);
+    vm.registerFunction("math.tointeger", &mathToInteger);
+    vm.registerFunction("math.type", &mathType);
+}
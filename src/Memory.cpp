@@ -0,0 +1,83 @@
+#include "Memory.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace {
+thread_local MemoryStats* activeStats = nullptr;
+thread_local MemoryCategory activeCategory = MemoryCategory::Heap;
+
+// Placed in front of every block; its size keeps the block max-aligned
+struct alignas(alignof(std::max_align_t)) BlockHeader {
+    MemoryStats* stats; // nullptr if the block is not counted
+    size_t size;
+    MemoryCategory category;
+};
+
+void* allocate(size_t size) {
+    void* raw = std::malloc(sizeof(BlockHeader) + size);
+    if (!raw) throw std::bad_alloc();
+    BlockHeader* header = static_cast<BlockHeader*>(raw);
+    header->stats = activeStats;
+    header->size = size;
+    header->category = activeCategory;
+    if (activeStats) activeStats->allocated(activeCategory, size);
+    return header + 1;
+}
+
+void release(void* block) {
+    if (!block) return;
+    BlockHeader* header = static_cast<BlockHeader*>(block) - 1;
+    if (header->stats) header->stats->freed(header->category, header->size);
+    std::free(header);
+}
+}
+
+// The remaining forms (arrays, nothrow, sized delete) forward to these in the
+// standard library. Over-aligned new and delete do not, and are not counted.
+void* operator new(size_t size) { return allocate(size); }
+void operator delete(void* block) noexcept { release(block); }
+void operator delete(void* block, size_t) noexcept { release(block); }
+
+MemoryScope::MemoryScope(MemoryStats* stats, MemoryCategory category)
+    : previousStats(activeStats), previousCategory(activeCategory) {
+    activeStats = stats;
+    activeCategory = category;
+}
+
+MemoryScope::MemoryScope(MemoryCategory category)
+    : previousStats(activeStats), previousCategory(activeCategory) {
+    activeCategory = category;
+}
+
+MemoryScope::~MemoryScope() {
+    activeStats = previousStats;
+    activeCategory = previousCategory;
+}
+
+const char* MemoryStats::categoryName(MemoryCategory category) {
+    switch (category) {
+        case MemoryCategory::Lexer:    return "lexer";
+        case MemoryCategory::Parser:   return "parser";
+        case MemoryCategory::Compiler: return "compiler";
+        case MemoryCategory::Heap:     return "heap";
+        default:                       return "stack";
+    }
+}
+
+void MemoryStats::print(std::ostream& out) const {
+    char line[96];
+    std::snprintf(line, sizeof(line), "%-10s %14s %14s\n", "memory", "current", "peak");
+    out << line;
+    for (int i = 0; i < kCategories; i++) {
+        std::snprintf(line, sizeof(line), "%-10s %14zu %14zu\n",
+                      categoryName(static_cast<MemoryCategory>(i)), bytes[i], peaks[i]);
+        out << line;
+    }
+    std::snprintf(line, sizeof(line), "%-10s %14zu %14zu\n", "total", total, totalPeak);
+    out << line;
+    if (limit != 0) {
+        std::snprintf(line, sizeof(line), "%-10s %14zu\n", "limit", limit);
+        out << line;
+    }
+}
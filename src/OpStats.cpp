@@ -0,0 +1,104 @@
+#include "OpStats.h"
+#include "Debug.h"
+#include <algorithm>
+#include <cstdio>
+#include <tuple>
+
+OpStats::OpStats(uint32_t sampleInterval)
+    : histogram(kOpcodes * kHistogramBuckets, 0),
+      bigrams(kOpcodes * kOpcodes, 0),
+      sampleInterval(sampleInterval),
+      countdown(sampleInterval) {}
+
+void OpStats::addSample(uint8_t op, uint64_t elapsed) {
+    cycles[op] += elapsed;
+    samples[op]++;
+
+    int bucket = 0;
+    while (elapsed > 1 && bucket < kHistogramBuckets - 1) {
+        elapsed >>= 1;
+        bucket++;
+    }
+    histogram[op * kHistogramBuckets + bucket]++;
+}
+
+uint64_t OpStats::totalInstructions() const {
+    uint64_t total = 0;
+    for (uint64_t c : counts) total += c;
+    return total;
+}
+
+void OpStats::printTable(std::ostream& out, size_t topBigrams) const {
+    uint64_t total = totalInstructions();
+    std::vector<int> ops;
+    for (int op = 0; op < kOpcodes; op++) {
+        if (counts[op] != 0) ops.push_back(op);
+    }
+    std::sort(ops.begin(), ops.end(), [this](int a, int b) { return counts[a] > counts[b]; });
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-20s %14s %8s %10s %12s\n",
+                  "opcode", "count", "%", "samples", "avg cycles");
+    out << line;
+    for (int op : ops) {
+        double percent = total ? 100.0 * counts[op] / total : 0;
+        double avg = samples[op] ? static_cast<double>(cycles[op]) / samples[op] : 0;
+        std::snprintf(line, sizeof(line), "%-20s %14llu %7.2f%% %10llu %12.1f\n",
+                      opcodeName(op), static_cast<unsigned long long>(counts[op]), percent,
+                      static_cast<unsigned long long>(samples[op]), avg);
+        out << line;
+    }
+    std::snprintf(line, sizeof(line), "%-20s %14llu\n", "total", static_cast<unsigned long long>(total));
+    out << line;
+
+    std::vector<std::tuple<uint64_t, int, int>> pairs;
+    for (int a = 0; a < kOpcodes; a++) {
+        if (a == kNoOpcode) continue;
+        for (int b = 0; b < kOpcodes; b++) {
+            uint64_t n = bigrams[a * kOpcodes + b];
+            if (n != 0) pairs.emplace_back(n, a, b);
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const auto& x, const auto& y) { return std::get<0>(x) > std::get<0>(y); });
+    if (pairs.size() > topBigrams) pairs.resize(topBigrams);
+
+    out << "\ntop opcode pairs:\n";
+    for (const auto& [n, a, b] : pairs) {
+        std::snprintf(line, sizeof(line), "%-20s -> %-20s %14llu\n",
+                      opcodeName(a), opcodeName(b), static_cast<unsigned long long>(n));
+        out << line;
+    }
+}
+
+void OpStats::writeJson(std::ostream& out) const {
+    out << "{\n  \"total\": " << totalInstructions() << ",\n  \"opcodes\": [";
+    bool first = true;
+    for (int op = 0; op < kOpcodes; op++) {
+        if (counts[op] == 0) continue;
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "    {\"name\": \"" << opcodeName(op) << "\", \"count\": " << counts[op]
+            << ", \"samples\": " << samples[op] << ", \"cycles\": " << cycles[op] << ", \"histogram\": [";
+        // Trailing empty buckets are trimmed; bucket i covers [2^i, 2^(i+1)) cycles
+        int last = kHistogramBuckets - 1;
+        while (last > 0 && histogram[op * kHistogramBuckets + last] == 0) last--;
+        for (int i = 0; i <= last; i++) {
+            out << (i ? ", " : "") << histogram[op * kHistogramBuckets + i];
+        }
+        out << "]}";
+    }
+    out << "\n  ],\n  \"bigrams\": [";
+    first = true;
+    for (int a = 0; a < kOpcodes; a++) {
+        if (a == kNoOpcode) continue;
+        for (int b = 0; b < kOpcodes; b++) {
+            uint64_t n = bigrams[a * kOpcodes + b];
+            if (n == 0) continue;
+            out << (first ? "\n" : ",\n");
+            first = false;
+            out << "    {\"first\": \"" << opcodeName(a) << "\", \"second\": \"" << opcodeName(b)
+                << "\", \"count\": " << n << "}";
+        }
+    }
+    out << "\n  ]\n}\n";
+}
@@ -1,32 +1,49 @@
 #include "Parser.h"
 #include <iostream>
 
-Parser::Parser(const std::vector<Token>& tokens) : tokens(tokens) {}
+template <typename Builder>
+BasicParser<Builder>::BasicParser(const std::vector<Token>& tokens) : tokens(tokens) {}
 
-std::vector<std::unique_ptr<Stmt>> Parser::parse() {
-    std::vector<std::unique_ptr<Stmt>> statements;
+template <typename Builder>
+typename Builder::Result BasicParser<Builder>::parse() {
+    StmtList statements;
     while (!isAtEnd()) {
-        statements.push_back(declaration());
+        Stmt stmt = declaration();
+        if (stmt) statements.push_back(std::move(stmt));
     }
-    return statements;
+    return builder.finish(std::move(statements));
 }
 
-std::unique_ptr<Stmt> Parser::declaration() {
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::declaration() {
     try {
         if (match({TokenType::FUNCTION})) return functionDeclaration();
         if (match({TokenType::LOCAL})) return varDeclaration();
         return statement();
-    } catch (ParseError& error) {
+    } catch (ParseError& e) {
+        error(peek(), e.what());
         synchronize();
-        return nullptr;
+        return Stmt{};
     }
 }
 
-std::unique_ptr<Stmt> Parser::functionDeclaration() {
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::functionDeclaration() {
+    Token keyword = previous();
     Token name = consume(TokenType::IDENTIFIER, "Expect function name.");
-    consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
-    
     std::vector<Token> parameters;
+    StmtList body;
+    std::unique_ptr<Token> deferred;
+    functionBody(parameters, body, deferred);
+    return builder.functionDecl(keyword, name, parameters, std::move(body), deferred.get());
+}
+
+// Parameter list and body, shared by declarations and function expressions.
+// A body the lexer skipped is returned in `deferred` instead of `body`.
+template <typename Builder>
+void BasicParser<Builder>::functionBody(std::vector<Token>& parameters, StmtList& body,
+                                        std::unique_ptr<Token>& deferred) {
+    consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
     if (!check(TokenType::RIGHT_PAREN)) {
         do {
             if (parameters.size() >= 255) {
@@ -39,66 +56,105 @@ std::unique_ptr<Stmt> Parser::functionDeclaration() {
     
     // Function body
     // In Lua, function body ends with 'end'
-    std::vector<std::unique_ptr<Stmt>> body = block();
+    if (match({TokenType::FUNCTION_BODY})) {
+        deferred = std::make_unique<Token>(previous());
+    } else {
+        body = block();
+    }
     consume(TokenType::END, "Expect 'end' after function body.");
-    
-    return std::make_unique<FunctionStmt>(name, parameters, std::move(body));
 }
 
-std::unique_ptr<Stmt> Parser::varDeclaration() {
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::varDeclaration() {
+    Token keyword = previous();
     Token name = consume(TokenType::IDENTIFIER, "Expect variable name.");
-    std::unique_ptr<Expr> initializer = nullptr;
+    Expr initializer{};
     if (match({TokenType::EQUAL})) {
         initializer = expression();
     }
     // Lua doesn't strictly require semicolons, but we can consume if present
     // match({TokenType::SEMICOLON}); 
-    return std::make_unique<VarDecl>(name, std::move(initializer));
+    return builder.varDecl(keyword, name, std::move(initializer));
 }
 
-std::unique_ptr<Stmt> Parser::statement() {
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::statement() {
     if (match({TokenType::IF})) return ifStatement();
     if (match({TokenType::WHILE})) return whileStatement();
+    if (match({TokenType::FOR})) return forStatement();
     if (match({TokenType::DO})) {
-        std::vector<std::unique_ptr<Stmt>> stmts = block();
+        Token keyword = previous();
+        StmtList stmts = block();
         consume(TokenType::END, "Expect 'end' after do block.");
-        return std::make_unique<BlockStmt>(std::move(stmts));
+        return builder.block(&keyword, std::move(stmts));
     }
     if (match({TokenType::RETURN})) return returnStatement();
     
     return expressionStatement();
 }
 
-std::unique_ptr<Stmt> Parser::ifStatement() {
-    std::unique_ptr<Expr> condition = expression();
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::ifStatement() {
+    Token keyword = previous();
+    Expr condition = expression();
     consume(TokenType::THEN, "Expect 'then' after if condition.");
     
-    std::vector<std::unique_ptr<Stmt>> thenStmts = block();
-    std::unique_ptr<Stmt> thenBranch = std::make_unique<BlockStmt>(std::move(thenStmts));
-    std::unique_ptr<Stmt> elseBranch = nullptr;
+    StmtList thenStmts = block();
+    Stmt thenBranch = builder.block(nullptr, std::move(thenStmts));
+    Stmt elseBranch{};
     
     if (match({TokenType::ELSE})) {
-        std::vector<std::unique_ptr<Stmt>> elseStmts = block();
-        elseBranch = std::make_unique<BlockStmt>(std::move(elseStmts));
+        StmtList elseStmts = block();
+        elseBranch = builder.block(nullptr, std::move(elseStmts));
     }
     // TODO: Handle elseif
     
     consume(TokenType::END, "Expect 'end' after if statement.");
-    return std::make_unique<IfStmt>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
+    return builder.ifStmt(keyword, std::move(condition), std::move(thenBranch), std::move(elseBranch));
 }
 
-std::unique_ptr<Stmt> Parser::whileStatement() {
-    std::unique_ptr<Expr> condition = expression();
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::whileStatement() {
+    Token keyword = previous();
+    Expr condition = expression();
     consume(TokenType::DO, "Expect 'do' after while condition.");
-    std::vector<std::unique_ptr<Stmt>> bodyStmts = block();
+    StmtList bodyStmts = block();
     consume(TokenType::END, "Expect 'end' after while loop.");
     
-    return std::make_unique<WhileStmt>(std::move(condition), std::make_unique<BlockStmt>(std::move(bodyStmts)));
+    return builder.whileStmt(keyword, std::move(condition), builder.block(nullptr, std::move(bodyStmts)));
 }
 
-std::unique_ptr<Stmt> Parser::returnStatement() {
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::forStatement() {
     Token keyword = previous();
-    std::unique_ptr<Expr> value = nullptr;
+    Token name = consume(TokenType::IDENTIFIER, "Expect variable name after 'for'.");
+    if (match({TokenType::IN})) {
+        Expr iterator = expression();
+        consume(TokenType::DO, "Expect 'do' after for clause.");
+        StmtList bodyStmts = block();
+        consume(TokenType::END, "Expect 'end' after for loop.");
+        return builder.forInStmt(keyword, name, std::move(iterator), builder.block(nullptr, std::move(bodyStmts)));
+    }
+    consume(TokenType::EQUAL, "Expect '=' after for variable.");
+    Expr start = expression();
+    consume(TokenType::COMMA, "Expect ',' after for initial value.");
+    Expr limit = expression();
+    Expr step{};
+    if (match({TokenType::COMMA})) {
+        step = expression();
+    }
+    consume(TokenType::DO, "Expect 'do' after for clause.");
+    StmtList bodyStmts = block();
+    consume(TokenType::END, "Expect 'end' after for loop.");
+
+    return builder.forStmt(keyword, name, std::move(start), std::move(limit), std::move(step),
+                           builder.block(nullptr, std::move(bodyStmts)));
+}
+
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::returnStatement() {
+    Token keyword = previous();
+    Expr value{};
     if (!check(TokenType::END) && !check(TokenType::ELSE) && !check(TokenType::ELSEIF) && !check(TokenType::TOKEN_EOF)) {
          // Actually we should check if next token starts a statement or is expression start
          // Simple check: if not block end
@@ -108,37 +164,42 @@ std::unique_ptr<Stmt> Parser::returnStatement() {
     }
     match({TokenType::SEMICOLON});
     
-    return std::make_unique<ReturnStmt>(keyword, std::move(value));
+    return builder.returnStmt(keyword, std::move(value));
 }
 
-std::vector<std::unique_ptr<Stmt>> Parser::block() {
-    std::vector<std::unique_ptr<Stmt>> statements;
+template <typename Builder>
+typename BasicParser<Builder>::StmtList BasicParser<Builder>::block() {
+    StmtList statements;
     while (!check(TokenType::END) && !check(TokenType::ELSE) && !check(TokenType::ELSEIF) && !check(TokenType::UNTIL) && !isAtEnd()) {
-        statements.push_back(declaration());
+        Stmt stmt = declaration();
+        if (stmt) statements.push_back(std::move(stmt));
     }
     return statements;
 }
 
-std::unique_ptr<Stmt> Parser::expressionStatement() {
-    std::unique_ptr<Expr> expr = expression();
+template <typename Builder>
+typename BasicParser<Builder>::Stmt BasicParser<Builder>::expressionStatement() {
+    Token first = peek();
+    Expr expr = expression();
     // match({TokenType::SEMICOLON});
-    return std::make_unique<ExpressionStmt>(std::move(expr));
+    return builder.expression(first, std::move(expr));
 }
 
-std::unique_ptr<Expr> Parser::expression() {
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::expression() {
     return assignment();
 }
 
-std::unique_ptr<Expr> Parser::assignment() {
-    std::unique_ptr<Expr> expr = orExpr();
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::assignment() {
+    Expr expr = orExpr();
 
     if (match({TokenType::EQUAL})) {
         Token equals = previous();
-        std::unique_ptr<Expr> value = assignment();
+        Expr value = assignment();
 
-        if (VariableExpr* v = dynamic_cast<VariableExpr*>(expr.get())) {
-            Token name = v->name;
-            return std::make_unique<AssignmentExpr>(name, std::move(value));
+        if (builder.isVariable(expr)) {
+            return builder.assignment(std::move(expr), std::move(value));
         }
         
         throw ParseError("Invalid assignment target.");
@@ -147,90 +208,112 @@ std::unique_ptr<Expr> Parser::assignment() {
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::orExpr() {
-    std::unique_ptr<Expr> expr = andExpr();
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::orExpr() {
+    Expr expr = andExpr();
 
     while (match({TokenType::OR})) {
         Token op = previous();
-        std::unique_ptr<Expr> right = andExpr();
-        expr = std::make_unique<BinaryExpr>(std::move(expr), op, std::move(right));
+        Expr right = andExpr();
+        expr = builder.binary(op, std::move(expr), std::move(right));
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::andExpr() {
-    std::unique_ptr<Expr> expr = equality();
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::andExpr() {
+    Expr expr = equality();
 
     while (match({TokenType::AND})) {
         Token op = previous();
-        std::unique_ptr<Expr> right = equality();
-        expr = std::make_unique<BinaryExpr>(std::move(expr), op, std::move(right));
+        Expr right = equality();
+        expr = builder.binary(op, std::move(expr), std::move(right));
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::equality() {
-    std::unique_ptr<Expr> expr = comparison();
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::equality() {
+    Expr expr = comparison();
 
     while (match({TokenType::BANG_EQUAL, TokenType::EQUAL_EQUAL})) {
         Token op = previous();
-        std::unique_ptr<Expr> right = comparison();
-        expr = std::make_unique<BinaryExpr>(std::move(expr), op, std::move(right));
+        Expr right = comparison();
+        expr = builder.binary(op, std::move(expr), std::move(right));
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::comparison() {
-    std::unique_ptr<Expr> expr = term();
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::comparison() {
+    Expr expr = concat();
 
     while (match({TokenType::GREATER, TokenType::GREATER_EQUAL, TokenType::LESS, TokenType::LESS_EQUAL})) {
         Token op = previous();
-        std::unique_ptr<Expr> right = term();
-        expr = std::make_unique<BinaryExpr>(std::move(expr), op, std::move(right));
+        Expr right = concat();
+        expr = builder.binary(op, std::move(expr), std::move(right));
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::term() {
-    std::unique_ptr<Expr> expr = factor();
+// '..' binds looser than + and - and is right associative
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::concat() {
+    Expr expr = term();
+
+    if (match({TokenType::DOT_DOT})) {
+        Token op = previous();
+        Expr right = concat();
+        expr = builder.binary(op, std::move(expr), std::move(right));
+    }
+
+    return expr;
+}
+
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::term() {
+    Expr expr = factor();
 
     while (match({TokenType::MINUS, TokenType::PLUS})) {
         Token op = previous();
-        std::unique_ptr<Expr> right = factor();
-        expr = std::make_unique<BinaryExpr>(std::move(expr), op, std::move(right));
+        Expr right = factor();
+        expr = builder.binary(op, std::move(expr), std::move(right));
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::factor() {
-    std::unique_ptr<Expr> expr = unary();
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::factor() {
+    Expr expr = unary();
 
-    while (match({TokenType::SLASH, TokenType::STAR})) {
+    while (match({TokenType::SLASH, TokenType::STAR, TokenType::SLASH_SLASH, TokenType::PERCENT})) {
         Token op = previous();
-        std::unique_ptr<Expr> right = unary();
-        expr = std::make_unique<BinaryExpr>(std::move(expr), op, std::move(right));
+        Expr right = unary();
+        expr = builder.binary(op, std::move(expr), std::move(right));
     }
 
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::unary() {
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::unary() {
     if (match({TokenType::BANG, TokenType::MINUS, TokenType::NOT})) {
         Token op = previous();
-        std::unique_ptr<Expr> right = unary();
-        return std::make_unique<UnaryExpr>(op, std::move(right));
+        Expr right = unary();
+        return builder.unary(op, std::move(right));
     }
 
     return call();
 }
 
-std::unique_ptr<Expr> Parser::call() {
-    std::unique_ptr<Expr> expr = primary();
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::call() {
+    Expr expr = primary();
 
     while (true) {
         if (match({TokenType::LEFT_PAREN})) {
@@ -243,8 +326,10 @@ std::unique_ptr<Expr> Parser::call() {
     return expr;
 }
 
-std::unique_ptr<Expr> Parser::finishCall(std::unique_ptr<Expr> callee) {
-    std::vector<std::unique_ptr<Expr>> arguments;
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::finishCall(Expr callee) {
+    Token open = previous();
+    ExprList arguments;
     if (!check(TokenType::RIGHT_PAREN)) {
         do {
             if (arguments.size() >= 255) {
@@ -256,32 +341,50 @@ std::unique_ptr<Expr> Parser::finishCall(std::unique_ptr<Expr> callee) {
 
     Token paren = consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
 
-    return std::make_unique<CallExpr>(std::move(callee), paren, std::move(arguments));
+    return builder.call(open, std::move(callee), paren, std::move(arguments));
 }
 
-std::unique_ptr<Expr> Parser::primary() {
-    if (match({TokenType::FALSE})) return std::make_unique<LiteralExpr>("false");
-    if (match({TokenType::TRUE})) return std::make_unique<LiteralExpr>("true");
-    if (match({TokenType::NIL})) return std::make_unique<LiteralExpr>("nil");
+template <typename Builder>
+typename BasicParser<Builder>::Expr BasicParser<Builder>::primary() {
+    if (match({TokenType::FALSE})) return builder.literal(previous(), "false", TokenType::FALSE);
+    if (match({TokenType::TRUE})) return builder.literal(previous(), "true", TokenType::TRUE);
+    if (match({TokenType::NIL})) return builder.literal(previous(), "nil", TokenType::NIL);
 
-    if (match({TokenType::NUMBER, TokenType::STRING})) {
-        return std::make_unique<LiteralExpr>(previous().lexeme);
+    if (match({TokenType::NUMBER, TokenType::INTEGER, TokenType::STRING})) {
+        return builder.literal(previous(), previous().lexeme, previous().type);
     }
 
     if (match({TokenType::IDENTIFIER})) {
-        return std::make_unique<VariableExpr>(previous());
+        // Library functions such as io.write are globals with a dotted name
+        // until tables exist
+        Token name = previous();
+        while (match({TokenType::DOT})) {
+            name.lexeme += "." + consume(TokenType::IDENTIFIER, "Expect name after '.'.").lexeme;
+        }
+        return builder.variable(name);
+    }
+
+    if (match({TokenType::FUNCTION})) {
+        Token keyword = previous();
+        std::vector<Token> parameters;
+        StmtList body;
+        std::unique_ptr<Token> deferred;
+        functionBody(parameters, body, deferred);
+        return builder.function(keyword, parameters, std::move(body), deferred.get());
     }
 
     if (match({TokenType::LEFT_PAREN})) {
-        std::unique_ptr<Expr> expr = expression();
+        Token open = previous();
+        Expr expr = expression();
         consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
-        return std::make_unique<GroupingExpr>(std::move(expr));
+        return builder.grouping(open, std::move(expr));
     }
 
     throw ParseError("Expect expression.");
 }
 
-bool Parser::match(const std::vector<TokenType>& types) {
+template <typename Builder>
+bool BasicParser<Builder>::match(const std::vector<TokenType>& types) {
     for (TokenType type : types) {
         if (check(type)) {
             advance();
@@ -291,34 +394,48 @@ bool Parser::match(const std::vector<TokenType>& types) {
     return false;
 }
 
-bool Parser::check(TokenType type) {
+template <typename Builder>
+bool BasicParser<Builder>::check(TokenType type) {
     if (isAtEnd()) return false;
     return peek().type == type;
 }
 
-bool Parser::isAtEnd() {
+template <typename Builder>
+bool BasicParser<Builder>::isAtEnd() {
     return peek().type == TokenType::TOKEN_EOF;
 }
 
-Token Parser::advance() {
+template <typename Builder>
+Token BasicParser<Builder>::advance() {
     if (!isAtEnd()) current++;
     return previous();
 }
 
-Token Parser::peek() {
+template <typename Builder>
+Token BasicParser<Builder>::peek() {
     return tokens[current];
 }
 
-Token Parser::previous() {
+template <typename Builder>
+Token BasicParser<Builder>::previous() {
     return tokens[current - 1];
 }
 
-Token Parser::consume(TokenType type, std::string message) {
+template <typename Builder>
+Token BasicParser<Builder>::consume(TokenType type, std::string message) {
     if (check(type)) return advance();
     throw ParseError(message.c_str());
 }
 
-void Parser::synchronize() {
+template <typename Builder>
+void BasicParser<Builder>::error(const Token& token, const char* message) {
+    if (errorMessages.empty()) errorAtEnd = token.type == TokenType::TOKEN_EOF;
+    std::string where = token.type == TokenType::TOKEN_EOF ? "end" : "'" + token.lexeme + "'";
+    errorMessages.push_back("[line " + std::to_string(token.line) + "] Error at " + where + ": " + message);
+}
+
+template <typename Builder>
+void BasicParser<Builder>::synchronize() {
     advance();
     while (!isAtEnd()) {
         if (previous().type == TokenType::SEMICOLON) return;
@@ -337,3 +454,6 @@ void Parser::synchronize() {
         advance();
     }
 }
+
+template class BasicParser<TreeBuilder>;
+template class BasicParser<FlatBuilder>;
@@ -0,0 +1,102 @@
+#include "Profiler.h"
+#include "Function.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/time.h>
+#define LUA_PROFILER_HAS_ITIMER 1
+#endif
+
+volatile std::sig_atomic_t Profiler::timerFired = 0;
+
+Profiler::Profiler(std::string sourceName, long intervalUs, uint64_t instructionInterval)
+    : sourceName(std::move(sourceName)),
+      intervalUs(intervalUs),
+      instructionInterval(instructionInterval),
+      countdown(instructionInterval) {
+#ifndef LUA_PROFILER_HAS_ITIMER
+    // No interval timer available: fall back to instruction sampling
+    if (this->instructionInterval == 0) {
+        this->instructionInterval = 10000;
+        countdown = this->instructionInterval;
+    }
+#endif
+}
+
+Profiler::~Profiler() {
+    stop();
+}
+
+void Profiler::onTimer(int) {
+    timerFired = 1;
+}
+
+void Profiler::start() {
+    if (running) return;
+    running = true;
+#ifdef LUA_PROFILER_HAS_ITIMER
+    if (instructionInterval == 0) {
+        timerFired = 0;
+        struct sigaction action = {};
+        action.sa_handler = &Profiler::onTimer;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGPROF, &action, nullptr);
+
+        struct itimerval timer = {};
+        timer.it_interval.tv_sec = intervalUs / 1000000;
+        timer.it_interval.tv_usec = intervalUs % 1000000;
+        timer.it_value = timer.it_interval;
+        setitimer(ITIMER_PROF, &timer, nullptr);
+    }
+#endif
+}
+
+void Profiler::stop() {
+    if (!running) return;
+    running = false;
+#ifdef LUA_PROFILER_HAS_ITIMER
+    if (instructionInterval == 0) {
+        struct itimerval timer = {};
+        setitimer(ITIMER_PROF, &timer, nullptr);
+        signal(SIGPROF, SIG_DFL);
+    }
+#endif
+}
+
+void Profiler::sample(const std::vector<Frame>& stack) {
+    if (instructionInterval != 0) {
+        countdown = instructionInterval;
+    } else {
+        timerFired = 0;
+    }
+
+    key.clear();
+    for (const Frame& frame : stack) {
+        size_t offset = frame.ip - frame.chunk->code.data();
+        key.push_back({frame.chunk, frame.chunk->lines.line(offset)});
+        if (names.find(frame.chunk) == names.end()) {
+            std::string name = !frame.function ? sourceName
+                             : frame.function->name.empty() ? "?" // Stripped
+                                                             : frame.function->name;
+            names.emplace(frame.chunk, std::move(name));
+        }
+    }
+    stackSamples[key]++;
+    total++;
+}
+
+// Chunks are only told apart while sampling; stacks whose frames print the
+// same (two functions with one name) are merged here, and sorted by text
+void Profiler::writeCollapsed(std::ostream& out) const {
+    std::map<std::string, uint64_t> lines;
+    for (const auto& [stack, count] : stackSamples) {
+        std::string text;
+        for (const FrameKey& frame : stack) {
+            if (!text.empty()) text += ';';
+            text += names.at(frame.chunk);
+            text += ':';
+            text += std::to_string(frame.line);
+        }
+        lines[text] += count;
+    }
+    for (const auto& [text, count] : lines) out << text << " " << count << "\n";
+}
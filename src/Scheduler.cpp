@@ -0,0 +1,125 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#define LUA_SCHEDULER_HAS_THREAD_CPUTIME 1
+#endif
+
+namespace {
+// CPU time of the calling thread; wall time where that is not available
+std::chrono::nanoseconds threadCpuTime() {
+#ifdef LUA_SCHEDULER_HAS_THREAD_CPUTIME
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+#else
+    return std::chrono::steady_clock::now().time_since_epoch();
+#endif
+}
+
+const char* resultName(InterpretResult result) {
+    switch (result) {
+        case InterpretResult::OK:            return "ok";
+        case InterpretResult::COMPILE_ERROR: return "compile error";
+        case InterpretResult::RUNTIME_ERROR: return "error";
+        default:                             return "suspended";
+    }
+}
+}
+
+Scheduler::Scheduler(Options options) : options(options) {
+    this->options.threads = std::max(1u, options.threads);
+}
+
+VM& Scheduler::add(std::string name, std::unique_ptr<Chunk> chunk) {
+    auto task = std::make_unique<Task>();
+    task->chunk = std::move(chunk);
+    task->vm = std::make_unique<VM>();
+    task->budget = options.fixedBudget != 0 ? options.fixedBudget : kInitialBudget;
+    task->stats.name = std::move(name);
+    tasks.push_back(std::move(task));
+    return *tasks.back()->vm;
+}
+
+void Scheduler::run() {
+    for (auto& task : tasks) {
+        if (task->stats.slices == 0) ready.push_back(task.get());
+    }
+    unfinished = ready.size();
+    if (unfinished == 0) return;
+    std::vector<std::thread> workers;
+    unsigned count = static_cast<unsigned>(std::min<size_t>(options.threads, unfinished));
+    for (unsigned i = 1; i < count; i++) workers.emplace_back(&Scheduler::work, this);
+    work();
+    for (std::thread& worker : workers) worker.join();
+}
+
+// Takes the script at the front of the queue, runs one slice and requeues
+// it at the back if it was suspended. Returns when every script is done.
+void Scheduler::work() {
+    for (;;) {
+        Task* task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return !ready.empty() || unfinished == 0; });
+            if (ready.empty()) return;
+            task = ready.front();
+            ready.pop_front();
+        }
+        runSlice(*task);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (task->stats.result == InterpretResult::SUSPENDED) {
+                ready.push_back(task);
+            } else if (--unfinished == 0) {
+                wake.notify_all();
+                continue;
+            }
+        }
+        wake.notify_one();
+    }
+}
+
+void Scheduler::runSlice(Task& task) {
+    VM& vm = *task.vm;
+    vm.setBudget(task.budget);
+    std::chrono::nanoseconds start = threadCpuTime();
+    InterpretResult result = task.stats.slices == 0 ? vm.interpret(task.chunk.get()) : vm.resumeScript();
+    std::chrono::nanoseconds elapsed = threadCpuTime() - start;
+
+    task.stats.result = result;
+    task.stats.slices++;
+    task.stats.steps += task.budget - vm.remainingBudget();
+    task.stats.cpuTime += elapsed;
+
+    // Scale the budget toward one slice of CPU time, halfway per slice so a
+    // single slow or fast slice does not swing it
+    if (options.fixedBudget == 0 && result == InterpretResult::SUSPENDED) {
+        double ratio = static_cast<double>(std::chrono::nanoseconds(options.slice).count()) /
+                       static_cast<double>(std::max<int64_t>(elapsed.count(), 1));
+        double scaled = static_cast<double>(task.budget) * (1.0 + ratio) / 2.0;
+        task.budget = static_cast<uint64_t>(std::clamp(scaled, static_cast<double>(kMinBudget),
+                                                       static_cast<double>(kMaxBudget)));
+    }
+}
+
+std::vector<Scheduler::TaskStats> Scheduler::stats() const {
+    std::vector<TaskStats> result;
+    for (const auto& task : tasks) result.push_back(task->stats);
+    return result;
+}
+
+void Scheduler::printStats(std::ostream& out) const {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-24s %-10s %10s %14s %12s\n", "script", "result", "slices", "steps", "cpu ms");
+    out << line;
+    for (const auto& task : tasks) {
+        const TaskStats& s = task->stats;
+        std::snprintf(line, sizeof(line), "%-24s %-10s %10llu %14llu %12.3f\n", s.name.c_str(), resultName(s.result),
+                      static_cast<unsigned long long>(s.slices), static_cast<unsigned long long>(s.steps),
+                      std::chrono::duration<double, std::milli>(s.cpuTime).count());
+        out << line;
+    }
+}
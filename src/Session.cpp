@@ -0,0 +1,70 @@
+#include "Session.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include <iostream>
+#include <iterator>
+
+Session::Session(MemoryStats* memory) : memory(memory) {
+    MemoryScope scope(memory, MemoryCategory::Heap);
+    machine = std::make_unique<VM>();
+    machine->setMemoryStats(memory);
+    // A later input may set a hook that code compiled now runs under
+    compiler_.setDebugHooks(true);
+}
+
+// A lone expression statement whose value would otherwise be dropped
+static bool isEcho(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    if (statements.size() != 1) return false;
+    auto* stmt = dynamic_cast<ExpressionStmt*>(statements[0].get());
+    return stmt && !dynamic_cast<CallExpr*>(stmt->expression.get()) &&
+           !dynamic_cast<AssignmentExpr*>(stmt->expression.get());
+}
+
+Session::Status Session::execute(const std::string& source, bool final) {
+    std::vector<Token> tokens;
+    {
+        MemoryScope scope(memory, MemoryCategory::Lexer);
+        Lexer lexer(source);
+        tokens = lexer.scanTokens();
+    }
+    std::vector<std::unique_ptr<Stmt>> statements;
+    {
+        MemoryScope scope(memory, MemoryCategory::Parser);
+        Parser parser(tokens);
+        statements = parser.parse();
+        if (parser.incomplete() && !final) return Status::Incomplete;
+        if (parser.hadError()) {
+            for (const std::string& message : parser.errors()) std::cerr << message << std::endl;
+            return Status::CompileError;
+        }
+        if (isEcho(statements)) {
+            // Rewritten as print(expression)
+            auto* stmt = static_cast<ExpressionStmt*>(statements[0].get());
+            Token name(TokenType::IDENTIFIER, "print", stmt->line, stmt->column);
+            auto callee = std::make_unique<VariableExpr>(name);
+            callee->line = stmt->line;
+            callee->column = stmt->column;
+            std::vector<std::unique_ptr<Expr>> arguments;
+            arguments.push_back(std::move(stmt->expression));
+            auto call = std::make_unique<CallExpr>(std::move(callee), name, std::move(arguments));
+            call->line = stmt->line;
+            call->column = stmt->column;
+            stmt->expression = std::move(call);
+        }
+    }
+    if (statements.empty()) return Status::Ok;
+
+    // The previous input's code is dead: reuse its chunk
+    machine->releaseChunk(&chunk);
+    chunk.clear();
+    {
+        MemoryScope scope(memory, MemoryCategory::Compiler);
+        if (!compiler_.compile(statements, &chunk)) return Status::CompileError;
+        // Globals can hold on to these after the chunk is reused
+        functions.insert(functions.end(), std::make_move_iterator(chunk.functions.begin()),
+                         std::make_move_iterator(chunk.functions.end()));
+        chunk.functions.clear();
+    }
+    InterpretResult result = machine->interpret(&chunk);
+    return result == InterpretResult::OK ? Status::Ok : Status::RuntimeError;
+}
@@ -0,0 +1,165 @@
+#include "Stream.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define LUA_STREAM_HAS_READ 1
+#endif
+
+OutputBuffer::OutputBuffer(FILE* file, size_t capacity)
+    : file(file), capacity(capacity), data(new char[capacity]) {}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+void OutputBuffer::flush() {
+    if (used != 0) {
+        if (file) std::fwrite(data.get(), 1, used, file);
+        used = 0;
+    }
+    if (file) std::fflush(file);
+}
+
+void OutputBuffer::writeSlow(const char* bytes, size_t length) {
+    flush();
+    if (length >= capacity) {
+        if (file) std::fwrite(bytes, 1, length, file);
+        return;
+    }
+    std::memcpy(data.get(), bytes, length);
+    used = length;
+}
+
+void OutputBuffer::writeValue(const Value& value) {
+    char buffer[64];
+    switch (value.index()) {
+        case 0:
+            write("nil", 3);
+            break;
+        case 1:
+            if (std::get<bool>(value)) write("true", 4);
+            else write("false", 5);
+            break;
+        case 2:
+            write(buffer, formatNumber(std::get<double>(value), buffer));
+            break;
+        case 3:
+            write(std::get<std::string>(value));
+            break;
+        case 4:
+            write(buffer, std::to_chars(buffer, buffer + sizeof(buffer), std::get<int64_t>(value)).ptr - buffer);
+            break;
+        default: {
+            const char* format = value.index() == 5 ? "function: builtin: %p"
+                               : value.index() == 6 ? "function: %p" : "thread: %p";
+            const void* object = value.index() == 5 ? static_cast<const void*>(std::get<NativeFunction*>(value))
+                               : value.index() == 6 ? static_cast<const void*>(std::get<Function*>(value))
+                               : static_cast<const void*>(std::get<Coroutine*>(value));
+            int length = std::snprintf(buffer, sizeof(buffer), format, object);
+            write(buffer, static_cast<size_t>(length) < sizeof(buffer) ? length : sizeof(buffer) - 1);
+            break;
+        }
+    }
+}
+
+InputBuffer::InputBuffer(FILE* file, bool owned, size_t capacity)
+    : file(file), owned(owned), capacity(capacity), data(new char[capacity]) {}
+
+InputBuffer::~InputBuffer() {
+    if (owned && file) std::fclose(file);
+}
+
+// Refills the (empty) buffer. Reads what is available instead of waiting for
+// a full buffer, so interactive input arrives line by line.
+bool InputBuffer::fill() {
+    if (eof) return false;
+    if (tied) tied->flush();
+    begin = end = 0;
+#ifdef LUA_STREAM_HAS_READ
+    ssize_t count;
+    do {
+        count = ::read(fileno(file), data.get(), capacity);
+    } while (count < 0 && errno == EINTR);
+#else
+    size_t count = std::fread(data.get(), 1, capacity, file);
+#endif
+    if (count <= 0) {
+        eof = true;
+        return false;
+    }
+    end = static_cast<size_t>(count);
+    return true;
+}
+
+bool InputBuffer::atEnd() {
+    return begin == end && !fill();
+}
+
+bool InputBuffer::readLine(std::string& line, bool keepNewline, size_t maxLength) {
+    line.clear();
+    if (atEnd()) return false;
+    do {
+        const char* start = data.get() + begin;
+        size_t available = std::min(end - begin, maxLength - line.size());
+        const char* newline = static_cast<const char*>(std::memchr(start, '\n', available));
+        if (newline) {
+            size_t length = newline - start;
+            line.append(start, keepNewline ? length + 1 : length);
+            begin += length + 1;
+            return true;
+        }
+        line.append(start, available);
+        begin += available;
+        if (line.size() == maxLength) return true;
+    } while (fill());
+    return true; // Last line without a newline
+}
+
+bool InputBuffer::readBlock(std::string& block, size_t count) {
+    block.clear();
+    if (atEnd()) return false;
+    while (block.size() < count && !atEnd()) {
+        size_t take = std::min(count - block.size(), end - begin);
+        block.append(data.get() + begin, take);
+        begin += take;
+    }
+    return true;
+}
+
+void InputBuffer::readAll(std::string& text, size_t maxLength) {
+    text.clear();
+    while (text.size() < maxLength && !atEnd()) {
+        size_t take = std::min(end - begin, maxLength - text.size());
+        text.append(data.get() + begin, take);
+        begin += take;
+    }
+}
+
+Value InputBuffer::readNumber() {
+    while (!atEnd() && std::isspace(static_cast<unsigned char>(data[begin]))) begin++;
+
+    // Longest prefix that can belong to a numeral; validated below
+    std::string numeral;
+    while (numeral.size() < 200 && !atEnd()) {
+        char c = data[begin];
+        if (!std::isxdigit(static_cast<unsigned char>(c)) && (c == '\0' || !std::strchr("+-.xXpP", c))) break;
+        numeral += c;
+        begin++;
+    }
+    if (numeral.empty()) return Nil{};
+
+    const char* text = numeral.c_str();
+    char* stop = nullptr;
+    bool hex = numeral.find_first_of("xX") != std::string::npos;
+    if (numeral.find_first_of(hex ? ".pP" : ".eE") == std::string::npos) {
+        errno = 0;
+        long long integer = hex ? static_cast<long long>(std::strtoull(text, &stop, 16))
+                                : std::strtoll(text, &stop, 10);
+        if (*stop == '\0' && (hex || errno != ERANGE)) return static_cast<int64_t>(integer);
+    }
+    double number = std::strtod(text, &stop);
+    if (*stop == '\0') return number;
+    return Nil{};
+}
@@ -0,0 +1,1012 @@
+#include "Library.h"
+#include "VM.h"
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The string library. Subjects and patterns are read where they lie on the
+// VM stack; a function producing a string builds it in `result`'s buffer
+// with a single allocation at most, and a search never copies its subject.
+namespace {
+
+// Longest string string.rep builds; beyond it the request is an error rather
+// than an allocation that would fail. Under a memory limit the headroom left
+// (VM::checkMemoryHeadroom) is checked as well.
+constexpr size_t kMaxBuiltString = 0x7fffffff;
+
+bool argumentError(VM& vm, NativeFunction& self, int position, const char* message) {
+    vm.runtimeError("bad argument #%d to '%s' (%s)", position, self.name.c_str(), message);
+    return false;
+}
+
+bool typeError(VM& vm, NativeFunction& self, Value* args, int argCount, int position, const char* expected) {
+    std::string message = std::string(expected) + " expected, got " +
+                          (position <= argCount ? typeName(args[position - 1]) : "no value");
+    return argumentError(vm, self, position, message.c_str());
+}
+
+// The string held by `result`, keeping its capacity when it already is one
+std::string& reuseString(Value& result) {
+    if (std::string* s = std::get_if<std::string>(&result)) return *s;
+    return result.emplace<std::string>();
+}
+
+// Argument `position` (counted from 1) as a string. A number is converted
+// into `scratch` the way concatenation would; anything else is an error.
+const std::string* stringArgument(VM& vm, NativeFunction& self, Value* args, int argCount, int position,
+                                  std::string& scratch) {
+    if (position <= argCount) {
+        const Value& arg = args[position - 1];
+        if (const std::string* s = std::get_if<std::string>(&arg)) return s;
+        if (const int64_t* i = std::get_if<int64_t>(&arg)) {
+            char buffer[24];
+            scratch.assign(buffer, std::to_chars(buffer, buffer + sizeof(buffer), *i).ptr);
+            return &scratch;
+        }
+        if (const double* d = std::get_if<double>(&arg)) {
+            scratch = formatNumber(*d);
+            return &scratch;
+        }
+    }
+    typeError(vm, self, args, argCount, position, "string");
+    return nullptr;
+}
+
+// Argument `position` as an integer; a float must have an exact integer
+// value. A missing or nil argument leaves `out` (the default) unchanged.
+bool integerArgument(VM& vm, NativeFunction& self, Value* args, int argCount, int position, int64_t& out) {
+    if (position > argCount || std::holds_alternative<Nil>(args[position - 1])) return true;
+    const Value& arg = args[position - 1];
+    if (const int64_t* i = std::get_if<int64_t>(&arg)) {
+        out = *i;
+        return true;
+    }
+    if (const double* d = std::get_if<double>(&arg)) {
+        if (*d >= -9223372036854775808.0 && *d < 9223372036854775808.0 && std::floor(*d) == *d) {
+            out = static_cast<int64_t>(*d);
+            return true;
+        }
+        return argumentError(vm, self, position, "number has no integer representation");
+    }
+    return typeError(vm, self, args, argCount, position, "number");
+}
+
+// Lua's reading of a start index into a string of `length` bytes: negative
+// counts from the end, and anything before the first byte means the first.
+// The result is 1-based and may lie past the end.
+size_t startIndex(int64_t index, size_t length) {
+    if (index > 0) return static_cast<size_t>(index);
+    if (index == 0 || static_cast<uint64_t>(-(index + 1)) >= length) return 1;
+    return length - static_cast<size_t>(-(index + 1));
+}
+
+// The same for an end index, clamped to [0, length]
+size_t endIndex(int64_t index, size_t length) {
+    if (index >= 0) return std::min(static_cast<size_t>(index), length);
+    if (static_cast<uint64_t>(-(index + 1)) >= length) return 0;
+    return length - static_cast<size_t>(-(index + 1));
+}
+
+// --- Plain search ---
+
+// Offset of the first occurrence of `needle` in `haystack` at or after
+// `from`, or npos. Candidates are filtered on the needle's first and last
+// bytes, 16 positions at a time with SSE2, so the full comparison only runs
+// where both match; text rarely matches both by accident.
+size_t findPlain(std::string_view haystack, std::string_view needle, size_t from) {
+    const size_t n = haystack.size();
+    const size_t m = needle.size();
+    if (m == 0) return from <= n ? from : std::string_view::npos;
+    if (from >= n || m > n - from) return std::string_view::npos;
+    const char* s = haystack.data();
+    const char* p = needle.data();
+    if (m == 1) {
+        const void* hit = std::memchr(s + from, p[0], n - from);
+        return hit ? static_cast<const char*>(hit) - s : std::string_view::npos;
+    }
+    const size_t last = n - m; // Last offset where the needle fits
+    size_t i = from;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(p[0]);
+    const __m128i final = _mm_set1_epi8(p[m - 1]);
+    for (; i + 15 <= last; i += 16) {
+        __m128i starts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i ends = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + m - 1));
+        unsigned mask = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, final))));
+        while (mask != 0) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (std::memcmp(s + i + bit + 1, p + 1, m - 2) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    // The tail, or everything without SSE2: memchr to the next first byte
+    while (i <= last) {
+        const void* hit = std::memchr(s + i, p[0], last - i + 1);
+        if (!hit) break;
+        i = static_cast<const char*>(hit) - s;
+        if (s[i + m - 1] == p[m - 1] && std::memcmp(s + i + 1, p + 1, m - 2) == 0) return i;
+        i++;
+    }
+    return std::string_view::npos;
+}
+
+// True when `pattern` contains none of the characters that give a Lua
+// pattern its meaning, so it can be searched for as plain text
+bool isPlain(std::string_view pattern) {
+    return pattern.find_first_of("^$*+?.([%-") == std::string_view::npos;
+}
+
+// --- Lua patterns ---
+//
+// A backtracking matcher with the semantics of Lua 5.4's lstrlib: classes
+// (%a %c %d %g %l %p %s %u %w %x and their complements), sets, the
+// quantifiers * + - ?, anchors, captures and position captures, %b, %f and
+// back-references. Subjects and patterns are std::strings, whose terminating
+// NUL the matcher may read one past the end, as lstrlib does.
+
+constexpr int kMaxCaptures = 32;
+constexpr int kMaxMatchDepth = 200;
+constexpr ptrdiff_t kCaptureUnfinished = -1;
+constexpr ptrdiff_t kCapturePosition = -2;
+constexpr char kEscape = '%';
+
+struct MatchState {
+    const char* subjectStart;
+    const char* subjectEnd;
+    const char* patternEnd;
+    int depth = kMaxMatchDepth; // Recursion left before "pattern too complex"
+    int level = 0;              // Captures opened so far
+    struct {
+        const char* start;
+        ptrdiff_t length; // Or kCaptureUnfinished, kCapturePosition
+    } captures[kMaxCaptures];
+    const char* error = nullptr; // Set when the pattern is malformed
+
+    MatchState(std::string_view subject, std::string_view pattern)
+        : subjectStart(subject.data()), subjectEnd(subject.data() + subject.size()),
+          patternEnd(pattern.data() + pattern.size()) {}
+
+    // Before each attempt at a new position
+    void reset() {
+        level = 0;
+        depth = kMaxMatchDepth;
+    }
+    const char* fail(const char* message) {
+        if (!error) error = message;
+        return nullptr;
+    }
+};
+
+const char* doMatch(MatchState& ms, const char* s, const char* p);
+
+// End of the single-character class starting at `p`
+const char* classEnd(MatchState& ms, const char* p) {
+    switch (*p++) {
+        case kEscape:
+            if (p == ms.patternEnd) return ms.fail("malformed pattern (ends with '%')");
+            return p + 1;
+        case '[':
+            if (*p == '^') p++;
+            do {
+                if (p == ms.patternEnd) return ms.fail("malformed pattern (missing ']')");
+                if (*(p++) == kEscape && p < ms.patternEnd) p++; // Skips escapes such as '%]'
+            } while (*p != ']');
+            return p + 1;
+        default:
+            return p;
+    }
+}
+
+bool matchClass(int c, int cls) {
+    bool matches;
+    switch (std::tolower(cls)) {
+        case 'a': matches = std::isalpha(c); break;
+        case 'c': matches = std::iscntrl(c); break;
+        case 'd': matches = std::isdigit(c); break;
+        case 'g': matches = std::isgraph(c); break;
+        case 'l': matches = std::islower(c); break;
+        case 'p': matches = std::ispunct(c); break;
+        case 's': matches = std::isspace(c); break;
+        case 'u': matches = std::isupper(c); break;
+        case 'w': matches = std::isalnum(c); break;
+        case 'x': matches = std::isxdigit(c); break;
+        default: return cls == c;
+    }
+    return std::isupper(cls) ? !matches : matches;
+}
+
+// Whether `c` is in the set [p, end], where p is at '[' and end at ']'
+bool matchSet(int c, const char* p, const char* end) {
+    bool inSet = true;
+    if (*(p + 1) == '^') {
+        inSet = false;
+        p++;
+    }
+    while (++p < end) {
+        if (*p == kEscape) {
+            p++;
+            if (matchClass(c, static_cast<unsigned char>(*p))) return inSet;
+        } else if (*(p + 1) == '-' && p + 2 < end) {
+            p += 2;
+            if (static_cast<unsigned char>(*(p - 2)) <= c && c <= static_cast<unsigned char>(*p)) return inSet;
+        } else if (static_cast<unsigned char>(*p) == c) {
+            return inSet;
+        }
+    }
+    return !inSet;
+}
+
+// Whether the byte at `s` matches the class [p, classEnd)
+bool singleMatch(const MatchState& ms, const char* s, const char* p, const char* classEnd) {
+    if (s >= ms.subjectEnd) return false;
+    int c = static_cast<unsigned char>(*s);
+    switch (*p) {
+        case '.': return true;
+        case kEscape: return matchClass(c, static_cast<unsigned char>(*(p + 1)));
+        case '[': return matchSet(c, p, classEnd - 1);
+        default: return static_cast<unsigned char>(*p) == c;
+    }
+}
+
+// %bxy: a balanced run from x to the matching y
+const char* matchBalance(MatchState& ms, const char* s, const char* p) {
+    if (p >= ms.patternEnd - 1) return ms.fail("malformed pattern (missing arguments to '%b')");
+    if (s >= ms.subjectEnd || *s != *p) return nullptr;
+    char open = *p;
+    char close = *(p + 1);
+    int depth = 1;
+    while (++s < ms.subjectEnd) {
+        if (*s == close) {
+            if (--depth == 0) return s + 1;
+        } else if (*s == open) {
+            depth++;
+        }
+    }
+    return nullptr;
+}
+
+// Greedy repetition: as many as match, then backs off one at a time
+const char* maxExpand(MatchState& ms, const char* s, const char* p, const char* classEnd) {
+    ptrdiff_t count = 0;
+    while (singleMatch(ms, s + count, p, classEnd)) count++;
+    for (; count >= 0; count--) {
+        if (const char* end = doMatch(ms, s + count, classEnd + 1)) return end;
+        if (ms.error) return nullptr;
+    }
+    return nullptr;
+}
+
+// Lazy repetition: as few as let the rest of the pattern match
+const char* minExpand(MatchState& ms, const char* s, const char* p, const char* classEnd) {
+    for (;;) {
+        if (const char* end = doMatch(ms, s, classEnd + 1)) return end;
+        if (ms.error || !singleMatch(ms, s, p, classEnd)) return nullptr;
+        s++;
+    }
+}
+
+const char* startCapture(MatchState& ms, const char* s, const char* p, ptrdiff_t what) {
+    if (ms.level >= kMaxCaptures) return ms.fail("too many captures");
+    ms.captures[ms.level].start = s;
+    ms.captures[ms.level].length = what;
+    ms.level++;
+    const char* end = doMatch(ms, s, p);
+    if (!end) ms.level--;
+    return end;
+}
+
+const char* endCapture(MatchState& ms, const char* s, const char* p) {
+    int open = ms.level - 1;
+    while (open >= 0 && ms.captures[open].length != kCaptureUnfinished) open--;
+    if (open < 0) return ms.fail("invalid pattern capture");
+    ms.captures[open].length = s - ms.captures[open].start;
+    const char* end = doMatch(ms, s, p);
+    if (!end) ms.captures[open].length = kCaptureUnfinished;
+    return end;
+}
+
+// %1 to %9: the text of an earlier, closed capture again
+const char* matchBackReference(MatchState& ms, const char* s, char digit) {
+    int index = digit - '1';
+    if (index < 0 || index >= ms.level || ms.captures[index].length == kCaptureUnfinished) {
+        return ms.fail("invalid capture index");
+    }
+    size_t length = static_cast<size_t>(ms.captures[index].length);
+    if (static_cast<size_t>(ms.subjectEnd - s) >= length &&
+        std::memcmp(ms.captures[index].start, s, length) == 0) {
+        return s + length;
+    }
+    return nullptr;
+}
+
+// End of the match of pattern [p, patternEnd) at `s`, or nullptr. Items that
+// would end in a tail call loop instead.
+const char* doMatch(MatchState& ms, const char* s, const char* p) {
+    if (ms.depth-- == 0) return ms.fail("pattern too complex");
+    while (p != ms.patternEnd) {
+        if (*p == '(') {
+            s = *(p + 1) == ')' ? startCapture(ms, s, p + 2, kCapturePosition)
+                                : startCapture(ms, s, p + 1, kCaptureUnfinished);
+            break;
+        }
+        if (*p == ')') {
+            s = endCapture(ms, s, p + 1);
+            break;
+        }
+        if (*p == '$' && p + 1 == ms.patternEnd) {
+            if (s != ms.subjectEnd) s = nullptr;
+            break;
+        }
+        if (*p == kEscape && *(p + 1) == 'b') {
+            s = matchBalance(ms, s, p + 2);
+            if (!s) break;
+            p += 4;
+            continue;
+        }
+        if (*p == kEscape && *(p + 1) == 'f') {
+            p += 2;
+            if (*p != '[') return ms.fail("missing '[' after '%f' in pattern");
+            const char* end = classEnd(ms, p);
+            if (!end) return nullptr;
+            int previous = s == ms.subjectStart ? 0 : static_cast<unsigned char>(*(s - 1));
+            int current = s < ms.subjectEnd ? static_cast<unsigned char>(*s) : 0;
+            if (!matchSet(previous, p, end - 1) && matchSet(current, p, end - 1)) {
+                p = end;
+                continue;
+            }
+            s = nullptr;
+            break;
+        }
+        if (*p == kEscape && std::isdigit(static_cast<unsigned char>(*(p + 1)))) {
+            s = matchBackReference(ms, s, *(p + 1));
+            if (!s) break;
+            p += 2;
+            continue;
+        }
+
+        // A single-character class with an optional repetition suffix
+        const char* end = classEnd(ms, p);
+        if (!end) return nullptr;
+        if (!singleMatch(ms, s, p, end)) {
+            if (*end == '*' || *end == '?' || *end == '-') {
+                p = end + 1; // Matches empty
+                continue;
+            }
+            s = nullptr;
+            break;
+        }
+        if (*end == '?') {
+            if (const char* rest = doMatch(ms, s + 1, end + 1)) {
+                s = rest;
+                break;
+            }
+            if (ms.error) return nullptr;
+            p = end + 1;
+            continue;
+        }
+        if (*end == '+') {
+            s = maxExpand(ms, s + 1, p, end);
+            break;
+        }
+        if (*end == '*') {
+            s = maxExpand(ms, s, p, end);
+            break;
+        }
+        if (*end == '-') {
+            s = minExpand(ms, s, p, end);
+            break;
+        }
+        s++;
+        p = end;
+    }
+    ms.depth++;
+    return s;
+}
+
+// Capture `index` of a match spanning [start, end) into `result`: its text,
+// or its position for a position capture. A pattern without captures
+// captures the whole match.
+bool getCapture(VM& vm, const MatchState& ms, int index, const char* start, const char* end, Value& result) {
+    if (index >= ms.level) {
+        reuseString(result).assign(start, end - start);
+        return true;
+    }
+    ptrdiff_t length = ms.captures[index].length;
+    if (length == kCaptureUnfinished) {
+        vm.runtimeError("unfinished capture");
+        return false;
+    }
+    if (length == kCapturePosition) {
+        result = static_cast<int64_t>(ms.captures[index].start - ms.subjectStart + 1);
+    } else {
+        reuseString(result).assign(ms.captures[index].start, static_cast<size_t>(length));
+    }
+    return true;
+}
+
+// Start of the first match of `pattern` in `subject` at or after offset
+// `from`, with `end` set to its end; nullptr if there is none or the pattern
+// is malformed (ms.error)
+const char* search(MatchState& ms, std::string_view pattern, size_t from, const char*& end) {
+    const char* p = pattern.data();
+    bool anchored = *p == '^';
+    if (anchored) p++;
+    const char* s = ms.subjectStart + from;
+    do {
+        ms.reset();
+        end = doMatch(ms, s, p);
+        if (end) return s;
+        if (ms.error) return nullptr;
+    } while (s++ < ms.subjectEnd && !anchored);
+    return nullptr;
+}
+
+bool patternError(VM& vm, const MatchState& ms) {
+    vm.runtimeError("%s", ms.error);
+    return false;
+}
+
+// --- Library functions ---
+
+// string.len(s)
+bool stringLen(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string scratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    result = static_cast<int64_t>(s->size());
+    return true;
+}
+
+// string.sub(s, i [, j]): bytes i to j, counting negative indices from the
+// end. The slice is copied once, into `result`'s buffer.
+bool stringSub(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string scratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    int64_t i = 1;
+    int64_t j = -1;
+    if (argCount < 2) return typeError(vm, self, args, argCount, 2, "number");
+    if (!integerArgument(vm, self, args, argCount, 2, i) || !integerArgument(vm, self, args, argCount, 3, j)) {
+        return false;
+    }
+    size_t start = startIndex(i, s->size());
+    size_t end = endIndex(j, s->size());
+    std::string& out = reuseString(result);
+    if (start > end) out.clear();
+    else out.assign(*s, start - 1, end - start + 1);
+    return true;
+}
+
+// string.byte(s [, i]): the code of byte i (default 1), or nil past either
+// end. A call produces one value, so there is no range form.
+bool stringByte(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    if (argCount > 2) return argumentError(vm, self, 3, "only one byte is supported");
+    std::string scratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    int64_t i = 1;
+    if (!integerArgument(vm, self, args, argCount, 2, i)) return false;
+    size_t index = startIndex(i, s->size());
+    if (index > endIndex(i, s->size())) result = Nil{};
+    else result = static_cast<int64_t>(static_cast<unsigned char>((*s)[index - 1]));
+    return true;
+}
+
+// string.rep(s, n [, sep]): n copies of s separated by sep. The result is
+// sized up front and filled by doubling what is already written, so it
+// takes O(log n) copies however short s is.
+bool stringRep(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string scratch;
+    std::string separatorScratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    if (argCount < 2) return typeError(vm, self, args, argCount, 2, "number");
+    int64_t n = 0;
+    if (!integerArgument(vm, self, args, argCount, 2, n)) return false;
+    static const std::string kNoSeparator;
+    const std::string* separator = &kNoSeparator;
+    if (argCount > 2 && !std::holds_alternative<Nil>(args[2])) {
+        separator = stringArgument(vm, self, args, argCount, 3, separatorScratch);
+        if (!separator) return false;
+    }
+    std::string& out = reuseString(result);
+    out.clear();
+    if (n <= 0) return true;
+
+    size_t unit = s->size() + separator->size();
+    if (unit == 0) return true;
+    if (static_cast<uint64_t>(n) > (kMaxBuiltString + separator->size()) / unit) {
+        vm.runtimeError("resulting string too large");
+        return false;
+    }
+    size_t total = static_cast<size_t>(n) * unit - separator->size();
+    if (total > out.capacity() && !vm.checkMemoryHeadroom(total)) return false;
+    out.reserve(total);
+    out += *s;
+    if (n > 1) {
+        out += *separator;
+        out += *s;
+    }
+    // Past the first copy the text repeats with period `unit`, and the
+    // capacity is reserved, so the source does not move while appending
+    while (out.size() < total) {
+        out.append(out.data() + s->size(), std::min(out.size() - s->size(), total - out.size()));
+    }
+    return true;
+}
+
+// string.upper(s) and string.lower(s), for ASCII letters
+bool stringUpper(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string scratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    std::string& out = reuseString(result);
+    out.resize(s->size());
+    for (size_t i = 0; i < s->size(); i++) {
+        char c = (*s)[i];
+        out[i] = c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c;
+    }
+    return true;
+}
+
+bool stringLower(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string scratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    std::string& out = reuseString(result);
+    out.resize(s->size());
+    for (size_t i = 0; i < s->size(); i++) {
+        char c = (*s)[i];
+        out[i] = c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+    return true;
+}
+
+// string.find(s, pattern [, init [, plain]]): where the first match starts,
+// or nil. A call produces one value, so the end and the captures are not
+// returned (string.match gives the captures). A pattern without special
+// characters is searched for as plain text.
+bool stringFind(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string scratch;
+    std::string patternScratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    const std::string* pattern = stringArgument(vm, self, args, argCount, 2, patternScratch);
+    if (!pattern) return false;
+    int64_t init = 1;
+    if (!integerArgument(vm, self, args, argCount, 3, init)) return false;
+    size_t start = startIndex(init, s->size());
+    if (start > s->size() + 1) {
+        result = Nil{};
+        return true;
+    }
+
+    bool plain = argCount > 3 && !isFalsey(args[3]);
+    if (plain || isPlain(*pattern)) {
+        size_t at = findPlain(*s, *pattern, start - 1);
+        if (at == std::string_view::npos) result = Nil{};
+        else result = static_cast<int64_t>(at + 1);
+        return true;
+    }
+    MatchState ms(*s, *pattern);
+    const char* end;
+    const char* match = search(ms, *pattern, start - 1, end);
+    if (ms.error) return patternError(vm, ms);
+    if (match) result = static_cast<int64_t>(match - ms.subjectStart + 1);
+    else result = Nil{};
+    return true;
+}
+
+// string.match(s, pattern [, init]): the first capture of the first match
+// (the whole match if the pattern has no captures), or nil
+bool stringMatch(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string scratch;
+    std::string patternScratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    const std::string* pattern = stringArgument(vm, self, args, argCount, 2, patternScratch);
+    if (!pattern) return false;
+    int64_t init = 1;
+    if (!integerArgument(vm, self, args, argCount, 3, init)) return false;
+    size_t start = startIndex(init, s->size());
+    if (start > s->size() + 1) {
+        result = Nil{};
+        return true;
+    }
+
+    MatchState ms(*s, *pattern);
+    const char* end;
+    const char* match = search(ms, *pattern, start - 1, end);
+    if (ms.error) return patternError(vm, ms);
+    if (!match) {
+        result = Nil{};
+        return true;
+    }
+    return getCapture(vm, ms, 0, match, end, result);
+}
+
+// Iterator returned by string.gmatch. It keeps its own copies of the subject
+// and pattern, and drops them once the matches run out.
+struct MatchIterator : NativeFunction {
+    std::string subject;
+    std::string pattern;
+    size_t position = 0;                        // Where the next search starts
+    size_t lastMatch = std::string_view::npos;  // End of the previous match
+    bool done = false;
+
+    MatchIterator(NativeFn function, std::string subject, std::string pattern)
+        : NativeFunction("for iterator", function), subject(std::move(subject)), pattern(std::move(pattern)) {}
+};
+
+bool nextMatch(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    MatchIterator& iterator = static_cast<MatchIterator&>(self);
+    if (!iterator.done) {
+        MatchState ms(iterator.subject, iterator.pattern);
+        for (const char* s = ms.subjectStart + iterator.position; s <= ms.subjectEnd; s++) {
+            ms.reset();
+            const char* end = doMatch(ms, s, iterator.pattern.data());
+            if (ms.error) return patternError(vm, ms);
+            // An empty match right where the previous one ended is skipped
+            if (end && static_cast<size_t>(end - ms.subjectStart) != iterator.lastMatch) {
+                iterator.position = iterator.lastMatch = end - ms.subjectStart;
+                return getCapture(vm, ms, 0, s, end, result);
+            }
+        }
+        iterator.done = true;
+        std::string().swap(iterator.subject);
+        std::string().swap(iterator.pattern);
+    }
+    result = Nil{};
+    return true;
+}
+
+// string.gmatch(s, pattern): an iterator over the matches of pattern in s,
+// producing the first capture of each (or the whole match). As in Lua, a
+// leading '^' is not an anchor here. The iterator is owned by the VM until
+// it is destroyed.
+bool stringGmatch(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string scratch;
+    std::string patternScratch;
+    const std::string* s = stringArgument(vm, self, args, argCount, 1, scratch);
+    if (!s) return false;
+    const std::string* pattern = stringArgument(vm, self, args, argCount, 2, patternScratch);
+    if (!pattern) return false;
+    result = vm.adoptNative(std::make_unique<MatchIterator>(&nextMatch, *s, *pattern));
+    return true;
+}
+
+// --- string.format ---
+
+// One conversion: %[flags][width][.precision]conversion
+struct FormatSpec {
+    bool left = false;      // '-'
+    bool plus = false;      // '+'
+    bool space = false;     // ' '
+    bool alternate = false; // '#'
+    bool zero = false;      // '0'
+    int width = 0;
+    int precision = -1; // -1 when absent
+    char conversion = '\0';
+};
+
+// Parses the conversion after a '%' at `p`, advancing past it. Width and
+// precision take at most two digits, as in Lua.
+bool parseSpec(const char*& p, const char* end, FormatSpec& spec) {
+    for (; p < end; p++) {
+        if (*p == '-') spec.left = true;
+        else if (*p == '+') spec.plus = true;
+        else if (*p == ' ') spec.space = true;
+        else if (*p == '#') spec.alternate = true;
+        else if (*p == '0') spec.zero = true;
+        else break;
+    }
+    for (int digits = 0; p < end && std::isdigit(static_cast<unsigned char>(*p)); digits++, p++) {
+        if (digits == 2) return false;
+        spec.width = spec.width * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        p++;
+        spec.precision = 0;
+        for (int digits = 0; p < end && std::isdigit(static_cast<unsigned char>(*p)); digits++, p++) {
+            if (digits == 2) return false;
+            spec.precision = spec.precision * 10 + (*p - '0');
+        }
+    }
+    if (p == end) return false;
+    spec.conversion = *p++;
+    return true;
+}
+
+// Appends `body` padded to the spec's width. Numbers pad with zeros after
+// their sign and base prefix (`prefix` bytes of body) when asked to.
+void appendPadded(std::string& out, std::string_view body, const FormatSpec& spec, bool zeroPad = false,
+                  size_t prefix = 0) {
+    size_t width = static_cast<size_t>(spec.width);
+    if (body.size() >= width) {
+        out += body;
+    } else if (spec.left) {
+        out += body;
+        out.append(width - body.size(), ' ');
+    } else if (zeroPad) {
+        out.append(body.data(), prefix);
+        out.append(width - body.size(), '0');
+        out.append(body.data() + prefix, body.size() - prefix);
+    } else {
+        out.append(width - body.size(), ' ');
+        out += body;
+    }
+}
+
+// Sign prefix for a non-negative number under the spec's flags
+const char* positiveSign(const FormatSpec& spec) {
+    return spec.plus ? "+" : spec.space ? " " : "";
+}
+
+// %d %i %x %X %o with the C semantics: precision is a minimum digit count
+void formatInteger(std::string& out, int64_t value, const FormatSpec& spec) {
+    char digits[32];
+    uint64_t magnitude = static_cast<uint64_t>(value);
+    const char* sign = "";
+    const char* prefix = "";
+    int base = 10;
+    if (spec.conversion == 'd' || spec.conversion == 'i') {
+        if (value < 0) {
+            magnitude = 0 - magnitude;
+            sign = "-";
+        } else {
+            sign = positiveSign(spec);
+        }
+    } else if (spec.conversion == 'o') {
+        base = 8;
+    } else {
+        base = 16;
+        if (spec.alternate && value != 0) prefix = spec.conversion == 'x' ? "0x" : "0X";
+    }
+    size_t length = std::to_chars(digits, digits + sizeof(digits), magnitude, base).ptr - digits;
+    if (spec.precision == 0 && magnitude == 0) length = 0;
+    if (spec.conversion == 'X') {
+        for (size_t i = 0; i < length; i++) digits[i] = static_cast<char>(std::toupper(digits[i]));
+    }
+    size_t zeros = spec.precision > static_cast<int>(length) ? spec.precision - length : 0;
+    if (spec.conversion == 'o' && spec.alternate && zeros == 0 && (length == 0 || digits[0] != '0')) zeros = 1;
+
+    char body[160];
+    size_t size = 0;
+    for (const char* c = sign; *c; c++) body[size++] = *c;
+    for (const char* c = prefix; *c; c++) body[size++] = *c;
+    size_t head = size;
+    std::memset(body + size, '0', zeros);
+    size += zeros;
+    std::memcpy(body + size, digits, length);
+    size += length;
+    appendPadded(out, std::string_view(body, size), spec, spec.zero && spec.precision < 0, head);
+}
+
+// %e %E %f %F %g %G %a %A, on std::to_chars. Only the '#' forms, which
+// to_chars has no equivalent for, go through snprintf.
+void formatFloat(std::string& out, double value, const FormatSpec& spec) {
+    char body[512];
+    size_t size = 0;
+    char lower = static_cast<char>(std::tolower(static_cast<unsigned char>(spec.conversion)));
+    if (spec.alternate) {
+        char format[16];
+        std::snprintf(format, sizeof(format), "%%%s%s#.*%c", spec.plus ? "+" : "", spec.space ? " " : "",
+                      spec.conversion);
+        int precision = spec.precision < 0 ? (lower == 'a' ? -1 : 6) : spec.precision;
+        size = static_cast<size_t>(std::snprintf(body, sizeof(body), format, precision, value));
+    } else {
+        if (std::signbit(value)) {
+            body[size++] = '-';
+            value = -value;
+        } else {
+            for (const char* c = positiveSign(spec); *c; c++) body[size++] = *c;
+        }
+        if (lower == 'a' && std::isfinite(value)) {
+            body[size++] = '0';
+            body[size++] = 'x';
+        }
+        char* first = body + size;
+        char* last = body + sizeof(body);
+        int precision = spec.precision < 0 ? 6 : spec.precision;
+        std::to_chars_result written;
+        switch (lower) {
+            case 'e': written = std::to_chars(first, last, value, std::chars_format::scientific, precision); break;
+            case 'f': written = std::to_chars(first, last, value, std::chars_format::fixed, precision); break;
+            case 'g': written = std::to_chars(first, last, value, std::chars_format::general, precision); break;
+            default:
+                written = spec.precision < 0 ? std::to_chars(first, last, value, std::chars_format::hex)
+                                             : std::to_chars(first, last, value, std::chars_format::hex, precision);
+                break;
+        }
+        size = written.ptr - body;
+    }
+    if (std::isupper(static_cast<unsigned char>(spec.conversion))) {
+        for (size_t i = 0; i < size; i++) body[i] = static_cast<char>(std::toupper(static_cast<unsigned char>(body[i])));
+    }
+    // Zeros go after the sign and the 0x
+    size_t head = size > 0 && (body[0] == '-' || body[0] == '+' || body[0] == ' ') ? 1 : 0;
+    if (lower == 'a' && head + 1 < size && body[head] == '0') head += 2;
+    appendPadded(out, std::string_view(body, size), spec, spec.zero && std::isfinite(value), head);
+}
+
+// Appends `value` the way print shows it
+void appendValue(std::string& out, const Value& value) {
+    char buffer[40];
+    if (const std::string* s = std::get_if<std::string>(&value)) {
+        out += *s;
+    } else if (const int64_t* i = std::get_if<int64_t>(&value)) {
+        out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), *i).ptr);
+    } else if (const double* d = std::get_if<double>(&value)) {
+        out.append(buffer, formatNumber(*d, buffer));
+    } else if (const bool* b = std::get_if<bool>(&value)) {
+        out += *b ? "true" : "false";
+    } else if (std::holds_alternative<Nil>(value)) {
+        out += "nil";
+    } else if (NativeFunction* const* native = std::get_if<NativeFunction*>(&value)) {
+        out.append(buffer, std::snprintf(buffer, sizeof(buffer), "function: builtin: %p", static_cast<void*>(*native)));
+    } else if (Function* const* function = std::get_if<Function*>(&value)) {
+        out.append(buffer, std::snprintf(buffer, sizeof(buffer), "function: %p", static_cast<void*>(*function)));
+    } else {
+        out.append(buffer, std::snprintf(buffer, sizeof(buffer), "thread: %p",
+                                         static_cast<void*>(std::get<Coroutine*>(value))));
+    }
+}
+
+// %q: a literal that reads back as the same value
+bool appendQuoted(VM& vm, NativeFunction& self, std::string& out, const Value& value, int position) {
+    if (const std::string* s = std::get_if<std::string>(&value)) {
+        out += '"';
+        for (size_t i = 0; i < s->size(); i++) {
+            unsigned char c = static_cast<unsigned char>((*s)[i]);
+            if (c == '"' || c == '\\' || c == '\n') {
+                out += '\\';
+                out += static_cast<char>(c);
+            } else if (c == 0 || std::iscntrl(c)) {
+                char code[8];
+                bool digitFollows = i + 1 < s->size() && std::isdigit(static_cast<unsigned char>((*s)[i + 1]));
+                out.append(code, std::snprintf(code, sizeof(code), digitFollows ? "\\%03d" : "\\%d", c));
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+        out += '"';
+    } else if (const double* d = std::get_if<double>(&value)) {
+        if (*d == HUGE_VAL) {
+            out += "1e9999";
+        } else if (*d == -HUGE_VAL) {
+            out += "-1e9999";
+        } else if (std::isnan(*d)) {
+            out += "(0/0)";
+        } else {
+            // A hex float, as in Lua 5.4: exact, and always read as a float
+            char buffer[40];
+            out.append(buffer, std::snprintf(buffer, sizeof(buffer), "%a", *d));
+        }
+    } else if (const int64_t* i = std::get_if<int64_t>(&value); i && *i == INT64_MIN) {
+        out += "0x8000000000000000"; // Its decimal form would read as a float
+    } else if (std::holds_alternative<int64_t>(value) || std::holds_alternative<bool>(value) ||
+               std::holds_alternative<Nil>(value)) {
+        appendValue(out, value);
+    } else {
+        return argumentError(vm, self, position, "value has no literal form");
+    }
+    return true;
+}
+
+bool invalidConversion(VM& vm, const char* spec, ptrdiff_t length) {
+    vm.runtimeError("invalid conversion '%%%.*s' to 'format'", static_cast<int>(length), spec);
+    return false;
+}
+
+// string.format(format, ...): the conversions of C's printf (d i c x X o e E
+// f F g G a A s q %), built into `result`'s buffer. Numbers are converted
+// with std::to_chars; literal text between conversions is copied in runs.
+bool stringFormat(VM& vm, NativeFunction& self, Value* args, int argCount, Value& result) {
+    std::string formatScratch;
+    const std::string* format = stringArgument(vm, self, args, argCount, 1, formatScratch);
+    if (!format) return false;
+    std::string& out = reuseString(result);
+    out.clear();
+    out.reserve(format->size() + 16 * static_cast<size_t>(argCount));
+
+    const char* p = format->data();
+    const char* end = p + format->size();
+    int position = 1;
+    while (p < end) {
+        const char* percent = static_cast<const char*>(std::memchr(p, '%', end - p));
+        if (!percent) {
+            out.append(p, end - p);
+            break;
+        }
+        out.append(p, percent - p);
+        p = percent + 1;
+        if (p < end && *p == '%') {
+            out += '%';
+            p++;
+            continue;
+        }
+
+        FormatSpec spec;
+        const char* specStart = p;
+        if (!parseSpec(p, end, spec)) {
+            return invalidConversion(vm, specStart, std::min<ptrdiff_t>(p - specStart + 1, end - specStart));
+        }
+        if (++position > argCount) return argumentError(vm, self, position, "no value");
+        const Value& arg = args[position - 1];
+        switch (spec.conversion) {
+            case 'd':
+            case 'i':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c': {
+                int64_t value = 0;
+                if (std::holds_alternative<Nil>(arg)) return typeError(vm, self, args, argCount, position, "number");
+                if (!integerArgument(vm, self, args, argCount, position, value)) return false;
+                if (spec.conversion != 'c') {
+                    formatInteger(out, value, spec);
+                } else {
+                    char c = static_cast<char>(value);
+                    appendPadded(out, std::string_view(&c, 1), spec);
+                }
+                break;
+            }
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                if (!isNumber(arg)) return typeError(vm, self, args, argCount, position, "number");
+                formatFloat(out, toDouble(arg), spec);
+                break;
+            case 's':
+                if (spec.width == 0 && spec.precision < 0) {
+                    appendValue(out, arg); // The common case, without a copy
+                } else {
+                    std::string text;
+                    appendValue(text, arg);
+                    if (spec.precision >= 0 && text.size() > static_cast<size_t>(spec.precision)) {
+                        text.resize(spec.precision);
+                    }
+                    appendPadded(out, text, spec);
+                }
+                break;
+            case 'q':
+                if (p - specStart != 1) {
+                    vm.runtimeError("specifier '%%q' cannot have modifiers");
+                    return false;
+                }
+                if (!appendQuoted(vm, self, out, arg, position)) return false;
+                break;
+            default:
+                return invalidConversion(vm, specStart, p - specStart);
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+void openStringLibrary(VM& vm) {
+    vm.defineNative("string.len", &stringLen);
+    vm.defineNative("string.sub", &stringSub);
+    vm.defineNative("string.byte", &stringByte);
+    vm.defineNative("string.rep", &stringRep);
+    vm.defineNative("string.upper", &stringUpper);
+    vm.defineNative("string.lower", &stringLower);
+    vm.defineNative("string.find", &stringFind);
+    vm.defineNative("string.match", &stringMatch);
+    vm.defineNative("string.gmatch", &stringGmatch);
+    vm.defineNative("string.format", &stringFormat);
+}
@@ -1,143 +1,695 @@
 #include "VM.h"
+#include "Compiler.h"
+#include "Debug.h"
 #include <iostream>
 #include <cstdarg>
 #include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <charconv>
+#include <atomic>
+#include <new>
+
+namespace {
+// Source of globalsVersion values; shared by every VM in the process
+std::atomic<uint64_t> globalsEpoch{0};
+
+// Policies for VM::run. Each instantiation of the dispatch loop is compiled
+// on its own, so NoHooks has no hook code in it at all: setting hooks swaps
+// the loop (VM::redispatch) instead of testing a flag per instruction.
+struct NoHooks {
+    static constexpr bool kHooks = false; // Call and count events; never enters the JIT
+    static constexpr bool kLines = false; // Line events
+    static constexpr bool kTrace = false; // Prints each instruction (--trace)
+};
+struct CountHook {
+    static constexpr bool kHooks = true;
+    static constexpr bool kLines = false;
+    static constexpr bool kTrace = false;
+};
+struct LineHook {
+    static constexpr bool kHooks = true;
+    static constexpr bool kLines = true;
+    static constexpr bool kTrace = false;
+};
+struct Trace {
+    static constexpr bool kHooks = true;
+    static constexpr bool kLines = true;
+    static constexpr bool kTrace = true;
+};
+
+// What ip points at while the dispatch loop has to be chosen again
+uint8_t kRedispatchCode[] = {static_cast<uint8_t>(OpCode::OP_REDISPATCH)};
+
+// Integer arithmetic wraps around on overflow, as in Lua
+int64_t wrapAdd(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)); }
+int64_t wrapSubtract(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b)); }
+int64_t wrapMultiply(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)); }
+
+// Floor division and modulo round toward minus infinity; b is nonzero
+int64_t floorDivide(int64_t a, int64_t b) {
+    if (b == -1) return wrapSubtract(0, a); // Avoids the INT64_MIN / -1 trap
+    int64_t quotient = a / b;
+    if ((a % b != 0) && ((a ^ b) < 0)) quotient--;
+    return quotient;
+}
+
+int64_t floorModulo(int64_t a, int64_t b) {
+    if (b == -1) return 0;
+    int64_t remainder = a % b;
+    if (remainder != 0 && ((remainder ^ b) < 0)) remainder += b;
+    return remainder;
+}
+
+double floatModulo(double a, double b) {
+    double remainder = std::fmod(a, b);
+    if (remainder != 0 && ((remainder > 0) != (b > 0))) remainder += b;
+    return remainder;
+}
+
+// Exact integer/float comparisons: converting a large integer to double
+// could round it across the float. For integer i and real f,
+// i < f  <=>  i < ceil(f)  and  i <= f  <=>  i <= floor(f).
+constexpr double kTwoTo63 = 9223372036854775808.0;
+
+bool floatFitsInteger(double f) {
+    return f >= -kTwoTo63 && f < kTwoTo63;
+}
+
+bool integerLessFloat(int64_t i, double f, bool orEqual) {
+    double bound = orEqual ? std::floor(f) : std::ceil(f);
+    if (floatFitsInteger(bound)) return orEqual ? i <= static_cast<int64_t>(bound) : i < static_cast<int64_t>(bound);
+    return f > 0; // Beyond the integer range (false for NaN)
+}
+
+bool floatLessInteger(double f, int64_t i, bool orEqual) {
+    double bound = orEqual ? std::ceil(f) : std::floor(f);
+    if (floatFitsInteger(bound)) return orEqual ? static_cast<int64_t>(bound) <= i : static_cast<int64_t>(bound) < i;
+    return f < 0;
+}
+
+// a < b (or a <= b) for two numbers
+bool numberLess(const Value& a, const Value& b, bool orEqual) {
+    const int64_t* ai = std::get_if<int64_t>(&a);
+    const int64_t* bi = std::get_if<int64_t>(&b);
+    if (ai && bi) return orEqual ? *ai <= *bi : *ai < *bi;
+    if (ai) return integerLessFloat(*ai, std::get<double>(b), orEqual);
+    if (bi) return floatLessInteger(std::get<double>(a), *bi, orEqual);
+    double x = std::get<double>(a), y = std::get<double>(b);
+    return orEqual ? x <= y : x < y;
+}
+
+bool numbersEqual(const Value& a, const Value& b) {
+    const int64_t* ai = std::get_if<int64_t>(&a);
+    const int64_t* bi = std::get_if<int64_t>(&b);
+    if (ai && bi) return *ai == *bi;
+    if (!ai && !bi) return std::get<double>(a) == std::get<double>(b);
+    int64_t i = ai ? *ai : *bi;
+    double f = ai ? std::get<double>(b) : std::get<double>(a);
+    return floatFitsInteger(f) && std::floor(f) == f && static_cast<int64_t>(f) == i;
+}
+}
 
 VM::VM() {
-    // Reserve some stack space
-    stack.reserve(256);
+    // The stack is a fixed block addressed through stackTop so that JIT code
+    // can work on it directly; it only reallocates when it fills up.
+    {
+        MemoryScope scope(MemoryCategory::Stack);
+        mainCoroutine.stack.values.resize(kInitialStack);
+    }
+    mainCoroutine.status = Coroutine::Status::Running;
+    current = &mainCoroutine;
+    chunk = nullptr;
+    ip = nullptr;
+    stackTop = stackBase();
+    stackLimit = stackBase() + mainCoroutine.stack.values.size();
+    slots = stackBase();
+    globalsVersion = ++globalsEpoch;
+    setJitEnabled(true);
+    stdinBuffer.tie(&stdoutBuffer);
+    openIoLibrary(*this);
+    openCoroutineLibrary(*this);
+    openMathLibrary(*this);
+    openStringLibrary(*this);
+    openDebugLibrary(*this);
+}
+
+void VM::defineNative(const std::string& name, NativeFn function) {
+    globals[name] = adoptNative(std::make_unique<NativeFunction>(name, function));
+}
+
+bool binding::argumentError(VM& vm, NativeFunction& self, int position, const char* expected, const Value& got) {
+    vm.runtimeError("bad argument #%d to '%s' (%s expected, got %s)", position, self.name.c_str(), expected,
+                    typeName(got));
+    return false;
+}
+
+NativeFunction* VM::adoptNative(std::unique_ptr<NativeFunction> native) {
+    natives.push_back(std::move(native));
+    return natives.back().get();
+}
+
+void VM::cacheGlobal(uint8_t constant, Value* slot) {
+    GlobalCache& cache = chunk->globalCaches[constant];
+    cache.slot = slot;
+    cache.version = globalsVersion;
+}
+
+void VM::setBudget(uint64_t steps) {
+    budget = steps == 0 ? kUnlimitedBudget : steps;
+}
+
+void VM::setHook(Function* function, uint8_t mask, uint32_t count) {
+    if (!function) mask = count = 0;
+    if (count > 0) mask |= kHookCount;
+    else mask &= ~kHookCount;
+    hooks.function = mask != 0 ? function : nullptr;
+    hooks.mask = mask;
+    hooks.count = hooks.countLeft = count;
+    // Events are tracked from the next instruction on; a running hook still
+    // returns to its instruction, whose remaining events are dropped
+    if (!hooks.running) hooks.resuming = false;
+    hooks.pending = 0;
+    hooks.coroutine = current;
+    hooks.frames = current->stack.frames.size();
+    hooks.lastChunk = chunk;
+    if (chunk) {
+        // The rest of the line that set the hook is not a new line
+        hooks.lastIp = hooks.changed ? hooks.resumeIp : ip;
+        hooks.lastLine = chunk->lines.line(hooks.lastIp - chunk->code.data() - 1);
+    }
+    redispatch();
+}
+
+void VM::setTrace(bool enabled) {
+    hooks.trace = enabled;
+    redispatch();
 }
 
+// Makes the running dispatch loop return before its next instruction, so
+// that execute() can choose the loop again: ip points at OP_REDISPATCH until
+// then, which costs the unhooked loop nothing. Native code exits after the
+// call of a built-in that got here (Jit::helperCall). Hooks set from the
+// host between runs take effect when the script is resumed.
+void VM::redispatch() {
+    if (hooks.changed) return;
+    hooks.changed = true;
+    hooks.resumeIp = ip;
+    ip = kRedispatchCode;
+}
+
+void VM::setJitEnabled(bool enabled) {
+#ifdef LUA_HAS_JIT
+    jitEnabled = enabled && Jit::available();
+#else
+    jitEnabled = false;
+#endif
+}
+
+void VM::releaseChunk(const Chunk* chunk) {
+#ifdef LUA_HAS_JIT
+    jit.release(chunk);
+#else
+    (void)chunk;
+#endif
+}
+
+// No room check: every chunk reserves its compiler-computed maximum depth
+// when it is entered (reserveStack), so pushes inside it always fit
 void VM::push(Value value) {
-    stack.push_back(value);
+    *stackTop++ = std::move(value);
+}
+
+// Makes room for `count` more values above the stack top
+void VM::reserveStack(size_t count) {
+    if (static_cast<size_t>(stackLimit - stackTop) < count) growStack(count);
 }
 
-Value VM::pop() {
-    Value val = stack.back();
-    stack.pop_back();
-    return val;
+void VM::growStack(size_t count) {
+    MemoryScope scope(MemoryCategory::Stack);
+    std::vector<Value>& stack = current->stack.values;
+    size_t depth = stackTop - stack.data();
+    size_t base = slots - stack.data();
+    size_t size = std::max<size_t>(stack.size(), 1);
+    while (size - depth < count) size *= 2;
+    stack.resize(size);
+    stackTop = stack.data() + depth;
+    slots = stack.data() + base;
+    stackLimit = stack.data() + stack.size();
 }
 
-Value VM::peek(int distance) {
-    return stack[stack.size() - 1 - distance];
+void VM::growFrames() {
+    MemoryScope scope(MemoryCategory::Stack);
+    std::vector<CallFrame>& frames = current->stack.frames;
+    frames.reserve(std::max<size_t>(frames.capacity() * 2, 8));
+}
+
+// False (after reporting the error) once the script's memory is over the
+// limit. Called after operations that allocate, so ip is at a valid
+// instruction of the running chunk.
+bool VM::checkMemoryLimit() {
+    if (!memory || !memory->overLimit()) return true;
+    runtimeError("not enough memory");
+    return false;
+}
+
+bool VM::checkMemoryHeadroom(size_t bytes) {
+    if (bytes <= memoryHeadroom()) return true;
+    runtimeError("not enough memory");
+    return false;
 }
 
 InterpretResult VM::interpret(Chunk* chunk) {
+    MemoryScope scope(memory, MemoryCategory::Heap);
+    // A previous run may have stopped inside a coroutine
+    current = &mainCoroutine;
+    current->stack.frames.clear();
     this->chunk = chunk;
     this->ip = chunk->code.data();
-    return run();
+    // Top-level locals of the previous chunk are gone; this one starts at slot 0
+    stackTop = stackBase();
+    slots = stackBase();
+    stackLimit = stackBase() + current->stack.values.size();
+    reserveStack(chunk->maxStack);
+    if (chunk->globalCaches.size() < chunk->constants.size()) {
+        chunk->globalCaches.resize(chunk->constants.size());
+    }
+    backEdges = 0;
+    hooks.running = hooks.resuming = false;
+    hooks.pending = 0;
+    hooks.coroutine = nullptr;
+    hooks.lastChunk = nullptr;
+#ifdef LUA_OPSTATS
+    if (opStats) jitEnabled = false; // Native code would bypass the counters
+#endif
+#ifdef LUA_PROFILER
+    if (profiler) jitEnabled = false;
+#endif
+    return execute();
+}
+
+InterpretResult VM::resumeScript() {
+    if (!suspended) return InterpretResult::OK;
+    MemoryScope scope(memory, MemoryCategory::Heap);
+    return execute();
+}
+
+// Runs from the current registers until the script finishes, fails or
+// uses up its budget
+InterpretResult VM::execute() {
+    InterpretResult result;
+    for (;;) {
+        if (hooks.changed) {
+            // Hooks changed (redispatch): continue where the script was, in
+            // the loop serving them
+            hooks.changed = false;
+            if (ip == kRedispatchCode) ip = hooks.resumeIp;
+        }
+        try {
+            result = dispatch();
+        } catch (...) {
+            exceptionError();
+            result = InterpretResult::RUNTIME_ERROR;
+        }
+        if (result != InterpretResult::SUSPENDED || !hooks.changed) break;
+    }
+    if (result == InterpretResult::RUNTIME_ERROR) {
+        // Release what the failed run left on the stacks (possibly what
+        // exceeded the memory limit); nothing can reach those slots any more
+        for (Value& value : mainCoroutine.stack.values) value = Nil{};
+        for (Value& value : current->stack.values) value = Nil{};
+        nativeResult = Nil{};
+        hooks.running = hooks.resuming = false;
+        hooks.pending = 0;
+    }
+    suspended = result == InterpretResult::SUSPENDED;
+    stdoutBuffer.flush();
+    return result;
+}
+
+// Runs the dispatch loop that serves the hooks currently set. A hook that
+// turned hooks off still finishes in a hooked loop, which returns to it.
+InterpretResult VM::dispatch() {
+    if (hooks.trace) return run<Trace>();
+    if (hooks.running || (hooks.mask & kHookLine)) return run<LineHook>();
+    if (hooks.mask != 0) return run<CountHook>();
+#ifdef LUA_HAS_JIT
+    // Native code hands back OK whenever the interpreter has to take over
+    // (a Lua call, a return, a coroutine switch)
+    InterpretResult result;
+    if (jitEnabled && jitThreshold == 0 && enterJit(result) && result != InterpretResult::OK) return result;
+#endif
+    return run<NoHooks>();
+}
+
+#ifdef LUA_HAS_JIT
+bool VM::enterJit(InterpretResult& result) {
+    if (!jit.isCompiled(chunk) && !jit.compile(chunk)) {
+        jitEnabled = false; // Unsupported bytecode: keep interpreting
+        return false;
+    }
+    result = jit.execute(this, chunk, ip);
+    // Native code leaves after a call that used up the budget
+    if (result == InterpretResult::OK && budget == 0) result = InterpretResult::SUSPENDED;
+    return true;
 }
+#endif
 
 #define READ_BYTE() (*ip++)
 #define READ_CONSTANT() (chunk->constants[READ_BYTE()])
 #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 #define READ_STRING() (std::get<std::string>(READ_CONSTANT()))
+// Rewrite the opcode of the instruction being executed (operand bytes already read)
+#define REWRITE(length, op) (ip[-(length)] = static_cast<uint8_t>(op))
+// Guard failed in a quickened instruction: restore the generic opcode and re-dispatch
+#define DEOPTIMIZE(length, op) do { ip -= (length); *ip = static_cast<uint8_t>(op); } while (0)
+// Quickened number-number arithmetic/comparison, computed in place on the top two slots
+#define NUMERIC_BINARY(generic, assignOp) {                                      \
+        const double* b = std::get_if<double>(&stackTop[-1]);                    \
+        double* a = std::get_if<double>(&stackTop[-2]);                          \
+        if (!a || !b) { DEOPTIMIZE(1, generic); break; }                         \
+        *a assignOp *b;                                                          \
+        stackTop--;                                                              \
+        break;                                                                   \
+    }
+#define NUMERIC_COMPARE(generic, compareOp) {                                    \
+        const double* b = std::get_if<double>(&stackTop[-1]);                    \
+        const double* a = std::get_if<double>(&stackTop[-2]);                    \
+        if (!a || !b) { DEOPTIMIZE(1, generic); break; }                         \
+        bool result = *a compareOp *b;                                           \
+        stackTop--;                                                              \
+        stackTop[-1] = result;                                                   \
+        break;                                                                   \
+    }
+// Fused compare-and-branch: sense byte, forward offset. Same-typed numbers
+// are compared inline; anything else goes through compareValues.
+#define COMPARE_JUMP(generic, compareOp) {                                       \
+        bool sense = READ_BYTE() != 0;                                           \
+        uint16_t offset = READ_SHORT();                                          \
+        const Value& a = stackTop[-2];                                           \
+        const Value& b = stackTop[-1];                                           \
+        bool result;                                                             \
+        const int64_t* ai = std::get_if<int64_t>(&a);                            \
+        const int64_t* bi = std::get_if<int64_t>(&b);                            \
+        const double* ad = std::get_if<double>(&a);                              \
+        const double* bd = std::get_if<double>(&b);                              \
+        if (ai && bi) result = *ai compareOp *bi;                                \
+        else if (ad && bd) result = *ad compareOp *bd;                           \
+        else if (!compareValues(generic, a, b, result)) return InterpretResult::RUNTIME_ERROR; \
+        stackTop -= 2;                                                           \
+        if (result == sense) ip += offset;                                       \
+        break;                                                                   \
+    }
+// Quickened integer-integer forms of the above
+#define INTEGER_BINARY(generic, wrapOp) {                                        \
+        const int64_t* b = std::get_if<int64_t>(&stackTop[-1]);                  \
+        int64_t* a = std::get_if<int64_t>(&stackTop[-2]);                        \
+        if (!a || !b) { DEOPTIMIZE(1, generic); break; }                         \
+        *a = wrapOp(*a, *b);                                                     \
+        stackTop--;                                                              \
+        break;                                                                   \
+    }
+#define INTEGER_COMPARE(generic, compareOp) {                                    \
+        const int64_t* b = std::get_if<int64_t>(&stackTop[-1]);                  \
+        const int64_t* a = std::get_if<int64_t>(&stackTop[-2]);                  \
+        if (!a || !b) { DEOPTIMIZE(1, generic); break; }                         \
+        bool result = *a compareOp *b;                                           \
+        stackTop--;                                                              \
+        stackTop[-1] = result;                                                   \
+        break;                                                                   \
+    }
+// Typed forms: the compiler proved both operands are `type`, so nothing is
+// checked (and the variant's tag already fits the result)
+#define TYPED_BINARY(type, operation) {                                         \
+        type& a = *std::get_if<type>(&stackTop[-2]);                             \
+        type b = *std::get_if<type>(&stackTop[-1]);                              \
+        a = operation;                                                           \
+        stackTop--;                                                              \
+        break;                                                                   \
+    }
+#define TYPED_COMPARE_JUMP(type, compareOp) {                                    \
+        bool sense = READ_BYTE() != 0;                                           \
+        uint16_t offset = READ_SHORT();                                          \
+        bool result = *std::get_if<type>(&stackTop[-2]) compareOp *std::get_if<type>(&stackTop[-1]); \
+        stackTop -= 2;                                                           \
+        if (result == sense) ip += offset;                                       \
+        break;                                                                   \
+    }
 
+template <typename Hooks>
 InterpretResult VM::run() {
     for (;;) {
-        // Debug trace (optional)
-        /*
-        std::cout << "          ";
-        for (const auto& v : stack) {
-            std::cout << "[ ";
-            printValue(v);
-            std::cout << " ]";
+        if constexpr (Hooks::kHooks) {
+            if (hooks.changed) return InterpretResult::SUSPENDED; // ip may be kRedispatchCode
+            if (!hooks.running && hooks.mask != 0) {
+                if (hooks.resuming) hooks.resuming = false;
+                else hooks.pending = collectHookEvents<Hooks::kLines>();
+                if (hooks.pending != 0) {
+                    // The hook runs first and comes back to this instruction
+                    if (!callHook()) return InterpretResult::RUNTIME_ERROR;
+                    if (budget == 0) return InterpretResult::SUSPENDED;
+                    continue;
+                }
+            }
         }
-        std::cout << "\n";
-        */
+        if constexpr (Hooks::kTrace) traceInstruction();
+
+#ifdef LUA_COUNT_INSTRUCTIONS
+        instructionCount++;
+#endif
+#ifdef LUA_OPSTATS
+        if (opStats) opStats->record(*ip);
+#endif
+#ifdef LUA_PROFILER
+        if (profiler && profiler->shouldSample()) sampleProfile();
+#endif
 
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
-            case static_cast<uint8_t>(OpCode::OP_CONSTANT): {
-                Value constant = READ_CONSTANT();
-                push(constant);
-                break;
-            }
-            case static_cast<uint8_t>(OpCode::OP_NIL): push(Nil{}); break;
-            case static_cast<uint8_t>(OpCode::OP_TRUE): push(true); break;
-            case static_cast<uint8_t>(OpCode::OP_FALSE): push(false); break;
-            case static_cast<uint8_t>(OpCode::OP_POP): pop(); break;
+            case static_cast<uint8_t>(OpCode::OP_CONSTANT): *stackTop++ = READ_CONSTANT(); break;
+            case static_cast<uint8_t>(OpCode::OP_NIL): *stackTop++ = Nil{}; break;
+            case static_cast<uint8_t>(OpCode::OP_TRUE): *stackTop++ = true; break;
+            case static_cast<uint8_t>(OpCode::OP_FALSE): *stackTop++ = false; break;
+            case static_cast<uint8_t>(OpCode::OP_POP): stackTop--; break;
 
             case static_cast<uint8_t>(OpCode::OP_GET_GLOBAL): {
-                std::string name = READ_STRING();
+                uint8_t constant = READ_BYTE();
+                const std::string& name = std::get<std::string>(chunk->constants[constant]);
                 auto it = globals.find(name);
                 if (it == globals.end()) {
                     // Lua returns nil for undefined globals, but for debugging let's warn or return nil
                     push(Nil{}); 
                     // Or runtimeError("Undefined variable '%s'.", name.c_str()); return InterpretResult::RUNTIME_ERROR;
                 } else {
-                    push(it->second);
+                    cacheGlobal(constant, &it->second);
+                    REWRITE(2, OpCode::OP_GET_GLOBAL_CACHED);
+                    *stackTop++ = it->second;
+                }
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_GET_GLOBAL_CACHED): {
+                const GlobalCache& cache = chunk->globalCaches[READ_BYTE()];
+                if (cache.version != globalsVersion) {
+                    DEOPTIMIZE(2, OpCode::OP_GET_GLOBAL);
+                    break;
                 }
+                *stackTop++ = *cache.slot;
                 break;
             }
+            case static_cast<uint8_t>(OpCode::OP_GET_LOCAL): *stackTop++ = slots[READ_BYTE()]; break;
+            case static_cast<uint8_t>(OpCode::OP_SET_LOCAL): slots[READ_BYTE()] = stackTop[-1]; break;
             case static_cast<uint8_t>(OpCode::OP_DEFINE_GLOBAL): {
-                std::string name = READ_STRING();
-                globals[name] = peek(0);
-                pop();
+                globals[READ_STRING()] = std::move(*--stackTop);
                 break;
             }
             case static_cast<uint8_t>(OpCode::OP_SET_GLOBAL): {
-                std::string name = READ_STRING();
-                auto it = globals.find(name);
-                if (it == globals.end()) {
-                    // Implicit global declaration in Lua if assignment
-                    globals[name] = peek(0);
-                } else {
-                    globals[name] = peek(0);
-                }
+                uint8_t constant = READ_BYTE();
+                const std::string& name = std::get<std::string>(chunk->constants[constant]);
+                // Implicit global declaration in Lua if assignment
+                Value& slot = globals[name];
+                slot = stackTop[-1];
+                cacheGlobal(constant, &slot);
+                REWRITE(2, OpCode::OP_SET_GLOBAL_CACHED);
                 // Assignment expression evaluates to the value, so we don't pop?
                 // But in statement context we might pop. 
                 // Let's assume assignment expression keeps value on stack.
                 break;
             }
+            case static_cast<uint8_t>(OpCode::OP_SET_GLOBAL_CACHED): {
+                const GlobalCache& cache = chunk->globalCaches[READ_BYTE()];
+                if (cache.version != globalsVersion) {
+                    DEOPTIMIZE(2, OpCode::OP_SET_GLOBAL);
+                    break;
+                }
+                *cache.slot = stackTop[-1];
+                break;
+            }
 
             case static_cast<uint8_t>(OpCode::OP_EQUAL): {
-                Value b = pop();
-                Value a = pop();
-                push(valuesEqual(a, b));
+                bool equal = valuesEqual(stackTop[-2], stackTop[-1]);
+                stackTop--;
+                stackTop[-1] = equal;
                 break;
             }
-            case static_cast<uint8_t>(OpCode::OP_GREATER): {
-                // Simplified: assume numbers
-                if (!std::holds_alternative<double>(peek(0)) || !std::holds_alternative<double>(peek(1))) {
-                     runtimeError("Operands must be numbers.");
-                     return InterpretResult::RUNTIME_ERROR;
+            case static_cast<uint8_t>(OpCode::OP_GREATER):
+            case static_cast<uint8_t>(OpCode::OP_LESS): {
+                bool doubles = std::holds_alternative<double>(stackTop[-2]) && std::holds_alternative<double>(stackTop[-1]);
+                bool integers = std::holds_alternative<int64_t>(stackTop[-2]) && std::holds_alternative<int64_t>(stackTop[-1]);
+                if (!compareOp(static_cast<OpCode>(instruction))) return InterpretResult::RUNTIME_ERROR;
+                bool greater = instruction == static_cast<uint8_t>(OpCode::OP_GREATER);
+                if (doubles) {
+                    REWRITE(1, greater ? OpCode::OP_GREATER_NUM : OpCode::OP_LESS_NUM);
+                } else if (integers) {
+                    REWRITE(1, greater ? OpCode::OP_GREATER_INT : OpCode::OP_LESS_INT);
                 }
-                double b = std::get<double>(pop());
-                double a = std::get<double>(pop());
-                push(a > b);
                 break;
             }
-            case static_cast<uint8_t>(OpCode::OP_LESS): {
-                 if (!std::holds_alternative<double>(peek(0)) || !std::holds_alternative<double>(peek(1))) {
-                     runtimeError("Operands must be numbers.");
-                     return InterpretResult::RUNTIME_ERROR;
+            case static_cast<uint8_t>(OpCode::OP_LESS_EQUAL):
+            case static_cast<uint8_t>(OpCode::OP_GREATER_EQUAL):
+                if (!compareOp(static_cast<OpCode>(instruction))) return InterpretResult::RUNTIME_ERROR;
+                break;
+            case static_cast<uint8_t>(OpCode::OP_JLT): COMPARE_JUMP(OpCode::OP_LESS, <)
+            case static_cast<uint8_t>(OpCode::OP_JLE): COMPARE_JUMP(OpCode::OP_LESS_EQUAL, <=)
+            case static_cast<uint8_t>(OpCode::OP_JGT): COMPARE_JUMP(OpCode::OP_GREATER, >)
+            case static_cast<uint8_t>(OpCode::OP_JGE): COMPARE_JUMP(OpCode::OP_GREATER_EQUAL, >=)
+            case static_cast<uint8_t>(OpCode::OP_JEQ): {
+                bool sense = READ_BYTE() != 0;
+                uint16_t offset = READ_SHORT();
+                const int64_t* a = std::get_if<int64_t>(&stackTop[-2]);
+                const int64_t* b = std::get_if<int64_t>(&stackTop[-1]);
+                bool result = a && b ? *a == *b : valuesEqual(stackTop[-2], stackTop[-1]);
+                stackTop -= 2;
+                if (result == sense) ip += offset;
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_JTEST): {
+                bool sense = READ_BYTE() != 0;
+                uint16_t offset = READ_SHORT();
+                bool truthy = !isFalsey(*--stackTop);
+                if (truthy == sense) ip += offset;
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_CONCAT):
+                if (!concatenate(READ_BYTE())) return InterpretResult::RUNTIME_ERROR;
+                break;
+            case static_cast<uint8_t>(OpCode::OP_APPEND_LOCAL): {
+                uint8_t slot = READ_BYTE();
+                if (!appendToLocal(slot, READ_BYTE())) return InterpretResult::RUNTIME_ERROR;
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_GREATER_NUM): NUMERIC_COMPARE(OpCode::OP_GREATER, >)
+            case static_cast<uint8_t>(OpCode::OP_LESS_NUM): NUMERIC_COMPARE(OpCode::OP_LESS, <)
+            case static_cast<uint8_t>(OpCode::OP_GREATER_INT): INTEGER_COMPARE(OpCode::OP_GREATER, >)
+            case static_cast<uint8_t>(OpCode::OP_LESS_INT): INTEGER_COMPARE(OpCode::OP_LESS, <)
+            case static_cast<uint8_t>(OpCode::OP_ADD):
+            case static_cast<uint8_t>(OpCode::OP_SUBTRACT):
+            case static_cast<uint8_t>(OpCode::OP_MULTIPLY):
+            case static_cast<uint8_t>(OpCode::OP_DIVIDE): {
+                bool doubles = std::holds_alternative<double>(stackTop[-2]) && std::holds_alternative<double>(stackTop[-1]);
+                bool integers = std::holds_alternative<int64_t>(stackTop[-2]) && std::holds_alternative<int64_t>(stackTop[-1]);
+                if (!binaryOp(static_cast<OpCode>(instruction))) return InterpretResult::RUNTIME_ERROR;
+                // Mixed operands stay generic; '/' always produces a float
+                int variant = instruction - static_cast<uint8_t>(OpCode::OP_ADD);
+                if (doubles) {
+                    REWRITE(1, static_cast<uint8_t>(OpCode::OP_ADD_NUM) + variant);
+                } else if (integers && instruction != static_cast<uint8_t>(OpCode::OP_DIVIDE)) {
+                    REWRITE(1, static_cast<uint8_t>(OpCode::OP_ADD_INT) + variant);
                 }
-                double b = std::get<double>(pop());
-                double a = std::get<double>(pop());
-                push(a < b);
                 break;
             }
-            case static_cast<uint8_t>(OpCode::OP_ADD): binaryOp(OpCode::OP_ADD); break;
-            case static_cast<uint8_t>(OpCode::OP_SUBTRACT): binaryOp(OpCode::OP_SUBTRACT); break;
-            case static_cast<uint8_t>(OpCode::OP_MULTIPLY): binaryOp(OpCode::OP_MULTIPLY); break;
-            case static_cast<uint8_t>(OpCode::OP_DIVIDE): binaryOp(OpCode::OP_DIVIDE); break;
+            case static_cast<uint8_t>(OpCode::OP_FLOOR_DIVIDE):
+            case static_cast<uint8_t>(OpCode::OP_MODULO):
+                if (!binaryOp(static_cast<OpCode>(instruction))) return InterpretResult::RUNTIME_ERROR;
+                break;
+            case static_cast<uint8_t>(OpCode::OP_ADD_NUM): NUMERIC_BINARY(OpCode::OP_ADD, +=)
+            case static_cast<uint8_t>(OpCode::OP_SUBTRACT_NUM): NUMERIC_BINARY(OpCode::OP_SUBTRACT, -=)
+            case static_cast<uint8_t>(OpCode::OP_MULTIPLY_NUM): NUMERIC_BINARY(OpCode::OP_MULTIPLY, *=)
+            case static_cast<uint8_t>(OpCode::OP_DIVIDE_NUM): NUMERIC_BINARY(OpCode::OP_DIVIDE, /=)
+            case static_cast<uint8_t>(OpCode::OP_ADD_INT): INTEGER_BINARY(OpCode::OP_ADD, wrapAdd)
+            case static_cast<uint8_t>(OpCode::OP_SUBTRACT_INT): INTEGER_BINARY(OpCode::OP_SUBTRACT, wrapSubtract)
+            case static_cast<uint8_t>(OpCode::OP_MULTIPLY_INT): INTEGER_BINARY(OpCode::OP_MULTIPLY, wrapMultiply)
+            case static_cast<uint8_t>(OpCode::OP_ADD_II): TYPED_BINARY(int64_t, wrapAdd(a, b))
+            case static_cast<uint8_t>(OpCode::OP_SUBTRACT_II): TYPED_BINARY(int64_t, wrapSubtract(a, b))
+            case static_cast<uint8_t>(OpCode::OP_MULTIPLY_II): TYPED_BINARY(int64_t, wrapMultiply(a, b))
+            case static_cast<uint8_t>(OpCode::OP_ADD_FF): TYPED_BINARY(double, a + b)
+            case static_cast<uint8_t>(OpCode::OP_SUBTRACT_FF): TYPED_BINARY(double, a - b)
+            case static_cast<uint8_t>(OpCode::OP_MULTIPLY_FF): TYPED_BINARY(double, a * b)
+            case static_cast<uint8_t>(OpCode::OP_DIVIDE_FF): TYPED_BINARY(double, a / b)
+            case static_cast<uint8_t>(OpCode::OP_JLT_II): TYPED_COMPARE_JUMP(int64_t, <)
+            case static_cast<uint8_t>(OpCode::OP_JLE_II): TYPED_COMPARE_JUMP(int64_t, <=)
+            case static_cast<uint8_t>(OpCode::OP_JGT_II): TYPED_COMPARE_JUMP(int64_t, >)
+            case static_cast<uint8_t>(OpCode::OP_JGE_II): TYPED_COMPARE_JUMP(int64_t, >=)
+            case static_cast<uint8_t>(OpCode::OP_JLT_FF): TYPED_COMPARE_JUMP(double, <)
+            case static_cast<uint8_t>(OpCode::OP_JLE_FF): TYPED_COMPARE_JUMP(double, <=)
+            case static_cast<uint8_t>(OpCode::OP_JGT_FF): TYPED_COMPARE_JUMP(double, >)
+            case static_cast<uint8_t>(OpCode::OP_JGE_FF): TYPED_COMPARE_JUMP(double, >=)
             case static_cast<uint8_t>(OpCode::OP_NOT): {
-                push(isFalsey(pop()));
+                stackTop[-1] = isFalsey(stackTop[-1]);
                 break;
             }
             case static_cast<uint8_t>(OpCode::OP_NEGATE): {
-                if (!std::holds_alternative<double>(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return InterpretResult::RUNTIME_ERROR;
+                bool isDouble = std::holds_alternative<double>(stackTop[-1]);
+                if (!negateOp()) return InterpretResult::RUNTIME_ERROR;
+                if (isDouble) REWRITE(1, OpCode::OP_NEGATE_NUM);
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_NEGATE_NUM): {
+                double* val = std::get_if<double>(&stackTop[-1]);
+                if (!val) {
+                    DEOPTIMIZE(1, OpCode::OP_NEGATE);
+                    break;
                 }
-                double val = std::get<double>(pop());
-                push(-val);
+                *val = -*val;
                 break;
             }
             case static_cast<uint8_t>(OpCode::OP_PRINT): {
-                printValue(pop());
-                std::cout << std::endl;
+                stdoutBuffer.writeValue(stackTop[-1]);
+                stdoutBuffer.put('\n');
+                stackTop--;
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_CALL): {
+                int argCount = READ_BYTE();
+                Value* callee = stackTop - argCount - 1;
+                // Fast path for built-ins and bound host functions: called in
+                // place, the result overwrites the callee slot directly
+                if (NativeFunction* const* native = std::get_if<NativeFunction*>(callee)) {
+                    Coroutine* caller = current;
+                    if (!(*native)->function(*this, **native, callee + 1, argCount, nativeResult)) {
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    if (current == caller) {
+                        *callee = std::move(nativeResult);
+                        stackTop = callee + 1;
+                        if (!checkMemoryLimit()) return InterpretResult::RUNTIME_ERROR;
+                        break;
+                    }
+                    // resume/yield switched coroutines and delivered the value themselves
+                } else if (!callValue(argCount)) {
+                    return InterpretResult::RUNTIME_ERROR;
+                }
+                // Entering a Lua function or switching coroutines spent a step
+                if (budget == 0) return InterpretResult::SUSPENDED;
+#ifdef LUA_HAS_JIT
+                // With a zero threshold every function runs natively from its entry
+                if (!Hooks::kHooks && jitEnabled && jitThreshold == 0) {
+                    InterpretResult result;
+                    if (enterJit(result) && result != InterpretResult::OK) return result;
+                }
+#endif
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_TFORCALL): {
+                if (!forCall(slots + READ_BYTE())) return InterpretResult::RUNTIME_ERROR;
+                if (budget == 0) return InterpretResult::SUSPENDED;
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_TFORLOOP): {
+                Value* loop = slots + READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                // A Lua iterator left its result on the stack; natives wrote it in place
+                if (stackTop != loop + 2) loop[1] = std::move(*--stackTop);
+                if (std::holds_alternative<Nil>(loop[1])) ip += offset;
                 break;
             }
             case static_cast<uint8_t>(OpCode::OP_JUMP): {
@@ -147,7 +699,14 @@ InterpretResult VM::run() {
             }
             case static_cast<uint8_t>(OpCode::OP_JUMP_IF_FALSE): {
                 uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) {
+                if (isFalsey(stackTop[-1])) {
+                    ip += offset;
+                }
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_JUMP_IF_TRUE): {
+                uint16_t offset = READ_SHORT();
+                if (!isFalsey(stackTop[-1])) {
                     ip += offset;
                 }
                 break;
@@ -155,50 +714,699 @@ InterpretResult VM::run() {
             case static_cast<uint8_t>(OpCode::OP_LOOP): {
                 uint16_t offset = READ_SHORT();
                 ip -= offset;
+                if (--budget == 0) return InterpretResult::SUSPENDED;
+#ifdef LUA_HAS_JIT
+                // Hot loop: hand the function to native code until it returns or calls
+                if (!Hooks::kHooks && jitEnabled && ++backEdges >= jitThreshold) {
+                    InterpretResult result;
+                    if (enterJit(result) && result != InterpretResult::OK) return result;
+                }
+#endif
                 break;
             }
+            case static_cast<uint8_t>(OpCode::OP_FORPREP): {
+                Value* loop = slots + READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                bool enter;
+                if (!forPrepare(loop, enter)) return InterpretResult::RUNTIME_ERROR;
+                if (!enter) ip += offset;
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_FORLOOP): {
+                Value* loop = slots + READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                if (forLoop(loop)) {
+                    ip -= offset;
+                    if (--budget == 0) return InterpretResult::SUSPENDED;
+#ifdef LUA_HAS_JIT
+                    if (!Hooks::kHooks && jitEnabled && ++backEdges >= jitThreshold) {
+                        InterpretResult result;
+                        if (enterJit(result) && result != InterpretResult::OK) return result;
+                    }
+#endif
+                }
+                break;
+            }
+            case static_cast<uint8_t>(OpCode::OP_REDISPATCH):
+                ip--; // execute() restores ip and switches loops
+                return InterpretResult::SUSPENDED;
             case static_cast<uint8_t>(OpCode::OP_RETURN): {
-                // Exit interpreter
-                return InterpretResult::OK;
+                if constexpr (Hooks::kHooks) {
+                    if (hooks.running && current == hooks.owner && current->stack.frames.size() == hooks.ownerFrames) {
+                        // A Lua hook is done: its result is dropped and the
+                        // interrupted instruction runs next
+                        returnFromFunction();
+                        stackTop--;
+                        hooks.running = false;
+                        if (hooks.mask == 0) redispatch();
+                        break;
+                    }
+                }
+                // The main script is done; a coroutine's body hands its result to the resumer
+                if (current->stack.frames.empty()) {
+                    if (current == &mainCoroutine) return InterpretResult::OK;
+                    finishCoroutine();
+                } else {
+                    returnFromFunction();
+                    if constexpr (Hooks::kLines) {
+                        // Continuing the caller's line is not a new line
+                        hooks.lastChunk = chunk;
+                        hooks.lastIp = ip;
+                        hooks.lastLine = chunk->lines.line(ip - chunk->code.data() - 1);
+                    }
+                }
+#ifdef LUA_HAS_JIT
+                if (!Hooks::kHooks && jitEnabled && jitThreshold == 0) {
+                    InterpretResult result;
+                    if (enterJit(result) && result != InterpretResult::OK) return result;
+                }
+#endif
+                break;
             }
         }
     }
 }
 
-void VM::binaryOp(OpCode op) {
-    if (!std::holds_alternative<double>(peek(0)) || !std::holds_alternative<double>(peek(1))) {
+// Events to fire before the instruction at ip, updating what the hooked
+// loop has seen: a call when the running coroutine has one frame more than
+// at the previous instruction, a line when the instruction is on another
+// line or in another chunk than the previous one or jumped back, and a count
+// every hooks.count instructions
+template <bool Lines>
+uint8_t VM::collectHookEvents() {
+    uint8_t events = 0;
+    size_t frames = current->stack.frames.size();
+    if ((hooks.mask & kHookCall) && current == hooks.coroutine && frames > hooks.frames) events |= kHookCall;
+    hooks.coroutine = current;
+    hooks.frames = frames;
+    if (Lines && (hooks.mask & kHookLine)) {
+        int line = chunk->lines.line(ip - chunk->code.data());
+        // A stripped chunk has no lines to report
+        if (line != 0 && (chunk != hooks.lastChunk || line != hooks.lastLine || ip < hooks.lastIp)) {
+            events |= kHookLine;
+            hooks.line = line;
+        }
+        hooks.lastChunk = chunk;
+        hooks.lastIp = ip;
+        hooks.lastLine = line;
+    }
+    if (hooks.count != 0 && --hooks.countLeft == 0) {
+        hooks.countLeft = hooks.count;
+        events |= kHookCount;
+    }
+    return events;
+}
+
+// Fires the first pending event: the hook is entered like a called function
+// with the event name (and the line), in a frame that returns to the
+// interrupted instruction. OP_RETURN recognizes the frame and drops the
+// result.
+bool VM::callHook() {
+    uint8_t event = hooks.pending & -hooks.pending;
+    hooks.pending &= ~event;
+    hooks.resuming = true;
+    int argCount = event == kHookLine ? 2 : 1;
+    reserveStack(argCount + 1);
+    push(hooks.function);
+    push(std::string(event == kHookCall ? "call" : event == kHookLine ? "line" : "count"));
+    if (event == kHookLine) push(static_cast<int64_t>(hooks.line));
+    if (!callFunction(hooks.function, argCount)) return false;
+    hooks.running = true;
+    hooks.owner = current;
+    hooks.ownerFrames = current->stack.frames.size();
+    return true;
+}
+
+// --trace: the values of the running function, then the instruction about
+// to run with its offset and line
+void VM::traceInstruction() {
+    std::cerr << "          ";
+    for (Value* value = slots; value < stackTop; value++) {
+        std::cerr << "[ ";
+        printValue(*value, std::cerr);
+        std::cerr << " ]";
+    }
+    size_t offset = ip - chunk->code.data();
+    char line[64];
+    std::snprintf(line, sizeof(line), "\n%04zu %4d %s\n", offset, chunk->lines.line(offset), opcodeName(*ip));
+    std::cerr << line;
+}
+
+// A coroutine's frames sit above the resume call of the coroutine that
+// resumed it, so the resumer chain is followed back to the main script.
+// Saved ips point past the call instruction, hence the - 1.
+template <typename Visit>
+void VM::walkFrames(const uint8_t* top, Visit visit) {
+    for (Coroutine* coroutine = current; coroutine; coroutine = coroutine->resumer) {
+        bool running = coroutine == current;
+        Value* base = coroutine->stack.values.data();
+        visit(runningFunction(running ? slots : coroutine->slots, base), running ? chunk : coroutine->chunk,
+              running ? top : coroutine->ip - 1);
+        const std::vector<CallFrame>& frames = coroutine->stack.frames;
+        for (size_t i = frames.size(); i-- > 0;) {
+            visit(runningFunction(base + frames[i].slots, base), frames[i].chunk, frames[i].ip - 1);
+        }
+    }
+}
+
+// The function whose locals start at `locals` in the stack starting at `base`,
+// or nullptr for the main chunk, which has no callee slot below its locals
+const Function* VM::runningFunction(const Value* locals, const Value* base) {
+    if (locals == base) return nullptr;
+    Function* const* function = std::get_if<Function*>(&locals[-1]);
+    return function ? *function : nullptr;
+}
+
+#ifdef LUA_PROFILER
+// Hands the call stack to the profiler, outermost frame first
+void VM::sampleProfile() {
+    // After redispatch() the instruction to run is kept aside
+    const uint8_t* top = ip == kRedispatchCode ? hooks.resumeIp : ip;
+    profileStack.clear();
+    walkFrames(top, [&](const Function* function, const Chunk* at, const uint8_t* instruction) {
+        profileStack.push_back({function, at, instruction});
+    });
+    std::reverse(profileStack.begin(), profileStack.end());
+    profiler->sample(profileStack);
+}
+#endif
+
+// Arithmetic on the top two values, replacing them with the result. Integer
+// operands give an integer result except for '/', which like Lua always
+// works in floating point.
+bool VM::binaryOp(OpCode op) {
+    const Value& left = stackTop[-2];
+    const Value& right = stackTop[-1];
+    if (!isNumber(left) || !isNumber(right)) {
         runtimeError("Operands must be numbers.");
-        return;
+        return false;
+    }
+
+    // Operands are read before the result overwrites the left one in place
+    Value& result = stackTop[-2];
+    const int64_t* ai = std::get_if<int64_t>(&left);
+    const int64_t* bi = std::get_if<int64_t>(&right);
+    if (ai && bi && op != OpCode::OP_DIVIDE) {
+        int64_t a = *ai, b = *bi;
+        switch (op) {
+            case OpCode::OP_ADD: result = wrapAdd(a, b); break;
+            case OpCode::OP_SUBTRACT: result = wrapSubtract(a, b); break;
+            case OpCode::OP_MULTIPLY: result = wrapMultiply(a, b); break;
+            case OpCode::OP_FLOOR_DIVIDE:
+                if (b == 0) {
+                    runtimeError("attempt to perform 'n//0'");
+                    return false;
+                }
+                result = floorDivide(a, b);
+                break;
+            case OpCode::OP_MODULO:
+                if (b == 0) {
+                    runtimeError("attempt to perform 'n%%0'");
+                    return false;
+                }
+                result = floorModulo(a, b);
+                break;
+            default: break; // Unreachable
+        }
+    } else {
+        double a = toDouble(left), b = toDouble(right);
+        switch (op) {
+            case OpCode::OP_ADD: result = a + b; break;
+            case OpCode::OP_SUBTRACT: result = a - b; break;
+            case OpCode::OP_MULTIPLY: result = a * b; break;
+            case OpCode::OP_DIVIDE: result = a / b; break;
+            case OpCode::OP_FLOOR_DIVIDE: result = std::floor(a / b); break;
+            case OpCode::OP_MODULO: result = floatModulo(a, b); break;
+            default: break; // Unreachable
+        }
+    }
+    stackTop--;
+    return true;
+}
+
+// Ordering for OP_LESS, OP_LESS_EQUAL, OP_GREATER and OP_GREATER_EQUAL:
+// numbers compare by value, strings lexicographically
+bool VM::compareValues(OpCode op, const Value& a, const Value& b, bool& result) {
+    bool swap = op == OpCode::OP_GREATER || op == OpCode::OP_GREATER_EQUAL;
+    bool orEqual = op == OpCode::OP_LESS_EQUAL || op == OpCode::OP_GREATER_EQUAL;
+    const Value& left = swap ? b : a;
+    const Value& right = swap ? a : b;
+    if (isNumber(left) && isNumber(right)) {
+        result = numberLess(left, right, orEqual);
+        return true;
+    }
+    const std::string* x = std::get_if<std::string>(&left);
+    const std::string* y = std::get_if<std::string>(&right);
+    if (x && y) {
+        int order = x->compare(*y);
+        result = orEqual ? order <= 0 : order < 0;
+        return true;
+    }
+    runtimeError("Operands must be two numbers or two strings.");
+    return false;
+}
+
+// Comparison on the top two values, replacing them with the boolean result
+bool VM::compareOp(OpCode op) {
+    bool result;
+    if (!compareValues(op, stackTop[-2], stackTop[-1], result)) return false;
+    stackTop--;
+    stackTop[-1] = result;
+    return true;
+}
+
+bool VM::negateOp() {
+    Value& value = stackTop[-1];
+    if (int64_t* i = std::get_if<int64_t>(&value)) {
+        *i = wrapSubtract(0, *i);
+    } else if (double* d = std::get_if<double>(&value)) {
+        *d = -*d;
+    } else {
+        runtimeError("Operand must be a number.");
+        return false;
+    }
+    return true;
+}
+
+// Appends the string form of a '..' operand; only strings and numbers qualify
+bool VM::appendConcat(std::string& out, const Value& value) {
+    if (const std::string* s = std::get_if<std::string>(&value)) {
+        out += *s;
+    } else if (const int64_t* i = std::get_if<int64_t>(&value)) {
+        char buffer[24];
+        out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), *i).ptr);
+    } else if (const double* d = std::get_if<double>(&value)) {
+        out += formatNumber(*d);
+    } else {
+        runtimeError("attempt to concatenate a %s value", typeName(value));
+        return false;
+    }
+    return true;
+}
+
+// OP_CONCAT: the top `count` values become one string, built in a single
+// allocation sized up front
+bool VM::concatenate(int count) {
+    Value* first = stackTop - count;
+    size_t length = 0;
+    for (Value* v = first; v < stackTop; v++) {
+        const std::string* s = std::get_if<std::string>(v);
+        length += s ? s->size() : 24;
+    }
+    if (!checkMemoryHeadroom(length)) return false;
+    std::string result;
+    result.reserve(length);
+    for (Value* v = first; v < stackTop; v++) {
+        if (!appendConcat(result, *v)) return false;
+    }
+    // Popped operands would keep their strings alive until overwritten
+    for (Value* v = first + 1; v < stackTop; v++) *v = Nil{};
+    *first = std::move(result);
+    stackTop = first + 1;
+    return checkMemoryLimit();
+}
+
+// OP_APPEND_LOCAL: `local = local .. <top count values>`. The local's string
+// is extended in place, so std::string's geometric growth makes a loop of
+// appends linear overall.
+bool VM::appendToLocal(uint8_t slot, int count) {
+    Value& target = slots[slot];
+    if (!std::holds_alternative<std::string>(target)) {
+        std::string converted;
+        if (!appendConcat(converted, target)) return false;
+        target = std::move(converted);
+    }
+    std::string& buffer = std::get<std::string>(target);
+    if (memory) {
+        // Growing the buffer may reallocate it at twice the capacity
+        size_t length = buffer.size();
+        for (Value* v = stackTop - count; v < stackTop; v++) {
+            const std::string* s = std::get_if<std::string>(v);
+            length += s ? s->size() : 24;
+        }
+        if (length > buffer.capacity() && !checkMemoryHeadroom(std::max(length, 2 * buffer.capacity()))) return false;
+    }
+    for (Value* v = stackTop - count; v < stackTop; v++) {
+        if (!appendConcat(buffer, *v)) return false;
+        *v = Nil{};
+    }
+    stackTop -= count;
+    return checkMemoryLimit();
+}
+
+// OP_CALL: the callee sits below its `argCount` arguments and is replaced
+// by the single result. A Lua function only gets its frame set up here; its
+// body then runs in the dispatch loop until OP_RETURN.
+bool VM::callValue(int argCount) {
+    Value* callee = stackTop - argCount - 1;
+    if (Function** function = std::get_if<Function*>(callee)) {
+        return callFunction(*function, argCount);
     }
-    double b = std::get<double>(pop());
-    double a = std::get<double>(pop());
-    
-    switch (op) {
-        case OpCode::OP_ADD: push(a + b); break;
-        case OpCode::OP_SUBTRACT: push(a - b); break;
-        case OpCode::OP_MULTIPLY: push(a * b); break;
-        case OpCode::OP_DIVIDE: push(a / b); break;
-        default: break; // Unreachable
+    NativeFunction** native = std::get_if<NativeFunction*>(callee);
+    if (!native) {
+        runtimeError("attempt to call a %s value", typeName(*callee));
+        return false;
     }
+    Coroutine* caller = current;
+    Value result;
+    if (!(*native)->function(*this, **native, callee + 1, argCount, result)) return false;
+    // resume and yield switch coroutines and deliver their value themselves
+    if (current != caller) return true;
+    *callee = std::move(result);
+    stackTop = callee + 1;
+    return checkMemoryLimit();
 }
 
-bool VM::valuesEqual(Value a, Value b) {
+bool VM::callFunction(Function* function, int argCount) {
+    if (function->lazy && !compileLazy(function)) return false;
+    std::vector<CallFrame>& frames = current->stack.frames;
+    if (frames.size() >= kMaxFrames) {
+        runtimeError("stack overflow");
+        return false;
+    }
+    // The previous call's stack growth is checked here, at the call site
+    if (!checkMemoryLimit()) return false;
+    if (frames.size() == frames.capacity()) growFrames();
+    frames.push_back({chunk, ip, static_cast<size_t>(slots - stackBase())});
+    enterFunction(function, argCount);
+    budget--;
+    return true;
+}
+
+// First call of a function whose body the lexer skipped: it is compiled now
+bool VM::compileLazy(Function* function) {
+    MemoryScope scope(MemoryCategory::Compiler);
+    if (Compiler::compileLazy(function)) return true;
+    runtimeError("cannot compile function '%s'", function->name.c_str());
+    return false;
+}
+
+// Points the registers at the start of `function`, whose callee slot and
+// `argCount` arguments are on top of the stack. Missing arguments become nil
+// and extra ones are dropped. This is the only place a call checks for stack
+// room: it reserves the callee's whole Chunk::maxStack at once.
+void VM::enterFunction(Function* function, int argCount) {
+    if (function->chunk.maxStack > argCount) reserveStack(function->chunk.maxStack - argCount);
+    for (; argCount < function->arity; argCount++) push(Nil{});
+    stackTop -= argCount - function->arity;
+    chunk = &function->chunk;
+    ip = chunk->code.data();
+    slots = stackTop - function->arity;
+}
+
+// OP_RETURN inside a call: the result replaces the callee slot
+void VM::returnFromFunction() {
+    std::vector<CallFrame>& frames = current->stack.frames;
+    Value* callee = slots - 1;
+    *callee = std::move(stackTop[-1]);
+    stackTop = callee + 1;
+    const CallFrame& frame = frames.back();
+    chunk = frame.chunk;
+    ip = frame.ip;
+    slots = stackBase() + frame.slots;
+    frames.pop_back();
+}
+
+// OP_TFORCALL: calls the iterator in loop[0] with no arguments. Natives get
+// the loop variable loop[1] as their result slot, so an iterator returning
+// strings can reuse the previous iteration's buffer. Other iterators are
+// called normally and OP_TFORLOOP picks their result off the stack.
+bool VM::forCall(Value* loop) {
+    if (NativeFunction** native = std::get_if<NativeFunction*>(&loop[0])) {
+        // resume delivers to the slot below the arguments, which is loop[1] too
+        Coroutine* caller = current;
+        if (!(*native)->function(*this, **native, stackTop, 0, loop[1])) return false;
+        return current != caller || checkMemoryLimit();
+    }
+    push(loop[0]);
+    return callValue(0);
+}
+
+// --- Coroutines ---
+
+Coroutine* VM::newCoroutine(Function* body) {
+    coroutines.push_back(std::make_unique<Coroutine>());
+    Coroutine* coroutine = coroutines.back().get();
+    coroutine->body = body;
+    return coroutine;
+}
+
+void VM::saveRegisters() {
+    current->chunk = chunk;
+    current->ip = ip;
+    current->stackTop = stackTop;
+    current->slots = slots;
+}
+
+void VM::loadRegisters(Coroutine* coroutine) {
+    current = coroutine;
+    chunk = coroutine->chunk;
+    ip = coroutine->ip;
+    stackTop = coroutine->stackTop;
+    slots = coroutine->slots;
+    stackLimit = stackBase() + coroutine->stack.values.size();
+}
+
+// The caller is suspended with `resultSlot` (normally the native's callee
+// slot) as its stack top, where the value it gets back is pushed.
+bool VM::resume(Coroutine* coroutine, Value* resultSlot, Value* args, int argCount) {
+    if (coroutine->status != Coroutine::Status::Suspended) {
+        runtimeError("cannot resume %s coroutine",
+                     coroutine->status == Coroutine::Status::Dead ? "dead" : "non-suspended");
+        return false;
+    }
+    if (!coroutine->started && coroutine->body->lazy && !compileLazy(coroutine->body)) return false;
+    budget--;
+    stackTop = resultSlot;
+    saveRegisters();
+    current->status = Coroutine::Status::Normal;
+    coroutine->resumer = current;
+    coroutine->status = Coroutine::Status::Running;
+
+    if (!coroutine->started) {
+        // First resume: the arguments become the body's parameters
+        coroutine->started = true;
+        {
+            MemoryScope scope(MemoryCategory::Stack);
+            coroutine->stack = stackPool.acquire();
+        }
+        current = coroutine;
+        stackTop = slots = stackBase();
+        stackLimit = stackBase() + coroutine->stack.values.size();
+        reserveStack(argCount + 1);
+        push(coroutine->body);
+        for (int i = 0; i < argCount; i++) push(std::move(args[i]));
+        enterFunction(coroutine->body, argCount);
+        return true;
+    }
+    // Later resumes: the first argument is the result of the pending yield
+    Value value = argCount > 0 ? std::move(args[0]) : Value(Nil{});
+    loadRegisters(coroutine);
+    push(std::move(value));
+    return true;
+}
+
+bool VM::yield(Value* args, int argCount) {
+    if (current == &mainCoroutine) {
+        runtimeError("attempt to yield from outside a coroutine");
+        return false;
+    }
+    if (hooks.running && current == hooks.owner) {
+        runtimeError("attempt to yield across a hook");
+        return false;
+    }
+    budget--;
+    Value value = argCount > 0 ? std::move(args[0]) : Value(Nil{});
+    Coroutine* coroutine = current;
+    stackTop = args - 1; // The next resume pushes its value here
+    saveRegisters();
+    coroutine->status = Coroutine::Status::Suspended;
+    Coroutine* resumer = coroutine->resumer;
+    coroutine->resumer = nullptr;
+    loadRegisters(resumer);
+    resumer->status = Coroutine::Status::Running;
+    push(std::move(value));
+    return true;
+}
+
+// OP_RETURN at the bottom of a coroutine: it is dead, its stack goes back to
+// the pool and the return value is what the resumer's resume call returns
+void VM::finishCoroutine() {
+    Coroutine* coroutine = current;
+    Value value = std::move(stackTop[-1]);
+    coroutine->status = Coroutine::Status::Dead;
+    Coroutine* resumer = coroutine->resumer;
+    coroutine->resumer = nullptr;
+    loadRegisters(resumer);
+    stackPool.release(std::move(coroutine->stack));
+    coroutine->stack = ExecutionStack();
+    resumer->status = Coroutine::Status::Running;
+    push(std::move(value));
+}
+
+namespace {
+// Converts a float for-loop limit to an integer limit, rounding toward the
+// start (floor when counting up); false if it lies outside the integer range.
+bool forLimitToInteger(double limit, int64_t step, int64_t& result) {
+    double rounded = step > 0 ? std::floor(limit) : std::ceil(limit);
+    if (!floatFitsInteger(rounded)) return false;
+    result = static_cast<int64_t>(rounded);
+    return true;
+}
+}
+
+// `loop` points at the for loop's slots: index, limit, step, count, variable.
+// Sets `enter` to whether the body runs at least once. As in Lua 5.4 the loop
+// is an integer loop when start and step are integers: the number of further
+// iterations is computed here (as an unsigned count, so no overflow is
+// possible) and FORLOOP only has to count down. Otherwise everything is
+// converted to floats, count is nil and FORLOOP compares against the limit.
+bool VM::forPrepare(Value* loop, bool& enter) {
+    if (!isNumber(loop[0])) {
+        runtimeError("'for' initial value must be a number.");
+        return false;
+    }
+    if (!isNumber(loop[1])) {
+        runtimeError("'for' limit must be a number.");
+        return false;
+    }
+    if (!isNumber(loop[2])) {
+        runtimeError("'for' step must be a number.");
+        return false;
+    }
+
+    const int64_t* start = std::get_if<int64_t>(&loop[0]);
+    const int64_t* step = std::get_if<int64_t>(&loop[2]);
+    if (start && step) {
+        int64_t init = *start, increment = *step;
+        if (increment == 0) {
+            runtimeError("'for' step is zero.");
+            return false;
+        }
+        int64_t limit;
+        if (const int64_t* l = std::get_if<int64_t>(&loop[1])) {
+            limit = *l;
+        } else if (!forLimitToInteger(std::get<double>(loop[1]), increment, limit)) {
+            // Out of range: clamp, or skip when the limit lies behind the start
+            double l = std::get<double>(loop[1]);
+            if (l > 0 ? increment < 0 : increment > 0) {
+                enter = false;
+                return true;
+            }
+            limit = l > 0 ? INT64_MAX : INT64_MIN;
+        }
+        enter = increment > 0 ? init <= limit : init >= limit;
+        if (!enter) return true;
+
+        uint64_t count;
+        if (increment > 0) {
+            count = (static_cast<uint64_t>(limit) - static_cast<uint64_t>(init)) / static_cast<uint64_t>(increment);
+        } else {
+            count = (static_cast<uint64_t>(init) - static_cast<uint64_t>(limit)) /
+                    (static_cast<uint64_t>(-(increment + 1)) + 1u);
+        }
+        loop[1] = limit;
+        loop[3] = static_cast<int64_t>(count);
+        loop[4] = init;
+        return true;
+    }
+
+    double init = toDouble(loop[0]), limit = toDouble(loop[1]), increment = toDouble(loop[2]);
+    if (increment == 0) {
+        runtimeError("'for' step is zero.");
+        return false;
+    }
+    enter = increment > 0 ? init <= limit : init >= limit;
+    loop[0] = init;
+    loop[1] = limit;
+    loop[2] = increment;
+    loop[3] = Nil{};
+    loop[4] = init;
+    return true;
+}
+
+// Advances the loop; true if the body should run again
+bool VM::forLoop(Value* loop) {
+    if (int64_t* count = std::get_if<int64_t>(&loop[3])) {
+        if (*count == 0) return false;
+        *count = static_cast<int64_t>(static_cast<uint64_t>(*count) - 1);
+        int64_t& index = *std::get_if<int64_t>(&loop[0]);
+        index = wrapAdd(index, *std::get_if<int64_t>(&loop[2]));
+        loop[4] = index;
+        return true;
+    }
+    double& index = *std::get_if<double>(&loop[0]);
+    double step = *std::get_if<double>(&loop[2]);
+    index += step;
+    double limit = *std::get_if<double>(&loop[1]);
+    if (step > 0 ? !(index <= limit) : !(index >= limit)) return false;
+    loop[4] = index;
+    return true;
+}
+
+bool VM::valuesEqual(const Value& a, const Value& b) {
+    if (isNumber(a) && isNumber(b)) return numbersEqual(a, b); // 1 == 1.0
     if (a.index() != b.index()) return false;
     if (std::holds_alternative<Nil>(a)) return true;
     if (std::holds_alternative<bool>(a)) return std::get<bool>(a) == std::get<bool>(b);
-    if (std::holds_alternative<double>(a)) return std::get<double>(a) == std::get<double>(b);
     if (std::holds_alternative<std::string>(a)) return std::get<std::string>(a) == std::get<std::string>(b);
-    return false;
+    // Functions and coroutines compare by identity
+    if (NativeFunction* const* native = std::get_if<NativeFunction*>(&a)) return *native == std::get<NativeFunction*>(b);
+    if (Function* const* function = std::get_if<Function*>(&a)) return *function == std::get<Function*>(b);
+    return std::get<Coroutine*>(a) == std::get<Coroutine*>(b);
+}
+
+void VM::exceptionError() {
+    try {
+        throw;
+    } catch (const std::bad_alloc&) {
+        runtimeError("not enough memory");
+    } catch (const std::exception& e) {
+        runtimeError("%s", e.what());
+    } catch (...) {
+        runtimeError("unknown error");
+    }
 }
 
 void VM::runtimeError(const char* format, ...) {
+    stdoutBuffer.flush(); // Keep the script's output ahead of the message
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
     va_end(args);
     fputs("\n", stderr);
-    
-    size_t instruction = ip - chunk->code.data() - 1;
-    int line = chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+
+    // One line per active call, innermost first; a call the optimizer inlined
+    // gets its own line too. A runaway recursion keeps the first and last
+    // kTraceEnds of them.
+    static constexpr size_t kTraceEnds = 10;
+    struct Level {
+        const char* function;
+        int line; // -1 when stripped
+    };
+    std::vector<Level> levels;
+    walkFrames(ip - 1, [&](const Function* function, const Chunk* at, const uint8_t* instruction) {
+        // --strip leaves functions nameless; their frames still get a line
+        const char* name = !function ? "script" : function->name.empty() ? "?" : function->name.c_str();
+        bool stripped = at->lines.stripped();
+        size_t offset = instruction - at->code.data();
+        int line = stripped ? -1 : at->lines.line(offset);
+        if (const InlinedCall* call = at->inlinedAt(offset)) {
+            levels.push_back({call->function.empty() ? "?" : call->function.c_str(), line});
+            line = stripped ? -1 : call->line;
+        }
+        levels.push_back({name, line});
+    });
+    for (size_t i = 0; i < levels.size(); i++) {
+        if (levels.size() > 2 * kTraceEnds && i == kTraceEnds) {
+            fprintf(stderr, "...(skipping %zu calls)\n", levels.size() - 2 * kTraceEnds);
+            i = levels.size() - kTraceEnds - 1;
+            continue;
+        }
+        if (levels[i].line < 0) {
+            fprintf(stderr, "[line ?] in %s\n", levels[i].function);
+        } else {
+            fprintf(stderr, "[line %d] in %s\n", levels[i].line, levels[i].function);
+        }
+    }
 }
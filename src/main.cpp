@@ -2,11 +2,50 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <cstdlib>
 #include "Lexer.h"
 #include "Parser.h"
 #include "AST.h"
 #include "Compiler.h"
 #include "VM.h"
+#include "Memory.h"
+#include "Scheduler.h"
+#include "Session.h"
+#ifdef LUA_OPSTATS
+#include "OpStats.h"
+#endif
+#ifdef LUA_PROFILER
+#include "Profiler.h"
+#endif
+
+// Command-line switches that affect how a script is run
+struct RunOptions {
+    bool opStats = false;        // --opstats: print per-opcode table to stderr
+    std::string opStatsJsonPath; // --opstats-json=FILE: also write the statistics as JSON
+    std::string profilePath;     // --profile=FILE: write collapsed stacks for flamegraph tools
+    long profileIntervalUs = 1000;    // --profile-interval=US: CPU-time timer period
+    unsigned long profileEvery = 0;   // --profile-every=N: sample every N instructions instead
+    std::string sourceName = "stdin"; // Name used for the script in profiles
+    bool jit = true;                  // --no-jit: interpreter only
+    long jitThreshold = -1;           // --jit-threshold=N: loop back-edges before compiling
+    int optimizationLevel = Compiler::kDefaultOptimizationLevel; // -O0, -O1, -O2
+    bool dumpIr = false;              // --dump-ir: print the IR after each pass to stderr
+    bool inlineReport = false;        // --inline-report: list inlined calls on stderr
+    bool typeReport = false;          // --type-report: share of typed operations per function on stderr
+    bool lazy = false;                // --lazy: lex, parse and compile function bodies on their first call
+    bool strip = false;               // --strip: drop line tables; runtime errors report no line
+    bool trace = false;               // --trace: print each instruction and the stack to stderr
+    bool memStats = false;            // --mem-stats: print memory use per subsystem to stderr
+    size_t memLimit = 0;              // --mem-limit=BYTES: stop the script beyond this (0: none)
+    // Scheduling: several scripts, or any of these options, run through a Scheduler
+    unsigned threads = 1;             // --threads=N: worker threads
+    long sliceUs = 1000;              // --slice-us=US: CPU time per slice
+    unsigned long budget = 0;         // --budget=N: fixed steps per slice instead
+    bool schedStats = false;          // --sched-stats: per-script slices and CPU time on stderr
+    bool scheduled = false;
+    bool interactive = false;         // -i: run the scripts in one session, then prompt
+};
 
 // Keep AstPrinter for debug flag if needed, but remove from default flow
 class AstPrinter : public ExprVisitor, public StmtVisitor {
@@ -35,67 +74,318 @@ public:
     void visitVariableExpr(VariableExpr* expr) override {}
     void visitAssignmentExpr(AssignmentExpr* expr) override {}
     void visitCallExpr(CallExpr* expr) override {}
+    void visitFunctionExpr(FunctionExpr* expr) override {}
     void visitExpressionStmt(ExpressionStmt* stmt) override {}
     void visitPrintStmt(PrintStmt* stmt) override {}
     void visitVarDecl(VarDecl* stmt) override {}
     void visitBlockStmt(BlockStmt* stmt) override {}
     void visitIfStmt(IfStmt* stmt) override {}
     void visitWhileStmt(WhileStmt* stmt) override {}
+    void visitForStmt(ForStmt* stmt) override {}
+    void visitForInStmt(ForInStmt* stmt) override {}
     void visitFunctionStmt(FunctionStmt* stmt) override {}
     void visitReturnStmt(ReturnStmt* stmt) override {}
 };
 
-void run(const std::string& source) {
-    Lexer lexer(source);
-    std::vector<Token> tokens = lexer.scanTokens();
+// Lexes, parses and compiles `source` into `chunk`, charging each stage to
+// `memory` (if not nullptr). False if there is nothing to run.
+bool compileScript(const std::string& source, const RunOptions& options, MemoryStats* memory, Chunk& chunk) {
+    // Tokens and AST are freed once the chunk is compiled
+    std::vector<Token> tokens;
+    bool hooks;
+    {
+        MemoryScope scope(memory, MemoryCategory::Lexer);
+        Lexer lexer(source);
+        lexer.setLazyFunctions(options.lazy);
+        tokens = lexer.scanTokens();
+        hooks = lexer.mentionsDebug();
+    }
+    Compiler compiler;
+    compiler.setOptimizationLevel(options.optimizationLevel, options.dumpIr ? &std::cerr : nullptr);
+    if (options.inlineReport) compiler.setInlineReport(&std::cerr);
+    if (options.typeReport) compiler.setTypeReport(&std::cerr);
+    compiler.setStripDebugInfo(options.strip);
+    // Only a script that can name the debug library can set a hook
+    compiler.setDebugHooks(hooks);
 
-    Parser parser(tokens);
-    try {
-        std::vector<std::unique_ptr<Stmt>> statements = parser.parse();
-        
-        if (statements.empty()) return;
+    // -O0 compiles the flat AST, without ever building the tree
+    if (compiler.compilesFlat()) {
+        FlatAst ast;
+        {
+            MemoryScope scope(memory, MemoryCategory::Parser);
+            FlatParser parser(tokens);
+            ast = parser.parse();
+            if (parser.hadError()) {
+                for (const std::string& message : parser.errors()) std::cerr << message << std::endl;
+                return false;
+            }
+        }
+        if (ast.statements().size() == 0) return false;
+        MemoryScope scope(memory, MemoryCategory::Compiler);
+        return compiler.compile(ast, &chunk);
+    }
+
+    std::vector<std::unique_ptr<Stmt>> statements;
+    {
+        MemoryScope scope(memory, MemoryCategory::Parser);
+        Parser parser(tokens);
+        statements = parser.parse();
+        if (parser.hadError()) {
+            for (const std::string& message : parser.errors()) std::cerr << message << std::endl;
+            return false;
+        }
+    }
+    if (statements.empty()) return false;
+
+    MemoryScope scope(memory, MemoryCategory::Compiler);
+    return compiler.compile(statements, &chunk);
+}
 
+void run(const std::string& source, const RunOptions& options) {
+    // Declared first so that it outlives everything counted against it
+    MemoryStats memory;
+    memory.setLimit(options.memLimit);
+    bool accounting = options.memStats || options.memLimit != 0;
+    MemoryStats* accounted = accounting ? &memory : nullptr;
+
+    try {
         Chunk chunk;
-        Compiler compiler;
-        if (compiler.compile(statements, &chunk)) {
+        if (compileScript(source, options, accounted, chunk)) {
+            MemoryScope scope(accounted, MemoryCategory::Heap);
             VM vm;
+            vm.setMemoryStats(accounted);
+            vm.setJitEnabled(options.jit);
+            if (options.jitThreshold >= 0) vm.setJitThreshold(static_cast<uint32_t>(options.jitThreshold));
+            if (options.trace) vm.setTrace(true);
+#ifdef LUA_OPSTATS
+            OpStats stats;
+            bool collect = options.opStats || !options.opStatsJsonPath.empty();
+            if (collect) vm.setOpStats(&stats);
+#endif
+#ifdef LUA_PROFILER
+            Profiler profiler(options.sourceName, options.profileIntervalUs, options.profileEvery);
+            if (!options.profilePath.empty()) {
+                vm.setProfiler(&profiler);
+                profiler.start();
+            }
+#endif
             vm.interpret(&chunk);
+#ifdef LUA_PROFILER
+            if (!options.profilePath.empty()) {
+                profiler.stop();
+                std::ofstream out(options.profilePath);
+                profiler.writeCollapsed(out);
+            }
+#endif
+#ifdef LUA_OPSTATS
+            if (options.opStats) stats.printTable(std::cerr);
+            if (!options.opStatsJsonPath.empty()) {
+                std::ofstream out(options.opStatsJsonPath);
+                stats.writeJson(out);
+            }
+#endif
+            if (options.memStats) memory.print(std::cerr);
         }
-        
+
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
 }
 
-void runFile(const char* path) {
+bool readFile(const char* path, std::string& source) {
     std::ifstream file(path);
     if (!file.is_open()) {
         std::cerr << "Could not open file " << path << std::endl;
-        return;
+        return false;
     }
     std::stringstream buffer;
     buffer << file.rdbuf();
-    run(buffer.str());
+    source = buffer.str();
+    return true;
+}
+
+void runFile(const char* path, const RunOptions& options) {
+    std::string source;
+    if (readFile(path, source)) run(source, options);
+}
+
+// Runs every script in its own VM, interleaved by a Scheduler
+void runScheduled(const std::vector<const char*>& scripts, const RunOptions& options) {
+    // Declared before the scheduler so that they outlive its chunks and VMs
+    std::vector<std::unique_ptr<MemoryStats>> memory;
+    Scheduler::Options schedule;
+    schedule.threads = options.threads;
+    schedule.slice = std::chrono::microseconds(options.sliceUs);
+    schedule.fixedBudget = options.budget;
+    Scheduler scheduler(schedule);
+
+    bool accounting = options.memStats || options.memLimit != 0;
+    std::vector<const char*> names;
+    for (const char* path : scripts) {
+        std::string source;
+        if (!readFile(path, source)) continue;
+        std::unique_ptr<MemoryStats> stats;
+        if (accounting) {
+            stats = std::make_unique<MemoryStats>();
+            stats->setLimit(options.memLimit);
+        }
+        try {
+            auto chunk = std::make_unique<Chunk>();
+            if (!compileScript(source, options, stats.get(), *chunk)) continue;
+            MemoryScope scope(stats.get(), MemoryCategory::Heap);
+            VM& vm = scheduler.add(path, std::move(chunk));
+            vm.setMemoryStats(stats.get());
+            vm.setJitEnabled(options.jit);
+            if (options.jitThreshold >= 0) vm.setJitThreshold(static_cast<uint32_t>(options.jitThreshold));
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        memory.push_back(std::move(stats));
+        names.push_back(path);
+    }
+
+    scheduler.run();
+    if (options.schedStats) scheduler.printStats(std::cerr);
+    if (options.memStats) {
+        for (size_t i = 0; i < names.size(); i++) {
+            std::cerr << "== " << names[i] << " ==\n";
+            memory[i]->print(std::cerr);
+        }
+    }
 }
 
-void runPrompt() {
-    std::string line;
-    while (true) {
-        std::cout << "> ";
-        if (!std::getline(std::cin, line)) break;
-        if (line == "exit") break;
-        run(line);
+// Runs `scripts`, then lines from standard input, in one Session so that
+// globals carry over. A line that leaves a statement unfinished asks for more.
+void runPrompt(const std::vector<const char*>& scripts, const RunOptions& options) {
+    // Declared first so that it outlives the session
+    MemoryStats memory;
+    memory.setLimit(options.memLimit);
+    bool accounting = options.memStats || options.memLimit != 0;
+    Session session(accounting ? &memory : nullptr);
+    session.compiler().setOptimizationLevel(options.optimizationLevel, options.dumpIr ? &std::cerr : nullptr);
+    if (options.inlineReport) session.compiler().setInlineReport(&std::cerr);
+    if (options.typeReport) session.compiler().setTypeReport(&std::cerr);
+    session.compiler().setStripDebugInfo(options.strip);
+    session.vm().setJitEnabled(options.jit);
+    if (options.jitThreshold >= 0) session.vm().setJitThreshold(static_cast<uint32_t>(options.jitThreshold));
+
+    try {
+        for (const char* path : scripts) {
+            std::string source;
+            if (!readFile(path, source)) continue;
+            session.execute(source, true);
+        }
+
+        std::string input;
+        std::string line;
+        while (true) {
+            std::cout << (input.empty() ? "> " : ">> ") << std::flush;
+            if (!std::getline(std::cin, line)) {
+                if (!input.empty()) session.execute(input, true); // Report what is missing
+                break;
+            }
+            if (input.empty() && line == "exit") break;
+            input += line;
+            input += '\n';
+            if (session.execute(input) != Session::Status::Incomplete) input.clear();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
     }
+    if (options.memStats) memory.print(std::cerr);
 }
 
 int main(int argc, char* argv[]) {
-    if (argc > 2) {
-        std::cout << "Usage: lua_compiler [script]" << std::endl;
+    RunOptions options;
+    std::vector<const char*> scripts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--opstats") {
+            options.opStats = true;
+        } else if (arg.rfind("--opstats-json=", 0) == 0) {
+            options.opStatsJsonPath = arg.substr(std::string("--opstats-json=").size());
+        } else if (arg.rfind("--profile=", 0) == 0) {
+            options.profilePath = arg.substr(std::string("--profile=").size());
+        } else if (arg.rfind("--profile-interval=", 0) == 0) {
+            options.profileIntervalUs = std::max(1L, std::atol(arg.c_str() + std::string("--profile-interval=").size()));
+        } else if (arg.rfind("--profile-every=", 0) == 0) {
+            options.profileEvery = std::strtoul(arg.c_str() + std::string("--profile-every=").size(), nullptr, 10);
+        } else if (arg == "--no-jit") {
+            options.jit = false;
+        } else if (arg.rfind("--jit-threshold=", 0) == 0) {
+            options.jitThreshold = std::max(0L, std::atol(arg.c_str() + std::string("--jit-threshold=").size()));
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            options.optimizationLevel = arg[2] - '0';
+        } else if (arg == "--dump-ir") {
+            options.dumpIr = true;
+        } else if (arg == "--inline-report") {
+            options.inlineReport = true;
+        } else if (arg == "--type-report") {
+            options.typeReport = true;
+        } else if (arg == "--lazy") {
+            options.lazy = true;
+        } else if (arg == "--strip") {
+            options.strip = true;
+        } else if (arg == "--trace") {
+            options.trace = true;
+        } else if (arg == "--mem-stats") {
+            options.memStats = true;
+        } else if (arg.rfind("--mem-limit=", 0) == 0) {
+            options.memLimit = std::strtoull(arg.c_str() + std::string("--mem-limit=").size(), nullptr, 10);
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            options.threads = static_cast<unsigned>(std::max(1L, std::atol(arg.c_str() + std::string("--threads=").size())));
+            options.scheduled = true;
+        } else if (arg.rfind("--slice-us=", 0) == 0) {
+            options.sliceUs = std::max(1L, std::atol(arg.c_str() + std::string("--slice-us=").size()));
+            options.scheduled = true;
+        } else if (arg.rfind("--budget=", 0) == 0) {
+            options.budget = std::strtoul(arg.c_str() + std::string("--budget=").size(), nullptr, 10);
+            options.scheduled = true;
+        } else if (arg == "-i") {
+            options.interactive = true;
+        } else if (arg == "--sched-stats") {
+            options.schedStats = true;
+            options.scheduled = true;
+        } else if (arg[0] != '-') {
+            scripts.push_back(argv[i]);
+        } else {
+            std::cout << "Usage: lua_compiler [--opstats] [--opstats-json=FILE] [--profile=FILE]"
+                         " [--profile-interval=US] [--profile-every=N] [--no-jit] [--jit-threshold=N]"
+                         " [-O0|-O1|-O2] [--dump-ir] [--inline-report] [--type-report] [--lazy] [--strip] [--trace] [--mem-stats] [--mem-limit=BYTES]"
+                         " [--threads=N] [--slice-us=US] [--budget=N] [--sched-stats] [-i] [script...]" << std::endl;
+            return 1;
+        }
+    }
+
+#ifndef LUA_OPSTATS
+    if (options.opStats || !options.opStatsJsonPath.empty()) {
+        std::cerr << "Opcode statistics are not compiled in; reconfigure with -DLUA_OPSTATS=ON." << std::endl;
+        return 1;
+    }
+#endif
+#ifndef LUA_PROFILER
+    if (!options.profilePath.empty()) {
+        std::cerr << "The profiler is not compiled in; reconfigure with -DLUA_PROFILER=ON." << std::endl;
         return 1;
-    } else if (argc == 2) {
-        runFile(argv[1]);
+    }
+#endif
+
+    bool scheduled = !options.interactive && (scripts.size() > 1 || (options.scheduled && !scripts.empty()));
+    if (scheduled && (options.trace || options.opStats || !options.opStatsJsonPath.empty() ||
+                      !options.profilePath.empty())) {
+        // Their output is per run, and the profiler's timer is process-wide
+        std::cerr << "--trace, --opstats and --profile only work with a single script run without the scheduler."
+                  << std::endl;
+        return 1;
+    }
+
+    if (options.interactive || scripts.empty()) {
+        runPrompt(scripts, options);
+    } else if (scheduled) {
+        runScheduled(scripts, options);
     } else {
-        runPrompt();
+        options.sourceName = scripts[0];
+        runFile(scripts[0], options);
     }
     return 0;
 }
@@ -0,0 +1,53 @@
+-- Conditions in branch context (fused compare-and-branch, short-circuit
+-- and/or/not) and the same operators in value context.
+local n = 0
+local hits = 0
+local nan = 0 / 0
+while n < 40 do
+  if n >= 10 and n <= 20 then
+    hits = hits + 1
+  end
+  if n < 5 or n > 35 then
+    hits = hits + 100
+  end
+  if not (n ~= 7) then
+    print("seven")
+  end
+  if n == 12.0 then
+    print("twelve")
+  end
+  if n > 2.5 and not (n >= 3.5) then
+    print("three")
+  end
+  if nan < n or nan >= n or not (nan ~= nan) then
+    print("nan compares true")
+  end
+  if "abc" < "abd" and n == 0 then
+    print("strings")
+  end
+  if n % 13 == 0 and "x" or nil then
+    print(n)
+  end
+  n = n + 1
+end
+print(hits)
+
+-- Value context keeps the deciding operand
+print(nil or "default")
+print(false and 1)
+print(1 and 2)
+print(nil and 1 or 3)
+print(3 >= 3)
+print(2 <= 1)
+print(1 ~= 1.0)
+print("a" ~= "b")
+
+-- The right operand is not evaluated when the left one decides
+local calls = 0
+if false and (calls + undefined_global) then
+  print("unreachable")
+end
+if true or (calls + undefined_global) then
+  calls = calls + 1
+end
+print(calls)
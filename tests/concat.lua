@@ -0,0 +1,33 @@
+-- String concatenation: flattened chains, numbers as operands and strings
+-- built up in loops (in-place append on a local).
+local name = "lua"
+print("hello " .. name .. "!")
+print(1 .. 2)
+print("pi is " .. 3.14 .. ", two is " .. 2.0)
+print("a" .. "b" .. "c" .. "d" .. "e" == "abcde")
+
+local log = ""
+for i = 1, 20 do
+  log = log .. i .. ","
+end
+print(log)
+
+local n = 7
+n = n .. "x"
+print(n)
+
+greeting = "hi"
+for i = 1, 3 do
+  greeting = greeting .. "!"
+end
+print(greeting .. " " .. log .. "")
+
+local long = ""
+local i = 0
+while i < 3000 do
+  long = long .. "ab"
+  i = i + 1
+end
+print(long == long .. "")
+
+print("done" .. nil)
@@ -0,0 +1,404 @@
+-- Constant pool: 400 uses of about 200 distinct constants share one chunk's
+-- 256 slots, since repeated constants are stored once
+s = 0
+s = s + 1
+s = s + 2
+s = s + 3
+s = s + 4
+s = s + 5
+s = s + 6
+s = s + 7
+s = s + 8
+s = s + 9
+s = s + 10
+s = s + 11
+s = s + 12
+s = s + 13
+s = s + 14
+s = s + 15
+s = s + 16
+s = s + 17
+s = s + 18
+s = s + 19
+s = s + 20
+s = s + 21
+s = s + 22
+s = s + 23
+s = s + 24
+s = s + 25
+s = s + 26
+s = s + 27
+s = s + 28
+s = s + 29
+s = s + 30
+s = s + 31
+s = s + 32
+s = s + 33
+s = s + 34
+s = s + 35
+s = s + 36
+s = s + 37
+s = s + 38
+s = s + 39
+s = s + 40
+s = s + 41
+s = s + 42
+s = s + 43
+s = s + 44
+s = s + 45
+s = s + 46
+s = s + 47
+s = s + 48
+s = s + 49
+s = s + 50
+s = s + 51
+s = s + 52
+s = s + 53
+s = s + 54
+s = s + 55
+s = s + 56
+s = s + 57
+s = s + 58
+s = s + 59
+s = s + 60
+s = s + 61
+s = s + 62
+s = s + 63
+s = s + 64
+s = s + 65
+s = s + 66
+s = s + 67
+s = s + 68
+s = s + 69
+s = s + 70
+s = s + 71
+s = s + 72
+s = s + 73
+s = s + 74
+s = s + 75
+s = s + 76
+s = s + 77
+s = s + 78
+s = s + 79
+s = s + 80
+s = s + 81
+s = s + 82
+s = s + 83
+s = s + 84
+s = s + 85
+s = s + 86
+s = s + 87
+s = s + 88
+s = s + 89
+s = s + 90
+s = s + 91
+s = s + 92
+s = s + 93
+s = s + 94
+s = s + 95
+s = s + 96
+s = s + 97
+s = s + 98
+s = s + 99
+s = s + 100
+s = s + 101
+s = s + 102
+s = s + 103
+s = s + 104
+s = s + 105
+s = s + 106
+s = s + 107
+s = s + 108
+s = s + 109
+s = s + 110
+s = s + 111
+s = s + 112
+s = s + 113
+s = s + 114
+s = s + 115
+s = s + 116
+s = s + 117
+s = s + 118
+s = s + 119
+s = s + 120
+s = s + 121
+s = s + 122
+s = s + 123
+s = s + 124
+s = s + 125
+s = s + 126
+s = s + 127
+s = s + 128
+s = s + 129
+s = s + 130
+s = s + 131
+s = s + 132
+s = s + 133
+s = s + 134
+s = s + 135
+s = s + 136
+s = s + 137
+s = s + 138
+s = s + 139
+s = s + 140
+s = s + 141
+s = s + 142
+s = s + 143
+s = s + 144
+s = s + 145
+s = s + 146
+s = s + 147
+s = s + 148
+s = s + 149
+s = s + 150
+s = s + 151
+s = s + 152
+s = s + 153
+s = s + 154
+s = s + 155
+s = s + 156
+s = s + 157
+s = s + 158
+s = s + 159
+s = s + 160
+s = s + 161
+s = s + 162
+s = s + 163
+s = s + 164
+s = s + 165
+s = s + 166
+s = s + 167
+s = s + 168
+s = s + 169
+s = s + 170
+s = s + 171
+s = s + 172
+s = s + 173
+s = s + 174
+s = s + 175
+s = s + 176
+s = s + 177
+s = s + 178
+s = s + 179
+s = s + 180
+s = s + 181
+s = s + 182
+s = s + 183
+s = s + 184
+s = s + 185
+s = s + 186
+s = s + 187
+s = s + 188
+s = s + 189
+s = s + 190
+s = s + 191
+s = s + 192
+s = s + 193
+s = s + 194
+s = s + 195
+s = s + 196
+s = s + 197
+s = s + 198
+s = s + 199
+s = s + 200
+s = s + 1
+s = s + 2
+s = s + 3
+s = s + 4
+s = s + 5
+s = s + 6
+s = s + 7
+s = s + 8
+s = s + 9
+s = s + 10
+s = s + 11
+s = s + 12
+s = s + 13
+s = s + 14
+s = s + 15
+s = s + 16
+s = s + 17
+s = s + 18
+s = s + 19
+s = s + 20
+s = s + 21
+s = s + 22
+s = s + 23
+s = s + 24
+s = s + 25
+s = s + 26
+s = s + 27
+s = s + 28
+s = s + 29
+s = s + 30
+s = s + 31
+s = s + 32
+s = s + 33
+s = s + 34
+s = s + 35
+s = s + 36
+s = s + 37
+s = s + 38
+s = s + 39
+s = s + 40
+s = s + 41
+s = s + 42
+s = s + 43
+s = s + 44
+s = s + 45
+s = s + 46
+s = s + 47
+s = s + 48
+s = s + 49
+s = s + 50
+s = s + 51
+s = s + 52
+s = s + 53
+s = s + 54
+s = s + 55
+s = s + 56
+s = s + 57
+s = s + 58
+s = s + 59
+s = s + 60
+s = s + 61
+s = s + 62
+s = s + 63
+s = s + 64
+s = s + 65
+s = s + 66
+s = s + 67
+s = s + 68
+s = s + 69
+s = s + 70
+s = s + 71
+s = s + 72
+s = s + 73
+s = s + 74
+s = s + 75
+s = s + 76
+s = s + 77
+s = s + 78
+s = s + 79
+s = s + 80
+s = s + 81
+s = s + 82
+s = s + 83
+s = s + 84
+s = s + 85
+s = s + 86
+s = s + 87
+s = s + 88
+s = s + 89
+s = s + 90
+s = s + 91
+s = s + 92
+s = s + 93
+s = s + 94
+s = s + 95
+s = s + 96
+s = s + 97
+s = s + 98
+s = s + 99
+s = s + 100
+s = s + 101
+s = s + 102
+s = s + 103
+s = s + 104
+s = s + 105
+s = s + 106
+s = s + 107
+s = s + 108
+s = s + 109
+s = s + 110
+s = s + 111
+s = s + 112
+s = s + 113
+s = s + 114
+s = s + 115
+s = s + 116
+s = s + 117
+s = s + 118
+s = s + 119
+s = s + 120
+s = s + 121
+s = s + 122
+s = s + 123
+s = s + 124
+s = s + 125
+s = s + 126
+s = s + 127
+s = s + 128
+s = s + 129
+s = s + 130
+s = s + 131
+s = s + 132
+s = s + 133
+s = s + 134
+s = s + 135
+s = s + 136
+s = s + 137
+s = s + 138
+s = s + 139
+s = s + 140
+s = s + 141
+s = s + 142
+s = s + 143
+s = s + 144
+s = s + 145
+s = s + 146
+s = s + 147
+s = s + 148
+s = s + 149
+s = s + 150
+s = s + 151
+s = s + 152
+s = s + 153
+s = s + 154
+s = s + 155
+s = s + 156
+s = s + 157
+s = s + 158
+s = s + 159
+s = s + 160
+s = s + 161
+s = s + 162
+s = s + 163
+s = s + 164
+s = s + 165
+s = s + 166
+s = s + 167
+s = s + 168
+s = s + 169
+s = s + 170
+s = s + 171
+s = s + 172
+s = s + 173
+s = s + 174
+s = s + 175
+s = s + 176
+s = s + 177
+s = s + 178
+s = s + 179
+s = s + 180
+s = s + 181
+s = s + 182
+s = s + 183
+s = s + 184
+s = s + 185
+s = s + 186
+s = s + 187
+s = s + 188
+s = s + 189
+s = s + 190
+s = s + 191
+s = s + 192
+s = s + 193
+s = s + 194
+s = s + 195
+s = s + 196
+s = s + 197
+s = s + 198
+s = s + 199
+s = s + 200
+print(s)
@@ -0,0 +1,76 @@
+-- Coroutines: resume/yield, wrap, status and many live coroutines at once
+function counter(limit)
+  for i = 1, limit do
+    coroutine.yield(i)
+  end
+  return "finished"
+end
+
+local co = coroutine.create(counter)
+print(coroutine.status(co))
+print(coroutine.resume(co, 3))
+print(coroutine.status(co))
+print(coroutine.resume(co))
+print(coroutine.resume(co))
+print(coroutine.resume(co))
+print(coroutine.status(co))
+
+-- Values passed to resume come back from yield
+function echo(first)
+  local received = first
+  while received ~= nil do
+    received = coroutine.yield("got " .. received)
+  end
+  return "echo done"
+end
+local e = coroutine.create(echo)
+print(coroutine.resume(e, "a"))
+print(coroutine.resume(e, "b"))
+print(coroutine.resume(e))
+
+-- wrap as a generic for iterator; the body calls another function that yields
+function produce(n)
+  for i = 1, n do
+    coroutine.yield(i * i)
+  end
+end
+for square in coroutine.wrap(function() produce(5) end) do
+  io.write(square, " ")
+end
+print("")
+
+-- Coroutines resuming each other
+function inner()
+  coroutine.yield("inner 1")
+  return "inner done"
+end
+function outer()
+  local c = coroutine.create(inner)
+  coroutine.yield(coroutine.resume(c))
+  coroutine.yield(coroutine.status(c))
+  return coroutine.resume(c)
+end
+local o = coroutine.wrap(outer)
+print(o())
+print(o())
+print(o())
+
+-- Many suspended coroutines, each holding its own stack
+function worker(id)
+  local total = 0
+  while true do
+    total = total + id
+    coroutine.yield(total)
+  end
+end
+workers = 0
+local sum = 0
+local i = 0
+while i < 20000 do
+  local w = coroutine.create(worker)
+  sum = sum + coroutine.resume(w, i) + coroutine.resume(w)
+  i = i + 1
+end
+print(sum)
+
+print(coroutine.resume(co))
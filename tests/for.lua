@@ -0,0 +1,58 @@
+-- Numeric for loops: integer (counted) and float forms, negative steps,
+-- empty ranges, nested loops and assignment to the loop variable.
+local sum = 0
+for i = 1, 100 do
+  sum = sum + i
+end
+print(sum)
+
+for i = 10, 1, -3 do
+  print(i)
+end
+
+for i = 5, 1 do
+  print("never")
+end
+
+for x = 0, 1, 0.25 do
+  print(x)
+end
+
+for i = 1, 3.5 do
+  print(i)
+end
+
+local product = 1
+for i = 1, 3 do
+  for j = 1, 4 do
+    product = product + i * j
+  end
+end
+print(product)
+
+-- Changing the visible variable does not affect the iteration
+local visits = 0
+for i = 1, 5 do
+  i = i * 100
+  visits = visits + 1
+end
+print(visits)
+
+-- A string in the loop variable's slot takes the slow path
+for i = 1, 3 do
+  print(i)
+  i = "s"
+end
+
+local outer = 0
+for i = 1, 2 do
+  local inner = i * 10
+  outer = outer + inner
+end
+print(outer)
+
+count = 0
+for i = 1, 1000 do
+  count = count + 1
+end
+print(count)
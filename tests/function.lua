@@ -0,0 +1,51 @@
+-- Lua functions: calls, arguments, returns and recursion
+function add(a, b)
+  return a + b
+end
+print(add(2, 3))
+function second(a, b)
+  return b
+end
+print(second(1))  -- missing argument is nil
+print(add(1, 2, 3))
+
+function fib(n)
+  if n < 2 then
+    return n
+  end
+  return fib(n - 1) + fib(n - 2)
+end
+print(fib(20))
+
+function noResult()
+end
+print(noResult())
+
+local square = function(x) return x * x end
+print(square(12))
+
+-- A hot loop inside a function, and calls from a hot loop
+function sum(n)
+  local total = 0
+  for i = 1, n do
+    total = total + i
+  end
+  return total
+end
+local total = 0
+for i = 1, 200 do
+  total = total + sum(i)
+end
+print(total)
+
+function greet(name)
+  return "hello " .. name
+end
+for word in io.lines() do
+  print(greet(word))
+end
+
+function depth(n)
+  return depth(n + 1)
+end
+depth(1)
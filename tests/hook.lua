@@ -0,0 +1,88 @@
+-- Debug hooks: call, line and count events, switching hooks on and off
+function fact(n)
+  if n <= 1 then
+    return 1
+  end
+  return n * fact(n - 1)
+end
+function trace(event, line)
+  if line then
+    print(event .. " " .. line)
+  else
+    print(event)
+  end
+end
+
+debug.sethook(trace, "cl")
+local x = fact(3)
+debug.sethook()
+print(x)
+print(debug.gethook())
+
+-- Count events; hot loops stay hooked under the JIT as well
+count = 0
+function counter(event)
+  count = count + 1
+end
+debug.sethook(counter, "", 10)
+print(debug.gethook() == counter)
+local s = 0
+for i = 1, 10000 do
+  s = s + i
+end
+debug.sethook()
+print(s)
+print(count > 0)
+
+-- A hook that turns itself off, and one set inside a built-in's loop
+seen = 0
+function once(event, line)
+  seen = seen + 1
+  debug.sethook()
+end
+debug.sethook(once, "l")
+local y = 1
+y = y + 1
+print(seen)
+lines = 0
+function countLines(event, line)
+  lines = lines + 1
+end
+for word in string.gmatch("one two", "%a+") do
+  if word == "one" then
+    debug.sethook(countLines, "l")
+  end
+end
+debug.sethook()
+print(lines > 0)
+
+-- A count hook stops a loop through a global it reads every iteration,
+-- which must not be hoisted out of the loop
+stop = false
+function watchdog(event)
+  stop = true
+end
+debug.sethook(watchdog, "", 1000)
+local n = 0
+while not stop do
+  n = n + 1
+end
+debug.sethook()
+print(n > 0)
+
+-- Hooks see each coroutine's calls; they cannot yield
+function body()
+  coroutine.yield(fact(2))
+end
+debug.sethook(trace, "c")
+local co = coroutine.create(body)
+print(coroutine.resume(co))
+debug.sethook()
+function yielder(event)
+  coroutine.yield()
+end
+co = coroutine.create(function()
+  debug.sethook(yielder, "l")
+  local z = 1
+end)
+coroutine.resume(co)
@@ -0,0 +1,14 @@
+-- A hook installed through an alias of the library function, written with
+-- spaces around the dot, still keeps global reads in the loop it stops
+local install = debug . sethook
+stop = false
+function watchdog(event)
+  stop = true
+end
+install(watchdog, "", 1000)
+local n = 0
+while not stop do
+  n = n + 1
+end
+install()
+print(n > 0)
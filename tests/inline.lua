@@ -0,0 +1,47 @@
+-- Calls to small leaf functions are inlined at -O1 and up; results, output
+-- order and errors must match the real calls.
+function clamp(x, lo, hi)
+  if x < lo then return lo end
+  if x > hi then return hi end
+  return x
+end
+function lerp(a, b, t)
+  return a + (b - a) * t
+end
+function describe(n)
+  local kind = "odd"
+  if n % 2 == 0 then kind = "even" end
+  print(n .. " is " .. kind)
+end
+function nothing() end
+function orDefault(x, d) return x or d end
+local twice = function(v) return v * 2 end
+
+local total = 0
+for i = 1, 12 do
+  total = total + clamp(i, 3, 9) + twice(i)
+end
+print(total, lerp(1, 5, 0.25), lerp(2, 4, 1))
+print(clamp(1, 2, 3, "extra"), orDefault(nil, "default"), orDefault(false))
+describe(3)
+describe(4)
+print(nothing())
+
+-- A global read inside the body is the global, even when the caller has a
+-- local of the same name
+scale = 10
+function scaled(x) return x * scale end
+local scale = 3
+print(scaled(2), scale)
+
+-- Arguments are evaluated once, in order, before the body runs
+count = 0
+function bump() count = count + 1 return count end
+print(lerp(bump(), bump(), 0.5), count)
+
+-- Defined only if the branch runs: the guard falls back to the real call
+if false then
+  function never(x) return x end
+end
+print("before")
+print(never(1))
@@ -0,0 +1,35 @@
+-- Integer and float subtypes: literals, wrapping arithmetic, floor division,
+-- modulo, mixed comparisons and full-precision large values.
+print(7 // 2)
+print(-7 // 2)
+print(7 % -3)
+print(-7.5 % 2)
+print(10 / 2)
+print(9223372036854775807 + 1)
+print(0x7fffffffffffffff)
+print(9007199254740993)
+print(1 == 1.0)
+print(9007199254740993 < 9007199254740992.0)
+
+-- Counters stay integers; a float operand turns a site mixed
+local n = 0
+local f = 0
+local id = 9007199254740000
+for i = 1, 2000 do
+  n = n + i * 2 - 1
+  f = f + i / 4
+  id = id + 1
+  if i > 1990 then
+    n = n + 0.5
+    print(n)
+  end
+  if -i < -1998 then
+    print(-i)
+  end
+end
+print(n)
+print(f)
+print(id)
+print(-id)
+print(5 // 0.0)
+print(5 % 0)
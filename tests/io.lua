@@ -0,0 +1,27 @@
+-- io library: buffered writes and every io.read format, fed from io.in
+io.write("a", 1, " ", 2.5, "\n")
+io.write()
+io.flush()
+print(io.read())
+print(io.read("n"))
+print(io.read("*n"))
+print(io.read("n"))
+print(io.read("L") .. "|")
+print(io.read("l"))
+print(io.read(4))
+print(io.read("L"))
+print(io.read(0) == "")
+local count = 0
+for line in io.lines() do
+  count = count + 1
+  io.write(count, ": ", line, "\n")
+end
+print(count)
+print(io.read())
+print(io.read("a") == "")
+print(io.read(0))
+for i = 1, 3 do
+  io.write(i, i < 3 and "," or "\n")
+end
+print(io.write == io.write)
+io.write("x", nil)
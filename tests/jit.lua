@@ -0,0 +1,43 @@
+-- Exercises every JIT fast path and its slow-path fallback.
+-- Run with --no-jit and --jit-threshold=0/1; the outputs must be identical.
+local i = 0
+local sum = 0
+local neg = 0
+local flag = nil
+local name = "x"
+while i < 50 do
+  sum = sum + i * 3 - i / 2
+  neg = -sum
+  if i > 25 then
+    flag = true
+  else
+    flag = false
+  end
+  if flag then
+    name = "big"
+  end
+  if not flag then
+    name = "small"
+  end
+  if i == 10 then
+    print(name)
+    print(flag)
+    print(neg)
+  end
+  i = i + 1
+end
+print(sum)
+print(neg)
+print(name == "big")
+print(name == "small")
+print(1 < 2)
+print(2 < 1)
+print(nil)
+print(not nil)
+print(-(-4))
+local s = "str"
+while s do
+  print(s)
+  s = nil
+end
+print(s)
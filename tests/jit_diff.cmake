@@ -0,0 +1,42 @@
+# Differential test: runs SCRIPT through LUA (lua_compiler) unoptimized with the
+# JIT disabled, then with the JIT forced on and at each IR optimization level,
+# and fails if stdout/stderr differ. The reference run itself must match the
+# golden file next to the script with the extension .expected (io.lua ->
+# io.expected), which holds its stdout followed by its stderr. A file with the
+# extension .in is fed to the script as standard input, and one with the
+# extension .args holds extra command-line options for every run.
+#   cmake -DLUA=path/to/lua_compiler -DSCRIPT=path/to/script.lua -P jit_diff.cmake
+get_filename_component(dir ${SCRIPT} DIRECTORY)
+get_filename_component(name ${SCRIPT} NAME_WE)
+set(input /dev/null)
+if(EXISTS ${dir}/${name}.in)
+    set(input ${dir}/${name}.in)
+endif()
+set(args "")
+if(EXISTS ${dir}/${name}.args)
+    file(READ ${dir}/${name}.args args)
+    separate_arguments(args UNIX_COMMAND "${args}")
+endif()
+execute_process(COMMAND ${LUA} -O0 --no-jit ${args} ${SCRIPT} INPUT_FILE ${input}
+                OUTPUT_VARIABLE expected ERROR_VARIABLE expected_err)
+if(NOT EXISTS ${dir}/${name}.expected)
+    message(FATAL_ERROR "Missing golden output ${dir}/${name}.expected; "
+                        "reference (-O0 --no-jit):\n${expected}${expected_err}")
+endif()
+file(READ ${dir}/${name}.expected golden)
+if(NOT "${expected}${expected_err}" STREQUAL golden)
+    message(FATAL_ERROR "Output differs from ${name}.expected\n"
+                        "expected:\n${golden}\n"
+                        "-O0 --no-jit:\n${expected}${expected_err}")
+endif()
+foreach(level -O0 -O1 -O2)
+    foreach(mode --no-jit --jit-threshold=0 --jit-threshold=1)
+        execute_process(COMMAND ${LUA} ${level} ${mode} ${args} ${SCRIPT} INPUT_FILE ${input}
+                        OUTPUT_VARIABLE actual ERROR_VARIABLE actual_err)
+        if(NOT actual STREQUAL expected OR NOT actual_err STREQUAL expected_err)
+            message(FATAL_ERROR "Output differs (${level} ${mode})\n"
+                                "reference (-O0 --no-jit):\n${expected}${expected_err}\n"
+                                "${level} ${mode}:\n${actual}${actual_err}")
+        endif()
+    endforeach()
+endforeach()
@@ -0,0 +1,11 @@
+-- A type error inside a JIT-compiled loop must report the same line as the interpreter.
+local i = 0
+local x = 1
+while i < 10 do
+  if i == 5 then
+    x = "five"
+  end
+  x = x + 1
+  i = i + 1
+end
+print(x)
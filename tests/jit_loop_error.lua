@@ -0,0 +1,13 @@
+-- A built-in that fails deep into a hot (JIT-compiled) loop must stop the
+-- script with the same message and line as the interpreter
+local total = 0
+local i = 0
+local count = 2
+while i < 5000 do
+  total = total + string.len(string.rep("ab", count))
+  if i == 3000 then
+    count = "many"
+  end
+  i = i + 1
+end
+print(total)
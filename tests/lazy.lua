@@ -0,0 +1,73 @@
+-- Run with --lazy (see lazy.args): function bodies of 256 bytes or more are
+-- lexed, parsed and compiled on their first call. Comments count towards the
+-- size, which is what makes these small functions long enough to be deferred.
+
+function histogram(n)
+  -- Counts how many of 1..n fall in each residue class mod 3 and returns a
+  -- summary string; long enough to be skipped by the lexer until called.
+  local zero = 0
+  local one = 0
+  local two = 0
+  for i = 1, n do
+    if i % 3 == 0 then
+      zero = zero + 1
+    else
+      if i % 3 == 1 then one = one + 1 else two = two + 1 end
+    end
+  end
+  return zero .. "/" .. one .. "/" .. two
+end
+
+-- Never called: its syntax error is never found
+function broken(x)
+  -- The body below does not parse, but a lazily compiled function is only
+  -- parsed on its first call, and this one has none. Padding, padding, padding,
+  -- padding, padding, padding, padding, padding, padding, padding, padding,
+  -- padding, padding, padding, padding, padding, padding, padding, padding.
+  return x +
+end
+
+function outer(n)
+  -- Defines a nested function on every call; the nested body is skipped too
+  -- and compiled once, on the first call of the first closure made from it.
+  -- Padding, padding, padding, padding, padding, padding, padding, padding.
+  local f = function(k)
+    -- A function expression inside a deferred body is deferred in turn when
+    -- its body is long enough. Padding, padding, padding, padding, padding,
+    -- padding, padding, padding, padding, padding, padding, padding, padding.
+    return k * 2 + 1
+  end
+  return f(n) + f(n + 1)
+end
+
+function generator(limit)
+  -- Started as a coroutine: the body is compiled by the first resume rather
+  -- than by a call. Padding, padding, padding, padding, padding, padding, ok.
+  local i = 0
+  while i < limit do
+    coroutine.yield(i * i)
+    i = i + 1
+  end
+  return "done"
+end
+
+print(histogram(10))
+print(histogram(100))
+print(outer(3), outer(4))
+local co = coroutine.create(generator)
+print(coroutine.resume(co, 3))
+print(coroutine.resume(co))
+print(coroutine.resume(co))
+print(coroutine.resume(co))
+if broken then print("broken is defined") end
+
+function failing(t)
+  -- A runtime error inside a lazily compiled body reports its real line.
+  -- Padding, padding, padding, padding, padding, padding, padding, padding,
+  -- padding, padding, padding, padding, padding, padding, padding, padding.
+  local total = 0
+  total = total + t
+  return total
+end
+print(failing(1))
+print(failing("x"))
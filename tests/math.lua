@@ -0,0 +1,32 @@
+-- Host functions bound with VM::registerFunction (the math library)
+print(math.sqrt(16))
+print(math.sqrt(2))
+print(math.floor(3.7))
+print(math.floor(-3.2))
+print(math.ceil(3.2))
+print(math.floor(7))
+print(math.floor(1e300))
+print(math.log(8, 2))
+print(math.log(100, 10))
+print(math.exp(0))
+print(math.sin(0) + math.cos(0))
+print(math.tointeger(3.0))
+print(math.tointeger(3.5))
+print(math.tointeger("3"))
+print(math.type(1))
+print(math.type(1.0))
+print(math.type("1"))
+print(math.type())
+
+-- Results can be reused as arguments, and calls sit inside hot loops
+local total = 0
+for i = 1, 10000 do
+  total = total + math.floor(math.sqrt(i))
+end
+print(total)
+
+local f = math.sqrt
+print(f(81) == math.sqrt(81))
+print(math.sqrt == math.sqrt)
+
+math.sqrt("nine")
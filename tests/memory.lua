@@ -0,0 +1,27 @@
+-- Run with the memory limit in memory.args. Ordinary work stays well under
+-- it; a string that keeps doubling goes over and stops the script with
+-- "not enough memory" at the concatenation, in every mode.
+local words = ""
+for i = 1, 200 do
+  words = words .. i .. " "
+end
+print(words)
+
+function depth(n)
+  if n == 0 then return 0 end
+  return depth(n - 1) + 1
+end
+print(depth(2000))
+
+local co = coroutine.create(function(x)
+  while true do x = coroutine.yield(x .. x) end
+end)
+print(coroutine.resume(co, "ab"), coroutine.resume(co, "cd"))
+
+-- How many doublings fit depends on the temporaries each level keeps, so
+-- only the error is printed
+local s = "0123456789abcdef"
+while true do
+  s = s .. s
+end
+print("unreachable")
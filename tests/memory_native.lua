@@ -0,0 +1,6 @@
+-- Run with the memory limit in memory_native.args. A built-in that
+-- allocates past it stops the script at its call, in every mode.
+local s = string.rep("x", 1000000)
+print(string.len(s))
+local t = string.rep(s, 8)
+print("unreachable")
@@ -0,0 +1,31 @@
+# Opcode statistics test: runs SCRIPT (tests/opstats/loop.lua) with --opstats
+# and checks the per-opcode counts against EXPECTED. Samples and cycles vary
+# from run to run and are ignored; opcodes with equal counts are compared in
+# name order.
+#   cmake -DLUA=path/to/lua_compiler -DSCRIPT=path/to/loop.lua -DEXPECTED=path/to/loop.expected -P opstats.cmake
+execute_process(COMMAND ${LUA} -O0 --no-jit --opstats ${SCRIPT}
+                RESULT_VARIABLE result OUTPUT_QUIET ERROR_VARIABLE table)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${SCRIPT} failed:\n${table}")
+endif()
+# Only the opcode table; the pairs after it are not checked
+string(FIND "${table}" "\ntop opcode pairs:" end)
+string(SUBSTRING "${table}" 0 ${end} table)
+string(REGEX MATCHALL "OP_[A-Z_]+ +[0-9]+ " rows "${table}")
+set(counts "")
+foreach(row ${rows})
+    string(REGEX REPLACE " +" " " row "${row}")
+    string(STRIP "${row}" row)
+    list(APPEND counts "${row}")
+endforeach()
+list(SORT counts)
+if(NOT table MATCHES "\ntotal +([0-9]+)\n")
+    message(FATAL_ERROR "No total in:\n${table}")
+endif()
+list(APPEND counts "total ${CMAKE_MATCH_1}")
+string(REPLACE ";" "\n" actual "${counts}")
+file(READ ${EXPECTED} expected)
+string(STRIP "${expected}" expected)
+if(NOT actual STREQUAL expected)
+    message(FATAL_ERROR "Opcode counts differ.\nExpected:\n${expected}\nActual:\n${actual}\nFull table:\n${table}")
+endif()
@@ -0,0 +1,11 @@
+-- Opcode mix checked by tests/opstats.cmake: a counted loop with one call
+-- and one addition per iteration.
+function add(a, b)
+  return a + b
+end
+
+local sum = 0
+for i = 1, 10 do
+  sum = add(sum, i)
+end
+print(sum)
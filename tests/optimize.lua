@@ -0,0 +1,73 @@
+-- Code the IR passes rewrite: folded constants and branches, propagated
+-- locals, repeated subexpressions, loop invariants and 'and'/'or' values.
+-- Every optimization level must print exactly what -O0 prints.
+local width = 3 * 4 + 1
+local name = "w" .. width .. "." .. 0.5
+print(width, name, 7 // 2, 7 % 3, -(2 - 5), 1 / 4, 2 == 2.0, "a" < "b")
+
+if width > 10 then print("wide") else print("narrow") end
+if nil then print("never") end
+print(nil or "fallback", false and 1, width and "set", (1 < 2) or 3)
+
+local alias = width
+local copy = alias
+alias = 0
+print(copy, alias)
+
+-- Repeated and loop-invariant work over values of unknown type
+function mix(a, b, n)
+  local total = 0
+  local i = 0
+  while i < n do
+    total = total + a * b + a * b
+    if a * b > 10 and i % 2 == 0 then
+      total = total - 1
+    end
+    i = i + 1
+  end
+  return total
+end
+print(mix(2, 3, 5), mix(2.5, 6, 4))
+
+limit = 6
+function sum()
+  local s = 0
+  for k = 1, 10 do
+    if k <= limit * 1 then s = s + k * limit end
+  end
+  return s
+end
+print(sum())
+limit = 2
+print(sum())
+
+-- Strings built in loops with invariant pieces
+local out = ""
+local sep = ", "
+local i = 0
+while i < 4 do
+  out = out .. i .. sep
+  i = i + 1
+end
+print(out)
+
+-- A global changed by a call inside the loop must be re-read
+count = 0
+function bump() count = count + 1 end
+local seen = 0
+local j = 0
+while j < 3 do
+  bump()
+  seen = seen + count
+  j = j + 1
+end
+print(seen)
+
+-- An invariant that fails must fail only once the loop body reaches it
+local bad = nil
+local k = 0
+while k < 3 do
+  print("iteration", k)
+  if k == 2 then print(bad + 1) end
+  k = k + 1
+end
@@ -0,0 +1,22 @@
+# Profiler test: samples SCRIPT (tests/profile/nested.lua) at every instruction
+# and checks that the collapsed stacks list the callers outermost first, through
+# nested calls and across a coroutine resume.
+#   cmake -DLUA=path/to/lua_compiler -DSCRIPT=path/to/nested.lua -DOUT=out.folded -P profile.cmake
+execute_process(COMMAND ${LUA} -O0 --profile=${OUT} --profile-every=1 ${SCRIPT}
+                RESULT_VARIABLE result OUTPUT_QUIET ERROR_VARIABLE error)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${SCRIPT} failed:\n${error}")
+endif()
+# The main chunk's frames are named after the script as given on the command line
+file(READ ${OUT} folded)
+set(folded "\n${folded}")
+foreach(stack "${SCRIPT}:13;outer:9;inner:4 "
+              "${SCRIPT}:18;anonymous:16;outer:9;inner:4 ")
+    string(FIND "${folded}" "\n${stack}" at)
+    if(at EQUAL -1)
+        message(FATAL_ERROR "Missing stack '${stack}' in:\n${folded}")
+    endif()
+endforeach()
+if(folded MATCHES "inner:[0-9]+;" OR folded MATCHES "outer:[0-9]+;anonymous")
+    message(FATAL_ERROR "Stacks out of order:\n${folded}")
+endif()
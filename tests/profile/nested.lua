@@ -0,0 +1,18 @@
+-- Profiled by tests/profile.cmake: the stacks must come out outermost first
+function inner(n)
+  local s = 0
+  for i = 1, n do s = s + i end
+  return s
+end
+
+function outer(n)
+  return inner(n) + 1
+end
+
+local t = 0
+for i = 1, 20 do t = t + outer(50) end
+
+local co = coroutine.create(function()
+  coroutine.yield(outer(50))
+end)
+print(t, coroutine.resume(co))
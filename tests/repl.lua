@@ -0,0 +1,11 @@
+-- Interactive session (-i): this script runs first, then repl.in is read
+-- line by line in the same VM, so its globals and functions stay usable
+function square(n)
+    return n * n
+end
+
+total = 0
+for i = 1, 10 do
+    total = total + square(i)
+end
+greeting = "hello"
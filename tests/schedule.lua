@@ -0,0 +1,45 @@
+-- Run with --budget=1 (schedule.args): the scheduler suspends the script at
+-- every loop back-edge, Lua call, resume and yield, and resumes it where it
+-- stopped, in the interpreter and in native code alike.
+local total = 0
+local i = 0
+while i < 40 do
+  total = total + i
+  i = i + 1
+end
+print("while", total)
+
+local product = 1
+for k = 1, 12 do product = product * k end
+for k = 10, 1, -2.5 do product = product - k end
+print("for", product)
+
+function fib(n)
+  if n < 2 then return n end
+  return fib(n - 1) + fib(n - 2)
+end
+print("fib", fib(15))
+
+function squares(limit)
+  for k = 1, limit do coroutine.yield(k * k) end
+end
+local sum = 0
+for square in coroutine.wrap(function() squares(6) end) do
+  sum = sum + square
+end
+print("squares", sum)
+
+local co = coroutine.create(function(x)
+  while true do x = coroutine.yield(x .. "!") end
+end)
+local text = ""
+for k = 1, 5 do text = text .. coroutine.resume(co, k) end
+print(text, coroutine.status(co))
+
+-- A suspended script still stops at its first error
+local s = "s"
+local n = 0
+while n < 10 do
+  n = n + 1
+  if n == 7 then s = s + 1 end
+end
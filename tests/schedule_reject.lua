@@ -0,0 +1,2 @@
+-- --trace cannot be combined with the scheduler: nothing below runs
+print("never")
@@ -0,0 +1,33 @@
+-- Stack depth: the compiler reserves each chunk's maximum depth on entry,
+-- and the stack grows (and moves) while frames and locals are live
+
+-- 301 operands are live at once in this expression
+local one = 1
+print(one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one + (one)))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))
+
+-- 300 operands of one concatenation
+local digit = "7"
+local digits = digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit .. digit
+print(digits)
+
+-- Deep recursion with several locals per frame forces the stack to grow
+-- while the callers' slots are in use
+function depth(n, label)
+  local a = n * 2
+  local b = label .. ""
+  local c = a + 1
+  if n == 0 then
+    return c
+  end
+  local below = depth(n - 1, label)
+  return below + a - a + (c - c)
+end
+print(depth(5000, "x"))
+
+-- The same inside a coroutine, whose stack starts small
+local co = coroutine.wrap(function()
+  coroutine.yield(depth(3000, "y"))
+  return depth(10, "z")
+end)
+print(co())
+print(co())
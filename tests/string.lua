@@ -0,0 +1,63 @@
+-- string library: slicing, building, plain and pattern search, format
+print(string.len("hello"))
+print(string.sub("hello world", 1, 5))
+print(string.sub("hello world", -5))
+print(string.sub("hello", 0))
+print(string.sub("hello", 4, 2) == "")
+print(string.sub("hello", -100, 2))
+print(string.sub(12345, 2, 3))
+print(string.byte("A"))
+print(string.byte("abc", -1))
+print(string.byte("abc", 4))
+print(string.rep("ab", 3, ","))
+print(string.rep("x", 0) == "")
+print(string.len(string.rep("0123456789", 1000)))
+print(string.upper("Hello, World 1"))
+print(string.lower("Hello, World 1"))
+
+-- Plain search, long enough for the vectorized scan
+local text = string.rep("abcdefgh", 20) .. "needle" .. string.rep("xy", 10)
+print(string.find(text, "needle"))
+print(string.find(text, "needle", 162))
+print(string.find(text, "gha", 1, true))
+print(string.find(text, "yx", -20))
+print(string.find("a.b", ".", 1, true))
+print(string.find("hello", "", 10))
+
+-- Patterns
+print(string.find("a.b", "%."))
+print(string.find("  x", "^%s*x"))
+print(string.find("abc", "^b"))
+print(string.match("key = value", "(%w+)%s*=%s*(%w+)"))
+print(string.match("hello", "()ll"))
+print(string.match("THE (quick) fox", "%((%a+)%)"))
+print(string.match("f(a(b)c)d", "%b()"))
+print(string.match("THE quick", "%f[%a]%a+", 4))
+print(string.match("hello", "h.-l"))
+print(string.match("hello", "h.*l"))
+print(string.match("abab", "(ab)%1"))
+print(string.match("a-b]", "[%]a-]+"))
+print(string.match("x=1", "^(%a)=(%d)$"))
+print(string.match("hello", "xyz"))
+for w in string.gmatch("one two  three", "%a+") do
+  print(w)
+end
+local empty = 0
+for e in string.gmatch("abc", "x*") do
+  empty = empty + 1
+end
+print(empty)
+
+-- Formatting
+print(string.format("%d %5d %-5d| %05d %+d %x %X %#x %o", 42, 42, 42, 42, 42, 255, 255, 255, 8))
+print(string.format("%.3f %10.2f %e %g %g %G", 3.14159, 2.5, 12345.678, 0.1, 1e20, 1e-10))
+print(string.format("%s %s %s %s %5s|%-5s|%.2s", "x", 1, 2.5, nil, "ab", "ab", "abcdef"))
+print(string.format("%q", "a\"b\\c\nd\0e\1"))
+print(string.format("%q %q %q", 1, 0.1, 2.0))
+-- %q writes floats in hex, which read back exactly
+print(0x1.999999999999ap-4 == 0.1, 0x1p+1, -0x1.8p+0, 0x10 .. "")
+print(string.format("%c%c%c 100%%", 76, 117, 97))
+print(string.format("%a %.0f %.10g %#g %d", 1.0, 2.5, 1/3, 1.0, 3.0))
+print(string.format("%05.1f %+.2e % d %.3d %x", 3.14159, -0.000123, 7, 5, -1))
+
+string.match("a", "[a")
@@ -0,0 +1,31 @@
+-- Run with --strip --lazy (see strip.args): no line tables are kept, even for
+-- function bodies compiled on their first call, so a runtime error reports
+-- "[line ?]" whatever the optimization level or JIT mode. Function names are
+-- stripped too, so every frame of the trace but the main chunk reads "in ?".
+
+function accumulate(n)
+  -- Long enough for the lexer to skip it until the first call; the error
+  -- below is raised from its lazily compiled chunk.
+  local total = 0
+  for i = 1, n do
+    if i % 2 == 0 then total = total + i else total = total - 1 end
+  end
+  if total > 40 then
+    return total + nil
+  end
+  return total
+end
+
+function inner(k)
+  return k * 2
+end
+
+print(accumulate(5))
+function report(n)
+  print(inner(accumulate(n)))
+end
+
+print(inner(21))
+report(4)
+report(20)
+print("not reached")
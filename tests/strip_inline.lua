@@ -0,0 +1,17 @@
+-- Run with --strip alone (see strip_inline.args): check is a leaf, so -O1 and
+-- -O2 inline it into validate, and the trace must not bring back its name
+-- from the record of inlined calls. Every frame but the main chunk is "?".
+
+function check(x)
+  return x + 1
+end
+
+function validate(a, b)
+  local sum = check(a)
+  sum = sum + check(b)
+  return sum
+end
+
+print(validate(1, 2))
+print(validate(4, "five"))
+print("not reached")
@@ -0,0 +1,21 @@
+-- A runtime error several calls deep lists every active call, innermost
+-- first, down to the main script
+function parse(text)
+  return text + 1
+end
+
+function load(text)
+  local value = parse(text)
+  return value * 2
+end
+
+function run(inputs)
+  local total = 0
+  for i = 1, 3 do
+    total = total + load(inputs)
+  end
+  return total
+end
+
+print(run(20))
+print(run("twenty"))
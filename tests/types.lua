@@ -0,0 +1,68 @@
+-- Type inference: operations on locals proved integers or floats use the
+-- unchecked typed opcodes; anything that might be another type stays checked
+
+-- Integer loop: counter and accumulator stay integers
+local n = 0
+local sum = 0
+while n < 1000 do
+    sum = sum + n * 3 - 1
+    n = n + 1
+end
+print(sum)
+
+-- Integer arithmetic wraps around
+local big = 9223372036854775807
+local wrapped = big + 1
+print(wrapped)
+print(big * 2)
+
+-- Float loop
+local x = 0.5
+local y = 1.5
+local steps = 0
+while x < 100.0 do
+    x = x * y + 0.25
+    steps = steps + 1
+end
+print(x, steps)
+print(x / 4.0)
+
+-- NaN compares false in every direction
+local nan = 0.0 / 0.0
+if nan < 1.0 then print("lt") else print("not lt") end
+if nan >= 1.0 then print("ge") else print("not ge") end
+if nan > nan then print("gt") else print("not gt") end
+
+-- A local that becomes a float on one path is no longer an integer
+local m = 1
+if sum > 0 then m = m / 2 end
+print(m + 1)
+
+-- Numeric for: integer loop, float loop and a body that reassigns the variable
+local total = 0
+for i = 1, 10 do
+    total = total + i * i
+end
+print(total)
+local ftotal = 0.0
+for f = 0.5, 3.0, 0.5 do
+    ftotal = ftotal + f
+end
+print(ftotal)
+for i = 1, 3 do
+    i = i .. "!"
+    print(i)
+end
+
+-- Values from globals and calls are unknown; errors stay where they were
+g = 10
+local k = g + 1
+print(k)
+function half(v) return v / 2 end
+print(half(7) + 1)
+local s = "text"
+local ok = 1
+if total > 1000000 then ok = s end
+print(ok + 1)
+local bad = "a"
+print(n + bad)